@@ -0,0 +1,282 @@
+// Out-of-line definitions of the plant model and its C API
+#include "dupont_plant.hpp"
+
+#include <cstring>
+#include <memory>
+
+#include "dupont_plant.h"
+
+using namespace std;
+
+namespace SystemConstants {
+static map<string, map<string, double> > create_color_recipes() {
+    map<string, map<string, double> > recipes;
+    
+    map<string, double> az_marino;
+    az_marino["Negro"] = 2.0 / 3.0;  // 2 parts Negro (100 lts for 150 lts batch)
+    az_marino["Azul"] = 1.0 / 3.0;   // 1 part Azul (50 lts for 150 lts batch)
+    recipes["AzMarino"] = az_marino;
+    
+    map<string, double> az_celeste;
+    az_celeste["Azul"] = 1.0 / 3.0;
+    az_celeste["Negro"] = 1.0 / 3.0;
+    az_celeste["Blanco"] = 1.0 / 3.0;
+    recipes["AzCeleste"] = az_celeste;
+    
+    return recipes;
+}
+
+const map<string, map<string, double> > COLOR_RECIPES = create_color_recipes();
+} // namespace SystemConstants
+
+static vector<string> create_known_valve_keys() {
+    vector<string> keys;
+    keys.push_back("V201");
+    keys.push_back("V202");
+    keys.push_back("V203");
+    keys.push_back("V401");
+    keys.push_back("V402");
+    keys.push_back("V403");
+    return keys;
+}
+
+const vector<string> ConfigValidator::KNOWN_VALVE_KEYS = create_known_valve_keys();
+const string ConfigValidator::K_COLOR = "COLOR_A_MEZCLAR";
+const string ConfigValidator::K_ARRANQUE = "ARRANQUE_DE_FABRICACION";
+
+// C API. Exceptions never cross the boundary: every entry point turns
+// them into a status code and keeps the message for
+// dupont_plant_last_error().
+struct dupont_plant {
+    PlantSession session;
+    SystemConfig config;
+    string last_error;
+    TickWorkerPool *worker_pool; // Owned; NULL steps on the caller's thread
+    vector<const PumpLine *> lines; // By line index, in map order
+
+    explicit dupont_plant(const Factory &factory)
+        : session(factory), worker_pool(NULL) {
+        // The C API never adds lines, so the map nodes stay put
+        const PumpLineMap &pump_lines =
+            session.get_factory().get_all_pump_lines();
+        lines.reserve(pump_lines.size());
+        for (PumpLineMap::const_iterator it = pump_lines.begin();
+             it != pump_lines.end(); ++it) {
+            lines.push_back(&it->second);
+        }
+    }
+    ~dupont_plant() { delete worker_pool; }
+};
+
+static_assert(static_cast<int>(DUPONT_PUMP_RUNNING) ==
+                      static_cast<int>(RUNNING) &&
+                  static_cast<int>(DUPONT_BATCH_EMPTYING) ==
+                      static_cast<int>(BATCH_EMPTYING),
+              "C API enums must match the plant model");
+
+static void copy_code(char *target, const string &code) {
+    memset(target, 0, DUPONT_PLANT_CODE_SIZE);
+    memcpy(target, code.data(),
+           code.size() < DUPONT_PLANT_CODE_SIZE ? code.size()
+                                                : DUPONT_PLANT_CODE_SIZE - 1);
+}
+
+static int fail(const dupont_plant *plant, int status, const string &message) {
+    const_cast<dupont_plant *>(plant)->last_error = message;
+    return status;
+}
+
+static int succeed(const dupont_plant *plant) {
+    const_cast<dupont_plant *>(plant)->last_error.clear();
+    return DUPONT_OK;
+}
+
+extern "C" {
+
+int dupont_plant_api_version(void) {
+    return DUPONT_PLANT_API_VERSION;
+}
+
+dupont_plant *dupont_plant_create(void) {
+    try {
+        // Owned here until returned, so a failed setup does not leak it
+        unique_ptr<dupont_plant> plant(
+            new dupont_plant(Factory::create_dupont_paint_factory()));
+        // Initial conditions: every valve open, AzCeleste, start OFF
+        const vector<string> &valves = ConfigValidator::get_known_valve_keys();
+        for (size_t i = 0; i < valves.size(); ++i) {
+            plant->config.valve_states[valves[i]] = "OPEN";
+        }
+        plant->config.color_a_mezclar = "AzCeleste";
+        plant->config.arranque_de_fabricacion = "OFF";
+        plant->session.apply_config(plant->config);
+        return plant.release();
+    } catch (const exception &) {
+        return NULL;
+    }
+}
+
+dupont_plant *dupont_plant_create_custom(const char *const *pump_codes,
+                                         const char *const *liquid_names,
+                                         size_t count) {
+    if (pump_codes == NULL || liquid_names == NULL || count == 0) {
+        return NULL;
+    }
+    try {
+        vector<PumpLine> lines;
+        for (size_t i = 0; i < count; ++i) {
+            lines.push_back(PumpLine::create_standard_paint_line(
+                pump_codes[i], liquid_names[i]));
+        }
+        unique_ptr<dupont_plant> plant(
+            new dupont_plant(Factory::create_custom_factory(lines)));
+        plant->config.color_a_mezclar = "AzCeleste";
+        plant->config.arranque_de_fabricacion = "OFF";
+        plant->session.apply_config(plant->config);
+        return plant.release();
+    } catch (const exception &) {
+        return NULL;
+    }
+}
+
+void dupont_plant_destroy(dupont_plant *plant) { delete plant; }
+
+int dupont_plant_set_vfd_mode(dupont_plant *plant, int enabled) {
+    if (plant == NULL) {
+        return DUPONT_ERROR_INVALID_ARGUMENT;
+    }
+    plant->session.get_factory().set_vfd_mode(enabled != 0);
+    return succeed(plant);
+}
+
+int dupont_plant_set_worker_threads(dupont_plant *plant, unsigned threads) {
+    if (plant == NULL || threads == 0) {
+        return DUPONT_ERROR_INVALID_ARGUMENT;
+    }
+    try {
+        Factory &factory = plant->session.get_factory();
+        factory.attach_worker_pool(NULL);
+        delete plant->worker_pool;
+        plant->worker_pool = NULL;
+        if (threads > 1) {
+            plant->worker_pool = new TickWorkerPool(threads);
+            factory.attach_worker_pool(plant->worker_pool);
+        }
+        return succeed(plant);
+    } catch (const exception &e) {
+        return fail(plant, DUPONT_ERROR_INTERNAL, e.what());
+    }
+}
+
+int dupont_plant_apply_commands(dupont_plant *plant,
+                                const dupont_command *commands, size_t count) {
+    if (plant == NULL || (commands == NULL && count > 0)) {
+        return DUPONT_ERROR_INVALID_ARGUMENT;
+    }
+    try {
+        SystemConfig config = plant->config;
+        for (size_t i = 0; i < count; ++i) {
+            if (commands[i].key == NULL || commands[i].value == NULL) {
+                return fail(plant, DUPONT_ERROR_INVALID_ARGUMENT,
+                            "Command without key or value");
+            }
+            ConfigValidator::validate_and_set_config_pair(
+                config, commands[i].key, commands[i].value);
+            // Custom plants may lack the lines a known valve key drives
+            const vector<string> &valves =
+                ConfigValidator::get_known_valve_keys();
+            if (find(valves.begin(), valves.end(), commands[i].key) !=
+                    valves.end() &&
+                !plant->session.get_factory().has_valve(commands[i].key)) {
+                return fail(plant, DUPONT_ERROR_INVALID_COMMAND,
+                            string("Valve not in this plant: ") +
+                                commands[i].key);
+            }
+        }
+        StartResult result = plant->session.apply_config(config);
+        plant->config = config;
+        switch (result) {
+        case START_REJECTED_BATCH_IN_PROCESS:
+            return fail(plant, DUPONT_ERROR_BATCH_IN_PROCESS,
+                        "The current batch has not finished");
+        case START_REJECTED_MIXER_NOT_EMPTY:
+            return fail(plant, DUPONT_ERROR_MIXER_NOT_EMPTY,
+                        "The mixer low-level switch is not in alarm");
+        default:
+            return succeed(plant);
+        }
+    } catch (const runtime_error &e) {
+        return fail(plant, DUPONT_ERROR_INVALID_COMMAND, e.what());
+    } catch (const exception &e) {
+        return fail(plant, DUPONT_ERROR_INTERNAL, e.what());
+    }
+}
+
+int dupont_plant_step(dupont_plant *plant, unsigned long ticks,
+                      double tick_seconds) {
+    if (plant == NULL || !(tick_seconds > 0.0)) {
+        return DUPONT_ERROR_INVALID_ARGUMENT;
+    }
+    try {
+        for (unsigned long i = 0; i < ticks; ++i) {
+            plant->session.step(tick_seconds);
+        }
+        return succeed(plant);
+    } catch (const exception &e) {
+        return fail(plant, DUPONT_ERROR_INTERNAL, e.what());
+    }
+}
+
+int dupont_plant_read_state(const dupont_plant *plant,
+                            dupont_plant_state *state) {
+    if (plant == NULL || state == NULL) {
+        return DUPONT_ERROR_INVALID_ARGUMENT;
+    }
+    const Factory &factory = plant->session.get_factory();
+    const MixerTank &mixer = factory.get_mixer_tank();
+    state->sim_time_seconds = factory.get_sim_time();
+    state->batch_phase = factory.get_batch_phase();
+    state->motor_running = mixer.get_mixer_motor().is_running();
+    state->low_level_alarm = mixer.get_low_level_switch().is_alarm();
+    state->batches_completed = plant->session.get_batches_completed();
+    state->mixer_liters = mixer.get_current_capacity();
+    state->mixer_level_percent = mixer.get_level();
+    state->motor_elapsed_seconds = mixer.get_mixer_motor().get_elapsed_time();
+    state->line_count = factory.get_all_pump_lines().size();
+    return succeed(plant);
+}
+
+int dupont_plant_read_line(const dupont_plant *plant, size_t line_index,
+                           dupont_line_state *state) {
+    if (plant == NULL || state == NULL) {
+        return DUPONT_ERROR_INVALID_ARGUMENT;
+    }
+    if (line_index >= plant->lines.size()) {
+        return fail(plant, DUPONT_ERROR_INVALID_ARGUMENT,
+                    "Line index out of range");
+    }
+    const PumpLine &pump_line = *plant->lines[line_index];
+    const LiquidPump &pump = pump_line.get_pump();
+    copy_code(state->pump_code, pump.get_code());
+    copy_code(state->liquid_name,
+              pump_line.get_tank().get_liquid_in_tank_name());
+    state->pump_state = pump.get_state();
+    state->pump_on = pump.is_on();
+    state->enter_valve_open = pump_line.get_enter_valve().is_open();
+    state->exit_valve_open = pump_line.get_exit_valve().is_open();
+    state->flow_switch_alarm = pump_line.get_flow_switch().is_alarm();
+    state->pressure_psi = pump_line.get_pressure_transmitter().read_pressure();
+    state->tank_liters = pump_line.get_tank().get_current_capacity();
+    state->tank_level_percent = pump_line.get_tank().get_level();
+    state->pump_elapsed_seconds = pump.get_elapsed_seconds();
+    state->pump_target_seconds = pump.get_target_duration();
+    state->delivered_liters = pump.get_delivered_liters();
+    state->speed_percent = pump.get_speed_percent();
+    return succeed(plant);
+}
+
+const char *dupont_plant_last_error(const dupont_plant *plant) {
+    return plant != NULL ? plant->last_error.c_str() : "";
+}
+
+} // extern "C"
@@ -0,0 +1,141 @@
+/* C interface to the Dupont paint plant model. A plant is an opaque handle
+ * stepped in-process: apply commands, advance N ticks, read the state.
+ * Commands use the keys and values of the configuration file
+ * (COLOR_A_MEZCLAR, ARRANQUE_DE_FABRICACION, V201..V403). */
+#ifndef DUPONT_PLANT_H
+#define DUPONT_PLANT_H
+
+#include <stddef.h>
+
+#if defined(_WIN32) && defined(DUPONT_PLANT_SHARED)
+#ifdef DUPONT_PLANT_BUILD
+#define DUPONT_PLANT_API __declspec(dllexport)
+#else
+#define DUPONT_PLANT_API __declspec(dllimport)
+#endif
+#else
+#define DUPONT_PLANT_API
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Bumped whenever a struct layout or a signature changes */
+#define DUPONT_PLANT_API_VERSION 1
+
+#define DUPONT_PLANT_CODE_SIZE 16
+
+enum dupont_status {
+    DUPONT_OK = 0,
+    DUPONT_ERROR_INVALID_ARGUMENT = -1,
+    DUPONT_ERROR_INVALID_COMMAND = -2,
+    DUPONT_ERROR_BATCH_IN_PROCESS = -3,
+    DUPONT_ERROR_MIXER_NOT_EMPTY = -4,
+    DUPONT_ERROR_INTERNAL = -5
+};
+
+/* Values of dupont_plant_state.batch_phase */
+enum dupont_batch_phase {
+    DUPONT_BATCH_IDLE = 0,
+    DUPONT_BATCH_PUMPING = 1,
+    DUPONT_BATCH_MIXING = 2,
+    DUPONT_BATCH_EMPTYING = 3
+};
+
+/* Values of dupont_line_state.pump_state */
+enum dupont_pump_state {
+    DUPONT_PUMP_STOPPED_LOW_PRESSURE = 0,
+    DUPONT_PUMP_STOPPED_HIGH_PRESSURE = 1,
+    DUPONT_PUMP_STOPPED_FLOW_ALARM = 2,
+    DUPONT_PUMP_STOPPED_TARGET_REACHED = 3,
+    DUPONT_PUMP_RUNNING = 4
+};
+
+typedef struct dupont_plant dupont_plant;
+
+typedef struct dupont_command {
+    const char *key;
+    const char *value;
+} dupont_command;
+
+typedef struct dupont_plant_state {
+    double sim_time_seconds;
+    int batch_phase;
+    int motor_running;
+    int low_level_alarm;
+    unsigned long batches_completed;
+    double mixer_liters;
+    double mixer_level_percent;
+    double motor_elapsed_seconds;
+    size_t line_count;
+} dupont_plant_state;
+
+typedef struct dupont_line_state {
+    char pump_code[DUPONT_PLANT_CODE_SIZE];
+    char liquid_name[DUPONT_PLANT_CODE_SIZE];
+    int pump_state;
+    int pump_on;
+    int enter_valve_open;
+    int exit_valve_open;
+    int flow_switch_alarm;
+    double pressure_psi;
+    double tank_liters;
+    double tank_level_percent;
+    double pump_elapsed_seconds;
+    double pump_target_seconds;
+    double delivered_liters;
+    double speed_percent;
+} dupont_line_state;
+
+DUPONT_PLANT_API int dupont_plant_api_version(void);
+
+/* The standard plant: P201 Blanco, P202 Azul, P203 Negro, mixer M401,
+ * starting from the initial conditions of the specification. Returns NULL
+ * on allocation failure. */
+DUPONT_PLANT_API dupont_plant *dupont_plant_create(void);
+
+/* A plant with one standard line per pump code and base name. Valve
+ * commands only address the standard plant's valves. */
+DUPONT_PLANT_API dupont_plant *
+dupont_plant_create_custom(const char *const *pump_codes,
+                           const char *const *liquid_names, size_t count);
+
+DUPONT_PLANT_API void dupont_plant_destroy(dupont_plant *plant);
+
+/* Fixed-speed or variable-speed pumps (see the --vfd console option) */
+DUPONT_PLANT_API int dupont_plant_set_vfd_mode(dupont_plant *plant,
+                                               int enabled);
+
+/* Threads that share each tick, the caller's included. Plants with fewer
+ * than 512 lines to update still step on the caller's thread. Results do not
+ * depend on the thread count. */
+DUPONT_PLANT_API int dupont_plant_set_worker_threads(dupont_plant *plant,
+                                                     unsigned threads);
+
+/* Applies every command, then the start rules. A rejected start reports
+ * DUPONT_ERROR_BATCH_IN_PROCESS or DUPONT_ERROR_MIXER_NOT_EMPTY; an
+ * invalid command leaves the plant as it was. */
+DUPONT_PLANT_API int dupont_plant_apply_commands(dupont_plant *plant,
+                                                 const dupont_command *commands,
+                                                 size_t count);
+
+DUPONT_PLANT_API int dupont_plant_step(dupont_plant *plant,
+                                       unsigned long ticks,
+                                       double tick_seconds);
+
+DUPONT_PLANT_API int dupont_plant_read_state(const dupont_plant *plant,
+                                             dupont_plant_state *state);
+
+DUPONT_PLANT_API int dupont_plant_read_line(const dupont_plant *plant,
+                                            size_t line_index,
+                                            dupont_line_state *state);
+
+/* Message of the last failed call on this plant; empty after success */
+DUPONT_PLANT_API const char *dupont_plant_last_error(const dupont_plant *plant);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* DUPONT_PLANT_H */
@@ -0,0 +1,3628 @@
+// Plant model of the Dupont paint mixing system: components, batch
+// sequencing and configuration handling. The console application uses it
+// directly; other programs can link it through the C API in dupont_plant.h.
+#ifndef DUPONT_PLANT_HPP
+#define DUPONT_PLANT_HPP
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <deque>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <math.h>
+#include <mutex>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+
+namespace SystemConstants {
+const bool NORMAL_STATUS = true;
+const bool ALARM_STATUS = false;
+const double INITIAL_TANK_CAPACITY = 20000.0;
+const double MIXER_TANK_CAPACITY = 200.0;  // Mixer tank capacity as per requirements
+const double INITIAL_BASE_TANK_LEVELS = 25.0;
+const double INITIAL_MIXER_TANK_LEVEL = 0.0;
+const double NORMAL_OPERATING_PRESSURE = 33.0;
+const double HIGH_PRESSURE_THRESHOLD = 50.0;
+const double LOW_PRESSURE_THRESHOLD = 20.0;
+const double PRESSURE_INCREMENT = 3.0; // psi per second of simulation
+const double INITIAL_PRESSURE = 0.0;
+const double DEFAULT_FLOW_RATE = 100.0;
+// Variable-speed drives. Flow follows speed and pressure its square, so
+// the top speed keeps the running pressure under the 50 psi trip
+const double VFD_MIN_SPEED_PERCENT = 20.0;
+const double VFD_MAX_SPEED_PERCENT = 120.0;
+const double VFD_PRESSURE_SETPOINT = 45.0;
+const double VFD_PROPORTIONAL_GAIN = 1.0;  // % speed per psi
+const double VFD_INTEGRAL_GAIN = 0.2;      // % speed per psi second
+const size_t PARALLEL_TICK_MIN_LINES = 512; // Smaller ticks stay sequential
+const bool INITIAL_PUMP_STATE = false;
+const bool INITIAL_FLOW_TRANSMITTER_STATE = NORMAL_STATUS;
+const std::string CONFIG_FILE_PATH = "./tercer_parcial_config.txt";
+const double BATCH_SIZE = 150.0;
+const double MIN_LOT_LITERS = 50.0; // Smallest lot sized from an order
+// Base inventory: a line feeding from a tank below this level moves to a
+// reserve tank of the same base
+const double BASE_SWITCHOVER_LEVEL_PERCENT = 5.0;
+const double REFILL_LEAD_SECONDS = 1800.0;  // Order to delivery
+const double PLANNED_LOTS_PER_HOUR = 30.0;  // Consumption assumed by refills
+const double REFILL_SAFETY_LOTS = 2.0;      // Stock kept beyond the lead time
+// Filling line downstream of the mixer
+const double PRODUCT_BUFFER_CAPACITY = 600.0; // Liters per colour
+const double FILLER_CANS_PER_MINUTE = 20.0;
+const double FILLER_CAN_LITERS = 4.0;
+const double FILLER_CHANGEOVER_SECONDS = 300.0; // Cleaning between colours
+// Base fractions per colour, defined in dupont_plant.cpp
+extern const std::map<std::string, std::map<std::string, double> >
+    COLOR_RECIPES;
+} // namespace SystemConstants
+
+struct SystemConfig {
+    std::map<std::string, std::string> valve_states;
+    std::string color_a_mezclar;
+    std::string arranque_de_fabricacion;
+};
+
+class StringUtils {
+  public:
+    static std::string trim_whitespace(const std::string &s) {
+        size_t start = s.find_first_not_of(" \t\r\n");
+        size_t end = s.find_last_not_of(" \t\r\n");
+        if (start == std::string::npos)
+            return "";
+        return s.substr(start, end - start + 1);
+    }
+};
+
+// Bump allocator for the objects of one simulation run. Allocation is a
+// pointer increment and every run is released at once with reset(), so the
+// containers built on it skip the global heap and each worker thread can
+// own its arena without allocator contention.
+class SimulationArena {
+  private:
+    static const size_t ALIGNMENT = 16;
+
+    std::vector<char *> blocks_;
+    size_t block_size_;
+    size_t current_block_;
+    char *cursor_;
+    char *end_;
+    size_t bytes_allocated_;
+
+    void use_block(size_t index) {
+        current_block_ = index;
+        cursor_ = blocks_[index];
+        end_ = blocks_[index] + block_size_;
+    }
+
+    // Disable copying: blocks are owned by exactly one arena
+    SimulationArena(const SimulationArena &);
+    SimulationArena &operator=(const SimulationArena &);
+
+  public:
+    explicit SimulationArena(size_t block_size = 64 * 1024)
+        : block_size_(block_size), current_block_(0), cursor_(NULL),
+          end_(NULL), bytes_allocated_(0) {
+        if (block_size == 0) {
+            throw std::invalid_argument("SimulationArena block size must be positive");
+        }
+    }
+
+    ~SimulationArena() {
+        for (size_t i = 0; i < blocks_.size(); ++i) {
+            ::operator delete(blocks_[i]);
+        }
+    }
+
+    void *allocate(size_t bytes) {
+        bytes = (bytes + ALIGNMENT - 1) & ~(ALIGNMENT - 1);
+        if (bytes > block_size_) {
+            throw std::length_error(
+                "SimulationArena allocation exceeds block size");
+        }
+        while (cursor_ == NULL || static_cast<size_t>(end_ - cursor_) < bytes) {
+            if (cursor_ != NULL && current_block_ + 1 < blocks_.size()) {
+                use_block(current_block_ + 1); // Reuse a block kept by reset()
+            } else {
+                blocks_.push_back(
+                    static_cast<char *>(::operator new(block_size_)));
+                use_block(blocks_.size() - 1);
+            }
+        }
+        void *result = cursor_;
+        cursor_ += bytes;
+        bytes_allocated_ += bytes;
+        return result;
+    }
+
+    // Releases every allocation at once; blocks are kept for the next run.
+    // Objects allocated here must already be destroyed.
+    void reset() {
+        if (!blocks_.empty()) {
+            use_block(0);
+        }
+        bytes_allocated_ = 0;
+    }
+
+    size_t get_bytes_allocated() const { return bytes_allocated_; }
+    size_t get_block_count() const { return blocks_.size(); }
+};
+
+// Standard allocator over a SimulationArena. Without an arena it falls back
+// to the global heap, so containers behave as before unless a run opts in.
+// The arena never follows a container into a copy: a copied container gets
+// the heap and an assigned one keeps its own allocator, so a copied plant
+// does not live in memory the source's arena reset() reclaims.
+template <class T> class ArenaAllocator {
+  private:
+    SimulationArena *arena_;
+
+  public:
+    typedef T value_type;
+    typedef T *pointer;
+    typedef const T *const_pointer;
+    typedef T &reference;
+    typedef const T &const_reference;
+    typedef size_t size_type;
+    typedef std::ptrdiff_t difference_type;
+
+    typedef std::false_type propagate_on_container_copy_assignment;
+    typedef std::false_type propagate_on_container_move_assignment;
+    typedef std::false_type propagate_on_container_swap;
+
+    template <class U> struct rebind {
+        typedef ArenaAllocator<U> other;
+    };
+
+    ArenaAllocator() : arena_(NULL) {}
+    explicit ArenaAllocator(SimulationArena *arena) : arena_(arena) {}
+    template <class U>
+    ArenaAllocator(const ArenaAllocator<U> &other)
+        : arena_(other.get_arena()) {}
+
+    SimulationArena *get_arena() const { return arena_; }
+
+    ArenaAllocator select_on_container_copy_construction() const {
+        return ArenaAllocator();
+    }
+
+    pointer allocate(size_type count) {
+        if (arena_ == NULL) {
+            return static_cast<pointer>(::operator new(count * sizeof(T)));
+        }
+        return static_cast<pointer>(arena_->allocate(count * sizeof(T)));
+    }
+
+    void deallocate(pointer p, size_type) {
+        if (arena_ == NULL) {
+            ::operator delete(p);
+        }
+        // Arena memory is only released by SimulationArena::reset()
+    }
+
+    size_type max_size() const { return size_type(-1) / sizeof(T); }
+};
+
+template <class T, class U>
+bool operator==(const ArenaAllocator<T> &a, const ArenaAllocator<U> &b) {
+    return a.get_arena() == b.get_arena();
+}
+
+template <class T, class U>
+bool operator!=(const ArenaAllocator<T> &a, const ArenaAllocator<U> &b) {
+    return a.get_arena() != b.get_arena();
+}
+
+class ConfigFileHandler {
+  public:
+    static void open_config_file(std::ifstream &file,
+                                 const std::string &filename) {
+        file.open(filename.c_str());
+        if (!file.is_open()) {
+            throw std::runtime_error("Error: Could not open config file: " +
+                                     filename);
+        }
+    }
+
+    static bool
+    parse_config_line(const std::string &line, std::string &key,
+                      std::string &value) {
+        size_t eq_pos = line.find('=');
+        if (eq_pos == std::string::npos)
+            return false;
+        key = StringUtils::trim_whitespace(line.substr(0, eq_pos));
+        value = StringUtils::trim_whitespace(line.substr(eq_pos + 1));
+        return !(key.empty() || value.empty());
+    }
+
+    static void create_default_config_file(
+        const std::string &filename = SystemConstants::CONFIG_FILE_PATH) {
+        const char *default_config =
+            "# Valvulas de entrada \n"
+            "# Valores Posibles: OPEN / CLOSE\n"
+            "V201 = OPEN\n"
+            "V202 = OPEN\n"
+            "V203 = OPEN\n"
+            "\n"
+            "# Valvulas de salida\n"
+            "# Valores Posibles: OPEN / CLOSE\n"
+            "V401 = OPEN\n"
+            "V402 = OPEN\n"
+            "V403 = OPEN\n"
+            "\n"
+            "# Valores Posibles: AzMarino / AzCeleste\n"
+            "COLOR_A_MEZCLAR = AzCeleste\n"
+            "\n"
+            "# Valores Posibles: ON / OFF   (Se debe apagar <OFF> y volver a "
+            "encender <ON>\n"
+            "# para comenzar un nuevo lote)\n"
+            "ARRANQUE_DE_FABRICACION = OFF\n";
+
+        std::ofstream out(filename.c_str(), std::ios::trunc);
+        if (!out) {
+            throw std::runtime_error("Could not write default config file: " +
+                                     filename);
+        }
+        out << default_config;
+        out.close();
+    }
+};
+
+class ConfigValidator {
+  private:
+    static const std::vector<std::string> KNOWN_VALVE_KEYS;
+    static const std::string K_COLOR;
+    static const std::string K_ARRANQUE;
+
+  public:
+    static void validate_and_set_config_pair(SystemConfig &config,
+                                             const std::string &key,
+                                             const std::string &value) {
+        if (key == K_COLOR) {
+            validate_color_value(value);
+            config.color_a_mezclar = value;
+        } else if (key == K_ARRANQUE) {
+            validate_start_command_value(value);
+            config.arranque_de_fabricacion = value;
+        } else if (is_known_valve(key)) {
+            validate_valve_value(key, value);
+            config.valve_states[key] = value;
+        } else {
+            throw std::runtime_error("Invalid configuration key found: " + key);
+        }
+    }
+
+    static const std::vector<std::string> &get_known_valve_keys() {
+        return KNOWN_VALVE_KEYS;
+    }
+
+    // Current value of a configuration key, empty when it is not set
+    static std::string get_config_value(const SystemConfig &config,
+                                        const std::string &key) {
+        if (key == K_COLOR) {
+            return config.color_a_mezclar;
+        }
+        if (key == K_ARRANQUE) {
+            return config.arranque_de_fabricacion;
+        }
+        std::map<std::string, std::string>::const_iterator valve =
+            config.valve_states.find(key);
+        return valve != config.valve_states.end() ? valve->second : "";
+    }
+
+    static void validate_complete_config(const SystemConfig &config) {
+        if (config.color_a_mezclar.empty()) {
+            throw std::runtime_error(
+                "Missing required setting: COLOR_A_MEZCLAR");
+        }
+        if (config.arranque_de_fabricacion.empty()) {
+            throw std::runtime_error(
+                "Missing required setting: ARRANQUE_DE_FABRICACION");
+        }
+
+        for (size_t i = 0; i < KNOWN_VALVE_KEYS.size(); ++i) {
+            const std::string& valve = KNOWN_VALVE_KEYS[i];
+            if (config.valve_states.find(valve) == config.valve_states.end()) {
+                throw std::runtime_error("Missing required valve setting: " +
+                                         valve);
+            }
+        }
+    }
+
+  private:
+    static void validate_color_value(const std::string &value) {
+        if (value != "AzMarino" && value != "AzCeleste") {
+            throw std::runtime_error("Invalid value for COLOR_A_MEZCLAR: " +
+                                     value);
+        }
+    }
+
+    static void validate_start_command_value(const std::string &value) {
+        if (value != "ON" && value != "OFF") {
+            throw std::runtime_error(
+                "Invalid value for ARRANQUE_DE_FABRICACION: " + value);
+        }
+    }
+
+    static void validate_valve_value(const std::string &key,
+                                     const std::string &value) {
+        if (value != "OPEN" && value != "CLOSE") {
+            throw std::runtime_error("Invalid value for valve " + key + ": " +
+                                     value);
+        }
+    }
+
+    static bool is_known_valve(const std::string &key) {
+        return std::find(KNOWN_VALVE_KEYS.begin(), KNOWN_VALVE_KEYS.end(),
+                         key) != KNOWN_VALVE_KEYS.end();
+    }
+};
+
+class ConfigManager {
+  public:
+    // Malformed lines are skipped. Their numbers go to malformed_lines when
+    // the caller collects them, otherwise they are reported on cerr.
+    static SystemConfig
+    read_config(const std::string &filename = SystemConstants::CONFIG_FILE_PATH,
+                std::vector<int> *malformed_lines = NULL) {
+        SystemConfig config;
+        std::ifstream file;
+        ConfigFileHandler::open_config_file(file, filename);
+        std::string line, key, value;
+        int line_number = 0;
+
+        while (std::getline(file, line)) {
+            line_number++;
+            std::string trimmed = StringUtils::trim_whitespace(line);
+
+            if (trimmed.empty() || trimmed[0] == '#')
+                continue;
+
+            if (!ConfigFileHandler::parse_config_line(trimmed, key, value)) {
+                if (malformed_lines != NULL) {
+                    malformed_lines->push_back(line_number);
+                } else {
+                    std::cerr << "Warning: Malformed config line "
+                              << line_number << ": " << line << std::endl;
+                }
+                continue;
+            }
+            ConfigValidator::validate_and_set_config_pair(config, key, value);
+        }
+
+        ConfigValidator::validate_complete_config(config);
+        return config;
+    }
+
+    static void repair_or_create_config_file(
+        const std::string &filename = SystemConstants::CONFIG_FILE_PATH) {
+        ConfigFileHandler::create_default_config_file(filename);
+    }
+};
+
+// Settings changed from outside the configuration file. An override holds
+// until the file itself changes that key, so the file keeps the last word.
+class ConfigOverrides {
+  private:
+    struct Override {
+        std::string value;
+        std::string file_value; // File value when the override was set
+    };
+    std::map<std::string, Override> overrides_;
+
+  public:
+    // Validated exactly like a configuration file line
+    void set(const std::string &key, const std::string &value,
+             const SystemConfig &file_config) {
+        SystemConfig checked = file_config;
+        ConfigValidator::validate_and_set_config_pair(checked, key, value);
+        Override &entry = overrides_[key];
+        entry.value = value;
+        entry.file_value = ConfigValidator::get_config_value(file_config, key);
+    }
+
+    // Takes the configuration as read from the file
+    void apply(SystemConfig &config) {
+        std::map<std::string, Override>::iterator it = overrides_.begin();
+        while (it != overrides_.end()) {
+            if (ConfigValidator::get_config_value(config, it->first) !=
+                it->second.file_value) {
+                overrides_.erase(it++);
+                continue;
+            }
+            ConfigValidator::validate_and_set_config_pair(config, it->first,
+                                                          it->second.value);
+            ++it;
+        }
+    }
+
+    size_t get_count() const { return overrides_.size(); }
+};
+
+class LevelTransmitter {
+  private:
+    std::string code_;
+    double level_;
+
+    void evaluate_level(double &current_capacity, double &max_capacity) {
+        if (current_capacity > max_capacity) {
+            current_capacity = max_capacity;
+        } else if (current_capacity < 0) {
+            current_capacity = 0;
+        }
+        level_ = (current_capacity / max_capacity) * 100.0;
+    }
+
+  public:
+    explicit LevelTransmitter(const std::string &code)
+        : code_(code), level_(SystemConstants::INITIAL_MIXER_TANK_LEVEL) {}
+
+    const std::string &get_code() const { return code_; }
+
+    double read_level(double &current_capacity, double &max_capacity) const {
+        const_cast<LevelTransmitter *>(this)->evaluate_level(current_capacity,
+                                                             max_capacity);
+        return level_;
+    }
+};
+
+class LiquidTank {
+  private:
+    std::string code_;
+    std::string liquid_name_;
+    double max_capacity_;
+    double current_capacity_;
+    LevelTransmitter level_transmitter_;
+
+  public:
+    LiquidTank(const std::string &tank_code,
+               const std::string &level_transmitter_code,
+               const std::string &liquid_name,
+               double max_capacity,
+               double current_capacity)
+        : code_(tank_code), liquid_name_(liquid_name),
+          max_capacity_(max_capacity), current_capacity_(current_capacity),
+          level_transmitter_(level_transmitter_code) {}
+
+    const std::string &get_liquid_in_tank_name() const { return liquid_name_; }
+    const std::string &get_code() const { return code_; }
+    const LevelTransmitter &get_level_transmitter() const {
+        return level_transmitter_;
+    }
+    double get_max_capacity() const { return max_capacity_; }
+    double get_current_capacity() const { return current_capacity_; }
+
+    double get_level() const {
+        return level_transmitter_.read_level(
+            const_cast<double &>(current_capacity_),
+            const_cast<double &>(max_capacity_));
+    }
+
+    double get_free_space() const { return max_capacity_ - current_capacity_; }
+
+    // Returns the liters that fit
+    double fill(double liters) {
+        double room = get_free_space() > 0.0 ? get_free_space() : 0.0;
+        double accepted = liters < room ? liters : room;
+        current_capacity_ += accepted;
+        return accepted;
+    }
+
+    double drain(double amount) {
+        if (amount <= 0) {
+            return 0.0;
+        }
+
+        double drained_amount;
+        if (current_capacity_ >= amount) {
+            current_capacity_ -= amount;
+            drained_amount = amount;
+        } else {
+            drained_amount = current_capacity_;
+            current_capacity_ = 0.0;
+        }
+        return drained_amount;
+    }
+};
+
+class FlowSwitch {
+  private:
+    std::string code_;
+    bool status_;
+    bool forced_alarm_; // Operator test input; wins over the measured flow
+
+  public:
+    explicit FlowSwitch(
+        const std::string &code,
+        bool initial_status = SystemConstants::INITIAL_FLOW_TRANSMITTER_STATE)
+        : code_(code), status_(initial_status), forced_alarm_(false) {
+        if (code.empty()) {
+            throw std::invalid_argument("FlowSwitch code cannot be empty");
+        }
+    }
+
+    void evaluate_status(double flow_rate, bool pump_should_be_flowing) {
+        // Flow switch goes to ALARM when:
+        // 1. Pump should be flowing but flow rate is 0 (valve issues, blockage, etc.)
+        // 2. Any flow anomaly when pump is running at expected capacity
+        // 3. The operator forces it, to test the trip
+        if (forced_alarm_) {
+            status_ = SystemConstants::ALARM_STATUS;
+        } else if (pump_should_be_flowing && flow_rate == 0) {
+            status_ = SystemConstants::ALARM_STATUS;
+        } else if (!pump_should_be_flowing) {
+            // If pump shouldn't be flowing, flow switch should be normal
+            status_ = SystemConstants::NORMAL_STATUS;
+        } else {
+            // Pump is flowing at expected rate, normal operation
+            status_ = SystemConstants::NORMAL_STATUS;
+        }
+    }
+
+    const std::string &get_code() const { return code_; }
+    bool is_normal() const { return status_ == SystemConstants::NORMAL_STATUS; }
+    bool is_alarm() const { return status_ == SystemConstants::ALARM_STATUS; }
+
+    // Takes effect on the next evaluation, so observers see the change
+    void set_forced_alarm(bool forced) { forced_alarm_ = forced; }
+    bool is_forced_alarm() const { return forced_alarm_; }
+};
+
+class Valve {
+  private:
+    std::string code_;
+    bool is_open_;
+
+  public:
+    explicit Valve(const std::string &code, bool is_open = true)
+        : code_(code), is_open_(is_open) {}
+
+    void toggle() { is_open_ = !is_open_; }
+    void set_open(bool new_open_state) { is_open_ = new_open_state; }
+    bool is_open() const { return is_open_; }
+    const std::string &get_code() const { return code_; }
+};
+
+enum PumpState {
+    STOPPED_LOW_PRESSURE,
+    STOPPED_HIGH_PRESSURE,
+    STOPPED_FLOW_ALARM,
+    STOPPED_TARGET_REACHED,
+    RUNNING
+};
+
+const int PUMP_STATE_COUNT = RUNNING + 1;
+
+class LiquidPump {
+  private:
+    std::string code_;
+    double flow_rate_lts_min_;
+    double target_pump_duration_seconds_;
+    double pump_elapsed_seconds_;
+    bool is_on_;
+    PumpState current_state_;
+    bool vfd_mode_;
+    double speed_percent_;
+    // Doses are metered on an integer millilitre totaliser; the remainder
+    // carries what the last scans moved short of a whole millilitre, in
+    // sixtieths (flow rates are per minute)
+    long long target_ml_;
+    long long delivered_ml_;
+    long long flow_remainder_;
+
+    void start() {
+        is_on_ = true;
+        current_state_ = RUNNING;
+    }
+
+    void stop(PumpState reason) {
+        is_on_ = false;
+        current_state_ = reason;
+    }
+
+    bool should_stop_for_alarm(const FlowSwitch &flow_switch) const {
+        return flow_switch.is_alarm();
+    }
+
+    bool should_stop_for_high_pressure(double current_pressure) const {
+        return current_pressure > SystemConstants::HIGH_PRESSURE_THRESHOLD;
+    }
+
+    bool should_stop_for_target_reached() const {
+        return is_target_reached();
+    }
+
+    bool can_start_for_pressure(double current_pressure) const {
+        return current_pressure < SystemConstants::LOW_PRESSURE_THRESHOLD;
+    }
+
+    bool can_start_pumping(const FlowSwitch &flow_switch, double current_pressure, 
+                          const Valve &enter_valve, const Valve &exit_valve) const {
+        // Pump can start if:
+        // 1. Flow switch is in normal state (no alarm)
+        // 2. Pressure is below low threshold (20 psi)
+        // 3. Pump has a valid target duration
+        // 4. Pump hasn't reached its target yet
+        // 5. Both enter and exit valves are open (essential for pump operation)
+        return flow_switch.is_normal() && 
+               can_start_for_pressure(current_pressure) &&
+               has_target() && !is_target_reached() &&
+               enter_valve.is_open() && 
+               exit_valve.is_open();
+    }
+
+  public:
+    explicit LiquidPump(const std::string &code,
+                        double flow_rate = SystemConstants::DEFAULT_FLOW_RATE)
+        : code_(code), flow_rate_lts_min_(flow_rate),
+          target_pump_duration_seconds_(0.0), pump_elapsed_seconds_(0.0),
+          is_on_(SystemConstants::INITIAL_PUMP_STATE),
+          current_state_(STOPPED_LOW_PRESSURE), vfd_mode_(false),
+          speed_percent_(100.0), target_ml_(0), delivered_ml_(0),
+          flow_remainder_(0) {}
+
+    bool is_on() const { return is_on_; }
+    // Flow at the current speed; the nominal rate at 100%
+    double get_flow_rate() const {
+        return flow_rate_lts_min_ * speed_percent_ / 100.0;
+    }
+    const std::string &get_code() const { return code_; }
+    PumpState get_state() const { return current_state_; }
+    double get_elapsed_seconds() const { return pump_elapsed_seconds_; }
+    double get_target_duration() const { return target_pump_duration_seconds_; }
+    long long get_target_ml() const { return target_ml_; }
+    long long get_delivered_ml() const { return delivered_ml_; }
+    long long get_metered_remainder() const { return flow_remainder_; }
+    double get_target_liters() const { return target_ml_ / 1000.0; }
+    double get_delivered_liters() const { return delivered_ml_ / 1000.0; }
+    double get_remaining_liters() const {
+        return (target_ml_ - delivered_ml_) / 1000.0;
+    }
+
+    bool has_target() const { return target_ml_ > 0; }
+
+    // Fixed and variable speed alike dose by the totalised volume; the
+    // target duration is what the dose takes at line speed
+    bool is_target_reached() const { return delivered_ml_ >= target_ml_; }
+
+    bool is_vfd_mode() const { return vfd_mode_; }
+    double get_speed_percent() const { return speed_percent_; }
+
+    // Leaving VFD mode returns the drive to full line speed
+    void set_vfd_mode(bool enabled) {
+        vfd_mode_ = enabled;
+        speed_percent_ = 100.0;
+    }
+
+    void set_speed_percent(double percent) {
+        if (percent < SystemConstants::VFD_MIN_SPEED_PERCENT) {
+            percent = SystemConstants::VFD_MIN_SPEED_PERCENT;
+        } else if (percent > SystemConstants::VFD_MAX_SPEED_PERCENT) {
+            percent = SystemConstants::VFD_MAX_SPEED_PERCENT;
+        }
+        speed_percent_ = percent;
+    }
+
+    // Nominal flow at full speed. The line was sized for the default rate,
+    // so a larger pump raises the discharge pressure as well.
+    void set_nominal_flow_rate(double lts_min) {
+        if (lts_min <= 0) {
+            throw std::invalid_argument("Pump flow rate must be positive");
+        }
+        flow_rate_lts_min_ = lts_min;
+    }
+
+    // Discharge pressure with both valves open; 33 psi at the default flow
+    // and full line speed, rising with the square of the flow
+    double get_running_pressure() const {
+        double speed_ratio =
+            speed_percent_ / 100.0 *
+            (flow_rate_lts_min_ / SystemConstants::DEFAULT_FLOW_RATE);
+        return SystemConstants::NORMAL_OPERATING_PRESSURE * speed_ratio *
+               speed_ratio;
+    }
+
+    // Millilitres the pump moves in this scan, the last scan of a dose cut
+    // to exactly what is left. Only whole millilitres are issued and the
+    // rest carries over, so a dose lands on its target at any scan length.
+    // The pump's elapsed time counts the part of the scan it pumped.
+    long long meter_dose(double seconds) {
+        long long sixtieths =
+            llround(get_flow_rate() * 1000.0 * seconds) + flow_remainder_;
+        long long ml = sixtieths / 60;
+        flow_remainder_ = sixtieths % 60;
+        long long remaining = target_ml_ - delivered_ml_;
+        if (ml >= remaining) {
+            if (ml > 0) {
+                seconds *= double(remaining) / ml;
+            }
+            ml = remaining;
+            flow_remainder_ = 0;
+        }
+        delivered_ml_ += ml;
+        pump_elapsed_seconds_ += seconds;
+        return ml;
+    }
+
+    double get_actual_flow_rate(const Valve &enter_valve, const Valve &exit_valve) const {
+        // Flow rate is 100 lts/min ONLY when:
+        // 1. Pump is ON
+        // 2. Both suction (enter) and discharge (exit) valves are open
+        // If any valve is closed or pump is off, flow rate is 0
+        if (is_on_ && enter_valve.is_open() && exit_valve.is_open()) {
+            return get_flow_rate();
+        }
+        return 0.0; // No flow if pump is off or any valve is closed
+    }
+
+    // Fixed: Added valve state checking to prevent pumps from starting/restarting
+    // when essential valves (enter/exit) are closed. This ensures pumps only
+    // operate when they can actually function properly.
+    void update_pump_state(const FlowSwitch &flow_switch,
+                           double current_pressure,
+                           const Valve &enter_valve,
+                           const Valve &exit_valve) {
+        // Check stop conditions first (in order of priority)
+        
+        // 1. Flow alarm - immediate stop
+        if (should_stop_for_alarm(flow_switch)) {
+            stop(STOPPED_FLOW_ALARM);
+            return;
+        }
+
+        // 2. High pressure - stop to prevent damage  
+        if (should_stop_for_high_pressure(current_pressure)) {
+            stop(STOPPED_HIGH_PRESSURE);
+            return;
+        }
+
+        // 3. Target reached - stop when pumping goal is achieved
+        if (should_stop_for_target_reached()) {
+            stop(STOPPED_TARGET_REACHED);
+            return;
+        }
+
+        // Check restart conditions based on current stop reason
+        if (!is_on_) {
+            if (current_state_ == STOPPED_FLOW_ALARM) {
+                // After flow alarm: restart only when flow is normal AND pressure is low AND valves are open
+                // This ensures the flow issue has been resolved and valves are properly configured
+                if (flow_switch.is_normal() && 
+                    can_start_for_pressure(current_pressure) &&
+                    enter_valve.is_open() && 
+                    exit_valve.is_open()) {
+                    start();
+                }
+            } else if (current_state_ == STOPPED_HIGH_PRESSURE) {
+                // After high pressure: restart when pressure drops below low threshold AND valves are open
+                // This implements the 20 psi restart logic from requirements
+                if (can_start_for_pressure(current_pressure) &&
+                    enter_valve.is_open() && 
+                    exit_valve.is_open()) {
+                    start();
+                }
+            } else if (current_state_ == STOPPED_LOW_PRESSURE) {
+                // Initial state or after manual stop: start when pressure allows AND valves are open
+                if (can_start_for_pressure(current_pressure) && 
+                    flow_switch.is_normal() &&
+                    enter_valve.is_open() && 
+                    exit_valve.is_open()) {
+                    start();
+                }
+            }
+            // STOPPED_TARGET_REACHED pumps should not restart automatically
+        }
+    }
+
+    void set_pump_target_liters(double amount_lts) {
+        // A zero target clears the previous lot's target for unused bases
+        // Rounding to the millilitre makes 1/3 and 2/3 of a lot exact
+        target_ml_ = amount_lts > 0 ? llround(amount_lts * 1000.0) : 0;
+        target_pump_duration_seconds_ =
+            (target_ml_ / 1000.0 / flow_rate_lts_min_) * 60.0;
+        delivered_ml_ = 0;
+        flow_remainder_ = 0;
+        pump_elapsed_seconds_ = 0.0;
+        // A new target re-arms a pump that finished the previous lot
+        if (current_state_ == STOPPED_TARGET_REACHED) {
+            current_state_ = STOPPED_LOW_PRESSURE;
+        }
+    }
+};
+
+class PressureTransmitter {
+  private:
+    std::string code_;
+    double pressure_;
+
+  public:
+    explicit PressureTransmitter(
+        const std::string &code,
+        double pressure = SystemConstants::INITIAL_PRESSURE)
+        : code_(code), pressure_(pressure) {}
+
+    const std::string &get_code() const { return code_; }
+    double read_pressure() const { return pressure_; }
+
+    // Pressure moves PRESSURE_INCREMENT psi per simulated second, so the
+    // behaviour does not depend on the scan period
+    void update_pressure(const Valve &enter_valve,
+                         const Valve &exit_valve,
+                         const LiquidPump &pump,
+                         double seconds = 1.0) {
+        const double step = SystemConstants::PRESSURE_INCREMENT * seconds;
+
+        if (pump.is_on()) {
+            // --- Pump is ON ---
+            if (enter_valve.is_open() && exit_valve.is_open()) {
+                // Normal operation: stabilize at 33 psi, or at the pressure
+                // of the drive's current speed
+                // Gradually approach normal pressure if not already there
+                double running_pressure = pump.get_running_pressure();
+                if (pressure_ < running_pressure) {
+                    pressure_ += step;
+                    if (pressure_ > running_pressure) {
+                        pressure_ = running_pressure;
+                    }
+                } else if (pressure_ > running_pressure) {
+                    pressure_ -= step;
+                    if (pressure_ < running_pressure) {
+                        pressure_ = running_pressure;
+                    }
+                }
+            } else if (!exit_valve.is_open() && enter_valve.is_open()) { 
+                // Exit valve closed, pump running - pressure builds up gradually
+                // Flow rate immediately drops to 0 lts/min when discharge valve closes
+                pressure_ += step;
+                // Pressure will build until it reaches HIGH_PRESSURE_THRESHOLD and pump stops
+            } else { 
+                // Enter valve closed - pump can't draw liquid, pressure drops to zero
+                if (pressure_ > SystemConstants::INITIAL_PRESSURE) {
+                    pressure_ -= step;
+                    if (pressure_ < SystemConstants::INITIAL_PRESSURE) {
+                        pressure_ = SystemConstants::INITIAL_PRESSURE;
+                    }
+                } else {
+                    pressure_ = SystemConstants::INITIAL_PRESSURE;
+                }
+            }
+        } else {
+            // --- Pump is OFF ---
+            // Handle pressure behavior based on pump stop reason and valve states
+            if (pump.get_state() == STOPPED_FLOW_ALARM) {
+                // After flow alarm shutdown: pressure behavior depends on discharge valve
+                if (exit_valve.is_open()) {
+                    // Discharge valve open: pressure drops to 0 psi gradually
+                    if (pressure_ > SystemConstants::INITIAL_PRESSURE) {
+                        pressure_ -= step;
+                        if (pressure_ < SystemConstants::INITIAL_PRESSURE) {
+                            pressure_ = SystemConstants::INITIAL_PRESSURE;
+                        }
+                    }
+                }
+                // If discharge valve closed: pressure maintains last value (no change)
+            } else {
+                // For other stop reasons (high pressure, target reached, etc.)
+                if (exit_valve.is_open()) {
+                    // Valve open, pressure decays gradually toward zero
+                    if (pressure_ > SystemConstants::INITIAL_PRESSURE) {
+                        pressure_ -= step * 0.7; // Controlled decay
+                        if (pressure_ < SystemConstants::INITIAL_PRESSURE) {
+                            pressure_ = SystemConstants::INITIAL_PRESSURE;
+                        }
+                    }
+                }
+                // If exit valve closed and pump off, pressure remains at current level
+            }
+        }
+
+        // Ensure pressure doesn't go below zero or above maximum safe limits
+        if (pressure_ < SystemConstants::INITIAL_PRESSURE) {
+            pressure_ = SystemConstants::INITIAL_PRESSURE;
+        }
+        // Note: No upper limit check here as high pressure should trigger pump shutdown
+    }
+};
+
+// PI loop on discharge pressure for a variable-speed pump. Feedforward
+// from the square law puts the drive near the setpoint speed at once; the
+// integral trims the rest and holds while the output is saturated.
+class PumpSpeedController {
+  private:
+    double integral_;
+
+  public:
+    PumpSpeedController() : integral_(0.0) {}
+
+    double get_integral() const { return integral_; }
+
+    void update(LiquidPump &pump, double pressure, double seconds) {
+        double feedforward =
+            100.0 * sqrt(SystemConstants::VFD_PRESSURE_SETPOINT /
+                         SystemConstants::NORMAL_OPERATING_PRESSURE);
+        if (!pump.is_on()) {
+            integral_ = 0.0;
+            pump.set_speed_percent(feedforward);
+            return;
+        }
+        double error = SystemConstants::VFD_PRESSURE_SETPOINT - pressure;
+        double unclamped = feedforward +
+                           SystemConstants::VFD_PROPORTIONAL_GAIN * error +
+                           integral_;
+        bool saturated =
+            (unclamped >= SystemConstants::VFD_MAX_SPEED_PERCENT &&
+             error > 0) ||
+            (unclamped <= SystemConstants::VFD_MIN_SPEED_PERCENT && error < 0);
+        if (!saturated) {
+            integral_ += SystemConstants::VFD_INTEGRAL_GAIN * error * seconds;
+        }
+        pump.set_speed_percent(unclamped);
+    }
+};
+
+class PumpLine {
+  private:
+    LiquidPump pump_;
+    Valve enter_valve_;
+    Valve exit_valve_;
+    FlowSwitch flow_switch_;
+    PressureTransmitter pressure_transmitter_;
+    LiquidTank tank_; // The tank the pump draws from
+    // Further tanks of the same base; empty on the standard lines
+    std::vector<LiquidTank> reserve_tanks_;
+    PumpSpeedController speed_controller_;
+
+    // Reserve with the most base, or -1 when none holds more than min_liters
+    int fullest_reserve(double min_liters) const {
+        int best = -1;
+        for (size_t i = 0; i < reserve_tanks_.size(); ++i) {
+            double liters = reserve_tanks_[i].get_current_capacity();
+            if (liters > min_liters &&
+                (best < 0 ||
+                 liters > reserve_tanks_[best].get_current_capacity())) {
+                best = static_cast<int>(i);
+            }
+        }
+        return best;
+    }
+
+PumpLine(const std::string &pump_code, // Private constructor
+             const std::string &enter_valve_code,
+             const std::string &exit_valve_code,
+             const std::string &flow_switch_code,
+             const std::string &pressure_transmitter_code,
+             const std::string &tank_code,
+             const std::string &liquid_name,
+             double max_capacity,
+             double current_capacity,
+             const std::string &level_transmitter_code)
+        : pump_(pump_code), enter_valve_(enter_valve_code),
+          exit_valve_(exit_valve_code), flow_switch_(flow_switch_code),
+          pressure_transmitter_(pressure_transmitter_code),
+          tank_(tank_code,
+                level_transmitter_code,
+                liquid_name,
+                max_capacity,
+                current_capacity) {}
+
+  public:
+    // Single creation method for standard paint lines - SIMPLIFIED
+    static PumpLine create_standard_paint_line(const std::string &pump_code,
+                                               const std::string &liquid_name) {
+        if (pump_code.empty())
+            throw std::invalid_argument("Pump code required");
+        if (liquid_name.empty())
+            throw std::invalid_argument("Liquid name required");
+
+        std::string numeric_pump_code = pump_code.substr(1); // "201", "P201"
+        std::string last_two_digits = pump_code.substr(2);   // "01" from "P201"
+
+        std::string enter_valve = "V" + numeric_pump_code;
+        std::string exit_valve = "V4" + last_two_digits;
+        std::string flow_switch = "FS" + numeric_pump_code;
+        std::string pressure_transmitter = "PT4" + last_two_digits;
+        // Past three digits the 4xx discharge tags would collide (P30003
+        // and P40003 -> V40003), so they carry the whole number instead
+        if (numeric_pump_code.size() > 3) {
+            exit_valve = "VS" + numeric_pump_code;
+            pressure_transmitter = "PT" + numeric_pump_code;
+        }
+        std::string tank = "TQ" + numeric_pump_code;
+        std::string level_transmitter = "LT" + numeric_pump_code;
+
+        double max_capacity = SystemConstants::INITIAL_TANK_CAPACITY;
+        double current_capacity =
+            max_capacity * SystemConstants::INITIAL_BASE_TANK_LEVELS / 100.0;
+
+        return PumpLine(pump_code, enter_valve, exit_valve, flow_switch,
+                        pressure_transmitter, tank, liquid_name, max_capacity,
+                        current_capacity, level_transmitter);
+    }
+
+    const LiquidPump &get_pump() const { return pump_; }
+    const Valve &get_enter_valve() const { return enter_valve_; }
+    const Valve &get_exit_valve() const { return exit_valve_; }
+    const FlowSwitch &get_flow_switch() const { return flow_switch_; }
+    const PressureTransmitter &get_pressure_transmitter() const {
+        return pressure_transmitter_;
+    }
+    const LiquidTank &get_tank() const { return tank_; }
+
+    LiquidPump &get_pump_mutable() { return pump_; }
+    Valve &get_enter_valve_mutable() { return enter_valve_; }
+    Valve &get_exit_valve_mutable() { return exit_valve_; }
+    FlowSwitch &get_flow_switch_mutable() { return flow_switch_; }
+    LiquidTank &get_tank_mutable() { return tank_; }
+
+    const std::vector<LiquidTank> &get_reserve_tanks() const {
+        return reserve_tanks_;
+    }
+
+    const PumpSpeedController &get_speed_controller() const {
+        return speed_controller_;
+    }
+
+    void add_reserve_tank(const LiquidTank &tank) {
+        if (tank.get_liquid_in_tank_name() != tank_.get_liquid_in_tank_name()) {
+            throw std::invalid_argument("Reserve tank " + tank.get_code() +
+                                        " does not hold " +
+                                        tank_.get_liquid_in_tank_name());
+        }
+        reserve_tanks_.push_back(tank);
+    }
+
+    // Base in every tank of the line
+    double get_base_inventory() const {
+        double liters = tank_.get_current_capacity();
+        for (size_t i = 0; i < reserve_tanks_.size(); ++i) {
+            liters += reserve_tanks_[i].get_current_capacity();
+        }
+        return liters;
+    }
+
+    double get_base_capacity() const {
+        double liters = tank_.get_max_capacity();
+        for (size_t i = 0; i < reserve_tanks_.size(); ++i) {
+            liters += reserve_tanks_[i].get_max_capacity();
+        }
+        return liters;
+    }
+
+    // Draws from the feed tank. Below the switchover level the line moves to
+    // a reserve that is not low itself, and if the feed tank runs dry
+    // mid-draw the rest comes from any reserve with base left. Sets
+    // switched when the feed tank changed.
+    double draw_base(double liters, bool &switched) {
+        switched = false;
+        if (reserve_tanks_.empty()) {
+            return tank_.drain(liters);
+        }
+        if (tank_.get_level() < SystemConstants::BASE_SWITCHOVER_LEVEL_PERCENT) {
+            int reserve = fullest_reserve(
+                tank_.get_max_capacity() *
+                SystemConstants::BASE_SWITCHOVER_LEVEL_PERCENT / 100.0);
+            if (reserve >= 0) {
+                std::swap(tank_, reserve_tanks_[reserve]);
+                switched = true;
+            }
+        }
+        double drawn = tank_.drain(liters);
+        while (drawn < liters) {
+            int reserve = fullest_reserve(0.0);
+            if (reserve < 0) {
+                break;
+            }
+            std::swap(tank_, reserve_tanks_[reserve]);
+            switched = true;
+            drawn += tank_.drain(liters - drawn);
+        }
+        return drawn;
+    }
+
+    // A delivery fills the emptiest tanks first; returns what fitted
+    double receive_refill(double liters) {
+        double accepted = 0.0;
+        while (accepted < liters) {
+            LiquidTank *emptiest = &tank_;
+            for (size_t i = 0; i < reserve_tanks_.size(); ++i) {
+                if (reserve_tanks_[i].get_free_space() >
+                    emptiest->get_free_space()) {
+                    emptiest = &reserve_tanks_[i];
+                }
+            }
+            double filled = emptiest->fill(liters - accepted);
+            if (filled <= 0.0) {
+                break;
+            }
+            accepted += filled;
+        }
+        return accepted;
+    }
+
+    void update_system_state(double seconds = 1.0) {
+        // Calculate actual flow rate based on current pump and valve states
+        double physical_flow = pump_.get_actual_flow_rate(enter_valve_, exit_valve_);
+        bool pump_should_be_flowing = pump_.is_on();
+        
+        // Evaluate flow switch status based on physical flow and pump expectation
+        // Flow switch will alarm if pump is on but no flow due to valve closure or blockage
+        flow_switch_.evaluate_status(physical_flow, pump_should_be_flowing);
+
+        // Order of updates matters for proper simulation:
+        // 1. Update pressure based on current valve/pump states (BEFORE pump state changes)
+        pressure_transmitter_.update_pressure(enter_valve_, exit_valve_, pump_,
+                                              seconds);
+        
+        // 2. Update pump state based on flow switch status and new pressure readings
+        pump_.update_pump_state(flow_switch_, pressure_transmitter_.read_pressure(), enter_valve_, exit_valve_);
+
+        // 3. Elapsed time is counted when the pump meters its dose, so the
+        // scan that reaches the target still delivers
+
+        // 4. A variable-speed drive sets the speed for the next scan
+        if (pump_.is_vfd_mode()) {
+            speed_controller_.update(pump_,
+                                     pressure_transmitter_.read_pressure(),
+                                     seconds);
+        }
+    }
+
+    bool need_to_pump() const {
+        // Check if pump has reached its target
+        if (pump_.is_target_reached()) {
+            return false; // Target reached, no more pumping needed
+        }
+        
+        // Check if pump has a valid target (greater than 0)
+        if (!pump_.has_target()) {
+            return false; // No target set, no pumping needed
+        }
+        
+        // Check pump state and conditions
+        PumpState state = pump_.get_state();
+        
+        // Pump needs to continue if it's currently running
+        if (state == RUNNING) {
+            return true; // Currently pumping and hasn't reached target
+        }
+        
+        // For stopped pumps, check if they can potentially restart
+        if (state == STOPPED_FLOW_ALARM || state == STOPPED_HIGH_PRESSURE || state == STOPPED_LOW_PRESSURE) {
+            // These states can potentially restart if conditions improve
+            // Also check if valves are in proper state for pumping
+            if (enter_valve_.is_open() && exit_valve_.is_open()) {
+                return true; // Conditions allow potential restart
+            }
+        }
+        
+        // If stopped due to target reached, no more pumping needed
+        return false;
+    }
+};
+
+class LowLevelSwitch {
+  private:
+    std::string code_;
+    bool status_;
+
+  public:
+    explicit LowLevelSwitch(const std::string &code,
+                            bool initial_status = SystemConstants::ALARM_STATUS)
+        : code_(code), status_(initial_status) {
+        if (code.empty()) {
+            throw std::invalid_argument("LowLevelSwitch code cannot be empty");
+        }
+    }
+
+    void set_status(bool new_status) { status_ = new_status; }
+    bool is_normal() const { return status_ == SystemConstants::NORMAL_STATUS; }
+    bool is_alarm() const { return status_ == SystemConstants::ALARM_STATUS; }
+    const std::string &get_code() const { return code_; }
+};
+
+class MixerMotor {
+  private:
+    std::string code_;
+    bool is_on_;
+    double elapsed_time_;
+    double target_time_;
+
+  public:
+    explicit MixerMotor(const std::string &code,
+                        bool initial_state = false,
+                        double target_time = 30)
+        : code_(code), is_on_(initial_state), elapsed_time_(0),
+          target_time_(target_time) {
+        if (code.empty()) {
+            throw std::invalid_argument("MixerMotor code cannot be empty");
+        }
+    }
+
+    void start() {
+        is_on_ = true;
+        elapsed_time_ = 0.0; // Reset elapsed time when starting
+    }
+    void stop() { is_on_ = false; }
+    void reset() { 
+        is_on_ = false; 
+        elapsed_time_ = 0.0; // Reset elapsed time completely
+    }
+    bool is_running() const { return is_on_; }
+    const std::string &get_code() const { return code_; }
+    double get_elapsed_time() const { return elapsed_time_; }
+    double get_target_time() const { return target_time_; }
+    double get_time_left() const { return target_time_ - elapsed_time_; }
+    void set_target_time(double seconds) {
+        if (seconds <= 0) {
+            throw std::invalid_argument("Mixing time must be positive");
+        }
+        target_time_ = seconds;
+    }
+    double update_mixing_progress(double elapsed_seconds) {
+        if (is_on_) {
+            elapsed_time_ += elapsed_seconds;
+            if (elapsed_time_ >= target_time_) {
+                elapsed_time_ = target_time_;
+                stop();
+            }
+        }
+        return get_time_left();
+    }
+};
+
+class MixerTank {
+  private:
+    LevelTransmitter level_transmitter_;
+    LowLevelSwitch low_level_switch_;
+    MixerMotor mixer_motor_;
+    double current_capacity_;
+    double max_capacity_;
+    std::string code_;
+    // Emptying timer variables
+    bool emptying_active_;
+    double emptying_elapsed_time_;
+    double emptying_rate_percent_per_second_;
+
+    void update_low_level_switch() {
+        double level_percent = (current_capacity_ / max_capacity_) * 100.0;
+        if (level_percent < 10.0) { // 10% threshold for alarm
+            low_level_switch_.set_status(SystemConstants::ALARM_STATUS);
+        } else {
+            low_level_switch_.set_status(SystemConstants::NORMAL_STATUS);
+        }
+    }
+
+  public:
+    MixerTank(const std::string &code,
+              const std::string &level_transmitter_code,
+              double max_capacity = SystemConstants::MIXER_TANK_CAPACITY,
+              double initial_capacity = 0.0)
+        : level_transmitter_(level_transmitter_code),
+          low_level_switch_(code, SystemConstants::ALARM_STATUS),
+          mixer_motor_(code), current_capacity_(initial_capacity),
+          max_capacity_(max_capacity), code_(code),
+          emptying_active_(false), emptying_elapsed_time_(0.0),
+          emptying_rate_percent_per_second_(4.0) {
+        if (code.empty()) {
+            throw std::invalid_argument("MixerTank code cannot be empty");
+        }
+        if (max_capacity <= 0) {
+            throw std::invalid_argument(
+                "MixerTank max capacity must be positive");
+        }
+        if (initial_capacity < 0 || initial_capacity > max_capacity) {
+            throw std::invalid_argument(
+                "MixerTank initial capacity must be between 0 and max "
+                "capacity");
+        }
+    }
+
+    const std::string &get_code() const { return code_; }
+    const LevelTransmitter &get_level_transmitter() const {
+        return level_transmitter_;
+    }
+    const LowLevelSwitch &get_low_level_switch() const {
+        return low_level_switch_;
+    }
+    const MixerMotor &get_mixer_motor() const { return mixer_motor_; }
+    double get_current_capacity() const { return current_capacity_; }
+    double get_max_capacity() const { return max_capacity_; }
+    double get_level() const {
+        return level_transmitter_.read_level(
+            const_cast<double &>(current_capacity_),
+            const_cast<double &>(max_capacity_));
+    }
+
+    void add_liquid(double liters) {
+        current_capacity_ += liters;
+        if (current_capacity_ > max_capacity_) {
+            current_capacity_ = max_capacity_;
+        }
+        update_low_level_switch();
+    }
+
+    void start_emptying() {
+        emptying_active_ = true;
+        emptying_elapsed_time_ = 0.0;
+    }
+
+    void stop_emptying() {
+        emptying_active_ = false;
+        emptying_elapsed_time_ = 0.0;
+    }
+
+    bool is_emptying() const {
+        return emptying_active_;
+    }
+
+    double get_emptying_elapsed_time() const {
+        return emptying_elapsed_time_;
+    }
+
+    double get_emptying_rate_liters_per_second() const {
+        return max_capacity_ * emptying_rate_percent_per_second_ / 100.0;
+    }
+
+    double get_emptying_rate_percent_per_second() const {
+        return emptying_rate_percent_per_second_;
+    }
+
+    void set_emptying_rate_percent_per_second(double percent) {
+        if (percent <= 0) {
+            throw std::invalid_argument("Emptying rate must be positive");
+        }
+        emptying_rate_percent_per_second_ = percent;
+    }
+
+    // room_liters is what the receiving tank can take this step; the
+    // discharge is held back to it
+    double update_emptying_progress(
+        double elapsed_seconds,
+        double room_liters = HUGE_VAL) {
+        if (!emptying_active_ || current_capacity_ <= 0) {
+            if (current_capacity_ <= 0) {
+                stop_emptying();
+            }
+            return 0.0;
+        }
+        
+        emptying_elapsed_time_ += elapsed_seconds;
+        
+        double amount_to_drain = (max_capacity_ * emptying_rate_percent_per_second_ / 100.0) * elapsed_seconds;
+        if (amount_to_drain > room_liters) {
+            amount_to_drain = room_liters > 0.0 ? room_liters : 0.0;
+        }
+        double actually_drained;
+        
+        if (current_capacity_ >= amount_to_drain) {
+            actually_drained = amount_to_drain;
+            current_capacity_ -= amount_to_drain;
+        } else {
+            actually_drained = current_capacity_;
+            current_capacity_ = 0.0;
+            stop_emptying(); // Automatically stop when empty
+        }
+        
+        update_low_level_switch();
+        return actually_drained;
+    }
+
+    double empty_tank(double empty_rate_percent_per_second = 4.0) {
+        if (current_capacity_ <= 0) {
+            return 0.0;
+        }
+        
+        double amount_to_drain = (max_capacity_ * empty_rate_percent_per_second / 100.0);
+        double actually_drained;
+        
+        if (current_capacity_ >= amount_to_drain) {
+            actually_drained = amount_to_drain;
+            current_capacity_ -= amount_to_drain;
+        } else {
+            actually_drained = current_capacity_;
+            current_capacity_ = 0.0;
+        }
+        
+        update_low_level_switch();
+        return actually_drained;
+    }
+
+    bool is_empty() const {
+        return current_capacity_ <= 0.0;
+    }
+
+    void reset_emptying() {
+        emptying_active_ = false;
+        emptying_elapsed_time_ = 0.0;
+    }
+
+    LowLevelSwitch &get_low_level_switch_mutable() { return low_level_switch_; }
+    MixerMotor &get_mixer_motor_mutable() { return mixer_motor_; }
+};
+
+// Finished paint of one colour waiting between the mixer and the filler
+class ProductBufferTank {
+  private:
+    std::string code_;
+    std::string color_;
+    double capacity_;
+    double current_liters_;
+
+  public:
+    ProductBufferTank(const std::string &code, const std::string &color,
+                      double capacity)
+        : code_(code), color_(color), capacity_(capacity),
+          current_liters_(0.0) {
+        if (code.empty() || color.empty()) {
+            throw std::invalid_argument(
+                "ProductBufferTank code and colour cannot be empty");
+        }
+        if (capacity <= 0) {
+            throw std::invalid_argument(
+                "ProductBufferTank capacity must be positive");
+        }
+    }
+
+    const std::string &get_code() const { return code_; }
+    const std::string &get_color() const { return color_; }
+    double get_capacity() const { return capacity_; }
+    double get_current_liters() const { return current_liters_; }
+    double get_free_space() const { return capacity_ - current_liters_; }
+    double get_level() const { return current_liters_ / capacity_ * 100.0; }
+    bool is_full() const { return current_liters_ >= capacity_; }
+
+    // Product already held above the new capacity stays in the tank
+    void set_capacity(double capacity) {
+        if (capacity <= 0) {
+            throw std::invalid_argument(
+                "ProductBufferTank capacity must be positive");
+        }
+        capacity_ = capacity;
+    }
+
+    // Returns the liters that fit
+    double fill(double liters) {
+        double room = get_free_space() > 0.0 ? get_free_space() : 0.0;
+        double accepted = liters < room ? liters : room;
+        current_liters_ += accepted;
+        return accepted;
+    }
+
+    double draw(double liters) {
+        double drawn = liters < current_liters_ ? liters : current_liters_;
+        current_liters_ -= drawn;
+        return drawn;
+    }
+};
+
+// Buffer tanks of a filling line, in the plant's arena when it has one
+typedef std::vector<ProductBufferTank, ArenaAllocator<ProductBufferTank> >
+    ProductBufferList;
+
+enum FillerState { FILLER_STARVED, FILLER_FILLING, FILLER_CHANGEOVER };
+const int FILLER_STATE_COUNT = FILLER_CHANGEOVER + 1;
+
+// Can filler fed by the buffer tanks. It fills whole cans of one colour at a
+// fixed rate, taking a can's worth from the buffer as each can starts, and
+// stays on its colour while that buffer holds a can. Switching to another
+// colour stops it for that colour's changeover (cleaning) time.
+class CanFiller {
+  private:
+    std::string code_;
+    double cans_per_minute_;
+    double can_liters_;
+    double default_changeover_seconds_;
+    // Overrides, by new colour
+    std::map<std::string, double> changeover_seconds_;
+    FillerState state_;
+    // Colour set up on the machine, empty until the first can
+    std::string color_;
+    double changeover_left_;
+    double can_left_seconds_; // Of the can being filled
+    unsigned long cans_filled_;
+    unsigned long changeovers_;
+    double state_seconds_[FILLER_STATE_COUNT];
+
+    // Buffer with the most product among those holding at least one can
+    ProductBufferTank *pick_source(ProductBufferList &buffers) {
+        ProductBufferTank *best = NULL;
+        for (size_t i = 0; i < buffers.size(); ++i) {
+            if (buffers[i].get_current_liters() >= can_liters_ &&
+                (best == NULL || buffers[i].get_current_liters() >
+                                     best->get_current_liters())) {
+                best = &buffers[i];
+            }
+        }
+        return best;
+    }
+
+    ProductBufferTank *find_buffer(ProductBufferList &buffers,
+                                   const std::string &color) {
+        for (size_t i = 0; i < buffers.size(); ++i) {
+            if (buffers[i].get_color() == color) {
+                return &buffers[i];
+            }
+        }
+        return NULL;
+    }
+
+  public:
+    CanFiller(const std::string &code, double cans_per_minute,
+              double can_liters, double changeover_seconds)
+        : code_(code), cans_per_minute_(cans_per_minute),
+          can_liters_(can_liters),
+          default_changeover_seconds_(changeover_seconds),
+          state_(FILLER_STARVED), changeover_left_(0.0),
+          can_left_seconds_(0.0), cans_filled_(0), changeovers_(0) {
+        if (code.empty()) {
+            throw std::invalid_argument("CanFiller code cannot be empty");
+        }
+        if (cans_per_minute <= 0 || can_liters <= 0) {
+            throw std::invalid_argument(
+                "CanFiller rate and can size must be positive");
+        }
+        if (changeover_seconds < 0) {
+            throw std::invalid_argument(
+                "CanFiller changeover time cannot be negative");
+        }
+        for (int i = 0; i < FILLER_STATE_COUNT; ++i) {
+            state_seconds_[i] = 0.0;
+        }
+    }
+
+    const std::string &get_code() const { return code_; }
+    FillerState get_state() const { return state_; }
+    const std::string &get_color() const { return color_; }
+    double get_cans_per_minute() const { return cans_per_minute_; }
+    double get_can_liters() const { return can_liters_; }
+    double get_liters_per_second() const {
+        return cans_per_minute_ * can_liters_ / 60.0;
+    }
+    double get_changeover_left() const { return changeover_left_; }
+    unsigned long get_cans_filled() const { return cans_filled_; }
+    unsigned long get_changeovers() const { return changeovers_; }
+    double get_seconds_in_state(FillerState state) const {
+        return state_seconds_[state];
+    }
+
+    double get_changeover_seconds(const std::string &color) const {
+        std::map<std::string, double>::const_iterator it =
+            changeover_seconds_.find(color);
+        return it != changeover_seconds_.end() ? it->second
+                                                : default_changeover_seconds_;
+    }
+
+    // Takes effect from the next can
+    void set_cans_per_minute(double cans_per_minute) {
+        if (cans_per_minute <= 0) {
+            throw std::invalid_argument("CanFiller rate must be positive");
+        }
+        cans_per_minute_ = cans_per_minute;
+    }
+
+    void set_changeover_seconds(double seconds) {
+        if (seconds < 0) {
+            throw std::invalid_argument(
+                "CanFiller changeover time cannot be negative");
+        }
+        default_changeover_seconds_ = seconds;
+        changeover_seconds_.clear();
+    }
+
+    void set_changeover_seconds(const std::string &color, double seconds) {
+        if (seconds < 0) {
+            throw std::invalid_argument(
+                "CanFiller changeover time cannot be negative");
+        }
+        changeover_seconds_[color] = seconds;
+    }
+
+    void update(double seconds, ProductBufferList &buffers) {
+        double remaining = seconds;
+        while (remaining > 0.0) {
+            if (changeover_left_ > 0.0) {
+                state_ = FILLER_CHANGEOVER;
+                double used =
+                    remaining < changeover_left_ ? remaining : changeover_left_;
+                changeover_left_ -= used;
+                state_seconds_[FILLER_CHANGEOVER] += used;
+                remaining -= used;
+                continue;
+            }
+            if (can_left_seconds_ > 0.0) {
+                state_ = FILLER_FILLING;
+                double used = remaining < can_left_seconds_ ? remaining
+                                                            : can_left_seconds_;
+                can_left_seconds_ -= used;
+                state_seconds_[FILLER_FILLING] += used;
+                remaining -= used;
+                if (can_left_seconds_ <= 0.0) {
+                    ++cans_filled_;
+                }
+                continue;
+            }
+            // Between cans: keep the colour while its buffer holds a can
+            ProductBufferTank *source = find_buffer(buffers, color_);
+            if (source == NULL || source->get_current_liters() < can_liters_) {
+                source = pick_source(buffers);
+                if (source == NULL) {
+                    state_ = FILLER_STARVED;
+                    state_seconds_[FILLER_STARVED] += remaining;
+                    return;
+                }
+                bool first_color = color_.empty();
+                color_ = source->get_color();
+                if (!first_color) {
+                    ++changeovers_;
+                    changeover_left_ = get_changeover_seconds(color_);
+                    continue;
+                }
+            }
+            source->draw(can_liters_);
+            can_left_seconds_ = 60.0 / cans_per_minute_;
+        }
+    }
+};
+
+// Downstream of M401: one buffer tank per colour and the can filler
+class FillingLine {
+  private:
+    ProductBufferList buffers_;
+    CanFiller filler_;
+
+    static FillingLine build_standard() {
+        FillingLine line(CanFiller("L601",
+                                   SystemConstants::FILLER_CANS_PER_MINUTE,
+                                   SystemConstants::FILLER_CAN_LITERS,
+                                   SystemConstants::FILLER_CHANGEOVER_SECONDS));
+        const std::map<std::string, std::map<std::string, double> > &recipes =
+            SystemConstants::COLOR_RECIPES;
+        int number = 501;
+        for (std::map<std::string,
+                      std::map<std::string, double> >::const_iterator it =
+                 recipes.begin();
+             it != recipes.end(); ++it, ++number) {
+            std::ostringstream code;
+            code << "T" << number;
+            line.add_buffer(ProductBufferTank(
+                code.str(), it->first,
+                SystemConstants::PRODUCT_BUFFER_CAPACITY));
+        }
+        return line;
+    }
+
+  public:
+    explicit FillingLine(const CanFiller &filler) : filler_(filler) {}
+
+    // Copy whose buffer tanks live in arena (the heap when NULL)
+    FillingLine(const FillingLine &other, SimulationArena *arena)
+        : buffers_(other.buffers_.begin(), other.buffers_.end(),
+                   ArenaAllocator<ProductBufferTank>(arena)),
+          filler_(other.filler_) {}
+
+    // T501.. for every colour with a recipe, feeding filler L601. Built
+    // once: every plant starts from a copy.
+    static const FillingLine &standard() {
+        static const FillingLine line = build_standard();
+        return line;
+    }
+
+    void add_buffer(const ProductBufferTank &buffer) {
+        if (find_buffer(buffer.get_color()) != NULL) {
+            throw std::invalid_argument("A buffer tank already holds " +
+                                        buffer.get_color());
+        }
+        buffers_.push_back(buffer);
+    }
+
+    // NULL when no buffer takes the colour
+    ProductBufferTank *find_buffer(const std::string &color) {
+        for (size_t i = 0; i < buffers_.size(); ++i) {
+            if (buffers_[i].get_color() == color) {
+                return &buffers_[i];
+            }
+        }
+        return NULL;
+    }
+
+    const ProductBufferList &get_buffers() const { return buffers_; }
+    const CanFiller &get_filler() const { return filler_; }
+    CanFiller &get_filler_mutable() { return filler_; }
+
+    void set_buffer_capacity(double liters) {
+        for (size_t i = 0; i < buffers_.size(); ++i) {
+            buffers_[i].set_capacity(liters);
+        }
+    }
+
+    void update(double seconds) { filler_.update(seconds, buffers_); }
+};
+
+enum BatchPhase { BATCH_IDLE, BATCH_PUMPING, BATCH_MIXING, BATCH_EMPTYING };
+
+// Conditions a suspended batch procedure can wait on. The plant raises them
+// from its own update paths, so waiting procedures are never polled.
+enum BatchEvent {
+    BATCH_EVENT_NONE,
+    BATCH_EVENT_PUMPS_COMPLETED,
+    BATCH_EVENT_MIXING_DONE,
+    BATCH_EVENT_MIXER_EMPTY
+};
+
+typedef std::map<std::string, PumpLine, std::less<std::string>,
+            ArenaAllocator<std::pair<const std::string, PumpLine> > >
+    PumpLineMap;
+
+// Persistent workers for a plant's tick. run() splits [0, count) into
+// contiguous chunks, one per worker plus the calling thread, and returns
+// when every chunk is done. Workers spin briefly before blocking, since
+// ticks follow each other closely. One plant at a time may use a pool.
+class TickWorkerPool {
+  public:
+    class Task {
+      public:
+        virtual ~Task() {}
+        virtual void run_range(size_t begin, size_t end) = 0;
+    };
+
+  private:
+    static const int SPIN_LIMIT = 4000;
+
+    std::vector<std::thread> workers_;
+    std::mutex mutex_;
+    std::condition_variable start_;
+    std::condition_variable done_;
+    Task *task_;
+    size_t count_;
+    std::atomic<unsigned long> generation_;
+    std::atomic<size_t> pending_;
+    std::atomic<bool> stopping_;
+
+    void run_chunk(size_t chunk) {
+        size_t chunks = workers_.size() + 1;
+        task_->run_range(count_ * chunk / chunks,
+                         count_ * (chunk + 1) / chunks);
+    }
+
+    void worker_loop(size_t chunk) {
+        unsigned long seen = 0;
+        while (true) {
+            int spins = 0;
+            while (generation_.load(std::memory_order_acquire) == seen &&
+                   !stopping_.load(std::memory_order_acquire)) {
+                if (++spins < SPIN_LIMIT) {
+                    std::this_thread::yield();
+                    continue;
+                }
+                std::unique_lock<std::mutex> lock(mutex_);
+                start_.wait(lock, [this, seen] {
+                    return generation_.load(std::memory_order_acquire) !=
+                               seen ||
+                           stopping_.load(std::memory_order_acquire);
+                });
+            }
+            if (stopping_.load(std::memory_order_acquire)) {
+                return;
+            }
+            seen = generation_.load(std::memory_order_acquire);
+            run_chunk(chunk);
+            if (pending_.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+                std::lock_guard<std::mutex> lock(mutex_);
+                done_.notify_one();
+            }
+        }
+    }
+
+    // Disable copying: the workers are bound to this instance
+    TickWorkerPool(const TickWorkerPool &);
+    TickWorkerPool &operator=(const TickWorkerPool &);
+
+  public:
+    // thread_count includes the caller of run()
+    explicit TickWorkerPool(size_t thread_count)
+        : task_(NULL), count_(0), generation_(0), pending_(0),
+          stopping_(false) {
+        if (thread_count == 0) {
+            throw std::invalid_argument(
+                "TickWorkerPool needs at least one thread");
+        }
+        for (size_t i = 1; i < thread_count; ++i) {
+            workers_.push_back(
+                std::thread(&TickWorkerPool::worker_loop, this, i));
+        }
+    }
+
+    ~TickWorkerPool() {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            stopping_.store(true, std::memory_order_release);
+        }
+        start_.notify_all();
+        for (size_t i = 0; i < workers_.size(); ++i) {
+            workers_[i].join();
+        }
+    }
+
+    size_t get_thread_count() const { return workers_.size() + 1; }
+
+    void run(Task &task, size_t count) {
+        task_ = &task;
+        count_ = count;
+        if (workers_.empty()) {
+            run_chunk(0);
+            return;
+        }
+        pending_.store(workers_.size(), std::memory_order_relaxed);
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            generation_.fetch_add(1, std::memory_order_release);
+        }
+        start_.notify_all();
+        run_chunk(0);
+
+        int spins = 0;
+        while (pending_.load(std::memory_order_acquire) != 0) {
+            if (++spins < SPIN_LIMIT) {
+                std::this_thread::yield();
+                continue;
+            }
+            std::unique_lock<std::mutex> lock(mutex_);
+            done_.wait(lock, [this] {
+                return pending_.load(std::memory_order_acquire) == 0;
+            });
+        }
+    }
+};
+
+// Lines whose next update can change something. A line goes to sleep after
+// an update that left it exactly as it was with its pump off: with the same
+// valves, target and drive mode every later update would do the same, so
+// the plant wakes it only when one of those changes. Positions follow the
+// map order the observers see as line_index.
+class LineActivitySet {
+  private:
+    std::vector<PumpLine *> lines_; // By map position
+    std::vector<char> awake_;
+    std::vector<char> sleeper_blocks_mixing_;
+    std::vector<size_t> active_; // Awake positions, ascending
+    std::vector<size_t> woken_;  // Woken since active_ was last merged
+    size_t blocking_sleepers_;
+
+  public:
+    LineActivitySet() : blocking_sleepers_(0) {}
+
+    // Copies start unindexed: the pointers belong to the other plant's map
+    LineActivitySet(const LineActivitySet &) : blocking_sleepers_(0) {}
+    LineActivitySet &operator=(const LineActivitySet &) {
+        lines_.clear();
+        awake_.clear();
+        sleeper_blocks_mixing_.clear();
+        active_.clear();
+        woken_.clear();
+        blocking_sleepers_ = 0;
+        return *this;
+    }
+
+    bool is_indexed(size_t line_count) const {
+        return lines_.size() == line_count;
+    }
+
+    // Every line starts awake
+    void index(PumpLineMap &pump_lines) {
+        *this = LineActivitySet();
+        for (PumpLineMap::iterator it = pump_lines.begin();
+             it != pump_lines.end(); ++it) {
+            active_.push_back(lines_.size());
+            lines_.push_back(&it->second);
+        }
+        awake_.assign(lines_.size(), 1);
+        sleeper_blocks_mixing_.assign(lines_.size(), 0);
+    }
+
+    PumpLine &get_line(size_t position) { return *lines_[position]; }
+
+    void wake(size_t position) {
+        if (awake_[position]) {
+            return;
+        }
+        awake_[position] = 1;
+        if (sleeper_blocks_mixing_[position]) {
+            sleeper_blocks_mixing_[position] = 0;
+            --blocking_sleepers_;
+        }
+        woken_.push_back(position);
+    }
+
+    void wake_all() {
+        for (size_t i = 0; i < lines_.size(); ++i) {
+            wake(i);
+        }
+    }
+
+    // Takes effect when the active list is next compacted. A sleeping line
+    // that holds mixing back keeps doing so until it wakes.
+    void sleep(size_t position, bool blocks_mixing) {
+        awake_[position] = 0;
+        sleeper_blocks_mixing_[position] = blocks_mixing ? 1 : 0;
+        if (blocks_mixing) {
+            ++blocking_sleepers_;
+        }
+    }
+
+    // Drops lines put to sleep and merges the woken ones in position order
+    const std::vector<size_t> &get_active() {
+        size_t kept = 0;
+        for (size_t i = 0; i < active_.size(); ++i) {
+            if (awake_[active_[i]]) {
+                active_[kept++] = active_[i];
+            }
+        }
+        active_.resize(kept);
+        if (!woken_.empty()) {
+            std::sort(woken_.begin(), woken_.end());
+            size_t middle = active_.size();
+            active_.insert(active_.end(), woken_.begin(), woken_.end());
+            std::inplace_merge(active_.begin(), active_.begin() + middle,
+                               active_.end());
+            // A line put to sleep and woken before compaction is in both
+            active_.erase(std::unique(active_.begin(), active_.end()),
+                               active_.end());
+            woken_.clear();
+        }
+        return active_;
+    }
+
+    size_t get_blocking_sleepers() const { return blocking_sleepers_; }
+};
+
+class BatchEventSink {
+  public:
+    virtual ~BatchEventSink() {}
+    virtual void on_batch_event(size_t procedure_id, BatchEvent event) = 0;
+};
+
+// The stages of one Factory::step, in the order they run
+enum ScanPhase {
+    SCAN_PHASE_PUMP_LINES,
+    SCAN_PHASE_MIX,
+    SCAN_PHASE_EMPTYING,
+    SCAN_PHASE_FILLING
+};
+
+// Brackets each stage of a tick, e.g. for a profiler. Called on the stepping
+// thread; a stage skipped this tick (pump lines outside the pumping phase)
+// is not reported.
+class ScanPhaseSink {
+  public:
+    virtual ~ScanPhaseSink() {}
+    virtual void on_phase_begin(ScanPhase phase) = 0;
+    virtual void on_phase_end(ScanPhase phase) = 0;
+};
+
+// Receives plant transitions as they happen. Callbacks run on the control
+// thread, once per transition, with the plant's simulated time in seconds.
+// line_index is the line's position in get_all_pump_lines() order.
+class PlantObserver {
+  public:
+    virtual ~PlantObserver() {}
+    virtual void on_pump_state_changed(size_t /*line_index*/,
+                                       const PumpLine & /*pump_line*/,
+                                       PumpState /*previous_state*/,
+                                       double /*sim_time*/) {}
+    virtual void on_batch_phase_changed(BatchPhase /*previous_phase*/,
+                                        BatchPhase /*new_phase*/,
+                                        double /*sim_time*/) {}
+    virtual void on_flow_switch_changed(size_t /*line_index*/,
+                                        const PumpLine & /*pump_line*/,
+                                        double /*sim_time*/) {}
+    virtual void on_low_level_switch_changed(const LowLevelSwitch & /*sw*/,
+                                             double /*sim_time*/) {}
+    // delivered_liters is less than requested when the base tank runs low
+    virtual void on_liquid_transferred(size_t /*line_index*/,
+                                       const PumpLine & /*pump_line*/,
+                                       double /*requested_liters*/,
+                                       double /*delivered_liters*/,
+                                       double /*sim_time*/) {}
+    virtual void on_filler_state_changed(const CanFiller & /*filler*/,
+                                         FillerState /*previous_state*/,
+                                         double /*sim_time*/) {}
+    // The line now feeds from pump_line.get_tank()
+    virtual void on_source_tank_switched(size_t /*line_index*/,
+                                         const PumpLine & /*pump_line*/,
+                                         double /*sim_time*/) {}
+    virtual void on_base_refilled(size_t /*line_index*/,
+                                  const PumpLine & /*pump_line*/,
+                                  double /*liters*/, double /*sim_time*/) {}
+    // The line's pressure or speed moved during a scan
+    virtual void on_line_readings_changed(size_t /*line_index*/,
+                                          const PumpLine & /*pump_line*/,
+                                          double /*sim_time*/) {}
+    // A valve, target or drive setting was handed to the line, possibly
+    // just before the caller changes it, so read the line later. With the
+    // callbacks above this covers everything a line can do.
+    virtual void on_line_setpoint_changed(size_t /*line_index*/,
+                                          const PumpLine & /*pump_line*/,
+                                          double /*sim_time*/) {}
+};
+
+// Base ordered for a line, due at arrival_time (simulated seconds)
+struct BaseRefill {
+    std::string pump_code;
+    double liters;
+    double arrival_time;
+};
+
+class Factory {
+  private:
+    // What one line did this tick. Lines are updated and drained on their
+    // own, possibly on a worker; notifications and the mixer additions are
+    // then replayed in position order, so the result is the same whether
+    // the tick ran on one thread or many.
+    struct LineTickResult {
+        PumpState previous_state;
+        bool flow_changed;
+        bool state_changed;
+        bool readings_changed; // Pressure or speed
+        bool settled;
+        bool transferred;
+        bool source_switched;
+        double requested_liters;
+        double drained_liters;
+    };
+
+    PumpLineMap pump_lines_;
+    BatchPhase batch_phase_;
+    MixerTank mixer_tank_;
+    // Procedure driving the current batch; the plant only signals it
+    BatchEventSink *batch_event_sink_;
+    size_t batch_procedure_id_;
+    std::vector<PlantObserver *> observers_;
+    double sim_time_seconds_;
+    std::string batch_color_;
+    double batch_size_liters_; // Volume of every lot
+    LineActivitySet activity_;
+    bool line_sleeping_; // See set_line_sleeping()
+    // Optional workers for large plants; not owned, and not copied by fork()
+    TickWorkerPool *worker_pool_;
+    std::vector<LineTickResult> tick_results_; // By active position
+    ScanPhaseSink *phase_sink_; // Not owned, and not copied by fork()
+    FillingLine filling_line_;
+    std::vector<BaseRefill> pending_refills_; // In order of arrival
+    // Emptying time lost to a full buffer tank
+    double discharge_blocked_seconds_;
+    bool discharge_blocked_; // During the last step
+    // Lines with a target for the lot, and those that reached it; counted
+    // when targets are set and kept up by the pump state changes
+    size_t required_lines_;
+    size_t completed_lines_;
+
+    // Factory::step with each stage reported to phase_sink_
+    void traced_step(double seconds) {
+        if (batch_phase_ == BATCH_PUMPING) {
+            phase_sink_->on_phase_begin(SCAN_PHASE_PUMP_LINES);
+            update_all_pump_lines(seconds);
+            phase_sink_->on_phase_end(SCAN_PHASE_PUMP_LINES);
+        }
+        phase_sink_->on_phase_begin(SCAN_PHASE_MIX);
+        update_mix(seconds);
+        phase_sink_->on_phase_end(SCAN_PHASE_MIX);
+        phase_sink_->on_phase_begin(SCAN_PHASE_EMPTYING);
+        update_emptying(seconds);
+        phase_sink_->on_phase_end(SCAN_PHASE_EMPTYING);
+        phase_sink_->on_phase_begin(SCAN_PHASE_FILLING);
+        update_filling(seconds);
+        phase_sink_->on_phase_end(SCAN_PHASE_FILLING);
+        deliver_due_refills();
+        advance_clock(seconds);
+    }
+
+    // Indexed on first use, so copies and added lines re-index themselves
+    LineActivitySet &line_activity() {
+        if (!activity_.is_indexed(pump_lines_.size())) {
+            activity_.index(pump_lines_);
+        }
+        return activity_;
+    }
+
+    // Sets a valve and wakes its line only when the position changes
+    void set_line_valve(const std::string &pump_code, bool exit_valve,
+                        bool open) {
+        PumpLineMap::iterator it = pump_lines_.find(pump_code);
+        if (it == pump_lines_.end()) {
+            throw std::runtime_error("Pump line not found: " + pump_code);
+        }
+        Valve &valve = exit_valve ? it->second.get_exit_valve_mutable()
+                                  : it->second.get_enter_valve_mutable();
+        if (valve.is_open() == open) {
+            return;
+        }
+        valve.set_open(open);
+        wake_changed_line(std::distance(pump_lines_.begin(), it));
+    }
+
+    // can_start_mixing() that visits only the awake lines; sleeping ones
+    // were counted when they went to sleep
+    bool active_lines_allow_mixing() {
+        LineActivitySet &activity = line_activity();
+        if (activity.get_blocking_sleepers() > 0) {
+            return false;
+        }
+        const std::vector<size_t> &active = activity.get_active();
+        for (size_t i = 0; i < active.size(); ++i) {
+            if (!line_allows_mixing(activity.get_line(active[i]))) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    static void update_line(PumpLine &pump_line, double seconds,
+                            LineTickResult &result) {
+        result.previous_state = pump_line.get_pump().get_state();
+        bool flow_was_alarm = pump_line.get_flow_switch().is_alarm();
+        double previous_pressure =
+            pump_line.get_pressure_transmitter().read_pressure();
+        double previous_speed = pump_line.get_pump().get_speed_percent();
+        pump_line.update_system_state(seconds);
+        result.flow_changed =
+            pump_line.get_flow_switch().is_alarm() != flow_was_alarm;
+        result.state_changed =
+            pump_line.get_pump().get_state() != result.previous_state;
+        result.readings_changed =
+            pump_line.get_pressure_transmitter().read_pressure() !=
+                previous_pressure ||
+            pump_line.get_pump().get_speed_percent() != previous_speed;
+        result.settled = !pump_line.get_pump().is_on() &&
+                         !result.flow_changed && !result.state_changed &&
+                         !result.readings_changed;
+    }
+
+    void finish_line_update(size_t line_index, const PumpLine &pump_line,
+                            const LineTickResult &result) {
+        if (result.flow_changed) {
+            for (size_t i = 0; i < observers_.size(); ++i) {
+                observers_[i]->on_flow_switch_changed(line_index, pump_line,
+                                                      sim_time_seconds_);
+            }
+        }
+        if (result.state_changed) {
+            notify_pump_state_changed(line_index, pump_line,
+                                      result.previous_state);
+        }
+        if (result.readings_changed) {
+            for (size_t i = 0; i < observers_.size(); ++i) {
+                observers_[i]->on_line_readings_changed(line_index, pump_line,
+                                                        sim_time_seconds_);
+            }
+        }
+        if (result.settled && line_sleeping_) {
+            activity_.sleep(line_index, !line_allows_mixing(pump_line));
+        }
+    }
+
+    // The line's side of a transfer: its totaliser and its tank. The
+    // totaliser counts what the pump moved, so a dry tank leaves the lot
+    // short rather than pumping forever.
+    static void drain_line(PumpLine &pump_line, double seconds,
+                           LineTickResult &result) {
+        LiquidPump& pump = pump_line.get_pump_mutable();
+        result.transferred = false;
+        // Check pump state AND valve states for actual liquid transfer
+        if (pump.is_on() &&
+            pump_line.get_enter_valve().is_open() && // Check inlet valve
+            pump_line.get_exit_valve().is_open() &&  // Check outlet valve
+            !pump.is_target_reached()) {
+            double liters_this_cycle = pump.meter_dose(seconds) / 1000.0;
+            double drained =
+                pump_line.draw_base(liters_this_cycle, result.source_switched);
+            result.transferred = true;
+            result.requested_liters = liters_this_cycle;
+            result.drained_liters = drained;
+        }
+    }
+
+    class UpdateLinesTask : public TickWorkerPool::Task {
+      private:
+        Factory &factory_;
+        const std::vector<size_t> &active_;
+        double seconds_;
+
+      public:
+        UpdateLinesTask(Factory &factory, const std::vector<size_t> &active,
+                        double seconds)
+            : factory_(factory), active_(active), seconds_(seconds) {}
+
+        void run_range(size_t begin, size_t end) {
+            for (size_t i = begin; i < end; ++i) {
+                update_line(factory_.activity_.get_line(active_[i]), seconds_,
+                            factory_.tick_results_[i]);
+            }
+        }
+    };
+
+    class DrainLinesTask : public TickWorkerPool::Task {
+      private:
+        Factory &factory_;
+        const std::vector<size_t> &active_;
+        double seconds_;
+
+      public:
+        DrainLinesTask(Factory &factory, const std::vector<size_t> &active,
+                       double seconds)
+            : factory_(factory), active_(active), seconds_(seconds) {}
+
+        void run_range(size_t begin, size_t end) {
+            for (size_t i = begin; i < end; ++i) {
+                drain_line(factory_.activity_.get_line(active_[i]), seconds_,
+                           factory_.tick_results_[i]);
+            }
+        }
+    };
+
+    // Also sizes the per-line results for this pass
+    bool use_worker_pool(size_t active_lines) {
+        if (tick_results_.size() < active_lines) {
+            tick_results_.resize(active_lines);
+        }
+        return worker_pool_ != NULL && worker_pool_->get_thread_count() > 1 &&
+               active_lines >= SystemConstants::PARALLEL_TICK_MIN_LINES;
+    }
+
+    void set_batch_phase(BatchPhase new_phase) {
+        BatchPhase previous_phase = batch_phase_;
+        batch_phase_ = new_phase;
+        if (previous_phase == new_phase) {
+            return;
+        }
+        for (size_t i = 0; i < observers_.size(); ++i) {
+            observers_[i]->on_batch_phase_changed(previous_phase, new_phase,
+                                                  sim_time_seconds_);
+        }
+    }
+
+    void notify_if_low_level_changed(bool was_alarm) {
+        const LowLevelSwitch &low_level = mixer_tank_.get_low_level_switch();
+        if (low_level.is_alarm() == was_alarm) {
+            return;
+        }
+        for (size_t i = 0; i < observers_.size(); ++i) {
+            observers_[i]->on_low_level_switch_changed(low_level,
+                                                       sim_time_seconds_);
+        }
+    }
+
+    void count_required_lines() {
+        required_lines_ = 0;
+        completed_lines_ = 0;
+        for (PumpLineMap::const_iterator it = pump_lines_.begin();
+             it != pump_lines_.end(); ++it) {
+            const LiquidPump &pump = it->second.get_pump();
+            if (pump.has_target()) {
+                ++required_lines_;
+                if (pump.get_state() == STOPPED_TARGET_REACHED) {
+                    ++completed_lines_;
+                }
+            }
+        }
+    }
+
+    // A setpoint of the line is changing: it is stepped again and the
+    // observers are told
+    void wake_changed_line(size_t line_index) {
+        LineActivitySet &activity = line_activity();
+        activity.wake(line_index);
+        for (size_t i = 0; i < observers_.size(); ++i) {
+            observers_[i]->on_line_setpoint_changed(
+                line_index, activity.get_line(line_index), sim_time_seconds_);
+        }
+    }
+
+    void wake_all_changed_lines() {
+        for (size_t i = 0; i < pump_lines_.size(); ++i) {
+            wake_changed_line(i);
+        }
+    }
+
+    void notify_pump_state_changed(size_t line_index,
+                                   const PumpLine &pump_line,
+                                   PumpState previous_state) {
+        const LiquidPump &pump = pump_line.get_pump();
+        if (pump.has_target()) {
+            if (pump.get_state() == STOPPED_TARGET_REACHED) {
+                ++completed_lines_;
+            } else if (previous_state == STOPPED_TARGET_REACHED &&
+                       completed_lines_ > 0) {
+                --completed_lines_;
+            }
+        }
+        for (size_t i = 0; i < observers_.size(); ++i) {
+            observers_[i]->on_pump_state_changed(line_index, pump_line,
+                                                 previous_state,
+                                                 sim_time_seconds_);
+        }
+    }
+
+    void raise_batch_event(BatchEvent event) {
+        if (batch_event_sink_ != NULL) {
+            batch_event_sink_->on_batch_event(batch_procedure_id_, event);
+        }
+    }
+
+    void notify_if_pumps_completed() {
+        if (batch_phase_ == BATCH_PUMPING && active_lines_allow_mixing()) {
+            raise_batch_event(BATCH_EVENT_PUMPS_COMPLETED);
+        }
+    }
+
+    // Private constructors ensure controlled initialization. With an arena,
+    // the pump line map and the buffer tanks live in it and are released by
+    // the arena's reset().
+    explicit Factory(SimulationArena *arena)
+        : pump_lines_(std::less<std::string>(),
+                      ArenaAllocator<std::pair<const std::string, PumpLine> >(
+                          arena)),
+          batch_phase_(BATCH_IDLE),
+          mixer_tank_("M401",
+                      "LT401",
+                      SystemConstants::MIXER_TANK_CAPACITY,
+                      SystemConstants::INITIAL_MIXER_TANK_LEVEL),
+          batch_event_sink_(NULL), batch_procedure_id_(0),
+          sim_time_seconds_(0.0),
+          batch_size_liters_(SystemConstants::BATCH_SIZE),
+          line_sleeping_(true), worker_pool_(NULL), phase_sink_(NULL),
+          filling_line_(FillingLine::standard(), arena),
+          discharge_blocked_seconds_(0.0), discharge_blocked_(false),
+          required_lines_(0), completed_lines_(0) {}
+
+    explicit Factory(const std::vector<PumpLine> &pump_lines,
+                     SimulationArena *arena)
+        : pump_lines_(std::less<std::string>(),
+                      ArenaAllocator<std::pair<const std::string, PumpLine> >(
+                          arena)),
+          batch_phase_(BATCH_IDLE),
+          mixer_tank_("M401",
+                      "LT401",
+                      SystemConstants::MIXER_TANK_CAPACITY,
+                      SystemConstants::INITIAL_MIXER_TANK_LEVEL),
+          batch_event_sink_(NULL), batch_procedure_id_(0),
+          sim_time_seconds_(0.0),
+          batch_size_liters_(SystemConstants::BATCH_SIZE),
+          line_sleeping_(true), worker_pool_(NULL), phase_sink_(NULL),
+          filling_line_(FillingLine::standard(), arena),
+          discharge_blocked_seconds_(0.0), discharge_blocked_(false),
+          required_lines_(0), completed_lines_(0) {
+        if (pump_lines.empty()) {
+            throw std::runtime_error(
+                "Factory must have at least one pump line");
+        }
+        for (size_t i = 0; i < pump_lines.size(); ++i) {
+            add_pump_line(pump_lines[i]);
+        }
+    }
+
+    void add_pump_line(const PumpLine &line) {
+        pump_lines_.insert(std::make_pair(line.get_pump().get_code(), line));
+    }
+
+  public:
+    // Standard Dupont setup. Lines are built straight into the map, so with
+    // an arena construction takes nothing from the heap. Observers, the line
+    // activity index, reserve tanks and refill orders still use the heap
+    // once they are added or the plant first steps. Start-up is dominated
+    // by building the lines: --benchmark-arena measures about 1.0x.
+    static Factory create_dupont_paint_factory(SimulationArena *arena = NULL) {
+        Factory factory(arena);
+        factory.add_pump_line(
+            PumpLine::create_standard_paint_line("P201", "Blanco"));
+        factory.add_pump_line(
+            PumpLine::create_standard_paint_line("P202", "Azul"));
+        factory.add_pump_line(
+            PumpLine::create_standard_paint_line("P203", "Negro"));
+        return factory;
+    }
+
+    // Static factory method for custom configurations
+    static Factory
+    create_custom_factory(const std::vector<PumpLine> &pump_lines,
+                          SimulationArena *arena = NULL) {
+        return Factory(pump_lines, arena);
+    }
+
+    // Detached copy for look-ahead runs: the same plant state without
+    // observers or batch procedure, so stepping it affects nothing else
+    Factory fork(SimulationArena *arena = NULL) const {
+        Factory copy(arena);
+        copy.pump_lines_.insert(pump_lines_.begin(), pump_lines_.end());
+        copy.batch_phase_ = batch_phase_;
+        copy.mixer_tank_ = mixer_tank_;
+        copy.sim_time_seconds_ = sim_time_seconds_;
+        copy.batch_color_ = batch_color_;
+        copy.batch_size_liters_ = batch_size_liters_;
+        copy.line_sleeping_ = line_sleeping_;
+        copy.filling_line_ = filling_line_;
+        copy.pending_refills_ = pending_refills_;
+        copy.discharge_blocked_seconds_ = discharge_blocked_seconds_;
+        copy.discharge_blocked_ = discharge_blocked_;
+        copy.required_lines_ = required_lines_;
+        copy.completed_lines_ = completed_lines_;
+        return copy;
+    }
+
+    const MixerTank &get_mixer_tank() const { return mixer_tank_; }
+    MixerTank &get_mixer_tank_mutable() { return mixer_tank_; }
+
+    // Base for a line, delivered lead_seconds from now into its emptiest
+    // tanks; what does not fit is not delivered. Returns the order queued.
+    BaseRefill order_refill(const std::string &pump_code, double liters,
+                            double lead_seconds) {
+        if (pump_lines_.find(pump_code) == pump_lines_.end()) {
+            throw std::runtime_error("Pump line not found: " + pump_code);
+        }
+        if (liters <= 0 || lead_seconds < 0) {
+            throw std::invalid_argument(
+                "Refill volume must be positive and lead time not negative");
+        }
+        BaseRefill refill;
+        refill.pump_code = pump_code;
+        refill.liters = liters;
+        refill.arrival_time = sim_time_seconds_ + lead_seconds;
+        std::vector<BaseRefill>::iterator position = pending_refills_.begin();
+        while (position != pending_refills_.end() &&
+               position->arrival_time <= refill.arrival_time) {
+            ++position;
+        }
+        pending_refills_.insert(position, refill);
+        return refill;
+    }
+
+    const std::vector<BaseRefill> &get_pending_refills() const {
+        return pending_refills_;
+    }
+
+    // count more tanks per line, named after the feed tank (TQ201B, C..)
+    // and stocked like a standard base tank
+    void add_standard_reserve_tanks(size_t count) {
+        for (PumpLineMap::iterator it = pump_lines_.begin();
+             it != pump_lines_.end(); ++it) {
+            PumpLine &pump_line = it->second;
+            const LiquidTank &feed = pump_line.get_tank();
+            for (size_t i = 0; i < count; ++i) {
+                std::string suffix(1, static_cast<char>('B' +
+                                  pump_line.get_reserve_tanks().size()));
+                double capacity = SystemConstants::INITIAL_TANK_CAPACITY;
+                pump_line.add_reserve_tank(LiquidTank(
+                    feed.get_code() + suffix,
+                    feed.get_level_transmitter().get_code() + suffix,
+                    feed.get_liquid_in_tank_name(), capacity,
+                    capacity * SystemConstants::INITIAL_BASE_TANK_LEVELS /
+                        100.0));
+            }
+        }
+    }
+
+    const FillingLine &get_filling_line() const { return filling_line_; }
+    FillingLine &get_filling_line_mutable() { return filling_line_; }
+    double get_discharge_blocked_seconds() const {
+        return discharge_blocked_seconds_;
+    }
+    bool is_discharge_blocked() const { return discharge_blocked_; }
+
+    bool need_to_mix() const {
+        return mixer_tank_.get_low_level_switch().is_alarm() &&
+               batch_phase_ == BATCH_IDLE;
+    }
+
+    BatchPhase get_batch_phase() const { return batch_phase_; }
+
+    // Colour of the current lot, or of the last one when idle
+    const std::string &get_batch_color() const { return batch_color_; }
+
+    bool is_batch_in_process() const { return batch_phase_ != BATCH_IDLE; }
+
+    bool is_emptying_in_process() const {
+        return batch_phase_ == BATCH_EMPTYING;
+    }
+
+    bool is_batch_complete() const {
+        return batch_phase_ == BATCH_IDLE &&
+               mixer_tank_.is_empty() && !pump_lines_need_to_pump();
+    }
+
+    // The plant must stay at a fixed address while a procedure is attached
+    void attach_batch_procedure(BatchEventSink *sink, size_t procedure_id) {
+        batch_event_sink_ = sink;
+        batch_procedure_id_ = procedure_id;
+    }
+
+    // Batch steps, sequenced by the procedure attached to this plant
+    // Targets are set before the phase changes so observers see the lot's
+    // recipe when the pumping phase starts
+    void begin_batch(const std::string &target_color) {
+        batch_color_ = target_color;
+        reset();
+        set_pump_times(target_color);
+        set_batch_phase(BATCH_PUMPING);
+        notify_if_pumps_completed();
+    }
+
+    bool start_mixing() {
+        if (batch_phase_ != BATCH_PUMPING || !can_start_mixing() ||
+            mixer_tank_.get_current_capacity() <= 0) {
+            return false;
+        }
+        mixer_tank_.get_mixer_motor_mutable().start();
+        set_batch_phase(BATCH_MIXING);
+        return true;
+    }
+
+    void start_emptying_phase() {
+        set_batch_phase(BATCH_EMPTYING);
+        mixer_tank_.start_emptying();
+    }
+
+    void finish_batch() {
+        batch_event_sink_ = NULL;
+        set_batch_phase(BATCH_IDLE);
+    }
+
+    void add_observer(PlantObserver *observer) {
+        observers_.push_back(observer);
+    }
+
+    void remove_observer(PlantObserver *observer) {
+        observers_.erase(remove(observers_.begin(), observers_.end(), observer),
+                         observers_.end());
+    }
+
+    double get_sim_time() const { return sim_time_seconds_; }
+
+    // Called once per scan after every update has been applied
+    void advance_clock(double seconds) { sim_time_seconds_ += seconds; }
+
+    // One scan of the plant: lines while pumping, then mixer and emptying
+    void step(double seconds) {
+        if (phase_sink_ != NULL) {
+            traced_step(seconds);
+            return;
+        }
+        if (batch_phase_ == BATCH_PUMPING) {
+            update_all_pump_lines(seconds);
+        }
+        update_mix(seconds);
+        update_emptying(seconds);
+        update_filling(seconds);
+        deliver_due_refills();
+        advance_clock(seconds);
+    }
+
+    // Design parameters. They apply from the next lot, and the pumps'
+    // target durations follow the flow rate when the lot is set up.
+    double get_batch_size() const { return batch_size_liters_; }
+
+    void set_batch_size(double liters) {
+        if (liters <= 0 || liters > mixer_tank_.get_max_capacity()) {
+            throw std::invalid_argument(
+                "Batch size must be positive and fit in the mixer");
+        }
+        batch_size_liters_ = liters;
+    }
+
+    void set_pump_flow_rate(double lts_min) {
+        for (PumpLineMap::iterator it = pump_lines_.begin();
+             it != pump_lines_.end(); ++it) {
+            it->second.get_pump_mutable().set_nominal_flow_rate(lts_min);
+        }
+        wake_all_changed_lines();
+    }
+
+    void set_mixing_seconds(double seconds) {
+        mixer_tank_.get_mixer_motor_mutable().set_target_time(seconds);
+    }
+
+    void set_emptying_rate_percent(double percent_per_second) {
+        mixer_tank_.set_emptying_rate_percent_per_second(percent_per_second);
+    }
+
+    // Switches every pump between fixed speed and variable-speed dosing
+    void set_vfd_mode(bool enabled) {
+        for (PumpLineMap::iterator it = pump_lines_.begin();
+             it != pump_lines_.end(); ++it) {
+            it->second.get_pump_mutable().set_vfd_mode(enabled);
+        }
+        wake_all_changed_lines();
+    }
+
+    const PumpLine &get_pump_line(const std::string &pump_code) const {
+        PumpLineMap::const_iterator it = pump_lines_.find(pump_code);
+        if (it == pump_lines_.end()) {
+            throw std::runtime_error("Pump line not found: " + pump_code);
+        }
+        return it->second;
+    }
+
+    // The caller may change anything, so the line is woken
+    PumpLine &get_pump_line_mutable(const std::string &pump_code) {
+        PumpLineMap::iterator it = pump_lines_.find(pump_code);
+        if (it == pump_lines_.end()) {
+            throw std::runtime_error("Pump line not found: " + pump_code);
+        }
+        wake_changed_line(std::distance(pump_lines_.begin(), it));
+        return it->second;
+    }
+
+    // Large plants split their tick across the pool's threads; NULL runs it
+    // on the caller. The pool must outlive its use by this plant.
+    void attach_worker_pool(TickWorkerPool *pool) { worker_pool_ = pool; }
+
+    // Off, every line is updated every scan as before LineActivitySet: the
+    // reference a sleeping plant must match exactly
+    void set_line_sleeping(bool enabled) {
+        line_sleeping_ = enabled;
+        line_activity().wake_all();
+    }
+
+    // NULL detaches
+    void attach_phase_sink(ScanPhaseSink *sink) { phase_sink_ = sink; }
+
+    // Lines stepped by the next scan
+    size_t get_active_line_count() {
+        return line_activity().get_active().size();
+    }
+
+    const PumpLineMap &get_all_pump_lines() const {
+        return pump_lines_;
+    }
+
+    void transfer_liquid_to_mixer(double seconds = 1.0) {
+        bool low_level_was_alarm =
+            mixer_tank_.get_low_level_switch().is_alarm();
+        // A running pump is always awake
+        LineActivitySet &activity = line_activity();
+        const std::vector<size_t> &active = activity.get_active();
+        bool parallel = use_worker_pool(active.size());
+        if (parallel) {
+            DrainLinesTask task(*this, active, seconds);
+            worker_pool_->run(task, active.size());
+        }
+        for (size_t i = 0; i < active.size(); ++i) {
+            size_t line_index = active[i];
+            PumpLine &pump_line = activity.get_line(line_index);
+            LineTickResult &result = tick_results_[i];
+            if (!parallel) {
+                drain_line(pump_line, seconds, result);
+            }
+            if (result.transferred) {
+                // Added in position order whatever the worker count
+                mixer_tank_.add_liquid(result.drained_liters);
+                for (size_t j = 0; j < observers_.size(); ++j) {
+                    if (result.source_switched) {
+                        observers_[j]->on_source_tank_switched(
+                            line_index, pump_line, sim_time_seconds_);
+                    }
+                    observers_[j]->on_liquid_transferred(
+                        line_index, pump_line, result.requested_liters,
+                        result.drained_liters, sim_time_seconds_);
+                }
+            }
+        }
+        notify_if_low_level_changed(low_level_was_alarm);
+    }
+
+    // Steps the awake lines only; see LineActivitySet. With a worker pool
+    // attached, large plants update their lines in parallel.
+    void update_all_pump_lines(double seconds = 1.0) {
+        LineActivitySet &activity = line_activity();
+        const std::vector<size_t> &active = activity.get_active();
+        bool parallel = use_worker_pool(active.size());
+        if (parallel) {
+            UpdateLinesTask task(*this, active, seconds);
+            worker_pool_->run(task, active.size());
+        }
+        for (size_t i = 0; i < active.size(); ++i) {
+            size_t line_index = active[i];
+            PumpLine &pump_line = activity.get_line(line_index);
+            if (!parallel) {
+                update_line(pump_line, seconds, tick_results_[i]);
+            }
+            finish_line_update(line_index, pump_line, tick_results_[i]);
+        }
+
+        transfer_liquid_to_mixer(seconds);
+        notify_if_pumps_completed();
+    }
+
+    void set_pump_times(const std::string &target_color) {
+        if (pump_lines_.empty()) {
+            throw std::runtime_error("No pump lines available to set times");
+        }
+
+        const std::map<std::string, std::map<std::string, double> >& color_recipes = SystemConstants::COLOR_RECIPES;
+        std::map<std::string, std::map<std::string, double> >::const_iterator color_recipe = color_recipes.find(target_color);
+
+        // for to get the pump in each pumpline, compare if the color content of
+        // the line is one of the targeted and if is, set the time with the
+        // proportions
+
+        size_t line_index = 0;
+        for (PumpLineMap::iterator it = pump_lines_.begin(); 
+             it != pump_lines_.end(); ++it, ++line_index) {
+            PumpLine& pump_line = it->second;
+            const LiquidTank& tank = pump_line.get_tank();
+            PumpState previous_state = pump_line.get_pump().get_state();
+
+            if (color_recipe != color_recipes.end()) {
+                const std::map<std::string, double>& recipe =
+                    color_recipe->second;
+                std::map<std::string, double>::const_iterator recipe_it = recipe.find(tank.get_liquid_in_tank_name());
+                if (recipe_it != recipe.end()) {
+                    double target_liters =
+                        batch_size_liters_ * recipe_it->second;
+                    pump_line.get_pump_mutable().set_pump_target_liters(
+                        target_liters);
+                } else {
+                    pump_line.get_pump_mutable().set_pump_target_liters(0);
+                }
+            } else {
+                pump_line.get_pump_mutable().set_pump_target_liters(0);
+            }
+
+            wake_changed_line(line_index);
+            if (pump_line.get_pump().get_state() != previous_state) {
+                notify_pump_state_changed(line_index, pump_line,
+                                          previous_state);
+            }
+        }
+        count_required_lines();
+    }
+
+    // Without walking the lines, for displays of large plants
+    size_t get_required_line_count() const { return required_lines_; }
+    size_t get_completed_line_count() const { return completed_lines_; }
+
+    void reset() {
+        for (PumpLineMap::iterator it = pump_lines_.begin(); 
+             it != pump_lines_.end(); ++it) {
+            PumpLine& pump_line = it->second;
+            pump_line.get_pump_mutable().set_pump_target_liters(0);
+            pump_line.get_enter_valve_mutable().set_open(true);
+            pump_line.get_exit_valve_mutable().set_open(true);
+        }
+        wake_all_changed_lines();
+        // Reset mixer motor completely
+        mixer_tank_.get_mixer_motor_mutable().reset();
+        // Reset emptying timer
+        mixer_tank_.reset_emptying();
+    }
+
+    bool pump_lines_need_to_pump() const {
+        for (PumpLineMap::const_iterator it = pump_lines_.begin(); 
+             it != pump_lines_.end(); ++it) {
+            const PumpLine& pump_line = it->second;
+            if (pump_line.need_to_pump()) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    bool all_required_pumps_completed() const {
+        // Check if all pumps that have a target have either:
+        // 1. Reached their target duration (STOPPED_TARGET_REACHED), OR
+        // 2. Are permanently unable to continue (valves closed, etc.)
+        // 
+        // IMPORTANT: Pumps that are temporarily stopped (flow alarms, pressure issues)
+        // should NOT be considered completed, as they may restart and continue pumping
+        
+        for (PumpLineMap::const_iterator it = pump_lines_.begin(); 
+             it != pump_lines_.end(); ++it) {
+            const PumpLine& pump_line = it->second;
+            const LiquidPump& pump = pump_line.get_pump();
+            
+            // Skip pumps with no target (target duration = 0)
+            if (!pump.has_target()) {
+                continue;
+            }
+            
+            // Check if this pump has actually completed its target
+            if (pump.get_state() == STOPPED_TARGET_REACHED) {
+                continue; // This pump is truly done
+            }
+            
+            // Check if pump is permanently prevented from continuing due to valve configuration
+            if (!pump_line.get_enter_valve().is_open() || !pump_line.get_exit_valve().is_open()) {
+                // Pump can't continue due to closed valves - consider it "completed" for mixing purposes
+                continue;
+            }
+            
+            // If pump is temporarily stopped (flow alarm, pressure issues) but hasn't reached target,
+            // it should not be considered completed as it may restart
+            if (pump.get_state() == STOPPED_FLOW_ALARM || 
+                pump.get_state() == STOPPED_HIGH_PRESSURE || 
+                pump.get_state() == STOPPED_LOW_PRESSURE) {
+                // Pump is paused but could potentially restart - not completed
+                return false;
+            }
+            
+            // If pump is currently running and hasn't reached target, it's not completed
+            if (pump.get_state() == RUNNING && !pump.is_target_reached()) {
+                return false;
+            }
+        }
+        
+        return true; // All required pumps are completed or permanently unable to continue
+    }
+
+    void update_mix(double seconds = 1.0) {
+        // Mixing is started by the batch procedure once every base is pumped;
+        // here the motor only advances and reports completion
+        MixerMotor &mixer_motor = mixer_tank_.get_mixer_motor_mutable();
+        if (!mixer_motor.is_running()) {
+            return;
+        }
+        mixer_motor.update_mixing_progress(seconds);
+        if (!mixer_motor.is_running()) {
+            raise_batch_event(BATCH_EVENT_MIXING_DONE);
+        }
+    }
+
+    void update_emptying(double seconds = 1.0) {
+        discharge_blocked_ = false;
+        if (batch_phase_ == BATCH_EMPTYING) {
+            bool low_level_was_alarm =
+                mixer_tank_.get_low_level_switch().is_alarm();
+            // The lot goes to its colour's buffer tank, and waits while that
+            // tank is full; a colour without one drains freely
+            ProductBufferTank *buffer = filling_line_.find_buffer(batch_color_);
+            if (buffer == NULL) {
+                mixer_tank_.update_emptying_progress(seconds);
+            } else {
+                double wanted = mixer_tank_.get_emptying_rate_liters_per_second() *
+                                seconds;
+                if (wanted > mixer_tank_.get_current_capacity()) {
+                    wanted = mixer_tank_.get_current_capacity();
+                }
+                double drained = mixer_tank_.update_emptying_progress(
+                    seconds, buffer->get_free_space());
+                buffer->fill(drained);
+                if (drained < wanted) {
+                    discharge_blocked_ = true;
+                    discharge_blocked_seconds_ +=
+                        seconds * (wanted - drained) / wanted;
+                }
+            }
+            notify_if_low_level_changed(low_level_was_alarm);
+
+            if (mixer_tank_.is_empty()) {
+                raise_batch_event(BATCH_EVENT_MIXER_EMPTY);
+            }
+        }
+    }
+
+    // A delivery lands in the scan its arrival time falls in
+    void deliver_due_refills() {
+        while (!pending_refills_.empty() &&
+               pending_refills_.front().arrival_time <= sim_time_seconds_) {
+            BaseRefill refill = pending_refills_.front();
+            pending_refills_.erase(pending_refills_.begin());
+            size_t line_index = 0;
+            for (PumpLineMap::iterator it = pump_lines_.begin();
+                 it != pump_lines_.end(); ++it, ++line_index) {
+                if (it->first != refill.pump_code) {
+                    continue;
+                }
+                double accepted = it->second.receive_refill(refill.liters);
+                for (size_t i = 0; i < observers_.size(); ++i) {
+                    observers_[i]->on_base_refilled(line_index, it->second,
+                                                    accepted,
+                                                    sim_time_seconds_);
+                }
+                break;
+            }
+        }
+    }
+
+    void update_filling(double seconds = 1.0) {
+        CanFiller &filler = filling_line_.get_filler_mutable();
+        FillerState previous_state = filler.get_state();
+        filling_line_.update(seconds);
+        if (filler.get_state() != previous_state) {
+            for (size_t i = 0; i < observers_.size(); ++i) {
+                observers_[i]->on_filler_state_changed(filler, previous_state,
+                                                       sim_time_seconds_);
+            }
+        }
+    }
+
+    // Pump line and side a valve key drives; false for keys without one
+    static bool find_valve_line(const std::string &valve_name,
+                                std::string &pump_code, bool &exit_valve) {
+        // TODO: Consider a more robust way to map valve names to components if more valves are added.
+        // For now, direct mapping is used.
+        if (valve_name == "V201" || valve_name == "V401") {
+            pump_code = "P201";
+        } else if (valve_name == "V202" || valve_name == "V402") {
+            pump_code = "P202";
+        } else if (valve_name == "V203" || valve_name == "V403") {
+            pump_code = "P203";
+        } else {
+            return false;
+        }
+        exit_valve = valve_name[1] == '4';
+        return true;
+    }
+
+    // Whether a valve key names a valve of this plant's lines
+    bool has_valve(const std::string &valve_name) const {
+        std::string pump_code;
+        bool exit_valve;
+        return find_valve_line(valve_name, pump_code, exit_valve) &&
+               pump_lines_.find(pump_code) != pump_lines_.end();
+    }
+
+    void apply_valve_configuration(const SystemConfig &config) {
+        for (std::map<std::string, std::string>::const_iterator it = config.valve_states.begin(); 
+             it != config.valve_states.end(); ++it) {
+            std::string pump_code;
+            bool exit_valve;
+            if (find_valve_line(it->first, pump_code, exit_valve)) {
+                set_line_valve(pump_code, exit_valve, it->second == "OPEN");
+            }
+        }
+    }
+
+    bool can_start_batch(const std::string &target_color) const {
+        // Check if required valves are open for the target color
+        const std::map<std::string, std::map<std::string, double> >& color_recipes = SystemConstants::COLOR_RECIPES;
+        std::map<std::string, std::map<std::string, double> >::const_iterator color_recipe = color_recipes.find(target_color);
+        if (color_recipe == color_recipes.end()) {
+            return false;
+        }
+
+        // Check mixer tank low level switch
+        if (!mixer_tank_.get_low_level_switch().is_alarm()) {
+            return false; // Tank must be empty to start
+        }
+
+        // Check if required pump lines have both valves open
+        for (PumpLineMap::const_iterator it = pump_lines_.begin(); 
+             it != pump_lines_.end(); ++it) {
+            const PumpLine& pump_line = it->second;
+            const std::string& tank_liquid = pump_line.get_tank().get_liquid_in_tank_name();
+            
+            // Check if this liquid is needed for the recipe
+            bool liquid_needed = color_recipe->second.find(tank_liquid) != color_recipe->second.end();
+            
+            if (liquid_needed) {
+                // Both enter and exit valves must be open for required liquids
+                if (!pump_line.get_enter_valve().is_open() || !pump_line.get_exit_valve().is_open()) {
+                    return false;
+                }
+            }
+        }
+        
+        return true;
+    }
+
+    bool can_start_mixing() const {
+        // Complete check to avoid premature mixing before all base colors are fully pumped
+        // This method enforces that mixing cannot start while pumps are in paused states
+        for (PumpLineMap::const_iterator it = pump_lines_.begin(); 
+             it != pump_lines_.end(); ++it) {
+            if (!line_allows_mixing(it->second)) {
+                return false;
+            }
+        }
+        
+        // All checks passed - safe to start mixing
+        return true;
+    }
+
+    static bool line_allows_mixing(const PumpLine &pump_line) {
+        const LiquidPump& pump = pump_line.get_pump();
+        
+        // Skip pumps with no target (target duration = 0) - not required for this batch
+        if (!pump.has_target()) {
+            return true;
+        }
+        
+        // CRITICAL CHECK: Ensure target time > 0 and elapsed time >= target time
+        // This prevents mixing when pumps have not reached their pumping goals
+        if (!pump.is_target_reached()) {
+            return false; // This pump hasn't finished pumping its required amount
+        }
+        
+        // CRITICAL CHECK: Ensure pumps are not just paused but actually completed
+        // Pumps in STOPPED_FLOW_ALARM, STOPPED_HIGH_PRESSURE, or STOPPED_LOW_PRESSURE
+        // are paused and may restart - mixing must wait for them to complete or be permanently stopped
+        PumpState state = pump.get_state();
+        if (state == STOPPED_FLOW_ALARM || 
+            state == STOPPED_HIGH_PRESSURE || 
+            state == STOPPED_LOW_PRESSURE) {
+            // Pump is paused but not permanently stopped - could potentially restart
+            // Check if pump can still continue (valves open and has remaining target time)
+            if (pump_line.get_enter_valve().is_open() && 
+                pump_line.get_exit_valve().is_open()) {
+                return false; // Pump could restart, don't mix yet
+            }
+            // If valves are closed, pump is effectively permanently stopped
+        }
+        
+        // CRITICAL CHECK: Running pumps must not be interrupted by mixing
+        if (state == RUNNING) {
+            return false; // Pump is still actively pumping
+        }
+        
+        // At this point, pump has either:
+        // 1. Reached target (STOPPED_TARGET_REACHED) - OK to mix
+        // 2. Is permanently unable to continue due to closed valves - OK to mix
+        return true;
+    }
+};
+
+// Runs batch procedures as resumable state machines: "await all pumps reach
+// target; run mixer 30 s; await empty". A suspended procedure is a few words
+// and is resumed only when its plant raises the event it awaits, so one
+// scheduler can hold thousands of concurrent batches without polling them.
+class BatchScheduler : public BatchEventSink {
+  private:
+    struct BatchProcedure {
+        Factory *plant;
+        BatchEvent awaiting;
+        bool ready;
+        bool active;
+    };
+
+    std::vector<BatchProcedure> procedures_;
+    std::vector<size_t> free_ids_;
+    std::vector<size_t> ready_ids_;
+    bool draining_;
+    size_t active_count_;
+
+    // Procedure body. Receives the event that woke it and returns the next
+    // one to await, or BATCH_EVENT_NONE once the batch has finished.
+    static BatchEvent resume(Factory &plant, BatchEvent fired) {
+        switch (fired) {
+        case BATCH_EVENT_PUMPS_COMPLETED:
+            if (!plant.start_mixing()) {
+                return BATCH_EVENT_PUMPS_COMPLETED;
+            }
+            return BATCH_EVENT_MIXING_DONE;
+        case BATCH_EVENT_MIXING_DONE:
+            if (plant.get_mixer_tank().is_empty()) {
+                plant.finish_batch();
+                return BATCH_EVENT_NONE;
+            }
+            plant.start_emptying_phase();
+            return BATCH_EVENT_MIXER_EMPTY;
+        default:
+            plant.finish_batch();
+            return BATCH_EVENT_NONE;
+        }
+    }
+
+    // Resumes ready procedures in order. Events raised by a resumed
+    // procedure are queued and handled by the outermost call.
+    void drain_ready() {
+        if (draining_) {
+            return;
+        }
+        draining_ = true;
+        for (size_t i = 0; i < ready_ids_.size(); ++i) {
+            size_t id = ready_ids_[i];
+            BatchProcedure &procedure = procedures_[id];
+            procedure.ready = false;
+            BatchEvent next = resume(*procedure.plant, procedure.awaiting);
+            // resume() may have queued more ids, so re-index the procedure
+            procedures_[id].awaiting = next;
+            if (next == BATCH_EVENT_NONE) {
+                procedures_[id].active = false;
+                free_ids_.push_back(id);
+                --active_count_;
+            }
+        }
+        ready_ids_.clear();
+        draining_ = false;
+    }
+
+    void attach_procedure(Factory &plant, BatchEvent awaiting) {
+        size_t id;
+        if (!free_ids_.empty()) {
+            id = free_ids_.back();
+            free_ids_.pop_back();
+        } else {
+            id = procedures_.size();
+            procedures_.push_back(BatchProcedure());
+        }
+        BatchProcedure &procedure = procedures_[id];
+        procedure.plant = &plant;
+        procedure.awaiting = awaiting;
+        procedure.ready = false;
+        procedure.active = true;
+        ++active_count_;
+
+        plant.attach_batch_procedure(this, id);
+    }
+
+  public:
+    BatchScheduler() : draining_(false), active_count_(0) {}
+
+    bool start_batch(Factory &plant, const std::string &target_color) {
+        if (plant.is_batch_in_process()) {
+            return false;
+        }
+        attach_procedure(plant, BATCH_EVENT_PUMPS_COMPLETED);
+        plant.begin_batch(target_color);
+        return true;
+    }
+
+    // Takes over a plant forked mid-batch; the procedure resumes awaiting
+    // the event that ends the plant's current phase
+    bool adopt_batch(Factory &plant) {
+        switch (plant.get_batch_phase()) {
+        case BATCH_PUMPING:
+            attach_procedure(plant, BATCH_EVENT_PUMPS_COMPLETED);
+            return true;
+        case BATCH_MIXING:
+            attach_procedure(plant, BATCH_EVENT_MIXING_DONE);
+            return true;
+        case BATCH_EMPTYING:
+            attach_procedure(plant, BATCH_EVENT_MIXER_EMPTY);
+            return true;
+        default:
+            return false;
+        }
+    }
+
+    void on_batch_event(size_t procedure_id, BatchEvent event) {
+        if (procedure_id >= procedures_.size()) {
+            return;
+        }
+        BatchProcedure &procedure = procedures_[procedure_id];
+        if (!procedure.active || procedure.ready ||
+            procedure.awaiting != event) {
+            return;
+        }
+        procedure.ready = true;
+        ready_ids_.push_back(procedure_id);
+        drain_ready();
+    }
+
+    size_t get_active_count() const { return active_count_; }
+};
+
+// Stock of one base across its line's tanks, against the order mix
+struct BaseForecast {
+    std::string pump_code;
+    std::string base_name;
+    double on_hand_liters;
+    double on_order_liters;
+    double liters_per_lot; // 0 when no colour in the mix uses the base
+    double lots_remaining; // From stock on hand; HUGE_VAL when unused
+};
+
+// Keeps the bases stocked for an order mix. forecast() turns each line's
+// inventory into lots; update() orders a refill for every base whose stock
+// on hand and on order would not cover the lots made during one lead time
+// plus a safety margin, sized to fill the line's tanks. Call update() at
+// least once per lot.
+class BaseInventoryPlanner {
+  private:
+    // Colour -> share of lots, sums to 1
+    std::map<std::string, double> order_mix_;
+    double lead_seconds_;
+    double lots_per_hour_;
+    unsigned long refills_ordered_;
+
+  public:
+    explicit BaseInventoryPlanner(
+        double lead_seconds = SystemConstants::REFILL_LEAD_SECONDS,
+        double lots_per_hour = SystemConstants::PLANNED_LOTS_PER_HOUR)
+        : lead_seconds_(lead_seconds), lots_per_hour_(lots_per_hour),
+          refills_ordered_(0) {
+        if (lead_seconds < 0 || lots_per_hour <= 0) {
+            throw std::invalid_argument(
+                "Refill lead time cannot be negative and the lot rate must "
+                "be positive");
+        }
+        // Every recipe equally often until told otherwise
+        const std::map<std::string, std::map<std::string, double> > &recipes =
+            SystemConstants::COLOR_RECIPES;
+        for (std::map<std::string,
+                      std::map<std::string, double> >::const_iterator it =
+                 recipes.begin();
+             it != recipes.end(); ++it) {
+            order_mix_[it->first] = 1.0 / recipes.size();
+        }
+    }
+
+    // Shares are relative: {AzMarino: 3, AzCeleste: 1} is 75 % / 25 %
+    void set_order_mix(const std::map<std::string, double> &shares) {
+        double total = 0.0;
+        for (std::map<std::string, double>::const_iterator it = shares.begin();
+             it != shares.end(); ++it) {
+            if (SystemConstants::COLOR_RECIPES.find(it->first) ==
+                    SystemConstants::COLOR_RECIPES.end() ||
+                it->second < 0) {
+                throw std::invalid_argument("Invalid order mix entry: " +
+                                            it->first);
+            }
+            total += it->second;
+        }
+        if (total <= 0) {
+            throw std::invalid_argument(
+                "The order mix must have a positive share");
+        }
+        order_mix_.clear();
+        for (std::map<std::string, double>::const_iterator it = shares.begin();
+             it != shares.end(); ++it) {
+            order_mix_[it->first] = it->second / total;
+        }
+    }
+
+    const std::map<std::string, double> &get_order_mix() const {
+        return order_mix_;
+    }
+    double get_lead_seconds() const { return lead_seconds_; }
+    unsigned long get_refills_ordered() const { return refills_ordered_; }
+
+    double get_reorder_point_lots() const {
+        return lots_per_hour_ * lead_seconds_ / 3600.0 +
+               SystemConstants::REFILL_SAFETY_LOTS;
+    }
+
+    // One entry per line, in get_all_pump_lines() order
+    std::vector<BaseForecast> forecast(const Factory &factory) const {
+        std::vector<BaseForecast> forecasts;
+        const PumpLineMap &pump_lines = factory.get_all_pump_lines();
+        for (PumpLineMap::const_iterator it = pump_lines.begin();
+             it != pump_lines.end(); ++it) {
+            forecasts.push_back(forecast_line(factory, it->second));
+        }
+        return forecasts;
+    }
+
+    // forecast() for a single line
+    BaseForecast forecast_line(const Factory &factory,
+                               const PumpLine &pump_line) const {
+        const std::vector<BaseRefill> &refills = factory.get_pending_refills();
+        BaseForecast forecast;
+        forecast.pump_code = pump_line.get_pump().get_code();
+        forecast.base_name = pump_line.get_tank().get_liquid_in_tank_name();
+        forecast.on_hand_liters = pump_line.get_base_inventory();
+        forecast.on_order_liters = 0.0;
+        for (size_t i = 0; i < refills.size(); ++i) {
+            if (refills[i].pump_code == forecast.pump_code) {
+                forecast.on_order_liters += refills[i].liters;
+            }
+        }
+        forecast.liters_per_lot = 0.0;
+        for (std::map<std::string, double>::const_iterator mix =
+                 order_mix_.begin();
+             mix != order_mix_.end(); ++mix) {
+            const std::map<std::string, double> &recipe =
+                SystemConstants::COLOR_RECIPES.find(mix->first)->second;
+            std::map<std::string, double>::const_iterator part =
+                recipe.find(forecast.base_name);
+            if (part != recipe.end()) {
+                forecast.liters_per_lot +=
+                    mix->second * part->second * factory.get_batch_size();
+            }
+        }
+        forecast.lots_remaining =
+            forecast.liters_per_lot > 0.0
+                ? forecast.on_hand_liters / forecast.liters_per_lot
+                : HUGE_VAL;
+        return forecast;
+    }
+
+    // Returns the number of refills ordered; each one is also appended to
+    // ordered_refills when given
+    int update(Factory &factory,
+               std::vector<BaseRefill> *ordered_refills = NULL) {
+        int ordered = 0;
+        std::vector<BaseForecast> forecasts = forecast(factory);
+        for (size_t i = 0; i < forecasts.size(); ++i) {
+            const BaseForecast &base = forecasts[i];
+            if (base.liters_per_lot <= 0.0) {
+                continue;
+            }
+            double covered_lots =
+                (base.on_hand_liters + base.on_order_liters) /
+                base.liters_per_lot;
+            if (covered_lots >= get_reorder_point_lots()) {
+                continue;
+            }
+            double room = factory.get_pump_line(base.pump_code)
+                              .get_base_capacity() -
+                          base.on_hand_liters - base.on_order_liters;
+            if (room <= 0.0) {
+                continue;
+            }
+            BaseRefill refill =
+                factory.order_refill(base.pump_code, room, lead_seconds_);
+            if (ordered_refills != NULL) {
+                ordered_refills->push_back(refill);
+            }
+            ++refills_ordered_;
+            ++ordered;
+        }
+        return ordered;
+    }
+};
+
+struct ProductionOrder {
+    std::string color;
+    double liters; // Still to be started
+};
+
+enum LotSizingPolicy {
+    LOT_SIZE_FIXED,   // Every lot is BATCH_SIZE; the last may overproduce
+    LOT_SIZE_VARIABLE // Each lot sized from the order, mixer and bases
+};
+
+// Orders waiting for the mixer, served in arrival order. With variable
+// sizing a lot takes as much of the head order as the mixer holds, split
+// into equal lots so that the last one is not a small remainder, and no
+// more than the base inventory can supply.
+class OrderQueue {
+  private:
+    std::deque<ProductionOrder> orders_;
+    LotSizingPolicy policy_;
+    double produced_liters_;
+    double overproduced_liters_;
+
+    // Largest lot of the colour the bases of the plant can supply
+    static double base_limited_liters(const Factory &factory,
+                                      const std::string &color) {
+        const std::map<std::string, double> &recipe =
+            SystemConstants::COLOR_RECIPES.find(color)->second;
+        double limit = HUGE_VAL;
+        for (std::map<std::string, double>::const_iterator part =
+                 recipe.begin();
+             part != recipe.end(); ++part) {
+            double available = 0.0;
+            const PumpLineMap &lines = factory.get_all_pump_lines();
+            for (PumpLineMap::const_iterator it = lines.begin();
+                 it != lines.end(); ++it) {
+                if (it->second.get_tank().get_liquid_in_tank_name() ==
+                    part->first) {
+                    available += it->second.get_base_inventory();
+                }
+            }
+            double liters = available / part->second;
+            if (liters < limit) {
+                limit = liters;
+            }
+        }
+        return limit;
+    }
+
+  public:
+    explicit OrderQueue(LotSizingPolicy policy = LOT_SIZE_VARIABLE)
+        : policy_(policy), produced_liters_(0.0), overproduced_liters_(0.0) {}
+
+    void add_order(const std::string &color, double liters) {
+        if (SystemConstants::COLOR_RECIPES.find(color) ==
+            SystemConstants::COLOR_RECIPES.end()) {
+            throw std::invalid_argument("Unknown colour: " + color);
+        }
+        if (liters <= 0) {
+            throw std::invalid_argument("Order volume must be positive");
+        }
+        ProductionOrder order;
+        order.color = color;
+        order.liters = liters;
+        orders_.push_back(order);
+    }
+
+    bool is_empty() const { return orders_.empty(); }
+    const std::deque<ProductionOrder> &get_orders() const { return orders_; }
+    LotSizingPolicy get_policy() const { return policy_; }
+    double get_produced_liters() const { return produced_liters_; }
+    // Made beyond the orders by fixed-size lots
+    double get_overproduced_liters() const { return overproduced_liters_; }
+
+    double get_remaining_liters() const {
+        double liters = 0.0;
+        for (size_t i = 0; i < orders_.size(); ++i) {
+            liters += orders_[i].liters;
+        }
+        return liters;
+    }
+
+    // Size of the head order's next lot in this plant; 0 when there is no
+    // order or the bases cannot supply a minimum lot
+    double next_lot_liters(const Factory &factory) const {
+        if (orders_.empty()) {
+            return 0.0;
+        }
+        const ProductionOrder &order = orders_.front();
+        double liters = SystemConstants::BATCH_SIZE;
+        if (policy_ == LOT_SIZE_VARIABLE) {
+            double capacity = factory.get_mixer_tank().get_max_capacity();
+            double lots = ceil(order.liters / capacity);
+            liters = order.liters / lots;
+            // A small order is made up to a minimum lot
+            if (liters < SystemConstants::MIN_LOT_LITERS) {
+                liters = SystemConstants::MIN_LOT_LITERS;
+            }
+            double available = base_limited_liters(factory, order.color);
+            if (liters > available) {
+                liters = available;
+            }
+        }
+        if (liters > base_limited_liters(factory, order.color) ||
+            liters < SystemConstants::MIN_LOT_LITERS) {
+            return 0.0;
+        }
+        return liters;
+    }
+
+    // Sizes the next lot and starts it on the plant. False when the plant
+    // is busy, the queue is empty or the bases are short.
+    bool start_next_lot(Factory &factory, BatchScheduler &scheduler) {
+        double liters = next_lot_liters(factory);
+        if (liters <= 0.0 || factory.is_batch_in_process()) {
+            return false;
+        }
+        ProductionOrder &order = orders_.front();
+        factory.set_batch_size(liters);
+        if (!scheduler.start_batch(factory, order.color)) {
+            return false;
+        }
+        produced_liters_ += liters;
+        order.liters -= liters;
+        // Within a millilitre counts as done
+        if (order.liters < 0.001) {
+            overproduced_liters_ -= order.liters;
+            orders_.pop_front();
+        }
+        return true;
+    }
+};
+
+inline const char *pump_state_name(PumpState state) {
+    switch (state) {
+    case STOPPED_LOW_PRESSURE:
+        return "BAJA PRESION";
+    case STOPPED_HIGH_PRESSURE:
+        return "ALTA PRESION";
+    case STOPPED_FLOW_ALARM:
+        return "ALARMA FLUJO";
+    case STOPPED_TARGET_REACHED:
+        return "OBJETIVO";
+    case RUNNING:
+        return "BOMBEANDO";
+    }
+    return "DESCONOCIDO";
+}
+
+inline const char *filler_state_name(FillerState state) {
+    switch (state) {
+    case FILLER_FILLING:
+        return "LLENANDO";
+    case FILLER_CHANGEOVER:
+        return "CAMBIO DE COLOR";
+    default:
+        return "SIN PRODUCTO";
+    }
+}
+
+inline const char *batch_phase_name(BatchPhase phase) {
+    switch (phase) {
+    case BATCH_PUMPING:
+        return "BOMBEO";
+    case BATCH_MIXING:
+        return "MEZCLA";
+    case BATCH_EMPTYING:
+        return "VACIADO";
+    default:
+        return "INACTIVO";
+    }
+}
+
+// Result of applying a configuration with respect to the start command
+enum StartResult {
+    START_NOT_REQUESTED,
+    START_ACCEPTED,
+    START_REJECTED_BATCH_IN_PROCESS,
+    START_REJECTED_MIXER_NOT_EMPTY,
+    START_REJECTED_BASES_SHORT // The head order's lot cannot be supplied
+};
+
+// A plant with its batch sequencing, driven by configurations and ticks.
+// The console loop, the C API and test rigs all step the plant through
+// this class, so the start rules live in one place. While production
+// orders are queued, a start makes the head order's next lot, in its
+// colour and sized by the queue, instead of a configured one.
+class PlantSession {
+  private:
+    Factory factory_;
+    BatchScheduler scheduler_;
+    OrderQueue orders_;
+    double config_lot_liters_; // Size of lots started from the configuration
+    std::string previous_arranque_;
+    std::string previous_color_;
+    unsigned long batches_completed_;
+
+    // Disable copying: the scheduler keeps the plant's address
+    PlantSession(const PlantSession &);
+    PlantSession &operator=(const PlantSession &);
+
+  public:
+    explicit PlantSession(const Factory &plant)
+        : factory_(plant), config_lot_liters_(plant.get_batch_size()),
+          previous_arranque_("OFF"), batches_completed_(0) {}
+
+    Factory &get_factory() { return factory_; }
+    const Factory &get_factory() const { return factory_; }
+    OrderQueue &get_orders() { return orders_; }
+    const OrderQueue &get_orders() const { return orders_; }
+
+    // Valves follow the configuration, a colour change re-targets the
+    // pumps between lots, and a lot starts on the OFF to ON edge of the
+    // start command when the mixer's low-level switch is in alarm
+    StartResult apply_config(const SystemConfig &config) {
+        factory_.apply_valve_configuration(config);
+
+        if (previous_color_ != config.color_a_mezclar &&
+            !factory_.is_batch_in_process()) {
+            factory_.set_pump_times(config.color_a_mezclar);
+        }
+        bool start_requested = previous_arranque_ == "OFF" &&
+                               config.arranque_de_fabricacion == "ON";
+        previous_arranque_ = config.arranque_de_fabricacion;
+        previous_color_ = config.color_a_mezclar;
+
+        if (!start_requested) {
+            return START_NOT_REQUESTED;
+        }
+        if (factory_.is_batch_in_process()) {
+            return START_REJECTED_BATCH_IN_PROCESS;
+        }
+        if (!factory_.get_mixer_tank().get_low_level_switch().is_alarm()) {
+            return START_REJECTED_MIXER_NOT_EMPTY;
+        }
+        if (!orders_.is_empty()) {
+            return orders_.start_next_lot(factory_, scheduler_)
+                       ? START_ACCEPTED
+                       : START_REJECTED_BASES_SHORT;
+        }
+        // An order lot may have left its own size on the plant
+        factory_.set_batch_size(config_lot_liters_);
+        scheduler_.start_batch(factory_, config.color_a_mezclar);
+        return START_ACCEPTED;
+    }
+
+    // Start button pressed on a console: an OFF to ON edge whatever the
+    // configured command is. The configured value applies again from the
+    // next apply_config(), so a file left in ON starts nothing more.
+    StartResult press_start(const SystemConfig &config) {
+        SystemConfig pressed = config;
+        pressed.arranque_de_fabricacion = "OFF";
+        apply_config(pressed);
+        pressed.arranque_de_fabricacion = "ON";
+        return apply_config(pressed);
+    }
+
+    void step(double seconds) {
+        bool was_in_process = factory_.is_batch_in_process();
+        factory_.step(seconds);
+        if (was_in_process && !factory_.is_batch_in_process()) {
+            ++batches_completed_;
+        }
+    }
+
+    unsigned long get_batches_completed() const { return batches_completed_; }
+};
+
+#endif // DUPONT_PLANT_HPP
@@ -1,1628 +1,7469 @@
+#include "dupont_plant.hpp"
+
 #include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <csignal>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
 #include <cstdlib>
+#include <cstring>
+#include <ctime>
 #include <fstream>
 #include <iostream>
 #include <limits>
 #include <locale.h>
 #include <map>
 #include <math.h>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <set>
 #include <string>
+#include <thread>
 #include <vector>
+#ifdef _WIN32
+#include <winsock2.h> // Before windows.h, which would pull in winsock 1
+#include <ws2tcpip.h>
 #include <windows.h>
+#endif
 #include <stdexcept>
 #include <sstream>
+#ifdef _WIN32
+#include <conio.h>
+#include <io.h>
+#else
+#include <arpa/inet.h>
+#include <cerrno>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/file.h>
+#include <sys/socket.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <termios.h>
+#include <unistd.h>
+#endif
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define DUPONT_HAVE_SSE2 1
+#endif
+#ifdef _MSC_VER
+#include <intrin.h>
+#pragma comment(lib, "ws2_32.lib")
+#endif
 
 using namespace std;
 
 namespace SystemConstants {
-const bool NORMAL_STATUS = true;
-const bool ALARM_STATUS = false;
 const int ONE_SECOND_IN_MS = 1000;
-const double INITIAL_TANK_CAPACITY = 20000.0;
-const double MIXER_TANK_CAPACITY = 200.0;  // Mixer tank capacity as per requirements
-const double INITIAL_BASE_TANK_LEVELS = 25.0;
-const double INITIAL_MIXER_TANK_LEVEL = 0.0;
-const double NORMAL_OPERATING_PRESSURE = 33.0;
-const double HIGH_PRESSURE_THRESHOLD = 50.0;
-const double LOW_PRESSURE_THRESHOLD = 20.0;
-const double PRESSURE_INCREMENT = 3.0;
-const double INITIAL_PRESSURE = 0.0;
-const double DEFAULT_FLOW_RATE = 100.0;
-const bool INITIAL_PUMP_STATE = false;
-const bool INITIAL_FLOW_TRANSMITTER_STATE = NORMAL_STATUS;
-const string CONFIG_FILE_PATH = "./tercer_parcial_config.txt";
-const double BATCH_SIZE = 150.0;
-static map<string, map<string, double> > create_color_recipes() {
-    map<string, map<string, double> > recipes;
-    
-    map<string, double> az_marino;
-    az_marino["Negro"] = 2.0 / 3.0;  // 2 parts Negro (100 lts for 150 lts batch)
-    az_marino["Azul"] = 1.0 / 3.0;   // 1 part Azul (50 lts for 150 lts batch)
-    recipes["AzMarino"] = az_marino;
-    
-    map<string, double> az_celeste;
-    az_celeste["Azul"] = 1.0 / 3.0;
-    az_celeste["Negro"] = 1.0 / 3.0;
-    az_celeste["Blanco"] = 1.0 / 3.0;
-    recipes["AzCeleste"] = az_celeste;
-    
-    return recipes;
-}
-
-const map<string, map<string, double> > COLOR_RECIPES = create_color_recipes();
+const int SCAN_PERIOD_MIN_MS = 10;
+#ifdef _WIN32
+const string SHARED_TAGS_NAME = "Local\\dupont_tercer_parcial_tags";
+#else
+const string SHARED_TAGS_NAME = "/dupont_tercer_parcial_tags";
+#endif
+const size_t SHARED_TAGS_MAX_LINES = 32;
+const double PREDICTION_HORIZON_SECONDS = 300.0;
+const uint32_t SHARED_COMMAND_SLOTS = 64; // Power of two
+const string KPI_CSV_PATH = "./tercer_parcial_kpi.csv";
+const string GENEALOGY_LOG_PATH = "./tercer_parcial_genealogia.jsonl";
+const size_t LOG_GROUP_SIZE = 16;     // Records per durable write
+const int LOG_GROUP_WINDOW_MS = 2000; // Max delay before a durable write
+const string EVENT_LOG_PATH = "./tercer_parcial_eventos.jsonl";
+const size_t EVENT_LOG_ROTATE_BYTES = 1024 * 1024;
+const int EVENT_LOG_ROTATED_FILES = 3; // eventos.jsonl.1 .. .3
+const int EVENT_LOG_DRAIN_MS = 20;
+const string HISTORY_ARCHIVE_PATH = "./tercer_parcial_historial";
+const uint32_t ARCHIVE_BLOCK_SAMPLES = 3600; // One hour per block at 1 Hz
+const int ALARM_CHATTER_LIMIT = 3;        // Activations tolerated per window
+const double ALARM_CHATTER_WINDOW = 60.0; // Seconds
+const double ALARM_SHELVE_SECONDS = 600.0; // Shelving from the console
+// Per thread. A 10-minute run at 10 ms puts about 400 000 on the control
+// thread; past the limit events are counted and dropped.
+const size_t TRACE_MAX_EVENTS_PER_THREAD = size_t(1) << 22;
+const size_t DASHBOARD_MAX_CLIENTS = 32;
+const size_t DASHBOARD_MAX_QUEUED_FRAMES = 16; // A slower client is dropped
+const size_t DASHBOARD_MAX_REQUEST_BYTES = 8192;
+const int DASHBOARD_SEND_BUFFER_BYTES = 64 * 1024; // Per client
+const int DASHBOARD_POLL_MS = 20; // Delay before a new frame goes out
+// A running design candidate is dropped when a finished one makes this much
+// more lots and liters per hour with no more dosing error or trips
+const double OPTIMIZER_PRUNE_MARGIN = 0.10;
+// Candidates, spread over the grid, run in full before the rest to set the
+// bound others are pruned against
+const size_t OPTIMIZER_PILOT_CANDIDATES = 12;
+const int OPTIMIZER_DEFAULT_LOTS = 24;
+const size_t DIFFERENTIAL_DEFAULT_SCENARIOS = 2000;
+const unsigned long DIFFERENTIAL_FORK_INTERVAL = 97; // Scans between forks
+const size_t DIFFERENTIAL_MAX_FIELDS_SHOWN = 20;
+// Plants with more lines get the overview instead of one block per line
+const size_t OVERVIEW_DETAIL_MAX_LINES = 8;
+const size_t OVERVIEW_PAGE_LINES = 10;
+const double OVERVIEW_PRESSURE_WARNING_PSI = 40.0;
+const size_t CONSOLE_EXTRA_LINE_BASE = 30000; // Codes sort after P203
 } // namespace SystemConstants
 
-struct SystemConfig {
-    map<string, string> valve_states;
-    string color_a_mezclar;
-    string arranque_de_fabricacion;
-};
+// Lock-free single-producer/single-consumer ring. The producer never waits:
+// try_push() fails when the ring is full and the caller decides what to drop.
+template <class T, size_t Capacity> class SpscRing {
+  private:
+    static_assert((Capacity & (Capacity - 1)) == 0,
+                  "SpscRing capacity must be a power of two");
+
+    T slots_[Capacity];
+    atomic<size_t> head_; // Next slot to write, owned by the producer
+    atomic<size_t> tail_; // Next slot to read, owned by the consumer
 
-class StringUtils {
   public:
-    static string trim_whitespace(const string &s) {
-        size_t start = s.find_first_not_of(" \t\r\n");
-        size_t end = s.find_last_not_of(" \t\r\n");
-        if (start == string::npos)
-            return "";
-        return s.substr(start, end - start + 1);
+    SpscRing() : head_(0), tail_(0) {}
+
+    bool try_push(const T &value) {
+        size_t head = head_.load(memory_order_relaxed);
+        if (head - tail_.load(memory_order_acquire) == Capacity) {
+            return false;
+        }
+        slots_[head & (Capacity - 1)] = value;
+        head_.store(head + 1, memory_order_release);
+        return true;
     }
-};
 
-class ConfigFileHandler {
-  public:
-    static void open_config_file(ifstream &file, const string &filename) {
-        file.open(filename.c_str());
-        if (!file.is_open()) {
-            throw runtime_error("Error: Could not open config file: " +
-                                filename);
+    // In-place push: claim() returns the next free slot (NULL when full)
+    // for the producer to fill, and publish() hands it to the consumer
+    T *claim() {
+        size_t head = head_.load(memory_order_relaxed);
+        if (head - tail_.load(memory_order_acquire) == Capacity) {
+            return NULL;
         }
+        return &slots_[head & (Capacity - 1)];
+    }
+
+    void publish() {
+        head_.store(head_.load(memory_order_relaxed) + 1,
+                    memory_order_release);
     }
 
-    static bool
-    parse_config_line(const string &line, string &key, string &value) {
-        size_t eq_pos = line.find('=');
-        if (eq_pos == string::npos)
+    bool try_pop(T &value) {
+        size_t tail = tail_.load(memory_order_relaxed);
+        if (tail == head_.load(memory_order_acquire)) {
             return false;
-        key = StringUtils::trim_whitespace(line.substr(0, eq_pos));
-        value = StringUtils::trim_whitespace(line.substr(eq_pos + 1));
-        return !(key.empty() || value.empty());
-    }
-
-    static void create_default_config_file(
-        const string &filename = SystemConstants::CONFIG_FILE_PATH) {
-        const char *default_config =
-            "# Valvulas de entrada \n"
-            "# Valores Posibles: OPEN / CLOSE\n"
-            "V201 = OPEN\n"
-            "V202 = OPEN\n"
-            "V203 = OPEN\n"
-            "\n"
-            "# Valvulas de salida\n"
-            "# Valores Posibles: OPEN / CLOSE\n"
-            "V401 = OPEN\n"
-            "V402 = OPEN\n"
-            "V403 = OPEN\n"
-            "\n"
-            "# Valores Posibles: AzMarino / AzCeleste\n"
-            "COLOR_A_MEZCLAR = AzCeleste\n"
-            "\n"
-            "# Valores Posibles: ON / OFF   (Se debe apagar <OFF> y volver a "
-            "encender <ON>\n"
-            "# para comenzar un nuevo lote)\n"
-            "ARRANQUE_DE_FABRICACION = OFF\n";
-
-        ofstream out(filename.c_str(), ios::trunc);
-        if (!out) {
-            throw runtime_error("Could not write default config file: " +
-                                filename);
         }
-        out << default_config;
-        out.close();
+        value = slots_[tail & (Capacity - 1)];
+        tail_.store(tail + 1, memory_order_release);
+        return true;
     }
 };
 
-static vector<string> create_known_valve_keys() {
-    vector<string> keys;
-    keys.push_back("V201");
-    keys.push_back("V202");
-    keys.push_back("V203");
-    keys.push_back("V401");
-    keys.push_back("V402");
-    keys.push_back("V403");
-    return keys;
-}
+// One trace event. name and arg_name must be string literals: only the
+// pointer is stored. detail is copied and truncated.
+struct TraceEvent {
+    int64_t timestamp_ns; // Since the tracer started
+    const char *name;
+    const char *arg_name; // NULL when the event has no argument
+    char phase;           // 'B' begin, 'E' end, 'i' instant
+    char detail[15];
+};
 
-class ConfigValidator {
+// Opt-in recorder of Chrome trace events (chrome://tracing, Perfetto). Each
+// thread appends to its own buffer with no lock or atomic read-modify-write;
+// buffers grow in chunks so an event never moves once written. The JSON file
+// is written by the destructor, which must run after every traced thread
+// has stopped. An empty path records nothing. Only one tracer is active at
+// a time; while none is, emit() costs one load and a branch.
+class ChromeTracer {
   private:
-    static const vector<string> KNOWN_VALVE_KEYS;
-    static const string K_COLOR;
-    static const string K_ARRANQUE;
+    static const size_t CHUNK_EVENTS = 8192;
+
+    struct ThreadBuffer {
+        int tid;
+        string thread_name;
+        vector<TraceEvent *> chunks;
+        size_t used_in_last_chunk;
+        size_t event_count;
+        unsigned long dropped;
+    };
+
+    // The calling thread's buffer, tagged with the tracer that owns it so a
+    // later tracer never follows a stale pointer
+    struct ThreadSlot {
+        unsigned long tracer_serial;
+        ThreadBuffer *buffer;
+    };
+
+    string path_; // Empty when disabled
+    unsigned long serial_;
+    chrono::steady_clock::time_point start_;
+    mutex mutex_; // Guards buffers_ while threads register
+    vector<ThreadBuffer *> buffers_;
+
+    static atomic<ChromeTracer *> &active_tracer() {
+        static atomic<ChromeTracer *> tracer(NULL);
+        return tracer;
+    }
 
-  public:
-    static void validate_and_set_config_pair(SystemConfig &config,
-                                             const string &key,
-                                             const string &value) {
-        if (key == K_COLOR) {
-            validate_color_value(value);
-            config.color_a_mezclar = value;
-        } else if (key == K_ARRANQUE) {
-            validate_start_command_value(value);
-            config.arranque_de_fabricacion = value;
-        } else if (is_known_valve(key)) {
-            validate_valve_value(key, value);
-            config.valve_states[key] = value;
-        } else {
-            throw runtime_error("Invalid configuration key found: " + key);
-        }
+    static unsigned long next_serial() {
+        static atomic<unsigned long> serial(0);
+        return serial.fetch_add(1) + 1;
+    }
+
+    static ThreadSlot &thread_slot() {
+        static thread_local ThreadSlot slot = {0, NULL};
+        return slot;
     }
 
-    static void validate_complete_config(const SystemConfig &config) {
-        if (config.color_a_mezclar.empty()) {
-            throw runtime_error("Missing required setting: COLOR_A_MEZCLAR");
+    ThreadBuffer *local_buffer() {
+        ThreadSlot &slot = thread_slot();
+        if (slot.tracer_serial == serial_) {
+            return slot.buffer;
         }
-        if (config.arranque_de_fabricacion.empty()) {
-            throw runtime_error(
-                "Missing required setting: ARRANQUE_DE_FABRICACION");
+        ThreadBuffer *buffer = new ThreadBuffer();
+        buffer->used_in_last_chunk = CHUNK_EVENTS;
+        buffer->event_count = 0;
+        buffer->dropped = 0;
+        {
+            lock_guard<mutex> lock(mutex_);
+            buffer->tid = static_cast<int>(buffers_.size()) + 1;
+            buffers_.push_back(buffer);
         }
+        slot.tracer_serial = serial_;
+        slot.buffer = buffer;
+        return buffer;
+    }
 
-        vector<string> known_valves = create_known_valve_keys();
-        for (size_t i = 0; i < known_valves.size(); ++i) {
-            const string& valve = known_valves[i];
-            if (config.valve_states.find(valve) == config.valve_states.end()) {
-                throw runtime_error("Missing required valve setting: " + valve);
+    void append(char phase, const char *name, const char *arg_name,
+                const char *detail) {
+        int64_t now_ns = chrono::duration_cast<chrono::nanoseconds>(
+                             chrono::steady_clock::now() - start_)
+                             .count();
+        ThreadBuffer *buffer = local_buffer();
+        if (buffer->used_in_last_chunk == CHUNK_EVENTS) {
+            if (buffer->event_count >=
+                SystemConstants::TRACE_MAX_EVENTS_PER_THREAD) {
+                ++buffer->dropped;
+                return;
             }
+            buffer->chunks.push_back(new TraceEvent[CHUNK_EVENTS]);
+            buffer->used_in_last_chunk = 0;
         }
-    }
-
-  private:
-    static void validate_color_value(const string &value) {
-        if (value != "AzMarino" && value != "AzCeleste") {
-            throw runtime_error("Invalid value for COLOR_A_MEZCLAR: " + value);
+        TraceEvent &event =
+            buffer->chunks.back()[buffer->used_in_last_chunk++];
+        ++buffer->event_count;
+        event.timestamp_ns = now_ns;
+        event.name = name;
+        event.arg_name = arg_name;
+        event.phase = phase;
+        size_t i = 0;
+        for (; i + 1 < sizeof(event.detail) && detail[i] != '\0'; ++i) {
+            event.detail[i] = detail[i];
         }
+        event.detail[i] = '\0';
     }
 
-    static void validate_start_command_value(const string &value) {
-        if (value != "ON" && value != "OFF") {
-            throw runtime_error("Invalid value for ARRANQUE_DE_FABRICACION: " +
-                                value);
+    static void write_json_string(FILE *file, const char *text) {
+        fputc('"', file);
+        for (const char *c = text; *c != '\0'; ++c) {
+            if (*c == '"' || *c == '\\') {
+                fputc('\\', file);
+                fputc(*c, file);
+            } else if (static_cast<unsigned char>(*c) >= 0x20) {
+                fputc(*c, file);
+            }
         }
+        fputc('"', file);
     }
 
-    static void validate_valve_value(const string &key, const string &value) {
-        if (value != "OPEN" && value != "CLOSE") {
-            throw runtime_error("Invalid value for valve " + key + ": " +
-                                value);
+    void write_file() const {
+        FILE *file = fopen(path_.c_str(), "wb");
+        if (file == NULL) {
+            cerr << "No se pudo escribir la traza: " << path_ << endl;
+            return;
         }
+        fputs("{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n", file);
+        bool first = true;
+        for (size_t b = 0; b < buffers_.size(); ++b) {
+            const ThreadBuffer &buffer = *buffers_[b];
+            string thread_name = buffer.thread_name;
+            if (thread_name.empty()) {
+                ostringstream name;
+                name << "hilo " << buffer.tid;
+                thread_name = name.str();
+            }
+            fprintf(file,
+                    "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,"
+                    "\"tid\":%d,\"args\":{\"name\":",
+                    first ? "" : ",\n", buffer.tid);
+            write_json_string(file, thread_name.c_str());
+            fputs("}}", file);
+            first = false;
+            size_t remaining = buffer.event_count;
+            for (size_t c = 0; c < buffer.chunks.size(); ++c) {
+                size_t count =
+                    remaining < CHUNK_EVENTS ? remaining : CHUNK_EVENTS;
+                remaining -= count;
+                for (size_t i = 0; i < count; ++i) {
+                    const TraceEvent &event = buffer.chunks[c][i];
+                    fprintf(file,
+                            ",\n{\"name\":\"%s\",\"ph\":\"%c\",\"ts\":%.3f,"
+                            "\"pid\":1,\"tid\":%d",
+                            event.name, event.phase,
+                            event.timestamp_ns / 1000.0, buffer.tid);
+                    if (event.phase == 'i') {
+                        fputs(",\"s\":\"t\"", file);
+                    }
+                    if (event.arg_name != NULL) {
+                        fprintf(file, ",\"args\":{\"%s\":", event.arg_name);
+                        write_json_string(file, event.detail);
+                        fputc('}', file);
+                    }
+                    fputc('}', file);
+                }
+            }
+            if (buffer.dropped > 0) {
+                cerr << "Traza: " << buffer.dropped
+                     << " eventos descartados en " << thread_name << endl;
+            }
+        }
+        fputs("\n]}\n", file);
+        fclose(file);
     }
 
-    static bool is_known_valve(const string &key) {
-        vector<string> known_valves = create_known_valve_keys();
-        return find(known_valves.begin(), known_valves.end(), key) !=
-               known_valves.end();
-    }
-};
-
-const vector<string> ConfigValidator::KNOWN_VALVE_KEYS = create_known_valve_keys();
-const string ConfigValidator::K_COLOR = "COLOR_A_MEZCLAR";
-const string ConfigValidator::K_ARRANQUE = "ARRANQUE_DE_FABRICACION";
+    // Disable copying: threads hold pointers into this tracer's buffers
+    ChromeTracer(const ChromeTracer &);
+    ChromeTracer &operator=(const ChromeTracer &);
 
-class ConfigManager {
   public:
-    static SystemConfig
-    read_config(const string &filename = SystemConstants::CONFIG_FILE_PATH) {
-        SystemConfig config;
-        ifstream file;
-        ConfigFileHandler::open_config_file(file, filename);
-        string line, key, value;
-        int line_number = 0;
-
-        while (getline(file, line)) {
-            line_number++;
-            string trimmed = StringUtils::trim_whitespace(line);
-
-            if (trimmed.empty() || trimmed[0] == '#')
-                continue;
+    explicit ChromeTracer(const string &path)
+        : path_(path), serial_(next_serial()),
+          start_(chrono::steady_clock::now()) {
+        if (path_.empty()) {
+            return;
+        }
+        ChromeTracer *expected = NULL;
+        if (!active_tracer().compare_exchange_strong(expected, this)) {
+            throw runtime_error("Another trace is already being recorded");
+        }
+    }
 
-            if (!ConfigFileHandler::parse_config_line(trimmed, key, value)) {
-                cerr << "Warning: Malformed config line " << line_number << ": "
-                     << line << endl;
-                continue;
+    ~ChromeTracer() {
+        if (path_.empty()) {
+            return;
+        }
+        active_tracer().store(NULL);
+        write_file();
+        for (size_t b = 0; b < buffers_.size(); ++b) {
+            for (size_t c = 0; c < buffers_[b]->chunks.size(); ++c) {
+                delete[] buffers_[b]->chunks[c];
             }
-            ConfigValidator::validate_and_set_config_pair(config, key, value);
+            delete buffers_[b];
         }
-
-        ConfigValidator::validate_complete_config(config);
-        return config;
     }
 
-    static void repair_or_create_config_file(
-        const string &filename = SystemConstants::CONFIG_FILE_PATH) {
-        ConfigFileHandler::create_default_config_file(filename);
+    // Records an event on the calling thread's buffer, if a trace is on
+    static void emit(char phase, const char *name,
+                     const char *arg_name = NULL, const char *detail = "") {
+        ChromeTracer *tracer = active_tracer().load(memory_order_acquire);
+        if (tracer != NULL) {
+            tracer->append(phase, name, arg_name, detail);
+        }
     }
-};
-
-class LevelTransmitter {
-  private:
-    string code_;
-    double level_;
 
-    void evaluate_level(double &current_capacity, double &max_capacity) {
-        if (current_capacity > max_capacity) {
-            current_capacity = max_capacity;
-        } else if (current_capacity < 0) {
-            current_capacity = 0;
+    // Label shown for the calling thread in the trace viewer
+    static void name_thread(const char *name) {
+        ChromeTracer *tracer = active_tracer().load(memory_order_acquire);
+        if (tracer != NULL) {
+            tracer->local_buffer()->thread_name = name;
         }
-        level_ = (current_capacity / max_capacity) * 100.0;
     }
 
-  public:
-    explicit LevelTransmitter(const string &code)
-        : code_(code), level_(SystemConstants::INITIAL_MIXER_TANK_LEVEL) {}
-
-    const string &get_code() const { return code_; }
-
-    double read_level(double &current_capacity, double &max_capacity) const {
-        const_cast<LevelTransmitter *>(this)->evaluate_level(current_capacity,
-                                                             max_capacity);
-        return level_;
+    static bool is_active() {
+        return active_tracer().load(memory_order_acquire) != NULL;
     }
-};
 
-class LiquidTank {
-  private:
-    string code_;
-    string liquid_name_;
-    double max_capacity_;
-    double current_capacity_;
-    LevelTransmitter level_transmitter_;
+    bool is_enabled() const { return !path_.empty(); }
 
-  public:
-    LiquidTank(const string &tank_code,
-               const string &level_transmitter_code,
-               const string &liquid_name,
-               double max_capacity,
-               double current_capacity)
-        : code_(tank_code), liquid_name_(liquid_name),
-          max_capacity_(max_capacity), current_capacity_(current_capacity),
-          level_transmitter_(level_transmitter_code) {}
-
-    const string &get_liquid_in_tank_name() const { return liquid_name_; }
-    const string &get_code() const { return code_; }
-    double get_max_capacity() const { return max_capacity_; }
-    double get_current_capacity() const { return current_capacity_; }
-
-    double get_level() const {
-        return level_transmitter_.read_level(
-            const_cast<double &>(current_capacity_),
-            const_cast<double &>(max_capacity_));
-    }
-
-    double drain(double amount) {
-        if (amount <= 0) {
-            return 0.0;
-        }
-
-        double drained_amount;
-        if (current_capacity_ >= amount) {
-            current_capacity_ -= amount;
-            drained_amount = amount;
-        } else {
-            drained_amount = current_capacity_;
-            current_capacity_ = 0.0;
+    size_t get_event_count() const {
+        size_t total = 0;
+        for (size_t b = 0; b < buffers_.size(); ++b) {
+            total += buffers_[b]->event_count;
         }
-        return drained_amount;
+        return total;
     }
 };
 
-class FlowSwitch {
+// Begin/end pair around a scope; free when no trace is being recorded
+class TraceSpan {
   private:
-    string code_;
-    bool status_;
+    const char *name_;
 
-  public:
-    explicit FlowSwitch(
-        const string &code,
-        bool initial_status = SystemConstants::INITIAL_FLOW_TRANSMITTER_STATE)
-        : code_(code), status_(initial_status) {
-        if (code.empty()) {
-            throw invalid_argument("FlowSwitch code cannot be empty");
-        }
-    }
-
-    void evaluate_status(double flow_rate, bool pump_should_be_flowing) {
-        // Flow switch goes to ALARM when:
-        // 1. Pump should be flowing but flow rate is 0 (valve issues, blockage, etc.)
-        // 2. Any flow anomaly when pump is running at expected capacity
-        if (pump_should_be_flowing && flow_rate == 0) {
-            status_ = SystemConstants::ALARM_STATUS;
-        } else if (!pump_should_be_flowing) {
-            // If pump shouldn't be flowing, flow switch should be normal
-            status_ = SystemConstants::NORMAL_STATUS;
-        } else {
-            // Pump is flowing at expected rate, normal operation
-            status_ = SystemConstants::NORMAL_STATUS;
-        }
-    }
-
-    const string &get_code() const { return code_; }
-    bool is_normal() const { return status_ == SystemConstants::NORMAL_STATUS; }
-    bool is_alarm() const { return status_ == SystemConstants::ALARM_STATUS; }
-};
-
-class Valve {
-  private:
-    string code_;
-    bool is_open_;
+    // Disable copying: the end event belongs to this scope
+    TraceSpan(const TraceSpan &);
+    TraceSpan &operator=(const TraceSpan &);
 
   public:
-    explicit Valve(const string &code, bool is_open = true)
-        : code_(code), is_open_(is_open) {}
-
-    void toggle() { is_open_ = !is_open_; }
-    void set_open(bool new_open_state) { is_open_ = new_open_state; }
-    bool is_open() const { return is_open_; }
-    const string &get_code() const { return code_; }
-};
-
-enum PumpState {
-    STOPPED_LOW_PRESSURE,
-    STOPPED_HIGH_PRESSURE,
-    STOPPED_FLOW_ALARM,
-    STOPPED_TARGET_REACHED,
-    RUNNING
+    explicit TraceSpan(const char *name) : name_(name) {
+        ChromeTracer::emit('B', name_);
+    }
+    ~TraceSpan() { ChromeTracer::emit('E', name_); }
 };
 
-class LiquidPump {
+// Read-only memory mapping of a whole file. Empty or missing files map to
+// an empty range so callers need no special case for a fresh archive.
+class MappedFile {
   private:
-    string code_;
-    double flow_rate_lts_min_;
-    double target_pump_duration_seconds_;
-    double pump_elapsed_seconds_;
-    bool is_on_;
-    PumpState current_state_;
-
-    void start() {
-        is_on_ = true;
-        current_state_ = RUNNING;
-    }
-
-    void stop(PumpState reason) {
-        is_on_ = false;
-        current_state_ = reason;
-    }
+    const uint8_t *data_;
+    size_t size_;
+#ifdef _WIN32
+    HANDLE file_;
+    HANDLE mapping_;
+#endif
 
-    bool should_stop_for_alarm(const FlowSwitch &flow_switch) const {
-        return flow_switch.is_alarm();
-    }
-
-    bool should_stop_for_high_pressure(double current_pressure) const {
-        return current_pressure > SystemConstants::HIGH_PRESSURE_THRESHOLD;
-    }
-
-    bool should_stop_for_target_reached() const {
-        return pump_elapsed_seconds_ >= target_pump_duration_seconds_;
-    }
-
-    bool can_start_for_pressure(double current_pressure) const {
-        return current_pressure < SystemConstants::LOW_PRESSURE_THRESHOLD;
-    }
-
-    bool can_start_pumping(const FlowSwitch &flow_switch, double current_pressure, 
-                          const Valve &enter_valve, const Valve &exit_valve) const {
-        // Pump can start if:
-        // 1. Flow switch is in normal state (no alarm)
-        // 2. Pressure is below low threshold (20 psi)
-        // 3. Pump has a valid target duration
-        // 4. Pump hasn't reached its target yet
-        // 5. Both enter and exit valves are open (essential for pump operation)
-        return flow_switch.is_normal() && 
-               can_start_for_pressure(current_pressure) &&
-               target_pump_duration_seconds_ > 0.0 &&
-               pump_elapsed_seconds_ < target_pump_duration_seconds_ &&
-               enter_valve.is_open() && 
-               exit_valve.is_open();
-    }
+    // Disable copying: the mapping is owned by exactly one instance
+    MappedFile(const MappedFile &);
+    MappedFile &operator=(const MappedFile &);
 
   public:
-    explicit LiquidPump(const string &code,
-                        double flow_rate = SystemConstants::DEFAULT_FLOW_RATE)
-        : code_(code), flow_rate_lts_min_(flow_rate),
-          target_pump_duration_seconds_(0.0), pump_elapsed_seconds_(0.0),
-          is_on_(SystemConstants::INITIAL_PUMP_STATE),
-          current_state_(STOPPED_LOW_PRESSURE) {}
-
-    bool is_on() const { return is_on_; }
-    double get_flow_rate() const { return flow_rate_lts_min_; }
-    const string &get_code() const { return code_; }
-    PumpState get_state() const { return current_state_; }
-    double get_elapsed_seconds() const { return pump_elapsed_seconds_; }
-    double get_target_duration() const { return target_pump_duration_seconds_; }
-
-    double get_actual_flow_rate(const Valve &enter_valve, const Valve &exit_valve) const {
-        // Flow rate is 100 lts/min ONLY when:
-        // 1. Pump is ON
-        // 2. Both suction (enter) and discharge (exit) valves are open
-        // If any valve is closed or pump is off, flow rate is 0
-        if (is_on_ && enter_valve.is_open() && exit_valve.is_open()) {
-            return flow_rate_lts_min_;
-        }
-        return 0.0; // No flow if pump is off or any valve is closed
-    }
-
-    // Fixed: Added valve state checking to prevent pumps from starting/restarting
-    // when essential valves (enter/exit) are closed. This ensures pumps only
-    // operate when they can actually function properly.
-    void update_pump_state(const FlowSwitch &flow_switch,
-                           double current_pressure,
-                           const Valve &enter_valve,
-                           const Valve &exit_valve) {
-        // Check stop conditions first (in order of priority)
-        
-        // 1. Flow alarm - immediate stop
-        if (should_stop_for_alarm(flow_switch)) {
-            stop(STOPPED_FLOW_ALARM);
+    explicit MappedFile(const string &path) : data_(NULL), size_(0) {
+#ifdef _WIN32
+        mapping_ = NULL;
+        file_ = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ |
+                            FILE_SHARE_WRITE, NULL, OPEN_EXISTING,
+                            FILE_ATTRIBUTE_NORMAL, NULL);
+        if (file_ == INVALID_HANDLE_VALUE) {
             return;
         }
-
-        // 2. High pressure - stop to prevent damage  
-        if (should_stop_for_high_pressure(current_pressure)) {
-            stop(STOPPED_HIGH_PRESSURE);
+        LARGE_INTEGER file_size;
+        if (!GetFileSizeEx(file_, &file_size) || file_size.QuadPart == 0) {
             return;
         }
-
-        // 3. Target reached - stop when pumping goal is achieved
-        if (should_stop_for_target_reached()) {
-            stop(STOPPED_TARGET_REACHED);
+        mapping_ = CreateFileMappingA(file_, NULL, PAGE_READONLY, 0, 0, NULL);
+        if (mapping_ == NULL) {
+            throw runtime_error("Could not map file: " + path);
+        }
+        data_ = static_cast<const uint8_t *>(
+            MapViewOfFile(mapping_, FILE_MAP_READ, 0, 0, 0));
+        if (data_ == NULL) {
+            throw runtime_error("Could not map file: " + path);
+        }
+        size_ = static_cast<size_t>(file_size.QuadPart);
+#else
+        int fd = open(path.c_str(), O_RDONLY);
+        if (fd < 0) {
             return;
         }
-
-        // Check restart conditions based on current stop reason
-        if (!is_on_) {
-            if (current_state_ == STOPPED_FLOW_ALARM) {
-                // After flow alarm: restart only when flow is normal AND pressure is low AND valves are open
-                // This ensures the flow issue has been resolved and valves are properly configured
-                if (flow_switch.is_normal() && 
-                    can_start_for_pressure(current_pressure) &&
-                    enter_valve.is_open() && 
-                    exit_valve.is_open()) {
-                    start();
-                }
-            } else if (current_state_ == STOPPED_HIGH_PRESSURE) {
-                // After high pressure: restart when pressure drops below low threshold AND valves are open
-                // This implements the 20 psi restart logic from requirements
-                if (can_start_for_pressure(current_pressure) &&
-                    enter_valve.is_open() && 
-                    exit_valve.is_open()) {
-                    start();
-                }
-            } else if (current_state_ == STOPPED_LOW_PRESSURE) {
-                // Initial state or after manual stop: start when pressure allows AND valves are open
-                if (can_start_for_pressure(current_pressure) && 
-                    flow_switch.is_normal() &&
-                    enter_valve.is_open() && 
-                    exit_valve.is_open()) {
-                    start();
-                }
+        struct stat info;
+        if (fstat(fd, &info) == 0 && info.st_size > 0) {
+            void *mapped = mmap(NULL, static_cast<size_t>(info.st_size),
+                                PROT_READ, MAP_SHARED, fd, 0);
+            if (mapped == MAP_FAILED) {
+                close(fd);
+                throw runtime_error("Could not map file: " + path);
             }
-            // STOPPED_TARGET_REACHED pumps should not restart automatically
+            data_ = static_cast<const uint8_t *>(mapped);
+            size_ = static_cast<size_t>(info.st_size);
         }
+        close(fd); // The mapping stays valid without the descriptor
+#endif
     }
 
-    void set_pump_target_liters(double amount_lts) {
-        if (amount_lts > 0) {
-            target_pump_duration_seconds_ =
-                (amount_lts / flow_rate_lts_min_) * 60.0;
-            pump_elapsed_seconds_ = 0.0;
+    ~MappedFile() {
+#ifdef _WIN32
+        if (data_ != NULL) {
+            UnmapViewOfFile(data_);
         }
-    }
-
-    void increment_elapsed_time(double seconds) {
-        if (is_on_) {
-            pump_elapsed_seconds_ += seconds;
+        if (mapping_ != NULL) {
+            CloseHandle(mapping_);
         }
+        if (file_ != INVALID_HANDLE_VALUE) {
+            CloseHandle(file_);
+        }
+#else
+        if (data_ != NULL) {
+            munmap(const_cast<uint8_t *>(data_), size_);
+        }
+#endif
     }
+
+    const uint8_t *get_data() const { return data_; }
+    size_t get_size() const { return size_; }
 };
 
-class PressureTransmitter {
+// Named memory shared between processes: a POSIX shm object, or a
+// pagefile-backed file mapping on Windows. The creator sizes and owns the
+// segment; other processes attach to it by name. Creating a name another
+// live process owns fails instead of taking its segment over.
+class SharedMemorySegment {
   private:
-    string code_;
-    double pressure_;
-
-  public:
-    explicit PressureTransmitter(
-        const string &code,
-        double pressure = SystemConstants::INITIAL_PRESSURE)
-        : code_(code), pressure_(pressure) {}
-
-    const string &get_code() const { return code_; }
-    double read_pressure() const { return pressure_; }
-
-    void update_pressure(const Valve &enter_valve,
-                         const Valve &exit_valve,
-                         const LiquidPump &pump) {
-
-        if (pump.is_on()) {
-            // --- Pump is ON ---
-            if (enter_valve.is_open() && exit_valve.is_open()) {
-                // Normal operation: stabilize at 33 psi
-                // Gradually approach normal pressure if not already there
-                if (pressure_ < SystemConstants::NORMAL_OPERATING_PRESSURE) {
-                    pressure_ += SystemConstants::PRESSURE_INCREMENT;
-                    if (pressure_ > SystemConstants::NORMAL_OPERATING_PRESSURE) {
-                        pressure_ = SystemConstants::NORMAL_OPERATING_PRESSURE;
-                    }
-                } else if (pressure_ > SystemConstants::NORMAL_OPERATING_PRESSURE) {
-                    pressure_ -= SystemConstants::PRESSURE_INCREMENT;
-                    if (pressure_ < SystemConstants::NORMAL_OPERATING_PRESSURE) {
-                        pressure_ = SystemConstants::NORMAL_OPERATING_PRESSURE;
-                    }
-                }
-            } else if (!exit_valve.is_open() && enter_valve.is_open()) { 
-                // Exit valve closed, pump running - pressure builds up gradually
-                // Flow rate immediately drops to 0 lts/min when discharge valve closes
-                pressure_ += SystemConstants::PRESSURE_INCREMENT;
-                // Pressure will build until it reaches HIGH_PRESSURE_THRESHOLD and pump stops
-            } else { 
-                // Enter valve closed - pump can't draw liquid, pressure drops to zero
-                if (pressure_ > SystemConstants::INITIAL_PRESSURE) {
-                    pressure_ -= SystemConstants::PRESSURE_INCREMENT;
-                    if (pressure_ < SystemConstants::INITIAL_PRESSURE) {
-                        pressure_ = SystemConstants::INITIAL_PRESSURE;
-                    }
-                } else {
-                    pressure_ = SystemConstants::INITIAL_PRESSURE;
-                }
+    void *data_;
+    size_t size_;
+    string name_;
+    bool owner_;
+#ifdef _WIN32
+    HANDLE mapping_;
+#else
+    int lock_fd_; // Owner only: holds the lock that marks the owner alive
+
+    // The owner keeps an exclusive flock on the object while it lives. An
+    // object nobody holds locked was left by an owner that died before
+    // unlinking it, and is replaced.
+    static int create_owned(const string &name) {
+        int fd = shm_open(name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0666);
+        if (fd < 0 && errno == EEXIST) {
+            int existing = shm_open(name.c_str(), O_RDWR, 0);
+            bool alive =
+                existing >= 0 && flock(existing, LOCK_EX | LOCK_NB) != 0;
+            if (existing >= 0) {
+                close(existing);
             }
-        } else {
-            // --- Pump is OFF ---
-            // Handle pressure behavior based on pump stop reason and valve states
-            if (pump.get_state() == STOPPED_FLOW_ALARM) {
-                // After flow alarm shutdown: pressure behavior depends on discharge valve
-                if (exit_valve.is_open()) {
-                    // Discharge valve open: pressure drops to 0 psi gradually
-                    if (pressure_ > SystemConstants::INITIAL_PRESSURE) {
-                        pressure_ -= SystemConstants::PRESSURE_INCREMENT;
-                        if (pressure_ < SystemConstants::INITIAL_PRESSURE) {
-                            pressure_ = SystemConstants::INITIAL_PRESSURE;
-                        }
-                    }
-                }
-                // If discharge valve closed: pressure maintains last value (no change)
-            } else {
-                // For other stop reasons (high pressure, target reached, etc.)
-                if (exit_valve.is_open()) {
-                    // Valve open, pressure decays gradually toward zero
-                    if (pressure_ > SystemConstants::INITIAL_PRESSURE) {
-                        pressure_ -= SystemConstants::PRESSURE_INCREMENT * 0.7; // Controlled decay
-                        if (pressure_ < SystemConstants::INITIAL_PRESSURE) {
-                            pressure_ = SystemConstants::INITIAL_PRESSURE;
-                        }
-                    }
-                }
-                // If exit valve closed and pump off, pressure remains at current level
+            if (alive) {
+                throw runtime_error(
+                    "Shared memory in use by another process: " + name);
             }
+            shm_unlink(name.c_str());
+            fd = shm_open(name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0666);
         }
-
-        // Ensure pressure doesn't go below zero or above maximum safe limits
-        if (pressure_ < SystemConstants::INITIAL_PRESSURE) {
-            pressure_ = SystemConstants::INITIAL_PRESSURE;
+        if (fd < 0) {
+            throw runtime_error("Could not open shared memory: " + name);
         }
-        // Note: No upper limit check here as high pressure should trigger pump shutdown
+        if (flock(fd, LOCK_EX | LOCK_NB) != 0) {
+            close(fd);
+            throw runtime_error(
+                "Shared memory in use by another process: " + name);
+        }
+        return fd;
     }
-};
+#endif
 
-class PumpLine {
-  private:
-    LiquidPump pump_;
-    Valve enter_valve_;
-    Valve exit_valve_;
-    FlowSwitch flow_switch_;
-    PressureTransmitter pressure_transmitter_;
-    LiquidTank tank_;
-
-PumpLine(const string &pump_code, // Private constructor
-             const string &enter_valve_code,
-             const string &exit_valve_code,
-             const string &flow_switch_code,
-             const string &pressure_transmitter_code,
-             const string &tank_code,
-             const string &liquid_name,
-             double max_capacity,
-             double current_capacity,
-             const string &level_transmitter_code)
-        : pump_(pump_code), enter_valve_(enter_valve_code),
-          exit_valve_(exit_valve_code), flow_switch_(flow_switch_code),
-          pressure_transmitter_(pressure_transmitter_code),
-          tank_(tank_code,
-                level_transmitter_code,
-                liquid_name,
-                max_capacity,
-                current_capacity) {}
+    // Disable copying: the mapping is owned by exactly one instance
+    SharedMemorySegment(const SharedMemorySegment &);
+    SharedMemorySegment &operator=(const SharedMemorySegment &);
 
   public:
-    // Single creation method for standard paint lines - SIMPLIFIED
-    static PumpLine create_standard_paint_line(const string &pump_code,
-                                               const string &liquid_name) {
-        if (pump_code.empty())
-            throw invalid_argument("Pump code required");
-        if (liquid_name.empty())
-            throw invalid_argument("Liquid name required");
-
-        string numeric_pump_code = pump_code.substr(1); // "201" from "P201"
-        string last_two_digits = pump_code.substr(2);   // "01" from "P201"
-
-        string enter_valve = "V" + numeric_pump_code;
-        string exit_valve = "V4" + last_two_digits;
-        string flow_switch = "FS" + numeric_pump_code;
-        string pressure_transmitter = "PT4" + last_two_digits;
-        string tank = "TQ" + numeric_pump_code;
-        string level_transmitter = "LT" + numeric_pump_code;
-
-        double max_capacity = SystemConstants::INITIAL_TANK_CAPACITY;
-        double current_capacity =
-            max_capacity * SystemConstants::INITIAL_BASE_TANK_LEVELS / 100.0;
-
-        return PumpLine(pump_code, enter_valve, exit_valve, flow_switch,
-                        pressure_transmitter, tank, liquid_name, max_capacity,
-                        current_capacity, level_transmitter);
-    }
-
-    const LiquidPump &get_pump() const { return pump_; }
-    const Valve &get_enter_valve() const { return enter_valve_; }
-    const Valve &get_exit_valve() const { return exit_valve_; }
-    const FlowSwitch &get_flow_switch() const { return flow_switch_; }
-    const PressureTransmitter &get_pressure_transmitter() const {
-        return pressure_transmitter_;
-    }
-    const LiquidTank &get_tank() const { return tank_; }
-
-    LiquidPump &get_pump_mutable() { return pump_; }
-    Valve &get_enter_valve_mutable() { return enter_valve_; }
-    Valve &get_exit_valve_mutable() { return exit_valve_; }
-    LiquidTank &get_tank_mutable() { return tank_; }
-
-    void update_system_state() {
-        // Calculate actual flow rate based on current pump and valve states
-        double physical_flow = pump_.get_actual_flow_rate(enter_valve_, exit_valve_);
-        bool pump_should_be_flowing = pump_.is_on();
-        
-        // Evaluate flow switch status based on physical flow and pump expectation
-        // Flow switch will alarm if pump is on but no flow due to valve closure or blockage
-        flow_switch_.evaluate_status(physical_flow, pump_should_be_flowing);
-
-        // Order of updates matters for proper simulation:
-        // 1. Update pressure based on current valve/pump states (BEFORE pump state changes)
-        pressure_transmitter_.update_pressure(enter_valve_, exit_valve_, pump_);
-        
-        // 2. Update pump state based on flow switch status and new pressure readings
-        pump_.update_pump_state(flow_switch_, pressure_transmitter_.read_pressure(), enter_valve_, exit_valve_);
-
-        // 3. Increment elapsed time if pump is (still) running after state update
-        if (pump_.is_on()) {
-            pump_.increment_elapsed_time(1.0); // Increment by 1 second
+    SharedMemorySegment(const string &name, size_t size, bool create)
+        : data_(NULL), size_(size), name_(name), owner_(create) {
+#ifdef _WIN32
+        if (create) {
+            mapping_ = CreateFileMappingA(INVALID_HANDLE_VALUE, NULL,
+                                          PAGE_READWRITE, 0,
+                                          static_cast<DWORD>(size),
+                                          name.c_str());
+            // A mapping outlives no process holding it, so one that
+            // already exists has a live owner
+            if (mapping_ != NULL && GetLastError() == ERROR_ALREADY_EXISTS) {
+                CloseHandle(mapping_);
+                throw runtime_error(
+                    "Shared memory in use by another process: " + name);
+            }
+        } else {
+            mapping_ = OpenFileMappingA(FILE_MAP_ALL_ACCESS, FALSE,
+                                        name.c_str());
         }
-    }
-
-    bool need_to_pump() const {
-        // Check if pump has reached its target duration
-        if (pump_.get_elapsed_seconds() >= pump_.get_target_duration()) {
-            return false; // Target reached, no more pumping needed
+        if (mapping_ == NULL) {
+            throw runtime_error("Could not open shared memory: " + name);
         }
-        
-        // Check if pump has a valid target (greater than 0)
-        if (pump_.get_target_duration() <= 0.0) {
-            return false; // No target set, no pumping needed
+        data_ = MapViewOfFile(mapping_, FILE_MAP_ALL_ACCESS, 0, 0, size);
+        if (data_ == NULL) {
+            CloseHandle(mapping_);
+            throw runtime_error("Could not map shared memory: " + name);
         }
-        
-        // Check pump state and conditions
-        PumpState state = pump_.get_state();
-        
-        // Pump needs to continue if it's currently running
-        if (state == RUNNING) {
-            return true; // Currently pumping and hasn't reached target
+#else
+        int fd = create ? create_owned(name)
+                        : shm_open(name.c_str(), O_RDWR, 0);
+        if (fd < 0) {
+            throw runtime_error("Could not open shared memory: " + name);
         }
-        
-        // For stopped pumps, check if they can potentially restart
-        if (state == STOPPED_FLOW_ALARM || state == STOPPED_HIGH_PRESSURE || state == STOPPED_LOW_PRESSURE) {
-            // These states can potentially restart if conditions improve
-            // Also check if valves are in proper state for pumping
-            if (enter_valve_.is_open() && exit_valve_.is_open()) {
-                return true; // Conditions allow potential restart
+        struct stat info;
+        bool sized = create ? ftruncate(fd, static_cast<off_t>(size)) == 0
+                            : fstat(fd, &info) == 0 &&
+                                  static_cast<size_t>(info.st_size) >= size;
+        if (!sized) {
+            close(fd);
+            if (create) {
+                shm_unlink(name.c_str());
             }
+            throw runtime_error("Shared memory has the wrong size: " + name);
         }
-        
-        // If stopped due to target reached, no more pumping needed
-        return false;
+        void *mapped =
+            mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        if (mapped == MAP_FAILED) {
+            close(fd);
+            if (create) {
+                shm_unlink(name.c_str());
+            }
+            throw runtime_error("Could not map shared memory: " + name);
+        }
+        // The mapping stays valid without the descriptor; the owner keeps
+        // it for the lock
+        lock_fd_ = create ? fd : -1;
+        if (!create) {
+            close(fd);
+        }
+        data_ = mapped;
+#endif
     }
-};
-
-class LowLevelSwitch {
-  private:
-    string code_;
-    bool status_;
 
-  public:
-    explicit LowLevelSwitch(const string &code,
-                            bool initial_status = SystemConstants::ALARM_STATUS)
-        : code_(code), status_(initial_status) {
-        if (code.empty()) {
-            throw invalid_argument("LowLevelSwitch code cannot be empty");
+    ~SharedMemorySegment() {
+#ifdef _WIN32
+        UnmapViewOfFile(data_);
+        CloseHandle(mapping_);
+#else
+        munmap(data_, size_);
+        if (owner_) {
+            shm_unlink(name_.c_str());
+            close(lock_fd_);
         }
+#endif
     }
 
-    void set_status(bool new_status) { status_ = new_status; }
-    bool is_normal() const { return status_ == SystemConstants::NORMAL_STATUS; }
-    bool is_alarm() const { return status_ == SystemConstants::ALARM_STATUS; }
-    const string &get_code() const { return code_; }
+    void *get_data() const { return data_; }
+    size_t get_size() const { return size_; }
 };
 
-class MixerMotor {
-    ;
+// Seconds a batch spent in each phase. Waiting is the mixer's idle time
+// between the previous lot and this one.
+struct BatchCycleTimes {
+    double phase_seconds[BATCH_EMPTYING + 1];
 
-  private:
-    string code_;
-    bool is_on_;
-    double elapsed_time_;
-    double target_time_;
+    BatchCycleTimes() { clear(); }
 
-  public:
-    explicit MixerMotor(const string &code,
-                        bool initial_state = false,
-                        double target_time = 30)
-        : code_(code), is_on_(initial_state), elapsed_time_(0),
-          target_time_(target_time) {
-        if (code.empty()) {
-            throw invalid_argument("MixerMotor code cannot be empty");
+    void clear() {
+        for (int i = 0; i <= BATCH_EMPTYING; ++i) {
+            phase_seconds[i] = 0.0;
         }
     }
 
-    void start() {
-        is_on_ = true;
-        elapsed_time_ = 0.0; // Reset elapsed time when starting
-    }
-    void stop() { is_on_ = false; }
-    void reset() { 
-        is_on_ = false; 
-        elapsed_time_ = 0.0; // Reset elapsed time completely
-    }
-    bool is_running() const { return is_on_; }
-    const string &get_code() const { return code_; }
-    double get_elapsed_time() const { return elapsed_time_; }
-    double get_target_time() const { return target_time_; }
-    double get_time_left() const { return target_time_ - elapsed_time_; }
-    double update_mixing_progress(double elapsed_seconds) {
-        if (is_on_) {
-            elapsed_time_ += elapsed_seconds;
-            if (elapsed_time_ >= target_time_) {
-                elapsed_time_ = target_time_;
-                stop();
-            }
+    double get_total() const {
+        double total = 0.0;
+        for (int i = 0; i <= BATCH_EMPTYING; ++i) {
+            total += phase_seconds[i];
         }
-        return get_time_left();
+        return total;
     }
 };
 
-class MixerTank {
+// Online production KPIs. Every figure is an accumulator updated only when a
+// pump changes state or the batch changes phase; intervals still open are
+// closed on read, so nothing is done per tick.
+class KpiTracker : public PlantObserver {
   private:
-    LevelTransmitter level_transmitter_;
-    LowLevelSwitch low_level_switch_;
-    MixerMotor mixer_motor_;
-    double current_capacity_;
-    double max_capacity_;
-    string code_;
-    // Emptying timer variables
-    bool emptying_active_;
-    double emptying_elapsed_time_;
-    double emptying_rate_percent_per_second_;
-
-    void update_low_level_switch() {
-        double level_percent = (current_capacity_ / max_capacity_) * 100.0;
-        if (level_percent < 10.0) { // 10% threshold for alarm
-            low_level_switch_.set_status(SystemConstants::ALARM_STATUS);
-        } else {
-            low_level_switch_.set_status(SystemConstants::NORMAL_STATUS);
+    struct PumpKpi {
+        string code;
+        PumpState state;
+        double state_since;
+        double seconds_in_state[PUMP_STATE_COUNT];
+        unsigned overpressure_trips;
+    };
+
+    // Totals at the start of the current CSV window
+    struct WindowSnapshot {
+        double start_time;
+        unsigned batches_completed;
+        double cycle_seconds;
+        double phase_seconds[BATCH_EMPTYING + 1];
+        vector<double> running_seconds;
+        vector<unsigned> overpressure_trips;
+    };
+
+    vector<PumpKpi> pumps_;
+    BatchPhase phase_;
+    double phase_since_;
+    double phase_totals_[BATCH_EMPTYING + 1];
+    BatchCycleTimes current_batch_;
+    BatchCycleTimes last_batch_;
+    unsigned batches_completed_;
+    double completed_cycle_seconds_;
+
+    string csv_path_;
+    double window_seconds_;
+    WindowSnapshot window_;
+
+    double pump_seconds_in_state(const PumpKpi &pump, PumpState state,
+                                 double now) const {
+        double seconds = pump.seconds_in_state[state];
+        if (pump.state == state) {
+            seconds += now - pump.state_since;
         }
+        return seconds;
     }
 
-  public:
-    MixerTank(const string &code,
-              const string &level_transmitter_code,
-              double max_capacity = SystemConstants::MIXER_TANK_CAPACITY,
-              double initial_capacity = 0.0)
-        : level_transmitter_(level_transmitter_code),
-          low_level_switch_(code, SystemConstants::ALARM_STATUS),
-          mixer_motor_(code), current_capacity_(initial_capacity),
-          max_capacity_(max_capacity), code_(code),
-          emptying_active_(false), emptying_elapsed_time_(0.0),
-          emptying_rate_percent_per_second_(4.0) {
-        if (code.empty()) {
-            throw invalid_argument("MixerTank code cannot be empty");
-        }
-        if (max_capacity <= 0) {
-            throw invalid_argument("MixerTank max capacity must be positive");
-        }
-        if (initial_capacity < 0 || initial_capacity > max_capacity) {
-            throw invalid_argument(
-                "MixerTank initial capacity must be between 0 and max "
-                "capacity");
+    double phase_total(BatchPhase phase, double now) const {
+        double seconds = phase_totals_[phase];
+        if (phase_ == phase) {
+            seconds += now - phase_since_;
         }
+        return seconds;
     }
 
-    const string &get_code() const { return code_; }
-    const LevelTransmitter &get_level_transmitter() const {
-        return level_transmitter_;
-    }
-    const LowLevelSwitch &get_low_level_switch() const {
-        return low_level_switch_;
-    }
-    const MixerMotor &get_mixer_motor() const { return mixer_motor_; }
-    double get_current_capacity() const { return current_capacity_; }
-    double get_max_capacity() const { return max_capacity_; }
-    double get_level() const {
-        return level_transmitter_.read_level(
-            const_cast<double &>(current_capacity_),
-            const_cast<double &>(max_capacity_));
+    void take_window_snapshot(double now) {
+        window_.start_time = now;
+        window_.batches_completed = batches_completed_;
+        window_.cycle_seconds = completed_cycle_seconds_;
+        for (int i = 0; i <= BATCH_EMPTYING; ++i) {
+            window_.phase_seconds[i] =
+                phase_total(static_cast<BatchPhase>(i), now);
+        }
+        window_.running_seconds.resize(pumps_.size());
+        window_.overpressure_trips.resize(pumps_.size());
+        for (size_t i = 0; i < pumps_.size(); ++i) {
+            window_.running_seconds[i] =
+                pump_seconds_in_state(pumps_[i], RUNNING, now);
+            window_.overpressure_trips[i] = pumps_[i].overpressure_trips;
+        }
     }
 
-    void add_liquid(double liters) {
-        current_capacity_ += liters;
-        if (current_capacity_ > max_capacity_) {
-            current_capacity_ = max_capacity_;
+    void write_csv_header() {
+        ofstream out(csv_path_.c_str(), ios::trunc);
+        if (!out) {
+            return; // KPI export is best effort, the plant keeps running
         }
-        update_low_level_switch();
+        out << "fin_ventana_s,lotes,ciclo_promedio_s,espera_s,bombeo_s,"
+               "mezcla_s,vaciado_s";
+        for (size_t i = 0; i < pumps_.size(); ++i) {
+            out << "," << pumps_[i].code << "_utilizacion_pct,"
+                << pumps_[i].code << "_disparos_sobrepresion";
+        }
+        out << "\n";
     }
 
-    void start_emptying() {
-        emptying_active_ = true;
-        emptying_elapsed_time_ = 0.0;
+    void write_csv_window(double now) {
+        ofstream out(csv_path_.c_str(), ios::app);
+        if (!out) {
+            return;
+        }
+        double window_length = now - window_.start_time;
+        unsigned lots = batches_completed_ - window_.batches_completed;
+        double average_cycle =
+            lots > 0 ? (completed_cycle_seconds_ - window_.cycle_seconds) / lots
+                     : 0.0;
+        out << now << "," << lots << "," << average_cycle;
+        for (int i = 0; i <= BATCH_EMPTYING; ++i) {
+            out << ","
+                << phase_total(static_cast<BatchPhase>(i), now) -
+                       window_.phase_seconds[i];
+        }
+        for (size_t i = 0; i < pumps_.size(); ++i) {
+            double running = pump_seconds_in_state(pumps_[i], RUNNING, now) -
+                             window_.running_seconds[i];
+            out << ","
+                << (window_length > 0 ? running / window_length * 100.0 : 0.0)
+                << ","
+                << pumps_[i].overpressure_trips -
+                       window_.overpressure_trips[i];
+        }
+        out << "\n";
     }
 
-    void stop_emptying() {
-        emptying_active_ = false;
-        emptying_elapsed_time_ = 0.0;
-    }
+  public:
+    KpiTracker(const Factory &factory, const string &csv_path,
+               double window_seconds = 60.0)
+        : phase_(factory.get_batch_phase()),
+          phase_since_(factory.get_sim_time()), batches_completed_(0),
+          completed_cycle_seconds_(0.0), csv_path_(csv_path),
+          window_seconds_(window_seconds) {
+        if (window_seconds <= 0) {
+            throw invalid_argument("KPI window must be positive");
+        }
+        for (int i = 0; i <= BATCH_EMPTYING; ++i) {
+            phase_totals_[i] = 0.0;
+        }
 
-    bool is_emptying() const {
-        return emptying_active_;
-    }
+        const PumpLineMap &pump_lines = factory.get_all_pump_lines();
+        for (PumpLineMap::const_iterator it = pump_lines.begin();
+             it != pump_lines.end(); ++it) {
+            PumpKpi pump;
+            pump.code = it->second.get_pump().get_code();
+            pump.state = it->second.get_pump().get_state();
+            pump.state_since = factory.get_sim_time();
+            for (int i = 0; i < PUMP_STATE_COUNT; ++i) {
+                pump.seconds_in_state[i] = 0.0;
+            }
+            pump.overpressure_trips = 0;
+            pumps_.push_back(pump);
+        }
 
-    double get_emptying_elapsed_time() const {
-        return emptying_elapsed_time_;
+        take_window_snapshot(factory.get_sim_time());
+        write_csv_header();
     }
 
-    double update_emptying_progress(double elapsed_seconds) {
-        if (!emptying_active_ || current_capacity_ <= 0) {
-            if (current_capacity_ <= 0) {
-                stop_emptying();
-            }
-            return 0.0;
+    void on_pump_state_changed(size_t line_index, const PumpLine &pump_line,
+                               PumpState previous_state, double sim_time) {
+        if (line_index >= pumps_.size()) {
+            return;
         }
-        
-        emptying_elapsed_time_ += elapsed_seconds;
-        
-        double amount_to_drain = (max_capacity_ * emptying_rate_percent_per_second_ / 100.0) * elapsed_seconds;
-        double actually_drained;
-        
-        if (current_capacity_ >= amount_to_drain) {
-            actually_drained = amount_to_drain;
-            current_capacity_ -= amount_to_drain;
-        } else {
-            actually_drained = current_capacity_;
-            current_capacity_ = 0.0;
-            stop_emptying(); // Automatically stop when empty
+        PumpKpi &pump = pumps_[line_index];
+        pump.seconds_in_state[previous_state] += sim_time - pump.state_since;
+        pump.state = pump_line.get_pump().get_state();
+        pump.state_since = sim_time;
+        if (pump.state == STOPPED_HIGH_PRESSURE) {
+            ++pump.overpressure_trips;
         }
-        
-        update_low_level_switch();
-        return actually_drained;
     }
 
-    double empty_tank(double empty_rate_percent_per_second = 4.0) {
-        if (current_capacity_ <= 0) {
-            return 0.0;
+    void on_batch_phase_changed(BatchPhase previous_phase,
+                                BatchPhase new_phase, double sim_time) {
+        double seconds = sim_time - phase_since_;
+        phase_totals_[previous_phase] += seconds;
+        current_batch_.phase_seconds[previous_phase] += seconds;
+        phase_ = new_phase;
+        phase_since_ = sim_time;
+
+        if (new_phase == BATCH_IDLE) {
+            last_batch_ = current_batch_;
+            current_batch_.clear();
+            ++batches_completed_;
+            completed_cycle_seconds_ += last_batch_.get_total();
         }
-        
-        double amount_to_drain = (max_capacity_ * empty_rate_percent_per_second / 100.0);
-        double actually_drained;
-        
-        if (current_capacity_ >= amount_to_drain) {
-            actually_drained = amount_to_drain;
-            current_capacity_ -= amount_to_drain;
-        } else {
-            actually_drained = current_capacity_;
-            current_capacity_ = 0.0;
+    }
+
+    // O(1) unless a window closed; call once per scan after the clock moved
+    void export_if_window_elapsed(double now) {
+        if (now - window_.start_time < window_seconds_) {
+            return;
         }
-        
-        update_low_level_switch();
-        return actually_drained;
+        write_csv_window(now);
+        take_window_snapshot(now);
     }
 
-    bool is_empty() const {
-        return current_capacity_ <= 0.0;
+    unsigned get_batches_completed() const { return batches_completed_; }
+    const BatchCycleTimes &get_last_batch() const { return last_batch_; }
+    size_t get_pump_count() const { return pumps_.size(); }
+    const string &get_pump_code(size_t index) const {
+        return pumps_[index].code;
+    }
+    unsigned get_overpressure_trips(size_t index) const {
+        return pumps_[index].overpressure_trips;
     }
 
-    void reset_emptying() {
-        emptying_active_ = false;
-        emptying_elapsed_time_ = 0.0;
+    double get_seconds_in_state(size_t index, PumpState state,
+                                double now) const {
+        return pump_seconds_in_state(pumps_[index], state, now);
     }
 
-    LowLevelSwitch &get_low_level_switch_mutable() { return low_level_switch_; }
-    MixerMotor &get_mixer_motor_mutable() { return mixer_motor_; }
-};
+    double get_utilisation_percent(size_t index, double now) const {
+        return now > 0 ? get_seconds_in_state(index, RUNNING, now) / now *
+                             100.0
+                       : 0.0;
+    }
 
-class Factory {
-  private:
-    map<string, PumpLine> pump_lines_;
-    bool batch_in_process_;
-    bool emptying_in_process_;
-    MixerTank mixer_tank_;
+    double get_mixer_idle_seconds(double now) const {
+        return phase_total(BATCH_IDLE, now);
+    }
 
-    // Private constructor ensures controlled initialization
-    explicit Factory(const vector<PumpLine> &pump_lines)
-        : batch_in_process_(false), emptying_in_process_(false),
-          mixer_tank_("M401",
-                      "LT401",
-                      SystemConstants::MIXER_TANK_CAPACITY,
-                      SystemConstants::INITIAL_MIXER_TANK_LEVEL) {
-        if (pump_lines.empty()) {
-            throw runtime_error("Factory must have at least one pump line");
-        }
-        for (size_t i = 0; i < pump_lines.size(); ++i) {
-            const PumpLine& line = pump_lines[i];
-            pump_lines_.insert(make_pair(line.get_pump().get_code(), line));
-        }
+    double get_average_cycle_seconds() const {
+        return batches_completed_ > 0
+                   ? completed_cycle_seconds_ / batches_completed_
+                   : 0.0;
     }
+};
 
-  public:
-    static Factory create_dupont_paint_factory() { // Standard Dupont setup
-        vector<PumpLine> pump_lines;
+enum AlarmPriority {
+    ALARM_PRIORITY_LOW,
+    ALARM_PRIORITY_MEDIUM,
+    ALARM_PRIORITY_HIGH,
+    ALARM_PRIORITY_CRITICAL
+};
 
-        pump_lines.push_back(
-            PumpLine::create_standard_paint_line("P201", "Blanco"));
-        pump_lines.push_back(
-            PumpLine::create_standard_paint_line("P202", "Azul"));
-        pump_lines.push_back(
-            PumpLine::create_standard_paint_line("P203", "Negro"));
+enum AlarmJournalEvent {
+    ALARM_RAISED,
+    ALARM_CLEARED,
+    ALARM_ACKNOWLEDGED,
+    ALARM_SHELVED,
+    ALARM_UNSHELVED,
+    ALARM_CHATTERING
+};
 
-        return Factory(pump_lines);
-    }
+// Fixed-size journal record so the ring never allocates
+struct AlarmJournalEntry {
+    double sim_time;
+    unsigned alarm_id;
+    AlarmJournalEvent event;
+    AlarmPriority priority;
+    bool annunciated; // False when shelving or chattering suppressed it
+};
 
-    // Static factory method for custom configurations
-    static Factory create_custom_factory(const vector<PumpLine> &pump_lines) {
-        return Factory(pump_lines);
+static const char *alarm_priority_name(AlarmPriority priority) {
+    switch (priority) {
+    case ALARM_PRIORITY_LOW:
+        return "BAJA";
+    case ALARM_PRIORITY_MEDIUM:
+        return "MEDIA";
+    case ALARM_PRIORITY_HIGH:
+        return "ALTA";
+    case ALARM_PRIORITY_CRITICAL:
+        return "CRITICA";
     }
+    return "DESCONOCIDA";
+}
 
-    const MixerTank &get_mixer_tank() const { return mixer_tank_; }
-    MixerTank &get_mixer_tank_mutable() { return mixer_tank_; }
-
-    bool need_to_mix() const {
-        return mixer_tank_.get_low_level_switch().is_alarm() &&
-               !batch_in_process_;
+static const char *alarm_event_name(AlarmJournalEvent event) {
+    switch (event) {
+    case ALARM_RAISED:
+        return "ACTIVADA";
+    case ALARM_CLEARED:
+        return "NORMALIZADA";
+    case ALARM_ACKNOWLEDGED:
+        return "RECONOCIDA";
+    case ALARM_SHELVED:
+        return "ARCHIVADA";
+    case ALARM_UNSHELVED:
+        return "DESARCHIVADA";
+    case ALARM_CHATTERING:
+        return "INTERMITENTE";
     }
+    return "DESCONOCIDO";
+}
 
-    bool is_batch_in_process() const { return batch_in_process_; }
-
-    bool is_emptying_in_process() const { return emptying_in_process_; }
+// Alarm subsystem. Alarms are evaluated only on the edges the plant reports
+// from its update paths, never by rescanning tags. Raising an active alarm
+// is a no-op, an alarm that activates too often inside the chatter window is
+// suppressed until it calms down, and shelved alarms are journaled but not
+// annunciated. The journal is a lock-free ring any one reader can drain
+// without blocking the scan; entries are dropped (and counted) when full.
+class AlarmManager : public PlantObserver {
+  public:
+    struct Alarm {
+        string tag;
+        string message;
+        AlarmPriority priority;
+        bool active;
+        bool acknowledged;
+        double activated_at;
+        double shelved_until;
+        bool chattering;
+        double chatter_window_start;
+        int activations_in_window;
+    };
+
+    typedef SpscRing<AlarmJournalEntry, 256> Journal;
 
-    bool is_batch_complete() const {
-        return !batch_in_process_ && !emptying_in_process_ && 
-               mixer_tank_.is_empty() && !pump_lines_need_to_pump();
+  private:
+    vector<Alarm> alarms_;
+    vector<unsigned> flow_alarm_ids_;     // By line index
+    vector<unsigned> pressure_alarm_ids_; // By line index
+    unsigned low_level_alarm_id_;
+    Journal journal_;
+    unsigned long dropped_entries_;
+    // Active or unacknowledged alarms by priority, ascending id: the only
+    // ones that can be annunciated, so displays never walk the whole table
+    set<unsigned> standing_[ALARM_PRIORITY_CRITICAL + 1];
+
+    void update_standing(unsigned id) {
+        const Alarm &alarm = alarms_[id];
+        if (alarm.active || !alarm.acknowledged) {
+            standing_[alarm.priority].insert(id);
+        } else {
+            standing_[alarm.priority].erase(id);
+        }
     }
 
-    void set_batch_in_process() {
-        if (!batch_in_process_) {
-            batch_in_process_ = true;
-        };
+    unsigned define_alarm(const string &tag, const string &message,
+                          AlarmPriority priority) {
+        Alarm alarm;
+        alarm.tag = tag;
+        alarm.message = message;
+        alarm.priority = priority;
+        alarm.active = false;
+        alarm.acknowledged = true;
+        alarm.activated_at = 0.0;
+        alarm.shelved_until = 0.0;
+        alarm.chattering = false;
+        alarm.chatter_window_start = 0.0;
+        alarm.activations_in_window = 0;
+        alarms_.push_back(alarm);
+        return static_cast<unsigned>(alarms_.size() - 1);
     }
 
-    const PumpLine &get_pump_line(const string &pump_code) const {
-        map<string, PumpLine>::const_iterator it = pump_lines_.find(pump_code);
-        if (it == pump_lines_.end()) {
-            throw runtime_error("Pump line not found: " + pump_code);
+    void journal(unsigned id, AlarmJournalEvent event, double sim_time,
+                 bool annunciated) {
+        AlarmJournalEntry entry;
+        entry.sim_time = sim_time;
+        entry.alarm_id = id;
+        entry.event = event;
+        entry.priority = alarms_[id].priority;
+        entry.annunciated = annunciated;
+        if (!journal_.try_push(entry)) {
+            ++dropped_entries_;
         }
-        return it->second;
     }
 
-    PumpLine &get_pump_line_mutable(const string &pump_code) {
-        map<string, PumpLine>::iterator it = pump_lines_.find(pump_code);
-        if (it == pump_lines_.end()) {
-            throw runtime_error("Pump line not found: " + pump_code);
+    void update_chatter(Alarm &alarm, unsigned id, double sim_time) {
+        if (sim_time - alarm.chatter_window_start >
+            SystemConstants::ALARM_CHATTER_WINDOW) {
+            alarm.chatter_window_start = sim_time;
+            alarm.activations_in_window = 0;
+            alarm.chattering = false;
+        }
+        ++alarm.activations_in_window;
+        if (!alarm.chattering && alarm.activations_in_window >
+                                     SystemConstants::ALARM_CHATTER_LIMIT) {
+            alarm.chattering = true;
+            journal(id, ALARM_CHATTERING, sim_time, true);
         }
-        return it->second;
     }
 
-    const map<string, PumpLine> &get_all_pump_lines() const {
-        return pump_lines_;
+    void raise(unsigned id, double sim_time) {
+        Alarm &alarm = alarms_[id];
+        if (alarm.active) {
+            return; // Deduplicated
+        }
+        alarm.active = true;
+        alarm.acknowledged = false;
+        alarm.activated_at = sim_time;
+        update_standing(id);
+        update_chatter(alarm, id, sim_time);
+        journal(id, ALARM_RAISED, sim_time, is_annunciated(id, sim_time));
     }
 
-    void transfer_liquid_to_mixer(double seconds = 1.0) {
-        for (map<string, PumpLine>::iterator it = pump_lines_.begin(); 
-             it != pump_lines_.end(); ++it) {
-            PumpLine& pump_line = it->second;
-            LiquidPump& pump = pump_line.get_pump_mutable();
-            LiquidTank& tank = pump_line.get_tank_mutable();
-            // Check pump state AND valve states for actual liquid transfer
-            if (pump.is_on() &&
-                pump_line.get_enter_valve().is_open() && // Check inlet valve
-                pump_line.get_exit_valve().is_open() &&  // Check outlet valve
-                (pump.get_elapsed_seconds() < pump.get_target_duration())) {
-                double flow_rate = pump.get_flow_rate(); // lts/min
-                double liters_this_cycle = flow_rate / 60.0 * seconds;
-                double drained = tank.drain(liters_this_cycle);
-                mixer_tank_.add_liquid(drained);
-            }
+    void clear(unsigned id, double sim_time) {
+        Alarm &alarm = alarms_[id];
+        if (!alarm.active) {
+            return;
         }
+        alarm.active = false;
+        update_standing(id);
+        journal(id, ALARM_CLEARED, sim_time, is_annunciated(id, sim_time));
     }
 
-    void update_all_pump_lines() {
-        for (map<string, PumpLine>::iterator it = pump_lines_.begin(); 
-             it != pump_lines_.end(); ++it) {
-            it->second.update_system_state();
+  public:
+    explicit AlarmManager(const Factory &factory) : dropped_entries_(0) {
+        const PumpLineMap &pump_lines = factory.get_all_pump_lines();
+        for (PumpLineMap::const_iterator it = pump_lines.begin();
+             it != pump_lines.end(); ++it) {
+            const PumpLine &pump_line = it->second;
+            const string &pump_code = pump_line.get_pump().get_code();
+            flow_alarm_ids_.push_back(define_alarm(
+                pump_line.get_flow_switch().get_code(),
+                "Bajo flujo, bomba " + pump_code + " detenida",
+                ALARM_PRIORITY_HIGH));
+            pressure_alarm_ids_.push_back(define_alarm(
+                pump_line.get_pressure_transmitter().get_code(),
+                "Sobrepresion, bomba " + pump_code + " disparada",
+                ALARM_PRIORITY_CRITICAL));
+        }
+        const MixerTank &mixer_tank = factory.get_mixer_tank();
+        low_level_alarm_id_ = define_alarm(
+            mixer_tank.get_low_level_switch().get_code(),
+            "Bajo nivel en el mezclador", ALARM_PRIORITY_LOW);
+        // The mixer starts empty, so its switch starts in alarm
+        if (mixer_tank.get_low_level_switch().is_alarm()) {
+            raise(low_level_alarm_id_, factory.get_sim_time());
         }
-
-        transfer_liquid_to_mixer();
     }
 
-    void set_pump_times(const std::string &target_color) {
-        if (pump_lines_.empty()) {
-            throw runtime_error("No pump lines available to set times");
+    void on_flow_switch_changed(size_t line_index, const PumpLine &pump_line,
+                                double sim_time) {
+        if (line_index >= flow_alarm_ids_.size()) {
+            return;
         }
-
-        map<string, map<string, double> > color_recipes = SystemConstants::create_color_recipes();
-        map<string, map<string, double> >::iterator color_recipe = color_recipes.find(target_color);
-
-        // for to get the pump in each pumpline, compare if the color content of
-        // the line is one of the targeted and if is, set the time with the
-        // proportions
-
-        for (map<string, PumpLine>::iterator it = pump_lines_.begin(); 
-             it != pump_lines_.end(); ++it) {
-            PumpLine& pump_line = it->second;
-            const LiquidTank& tank = pump_line.get_tank();
-
-            if (color_recipe != color_recipes.end()) {
-                const map<string, double>& recipe = color_recipe->second;
-                map<string, double>::const_iterator recipe_it = recipe.find(tank.get_liquid_in_tank_name());
-                if (recipe_it != recipe.end()) {
-                    double target_liters =
-                        SystemConstants::BATCH_SIZE * recipe_it->second;
-                    pump_line.get_pump_mutable().set_pump_target_liters(
-                        target_liters);
-                } else {
-                    pump_line.get_pump_mutable().set_pump_target_liters(0);
-                }
-            } else {
-                pump_line.get_pump_mutable().set_pump_target_liters(0);
-            }
+        if (pump_line.get_flow_switch().is_alarm()) {
+            raise(flow_alarm_ids_[line_index], sim_time);
+        } else {
+            clear(flow_alarm_ids_[line_index], sim_time);
         }
     }
 
-    void reset() {
-        for (map<string, PumpLine>::iterator it = pump_lines_.begin(); 
-             it != pump_lines_.end(); ++it) {
-            PumpLine& pump_line = it->second;
-            pump_line.get_pump_mutable().set_pump_target_liters(0);
-            pump_line.get_pump_mutable().increment_elapsed_time(
-                -pump_line.get_pump().get_elapsed_seconds());
-            pump_line.get_enter_valve_mutable().set_open(true);
-            pump_line.get_exit_valve_mutable().set_open(true);
+    void on_pump_state_changed(size_t line_index, const PumpLine &pump_line,
+                               PumpState previous_state, double sim_time) {
+        if (line_index >= pressure_alarm_ids_.size()) {
+            return;
+        }
+        if (pump_line.get_pump().get_state() == STOPPED_HIGH_PRESSURE) {
+            raise(pressure_alarm_ids_[line_index], sim_time);
+        } else if (previous_state == STOPPED_HIGH_PRESSURE) {
+            clear(pressure_alarm_ids_[line_index], sim_time);
         }
-        emptying_in_process_ = false;
-        // Reset mixer motor completely
-        mixer_tank_.get_mixer_motor_mutable().reset();
-        // Reset emptying timer
-        mixer_tank_.reset_emptying();
     }
 
-    bool pump_lines_need_to_pump() const {
-        for (map<string, PumpLine>::const_iterator it = pump_lines_.begin(); 
-             it != pump_lines_.end(); ++it) {
-            const PumpLine& pump_line = it->second;
-            if (pump_line.need_to_pump()) {
-                return true;
-            }
+    void on_low_level_switch_changed(const LowLevelSwitch &low_level_switch,
+                                     double sim_time) {
+        if (low_level_switch.is_alarm()) {
+            raise(low_level_alarm_id_, sim_time);
+        } else {
+            clear(low_level_alarm_id_, sim_time);
         }
-        return false;
     }
 
-    bool all_required_pumps_completed() const {
-        // Check if all pumps that have a target have either:
-        // 1. Reached their target duration (STOPPED_TARGET_REACHED), OR
-        // 2. Are permanently unable to continue (valves closed, etc.)
-        // 
-        // IMPORTANT: Pumps that are temporarily stopped (flow alarms, pressure issues)
-        // should NOT be considered completed, as they may restart and continue pumping
-        
-        for (map<string, PumpLine>::const_iterator it = pump_lines_.begin(); 
-             it != pump_lines_.end(); ++it) {
-            const PumpLine& pump_line = it->second;
-            const LiquidPump& pump = pump_line.get_pump();
-            
-            // Skip pumps with no target (target duration = 0)
-            if (pump.get_target_duration() <= 0) {
-                continue;
-            }
-            
-            // Check if this pump has actually completed its target
-            if (pump.get_state() == STOPPED_TARGET_REACHED) {
-                continue; // This pump is truly done
-            }
-            
-            // Check if pump is permanently prevented from continuing due to valve configuration
-            if (!pump_line.get_enter_valve().is_open() || !pump_line.get_exit_valve().is_open()) {
-                // Pump can't continue due to closed valves - consider it "completed" for mixing purposes
-                continue;
-            }
-            
-            // If pump is temporarily stopped (flow alarm, pressure issues) but hasn't reached target,
-            // it should not be considered completed as it may restart
-            if (pump.get_state() == STOPPED_FLOW_ALARM || 
-                pump.get_state() == STOPPED_HIGH_PRESSURE || 
-                pump.get_state() == STOPPED_LOW_PRESSURE) {
-                // Pump is paused but could potentially restart - not completed
-                return false;
-            }
-            
-            // If pump is currently running and hasn't reached target, it's not completed
-            if (pump.get_state() == RUNNING && pump.get_elapsed_seconds() < pump.get_target_duration()) {
-                return false;
-            }
+    void acknowledge(unsigned id, double sim_time) {
+        if (id >= alarms_.size() || alarms_[id].acknowledged) {
+            return;
         }
-        
-        return true; // All required pumps are completed or permanently unable to continue
+        alarms_[id].acknowledged = true;
+        update_standing(id);
+        journal(id, ALARM_ACKNOWLEDGED, sim_time, true);
     }
 
-    void update_mix() {
-        // ENHANCED MIXING CONTROL: Complete check to avoid premature mixing 
-        // Ensures all base colors are fully pumped before mixing starts
-        // Addresses issue where mixer could start when pumps are paused (flow alarms, pressure issues)
-        if (can_start_mixing() && !mixer_tank_.get_mixer_motor().is_running()) {
-            // Start mixing if there's liquid in the tank and batch is in process
-            if (mixer_tank_.get_current_capacity() > 0 && batch_in_process_) {
-                mixer_tank_.get_mixer_motor_mutable().start();
-            }
-        }
-        
-        // If mixer is running, update its progress (advance one second)
-        if (mixer_tank_.get_mixer_motor().is_running()) {
-            mixer_tank_.get_mixer_motor_mutable().update_mixing_progress(1.0);
-            
-            // Check if mixing is complete - ONLY start emptying after mixing is finished
-            if (!mixer_tank_.get_mixer_motor().is_running() && mixer_tank_.get_current_capacity() > 0) {
-                emptying_in_process_ = true;
-                mixer_tank_.start_emptying(); // Start the emptying timer
+    void acknowledge_all(double sim_time) {
+        for (int priority = ALARM_PRIORITY_LOW;
+             priority <= ALARM_PRIORITY_CRITICAL; ++priority) {
+            // acknowledge() may drop the alarm from the set being walked
+            vector<unsigned> ids(standing_[priority].begin(),
+                                 standing_[priority].end());
+            for (size_t i = 0; i < ids.size(); ++i) {
+                acknowledge(ids[i], sim_time);
             }
         }
     }
 
-    void update_emptying() {
-        if (emptying_in_process_) {
-            // Use the new timer-based emptying system
-            mixer_tank_.update_emptying_progress(1.0);
-            
-            // Check if tank is empty - finish batch process
-            if (mixer_tank_.is_empty()) {
-                emptying_in_process_ = false;
-                batch_in_process_ = false;
-                // Batch completion will be handled by UI notification
-            }
+    void shelve(unsigned id, double duration_seconds, double sim_time) {
+        if (id >= alarms_.size() || duration_seconds <= 0) {
+            return;
         }
+        alarms_[id].shelved_until = sim_time + duration_seconds;
+        journal(id, ALARM_SHELVED, sim_time, true);
     }
 
-    void apply_valve_configuration(const SystemConfig &config) {
-        for (map<string, string>::const_iterator it = config.valve_states.begin(); 
+    void unshelve(unsigned id, double sim_time) {
+        if (id >= alarms_.size() || alarms_[id].shelved_until <= sim_time) {
+            return;
+        }
+        alarms_[id].shelved_until = 0.0;
+        journal(id, ALARM_UNSHELVED, sim_time, true);
+    }
+
+    bool is_shelved(unsigned id, double sim_time) const {
+        return alarms_[id].shelved_until > sim_time;
+    }
+
+    // Whether the operator should see this alarm right now
+    bool is_annunciated(unsigned id, double sim_time) const {
+        const Alarm &alarm = alarms_[id];
+        if (is_shelved(id, sim_time)) {
+            return false;
+        }
+        if (alarm.chattering && sim_time - alarm.chatter_window_start <=
+                                    SystemConstants::ALARM_CHATTER_WINDOW) {
+            return false;
+        }
+        return alarm.active || !alarm.acknowledged;
+    }
+
+    // Consumer side of the journal; never blocks the producer
+    bool pop_journal_entry(AlarmJournalEntry &entry) {
+        return journal_.try_pop(entry);
+    }
+
+    size_t get_alarm_count() const { return alarms_.size(); }
+    const set<unsigned> &get_standing_alarms(AlarmPriority priority) const {
+        return standing_[priority];
+    }
+    const Alarm &get_alarm(unsigned id) const { return alarms_[id]; }
+    unsigned long get_dropped_entries() const { return dropped_entries_; }
+};
+
+// Append-only log with group commit. append() only queues the line; a
+// background thread writes whatever is pending and fsyncs once per group, so
+// durable writes never add latency to the scan.
+class DurableAppendLog {
+  private:
+    FILE *file_;
+    vector<string> pending_;
+    mutex mutex_;
+    condition_variable wake_;
+    bool stopping_;
+    thread writer_;
+
+    static void sync_to_disk(FILE *file) {
+        fflush(file);
+#ifdef _WIN32
+        _commit(_fileno(file));
+#else
+        fsync(fileno(file));
+#endif
+    }
+
+    void writer_loop() {
+        vector<string> group;
+        unique_lock<mutex> lock(mutex_);
+        while (true) {
+            wake_.wait_for(
+                lock,
+                chrono::milliseconds(SystemConstants::LOG_GROUP_WINDOW_MS),
+                [this] {
+                    return stopping_ ||
+                           pending_.size() >= SystemConstants::LOG_GROUP_SIZE;
+                });
+            if (pending_.empty()) {
+                if (stopping_) {
+                    return;
+                }
+                continue;
+            }
+            group.swap(pending_);
+            lock.unlock();
+
+            for (size_t i = 0; i < group.size(); ++i) {
+                fputs(group[i].c_str(), file_);
+                fputc('\n', file_);
+            }
+            sync_to_disk(file_);
+            group.clear();
+
+            lock.lock();
+        }
+    }
+
+    // Disable copying: the writer thread is bound to this instance
+    DurableAppendLog(const DurableAppendLog &);
+    DurableAppendLog &operator=(const DurableAppendLog &);
+
+  public:
+    explicit DurableAppendLog(const string &path)
+        : file_(fopen(path.c_str(), "ab")), stopping_(false) {
+        if (file_ == NULL) {
+            throw runtime_error("Could not open append log: " + path);
+        }
+        writer_ = thread(&DurableAppendLog::writer_loop, this);
+    }
+
+    // Flushes and syncs everything still queued before closing the file
+    ~DurableAppendLog() {
+        {
+            lock_guard<mutex> lock(mutex_);
+            stopping_ = true;
+        }
+        wake_.notify_one();
+        writer_.join();
+        fclose(file_);
+    }
+
+    void append(const string &line) {
+        bool group_full;
+        {
+            lock_guard<mutex> lock(mutex_);
+            pending_.push_back(line);
+            group_full =
+                pending_.size() >= SystemConstants::LOG_GROUP_SIZE;
+        }
+        if (group_full) {
+            wake_.notify_one();
+        }
+    }
+};
+
+enum LogLevel { LOG_INFO, LOG_WARNING, LOG_ERROR };
+
+enum LogEvent {
+    LOG_EVENT_CONFIG_MALFORMED_LINE, // number: line
+    LOG_EVENT_CONFIG_ERROR,          // text: message
+    LOG_EVENT_START_ACCEPTED,        // text: colour
+    LOG_EVENT_START_REJECTED,        // number: StartResult
+    LOG_EVENT_BATCH_PHASE,           // number: new BatchPhase
+    LOG_EVENT_PUMP_STATE,            // text: pump, number: new PumpState
+    LOG_EVENT_FLOW_SWITCH,           // text: pump, number: 1 in alarm
+    LOG_EVENT_FILLER_STATE,          // text: colour, number: FillerState
+    LOG_EVENT_SOURCE_TANK,           // text: tank now feeding the line
+    LOG_EVENT_BASE_REFILL,           // text: pump, number: liters delivered
+    LOG_EVENT_REFILL_ORDERED,        // text: pump, number: liters ordered
+    LOG_EVENT_SHARED_COMMANDS,       // number: overrides in force
+    LOG_EVENT_SCAN_OVERRUN,          // number: overruns so far
+    LOG_EVENT_REAL_TIME,             // text: why it is not available
+    LOG_EVENT_DASHBOARD,             // number: port listened on
+    LOG_EVENT_FATAL                  // text: message
+};
+
+// Quoted JSON string; control characters become spaces
+inline void append_json_string(string &out, const char *text) {
+    out += '"';
+    for (const char *c = text; *c != '\0'; ++c) {
+        if (*c == '"' || *c == '\\') {
+            out += '\\';
+            out += *c;
+        } else if (static_cast<unsigned char>(*c) < 0x20) {
+            out += ' ';
+        } else {
+            out += *c;
+        }
+    }
+    out += '"';
+}
+
+// Fixed-size binary event (one cache line); formatting is left to the
+// logger thread. Records carry simulation time only: reading a clock costs
+// as much as the whole write, so wall time is stamped when they are drained.
+struct LogRecord {
+    double sim_time;
+    int32_t number;
+    uint16_t event;
+    uint16_t level;
+    char text[48];
+};
+static_assert(sizeof(LogRecord) == 64, "LogRecord must fill one cache line");
+
+// Structured event log off the control thread. write() copies a LogRecord
+// into a lock-free ring and never blocks or touches the terminal; a
+// background thread turns records into JSON lines and rotates the file by
+// size. Only one thread may call write().
+class AsyncLogger {
+  private:
+    static const size_t RING_SLOTS = 1024;
+
+    SpscRing<LogRecord, RING_SLOTS> ring_;
+    atomic<unsigned long> dropped_; // Records lost to a full ring
+    string path_;
+    FILE *file_;
+    size_t file_bytes_;
+    mutex mutex_;
+    condition_variable wake_;
+    bool stopping_;
+    thread writer_;
+
+    static long long now_unix_ms() {
+        return static_cast<long long>(
+            chrono::duration_cast<chrono::milliseconds>(
+                chrono::system_clock::now().time_since_epoch())
+                .count());
+    }
+
+    static const char *level_name(uint16_t level) {
+        switch (level) {
+        case LOG_WARNING:
+            return "ADVERTENCIA";
+        case LOG_ERROR:
+            return "ERROR";
+        default:
+            return "INFO";
+        }
+    }
+
+    void format_record(const LogRecord &record, long long unix_ms,
+                       string &out) const {
+        ostringstream line;
+        line << "{\"unix_ms\":" << unix_ms << ",\"sim_s\":" << record.sim_time << ",\"nivel\":\""
+             << level_name(record.level) << "\",\"evento\":";
+        const char *text_field = NULL; // Field holding record.text, if any
+        switch (record.event) {
+        case LOG_EVENT_CONFIG_MALFORMED_LINE:
+            line << "\"linea_malformada\",\"linea\":" << record.number;
+            break;
+        case LOG_EVENT_CONFIG_ERROR:
+            line << "\"error_configuracion\"";
+            text_field = "mensaje";
+            break;
+        case LOG_EVENT_START_ACCEPTED:
+            line << "\"arranque\"";
+            text_field = "color";
+            break;
+        case LOG_EVENT_START_REJECTED:
+            line << "\"arranque_rechazado\",\"motivo\":\""
+                 << (record.number == START_REJECTED_MIXER_NOT_EMPTY
+                         ? "mezclador no vacio"
+                         : record.number == START_REJECTED_BASES_SHORT
+                               ? "bases insuficientes para el pedido"
+                               : "lote en curso")
+                 << "\"";
+            break;
+        case LOG_EVENT_BATCH_PHASE:
+            line << "\"fase_lote\",\"fase\":\""
+                 << batch_phase_name(static_cast<BatchPhase>(record.number))
+                 << "\"";
+            break;
+        case LOG_EVENT_PUMP_STATE:
+            line << "\"estado_bomba\",\"estado\":\""
+                 << pump_state_name(static_cast<PumpState>(record.number))
+                 << "\"";
+            text_field = "bomba";
+            break;
+        case LOG_EVENT_FLOW_SWITCH:
+            line << "\"interruptor_flujo\",\"alarma\":"
+                 << (record.number != 0 ? "true" : "false");
+            text_field = "bomba";
+            break;
+        case LOG_EVENT_FILLER_STATE:
+            line << "\"estado_llenadora\",\"estado\":\""
+                 << filler_state_name(static_cast<FillerState>(record.number))
+                 << "\"";
+            text_field = "color";
+            break;
+        case LOG_EVENT_SOURCE_TANK:
+            line << "\"cambio_tanque_base\"";
+            text_field = "tanque";
+            break;
+        case LOG_EVENT_BASE_REFILL:
+            line << "\"reposicion_recibida\",\"litros\":" << record.number;
+            text_field = "bomba";
+            break;
+        case LOG_EVENT_REFILL_ORDERED:
+            line << "\"reposicion_pedida\",\"litros\":" << record.number;
+            text_field = "bomba";
+            break;
+        case LOG_EVENT_SHARED_COMMANDS:
+            line << "\"comandos_compartidos\",\"anulaciones\":"
+                 << record.number;
+            break;
+        case LOG_EVENT_SCAN_OVERRUN:
+            line << "\"sobrepaso_scan\",\"total\":" << record.number;
+            break;
+        case LOG_EVENT_REAL_TIME:
+            line << "\"tiempo_real_no_disponible\"";
+            text_field = "mensaje";
+            break;
+        case LOG_EVENT_DASHBOARD:
+            line << "\"panel_http\",\"url\":\"http://127.0.0.1:"
+                 << record.number << "/\"";
+            break;
+        case LOG_EVENT_FATAL:
+            line << "\"error_critico\"";
+            text_field = "mensaje";
+            break;
+        default:
+            line << "\"desconocido\",\"codigo\":" << record.event;
+            break;
+        }
+        if (text_field != NULL) {
+            line << ",\"" << text_field << "\":";
+        }
+        out += line.str();
+        if (text_field != NULL) {
+            append_json_string(out, record.text);
+        }
+        out += "}\n";
+    }
+
+    string rotated_path(int index) const {
+        ostringstream name;
+        name << path_ << "." << index;
+        return name.str();
+    }
+
+    // file.jsonl -> file.jsonl.1 -> ... -> file.jsonl.N, the oldest is lost
+    void rotate() {
+        fclose(file_);
+        remove(rotated_path(SystemConstants::EVENT_LOG_ROTATED_FILES).c_str());
+        for (int i = SystemConstants::EVENT_LOG_ROTATED_FILES - 1; i >= 1;
+             --i) {
+            rename(rotated_path(i).c_str(), rotated_path(i + 1).c_str());
+        }
+        rename(path_.c_str(), rotated_path(1).c_str());
+        file_ = fopen(path_.c_str(), "wb");
+        file_bytes_ = 0;
+    }
+
+    void write_chunk(const string &chunk) {
+        if (file_ == NULL || chunk.empty()) {
+            return;
+        }
+        if (file_bytes_ > 0 &&
+            file_bytes_ + chunk.size() > SystemConstants::EVENT_LOG_ROTATE_BYTES) {
+            rotate();
+            if (file_ == NULL) {
+                return;
+            }
+        }
+        fwrite(chunk.data(), 1, chunk.size(), file_);
+        fflush(file_);
+        file_bytes_ += chunk.size();
+    }
+
+    // Formats everything queued so far; returns whether anything was written
+    bool drain(unsigned long &reported_drops) {
+        string chunk;
+        LogRecord record;
+        long long unix_ms = now_unix_ms();
+        while (ring_.try_pop(record)) {
+            format_record(record, unix_ms, chunk);
+        }
+        unsigned long drops = dropped_.load(memory_order_relaxed);
+        if (drops != reported_drops) {
+            ostringstream line;
+            line << "{\"nivel\":\"ADVERTENCIA\",\"evento\":\"descartados\","
+                    "\"cantidad\":"
+                 << drops - reported_drops << "}\n";
+            chunk += line.str();
+            reported_drops = drops;
+        }
+        write_chunk(chunk);
+        return !chunk.empty();
+    }
+
+    void writer_loop() {
+        ChromeTracer::name_thread("registro");
+        unsigned long reported_drops = 0;
+        unique_lock<mutex> lock(mutex_);
+        while (true) {
+            wake_.wait_for(
+                lock, chrono::milliseconds(SystemConstants::EVENT_LOG_DRAIN_MS),
+                [this] { return stopping_; });
+            bool stopping = stopping_;
+            lock.unlock();
+            {
+                TraceSpan span("drenar_registro");
+                drain(reported_drops);
+            }
+            if (stopping) {
+                return;
+            }
+            lock.lock();
+        }
+    }
+
+    // Disable copying: the writer thread is bound to this instance
+    AsyncLogger(const AsyncLogger &);
+    AsyncLogger &operator=(const AsyncLogger &);
+
+  public:
+    explicit AsyncLogger(const string &path)
+        : dropped_(0), path_(path), file_(fopen(path.c_str(), "ab")),
+          file_bytes_(0), stopping_(false) {
+        if (file_ == NULL) {
+            throw runtime_error("Could not open event log: " + path);
+        }
+        fseek(file_, 0, SEEK_END);
+        file_bytes_ = static_cast<size_t>(ftell(file_));
+        writer_ = thread(&AsyncLogger::writer_loop, this);
+    }
+
+    // Writes every record still in the ring before closing the file
+    ~AsyncLogger() {
+        {
+            lock_guard<mutex> lock(mutex_);
+            stopping_ = true;
+        }
+        wake_.notify_one();
+        writer_.join();
+        if (file_ != NULL) {
+            fclose(file_);
+        }
+    }
+
+    // Control-thread side: the record is filled in its ring slot, copying
+    // only the used bytes of text, with no lock, clock or syscall. text is
+    // truncated to fit the record.
+    void write(LogLevel level, LogEvent event, double sim_time,
+               int number = 0, const char *text = "") {
+        LogRecord *record = ring_.claim();
+        if (record == NULL) {
+            dropped_.store(dropped_.load(memory_order_relaxed) + 1,
+                           memory_order_relaxed);
+            return;
+        }
+        record->sim_time = sim_time;
+        record->number = number;
+        record->event = static_cast<uint16_t>(event);
+        record->level = static_cast<uint16_t>(level);
+        size_t length = strlen(text);
+        if (length >= sizeof(record->text)) {
+            length = sizeof(record->text) - 1;
+        }
+        memcpy(record->text, text, length);
+        record->text[length] = '\0';
+        ring_.publish();
+    }
+
+    unsigned long get_dropped() const {
+        return dropped_.load(memory_order_relaxed);
+    }
+};
+
+// Plant transitions and start decisions as log events
+class PlantEventLog : public PlantObserver {
+  private:
+    AsyncLogger &log_;
+
+  public:
+    explicit PlantEventLog(AsyncLogger &log) : log_(log) {}
+
+    void on_batch_phase_changed(BatchPhase, BatchPhase new_phase,
+                                double sim_time) {
+        log_.write(LOG_INFO, LOG_EVENT_BATCH_PHASE, sim_time, new_phase);
+    }
+
+    void on_pump_state_changed(size_t, const PumpLine &pump_line, PumpState,
+                               double sim_time) {
+        PumpState state = pump_line.get_pump().get_state();
+        LogLevel level =
+            state == STOPPED_HIGH_PRESSURE || state == STOPPED_FLOW_ALARM
+                ? LOG_WARNING
+                : LOG_INFO;
+        log_.write(level, LOG_EVENT_PUMP_STATE, sim_time, state,
+                   pump_line.get_pump().get_code().c_str());
+    }
+
+    void on_flow_switch_changed(size_t, const PumpLine &pump_line,
+                                double sim_time) {
+        bool alarm = pump_line.get_flow_switch().is_alarm();
+        log_.write(alarm ? LOG_WARNING : LOG_INFO, LOG_EVENT_FLOW_SWITCH,
+                   sim_time, alarm ? 1 : 0,
+                   pump_line.get_pump().get_code().c_str());
+    }
+
+    void on_filler_state_changed(const CanFiller &filler, FillerState,
+                                 double sim_time) {
+        log_.write(LOG_INFO, LOG_EVENT_FILLER_STATE, sim_time,
+                   filler.get_state(), filler.get_color().c_str());
+    }
+
+    void on_source_tank_switched(size_t, const PumpLine &pump_line,
+                                 double sim_time) {
+        log_.write(LOG_WARNING, LOG_EVENT_SOURCE_TANK, sim_time, 0,
+                   pump_line.get_tank().get_code().c_str());
+    }
+
+    void on_base_refilled(size_t, const PumpLine &pump_line, double liters,
+                          double sim_time) {
+        log_.write(LOG_INFO, LOG_EVENT_BASE_REFILL, sim_time,
+                   static_cast<int>(liters + 0.5),
+                   pump_line.get_pump().get_code().c_str());
+    }
+
+    // Refills the planner ordered this scan
+    void on_refills_ordered(const vector<BaseRefill> &refills,
+                            double sim_time) {
+        for (size_t i = 0; i < refills.size(); ++i) {
+            log_.write(LOG_INFO, LOG_EVENT_REFILL_ORDERED, sim_time,
+                       static_cast<int>(refills[i].liters + 0.5),
+                       refills[i].pump_code.c_str());
+        }
+    }
+
+    void on_start_result(StartResult result, const Factory &factory) {
+        if (result == START_ACCEPTED) {
+            log_.write(LOG_INFO, LOG_EVENT_START_ACCEPTED,
+                       factory.get_sim_time(),
+                       0, factory.get_batch_color().c_str());
+        } else if (result != START_NOT_REQUESTED) {
+            log_.write(LOG_WARNING, LOG_EVENT_START_REJECTED,
+                       factory.get_sim_time(), result);
+        }
+    }
+};
+
+// Pump and batch transitions as instant trace events, and the stages of
+// every tick as spans. Attached only while a trace is recorded.
+class PlantTraceEvents : public PlantObserver, public ScanPhaseSink {
+  private:
+    static const char *scan_phase_name(ScanPhase phase) {
+        switch (phase) {
+        case SCAN_PHASE_PUMP_LINES:
+            return "lineas_bomba";
+        case SCAN_PHASE_MIX:
+            return "mezcla";
+        case SCAN_PHASE_EMPTYING:
+            return "vaciado";
+        default:
+            return "llenado";
+        }
+    }
+
+  public:
+    void on_pump_state_changed(size_t, const PumpLine &pump_line, PumpState,
+                               double) {
+        ChromeTracer::emit('i',
+                           pump_state_name(pump_line.get_pump().get_state()),
+                           "bomba", pump_line.get_pump().get_code().c_str());
+    }
+
+    void on_batch_phase_changed(BatchPhase, BatchPhase new_phase, double) {
+        ChromeTracer::emit('i', "fase_lote", "fase",
+                           batch_phase_name(new_phase));
+    }
+
+    void on_filler_state_changed(const CanFiller &filler, FillerState,
+                                 double) {
+        ChromeTracer::emit('i', filler_state_name(filler.get_state()), "color",
+                           filler.get_color().c_str());
+    }
+
+    void on_source_tank_switched(size_t, const PumpLine &pump_line, double) {
+        ChromeTracer::emit('i', "cambio_tanque", "tanque",
+                           pump_line.get_tank().get_code().c_str());
+    }
+
+    void on_base_refilled(size_t, const PumpLine &pump_line, double, double) {
+        ChromeTracer::emit('i', "reposicion", "bomba",
+                           pump_line.get_pump().get_code().c_str());
+    }
+
+    void on_phase_begin(ScanPhase phase) {
+        ChromeTracer::emit('B', scan_phase_name(phase));
+    }
+
+    void on_phase_end(ScanPhase phase) {
+        ChromeTracer::emit('E', scan_phase_name(phase));
+    }
+};
+
+struct BaseDelivery {
+    string pump_code;
+    string base_name;
+    double target_liters;
+    double requested_liters;
+    double delivered_liters;
+};
+
+struct BatchInterruption {
+    string pump_code;
+    PumpState reason;
+    double start_time;
+    double end_time; // Negative while the pump is still stopped
+};
+
+// Genealogy of one lot: what was asked of each base, what actually reached
+// the mixer and every stop on the way
+struct BatchGenealogyRecord {
+    unsigned batch_number;
+    string color;
+    double start_sim_time;
+    double end_sim_time;
+    time_t start_wall_time;
+    time_t end_wall_time;
+    vector<BaseDelivery> bases;
+    vector<BatchInterruption> interruptions;
+    double final_mixer_liters;
+
+    string to_json() const {
+        ostringstream out;
+        out << "{\"lote\":" << batch_number << ",\"color\":\"" << color
+            << "\",\"inicio_s\":" << start_sim_time
+            << ",\"fin_s\":" << end_sim_time
+            << ",\"inicio_unix\":" << static_cast<long long>(start_wall_time)
+            << ",\"fin_unix\":" << static_cast<long long>(end_wall_time)
+            << ",\"bases\":[";
+        for (size_t i = 0; i < bases.size(); ++i) {
+            const BaseDelivery &base = bases[i];
+            out << (i > 0 ? "," : "") << "{\"bomba\":\"" << base.pump_code
+                << "\",\"base\":\"" << base.base_name
+                << "\",\"objetivo_l\":" << base.target_liters
+                << ",\"solicitado_l\":" << base.requested_liters
+                << ",\"entregado_l\":" << base.delivered_liters << "}";
+        }
+        out << "],\"interrupciones\":[";
+        for (size_t i = 0; i < interruptions.size(); ++i) {
+            const BatchInterruption &stop = interruptions[i];
+            out << (i > 0 ? "," : "") << "{\"bomba\":\"" << stop.pump_code
+                << "\",\"motivo\":\"" << pump_state_name(stop.reason)
+                << "\",\"inicio_s\":" << stop.start_time
+                << ",\"fin_s\":" << stop.end_time << "}";
+        }
+        out << "],\"volumen_final_mezclador_l\":" << final_mixer_liters
+            << "}";
+        return out.str();
+    }
+};
+
+// Builds one genealogy record per lot from plant transitions and hands the
+// finished record to the durable log
+class BatchGenealogyRecorder : public PlantObserver {
+  private:
+    const Factory &factory_;
+    DurableAppendLog &log_;
+    BatchGenealogyRecord record_;
+    bool recording_;
+    unsigned batches_started_;
+    // Index into record_.interruptions of each line's open stop, or -1
+    vector<int> open_interruptions_;
+
+    static bool is_interruption(PumpState state) {
+        return state == STOPPED_FLOW_ALARM || state == STOPPED_HIGH_PRESSURE;
+    }
+
+    void close_interruption(size_t line_index, double sim_time) {
+        if (open_interruptions_[line_index] >= 0) {
+            record_.interruptions[open_interruptions_[line_index]].end_time =
+                sim_time;
+            open_interruptions_[line_index] = -1;
+        }
+    }
+
+    void begin_record(double sim_time) {
+        record_ = BatchGenealogyRecord();
+        record_.batch_number = ++batches_started_;
+        record_.color = factory_.get_batch_color();
+        record_.start_sim_time = sim_time;
+        record_.end_sim_time = sim_time;
+        record_.start_wall_time = time(NULL);
+        record_.end_wall_time = record_.start_wall_time;
+        record_.final_mixer_liters = 0.0;
+
+        const PumpLineMap &pump_lines = factory_.get_all_pump_lines();
+        for (PumpLineMap::const_iterator it = pump_lines.begin();
+             it != pump_lines.end(); ++it) {
+            BaseDelivery base;
+            base.pump_code = it->second.get_pump().get_code();
+            base.base_name = it->second.get_tank().get_liquid_in_tank_name();
+            base.target_liters = it->second.get_pump().get_target_liters();
+            base.requested_liters = 0.0;
+            base.delivered_liters = 0.0;
+            record_.bases.push_back(base);
+        }
+        open_interruptions_.assign(record_.bases.size(), -1);
+        recording_ = true;
+    }
+
+    void finish_record(double sim_time) {
+        for (size_t i = 0; i < open_interruptions_.size(); ++i) {
+            close_interruption(i, sim_time);
+        }
+        record_.end_sim_time = sim_time;
+        record_.end_wall_time = time(NULL);
+        log_.append(record_.to_json());
+        recording_ = false;
+    }
+
+  public:
+    BatchGenealogyRecorder(const Factory &factory, DurableAppendLog &log)
+        : factory_(factory), log_(log), recording_(false),
+          batches_started_(0) {}
+
+    void on_batch_phase_changed(BatchPhase previous_phase,
+                                BatchPhase new_phase, double sim_time) {
+        if (previous_phase == BATCH_IDLE) {
+            begin_record(sim_time);
+        }
+        if (!recording_) {
+            return;
+        }
+        if (new_phase == BATCH_MIXING) {
+            record_.final_mixer_liters =
+                factory_.get_mixer_tank().get_current_capacity();
+        } else if (new_phase == BATCH_IDLE) {
+            finish_record(sim_time);
+        }
+    }
+
+    void on_pump_state_changed(size_t line_index, const PumpLine &pump_line,
+                               PumpState previous_state, double sim_time) {
+        if (!recording_ || line_index >= open_interruptions_.size()) {
+            return;
+        }
+        PumpState new_state = pump_line.get_pump().get_state();
+        if (is_interruption(previous_state)) {
+            close_interruption(line_index, sim_time);
+        }
+        if (is_interruption(new_state)) {
+            BatchInterruption stop;
+            stop.pump_code = pump_line.get_pump().get_code();
+            stop.reason = new_state;
+            stop.start_time = sim_time;
+            stop.end_time = -1.0;
+            record_.interruptions.push_back(stop);
+            open_interruptions_[line_index] =
+                static_cast<int>(record_.interruptions.size()) - 1;
+        }
+    }
+
+    void on_liquid_transferred(size_t line_index, const PumpLine &,
+                               double requested_liters,
+                               double delivered_liters, double) {
+        if (!recording_ || line_index >= record_.bases.size()) {
+            return;
+        }
+        record_.bases[line_index].requested_liters += requested_liters;
+        record_.bases[line_index].delivered_liters += delivered_liters;
+    }
+};
+
+// Bit-level stream used by the archive's compressed blocks
+class BitWriter {
+  private:
+    vector<uint8_t> bytes_;
+    int free_bits_; // Unused low bits in the last byte
+
+  public:
+    BitWriter() : free_bits_(0) {}
+
+    void write_bits(uint64_t value, int bit_count) {
+        while (bit_count > 0) {
+            if (free_bits_ == 0) {
+                bytes_.push_back(0);
+                free_bits_ = 8;
+            }
+            int chunk = bit_count < free_bits_ ? bit_count : free_bits_;
+            uint8_t bits = static_cast<uint8_t>(
+                (value >> (bit_count - chunk)) & ((1u << chunk) - 1));
+            bytes_.back() |= static_cast<uint8_t>(bits << (free_bits_ - chunk));
+            free_bits_ -= chunk;
+            bit_count -= chunk;
+        }
+    }
+
+    const vector<uint8_t> &get_bytes() const { return bytes_; }
+
+    void clear() {
+        bytes_.clear();
+        free_bits_ = 0;
+    }
+};
+
+class BitReader {
+  private:
+    const uint8_t *data_;
+    size_t size_;
+    size_t bit_position_;
+
+  public:
+    BitReader(const uint8_t *data, size_t size)
+        : data_(data), size_(size), bit_position_(0) {}
+
+    uint64_t read_bits(int bit_count) {
+        uint64_t value = 0;
+        while (bit_count > 0) {
+            size_t byte_index = bit_position_ / 8;
+            if (byte_index >= size_) {
+                throw runtime_error("Archive block is truncated");
+            }
+            int bit_offset = static_cast<int>(bit_position_ % 8);
+            int available = 8 - bit_offset;
+            int chunk = bit_count < available ? bit_count : available;
+            uint8_t bits = static_cast<uint8_t>(
+                (data_[byte_index] >> (available - chunk)) &
+                ((1u << chunk) - 1));
+            value = (value << chunk) | bits;
+            bit_position_ += chunk;
+            bit_count -= chunk;
+        }
+        return value;
+    }
+};
+
+static uint64_t double_to_bits(double value) {
+    uint64_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    return bits;
+}
+
+static double bits_to_double(uint64_t bits) {
+    double value;
+    memcpy(&value, &bits, sizeof(value));
+    return value;
+}
+
+static int count_leading_zeros(uint64_t value) {
+    if (value == 0) {
+        return 64;
+    }
+#if defined(__GNUC__)
+    return __builtin_clzll(value);
+#elif defined(_MSC_VER)
+    unsigned long index;
+    _BitScanReverse64(&index, value);
+    return 63 - static_cast<int>(index);
+#else
+    int count = 0;
+    for (uint64_t mask = 1ULL << 63; !(value & mask); mask >>= 1) {
+        ++count;
+    }
+    return count;
+#endif
+}
+
+static int count_trailing_zeros(uint64_t value) {
+    if (value == 0) {
+        return 64;
+    }
+#if defined(__GNUC__)
+    return __builtin_ctzll(value);
+#elif defined(_MSC_VER)
+    unsigned long index;
+    _BitScanForward64(&index, value);
+    return static_cast<int>(index);
+#else
+    int count = 0;
+    for (uint64_t mask = 1; !(value & mask); mask <<= 1) {
+        ++count;
+    }
+    return count;
+#endif
+}
+
+// One series' samples inside a block. Timestamps are stored as
+// delta-of-delta with variable-width buckets and values as the XOR with the
+// previous value, reusing the previous leading/trailing zero window when it
+// fits. A steady signal costs two bits per sample.
+class SeriesBlockEncoder {
+  private:
+    BitWriter bits_;
+    uint32_t sample_count_;
+    int64_t start_ms_;
+    int64_t previous_ms_;
+    int64_t previous_delta_;
+    uint64_t previous_value_bits_;
+    int previous_leading_;
+    int previous_trailing_;
+    double min_value_;
+    double max_value_;
+
+    void write_timestamp(int64_t time_ms) {
+        int64_t delta = time_ms - previous_ms_;
+        int64_t delta_of_delta = delta - previous_delta_;
+        if (delta_of_delta == 0) {
+            bits_.write_bits(0, 1);
+        } else if (delta_of_delta >= -63 && delta_of_delta <= 64) {
+            bits_.write_bits(0x2, 2);
+            bits_.write_bits(static_cast<uint64_t>(delta_of_delta + 63), 7);
+        } else if (delta_of_delta >= -255 && delta_of_delta <= 256) {
+            bits_.write_bits(0x6, 3);
+            bits_.write_bits(static_cast<uint64_t>(delta_of_delta + 255), 9);
+        } else if (delta_of_delta >= -2047 && delta_of_delta <= 2048) {
+            bits_.write_bits(0xE, 4);
+            bits_.write_bits(static_cast<uint64_t>(delta_of_delta + 2047), 12);
+        } else {
+            bits_.write_bits(0xF, 4);
+            bits_.write_bits(static_cast<uint64_t>(delta_of_delta), 64);
+        }
+        previous_delta_ = delta;
+        previous_ms_ = time_ms;
+    }
+
+    void write_value(double value) {
+        uint64_t value_bits = double_to_bits(value);
+        uint64_t xor_bits = value_bits ^ previous_value_bits_;
+        previous_value_bits_ = value_bits;
+        if (xor_bits == 0) {
+            bits_.write_bits(0, 1);
+            return;
+        }
+        bits_.write_bits(1, 1);
+        int leading = count_leading_zeros(xor_bits);
+        int trailing = count_trailing_zeros(xor_bits);
+        if (leading > 31) {
+            leading = 31; // Leading count is stored in five bits
+        }
+        if (previous_leading_ >= 0 && leading >= previous_leading_ &&
+            trailing >= previous_trailing_) {
+            bits_.write_bits(0, 1);
+            int meaningful = 64 - previous_leading_ - previous_trailing_;
+            bits_.write_bits(xor_bits >> previous_trailing_, meaningful);
+            return;
+        }
+        int meaningful = 64 - leading - trailing;
+        bits_.write_bits(1, 1);
+        bits_.write_bits(static_cast<uint64_t>(leading), 5);
+        bits_.write_bits(static_cast<uint64_t>(meaningful - 1), 6);
+        bits_.write_bits(xor_bits >> trailing, meaningful);
+        previous_leading_ = leading;
+        previous_trailing_ = trailing;
+    }
+
+  public:
+    SeriesBlockEncoder() { clear(); }
+
+    void clear() {
+        bits_.clear();
+        sample_count_ = 0;
+        start_ms_ = previous_ms_ = previous_delta_ = 0;
+        previous_value_bits_ = 0;
+        previous_leading_ = previous_trailing_ = -1;
+        min_value_ = max_value_ = 0.0;
+    }
+
+    void append(int64_t time_ms, double value) {
+        if (sample_count_ == 0) {
+            bits_.write_bits(static_cast<uint64_t>(time_ms), 64);
+            bits_.write_bits(double_to_bits(value), 64);
+            start_ms_ = previous_ms_ = time_ms;
+            previous_value_bits_ = double_to_bits(value);
+            min_value_ = max_value_ = value;
+        } else {
+            write_timestamp(time_ms);
+            write_value(value);
+            min_value_ = value < min_value_ ? value : min_value_;
+            max_value_ = value > max_value_ ? value : max_value_;
+        }
+        ++sample_count_;
+    }
+
+    uint32_t get_sample_count() const { return sample_count_; }
+    int64_t get_start_ms() const { return start_ms_; }
+    int64_t get_end_ms() const { return previous_ms_; }
+    double get_min_value() const { return min_value_; }
+    double get_max_value() const { return max_value_; }
+    const vector<uint8_t> &get_bytes() const { return bits_.get_bytes(); }
+};
+
+class SeriesBlockDecoder {
+  private:
+    BitReader bits_;
+    uint32_t remaining_;
+    bool first_;
+    int64_t previous_ms_;
+    int64_t previous_delta_;
+    uint64_t previous_value_bits_;
+    int previous_leading_;
+    int previous_trailing_;
+
+    int64_t read_timestamp() {
+        int64_t delta_of_delta;
+        if (bits_.read_bits(1) == 0) {
+            delta_of_delta = 0;
+        } else if (bits_.read_bits(1) == 0) {
+            delta_of_delta = static_cast<int64_t>(bits_.read_bits(7)) - 63;
+        } else if (bits_.read_bits(1) == 0) {
+            delta_of_delta = static_cast<int64_t>(bits_.read_bits(9)) - 255;
+        } else if (bits_.read_bits(1) == 0) {
+            delta_of_delta = static_cast<int64_t>(bits_.read_bits(12)) - 2047;
+        } else {
+            delta_of_delta = static_cast<int64_t>(bits_.read_bits(64));
+        }
+        previous_delta_ += delta_of_delta;
+        previous_ms_ += previous_delta_;
+        return previous_ms_;
+    }
+
+    double read_value() {
+        if (bits_.read_bits(1) == 0) {
+            return bits_to_double(previous_value_bits_);
+        }
+        if (bits_.read_bits(1) == 1) {
+            previous_leading_ = static_cast<int>(bits_.read_bits(5));
+            int meaningful = static_cast<int>(bits_.read_bits(6)) + 1;
+            previous_trailing_ = 64 - previous_leading_ - meaningful;
+        }
+        int meaningful = 64 - previous_leading_ - previous_trailing_;
+        uint64_t xor_bits = bits_.read_bits(meaningful) << previous_trailing_;
+        previous_value_bits_ ^= xor_bits;
+        return bits_to_double(previous_value_bits_);
+    }
+
+  public:
+    SeriesBlockDecoder(const uint8_t *data, size_t size, uint32_t sample_count)
+        : bits_(data, size), remaining_(sample_count), first_(true),
+          previous_ms_(0), previous_delta_(0), previous_value_bits_(0),
+          previous_leading_(0), previous_trailing_(0) {}
+
+    bool next(int64_t &time_ms, double &value) {
+        if (remaining_ == 0) {
+            return false;
+        }
+        --remaining_;
+        if (first_) {
+            first_ = false;
+            previous_ms_ = static_cast<int64_t>(bits_.read_bits(64));
+            previous_value_bits_ = bits_.read_bits(64);
+            time_ms = previous_ms_;
+            value = bits_to_double(previous_value_bits_);
+            return true;
+        }
+        time_ms = read_timestamp();
+        value = read_value();
+        return true;
+    }
+};
+
+// Fixed-size records so readers can seek and binary search the files
+struct ArchiveBlockIndexEntry {
+    int64_t start_ms;
+    int64_t end_ms;
+    uint64_t offset;
+    uint32_t series_id;
+    uint32_t sample_count;
+    uint32_t byte_length;
+    uint32_t reserved;
+    double min_value;
+    double max_value;
+};
+
+struct ArchiveRollupRecord {
+    int64_t bucket_start_ms;
+    uint32_t series_id;
+    uint32_t sample_count;
+    double min_value;
+    double max_value;
+    double sum;
+
+    double get_average() const {
+        return sample_count > 0 ? sum / sample_count : 0.0;
+    }
+};
+
+enum ArchiveRollupResolution { ROLLUP_ONE_MINUTE, ROLLUP_ONE_HOUR };
+
+// Layout of a plant history archive sharing one base path:
+//   .series  series names, one per line, line number is the series id
+//   .dat     compressed blocks, one series and up to an hour each
+//   .idx     ArchiveBlockIndexEntry per block, in write order
+//   .r1m/.r1h ArchiveRollupRecord per series and bucket, by bucket time
+class HistoryArchiveFormat {
+  public:
+    static string series_path(const string &base) { return base + ".series"; }
+    static string data_path(const string &base) { return base + ".dat"; }
+    static string index_path(const string &base) { return base + ".idx"; }
+
+    static string rollup_path(const string &base,
+                              ArchiveRollupResolution resolution) {
+        return base + (resolution == ROLLUP_ONE_MINUTE ? ".r1m" : ".r1h");
+    }
+
+    static int64_t rollup_bucket_ms(ArchiveRollupResolution resolution) {
+        return resolution == ROLLUP_ONE_MINUTE ? 60000 : 3600000;
+    }
+
+    static FILE *open_or_throw(const string &path, const char *mode) {
+        FILE *file = fopen(path.c_str(), mode);
+        if (file == NULL) {
+            throw runtime_error("Could not open archive file: " + path);
+        }
+        return file;
+    }
+};
+
+// Which plant signals the archive records and how they are sampled. Pump
+// states, valve positions and the batch phase are stored as numbers, where
+// XOR compression makes unchanged values nearly free.
+class PlantSignalSampler {
+  private:
+    vector<string> names_;
+
+  public:
+    explicit PlantSignalSampler(const Factory &factory) {
+        const PumpLineMap &pump_lines = factory.get_all_pump_lines();
+        for (PumpLineMap::const_iterator it = pump_lines.begin();
+             it != pump_lines.end(); ++it) {
+            const PumpLine &pump_line = it->second;
+            names_.push_back(pump_line.get_pressure_transmitter().get_code());
+            names_.push_back(pump_line.get_tank().get_code() + ".nivel");
+            names_.push_back(pump_line.get_pump().get_code() + ".estado");
+            names_.push_back(pump_line.get_enter_valve().get_code());
+            names_.push_back(pump_line.get_exit_valve().get_code());
+        }
+        names_.push_back("LT401");
+        names_.push_back("M401.litros");
+        names_.push_back("LOTE.fase");
+    }
+
+    const vector<string> &get_names() const { return names_; }
+
+    void sample(const Factory &factory, vector<double> &values) const {
+        values.clear();
+        const PumpLineMap &pump_lines = factory.get_all_pump_lines();
+        for (PumpLineMap::const_iterator it = pump_lines.begin();
+             it != pump_lines.end(); ++it) {
+            const PumpLine &pump_line = it->second;
+            values.push_back(
+                pump_line.get_pressure_transmitter().read_pressure());
+            values.push_back(pump_line.get_tank().get_level());
+            values.push_back(pump_line.get_pump().get_state());
+            values.push_back(pump_line.get_enter_valve().is_open() ? 1.0 : 0.0);
+            values.push_back(pump_line.get_exit_valve().is_open() ? 1.0 : 0.0);
+        }
+        values.push_back(factory.get_mixer_tank().get_level());
+        values.push_back(factory.get_mixer_tank().get_current_capacity());
+        values.push_back(factory.get_batch_phase());
+    }
+};
+
+// Appends plant history to the archive. record() only samples the plant and
+// queues the frame; compression, rollups and file writes happen on a
+// background thread so the scan never waits on the disk. Series ids index
+// the .series list, so a run with another signal set (--lineas,
+// --tanques-base) moves the old archive aside to *.anterior and starts a
+// new one instead of appending blocks whose ids mean something else.
+class HistoryArchiveWriter {
+  private:
+    struct Frame {
+        int64_t time_ms;
+        vector<double> values;
+    };
+
+    struct RollupAccumulator {
+        int64_t bucket_start_ms;
+        ArchiveRollupRecord record;
+    };
+
+    PlantSignalSampler sampler_;
+    string base_path_;
+    int64_t epoch_ms_; // Wall-clock time of simulated second zero
+    FILE *data_file_;
+    FILE *index_file_;
+    FILE *rollup_files_[2];
+    uint64_t data_offset_;
+    vector<SeriesBlockEncoder> encoders_;
+    vector<RollupAccumulator> rollups_[2];
+
+    vector<Frame> pending_;
+    vector<Frame> spare_frames_; // Recycled so steady state does not allocate
+    mutex mutex_;
+    condition_variable wake_;
+    bool stopping_;
+    thread writer_;
+
+    void flush_block(uint32_t series_id) {
+        SeriesBlockEncoder &encoder = encoders_[series_id];
+        if (encoder.get_sample_count() == 0) {
+            return;
+        }
+        const vector<uint8_t> &bytes = encoder.get_bytes();
+        ArchiveBlockIndexEntry entry;
+        entry.start_ms = encoder.get_start_ms();
+        entry.end_ms = encoder.get_end_ms();
+        entry.offset = data_offset_;
+        entry.series_id = series_id;
+        entry.sample_count = encoder.get_sample_count();
+        entry.byte_length = static_cast<uint32_t>(bytes.size());
+        entry.reserved = 0;
+        entry.min_value = encoder.get_min_value();
+        entry.max_value = encoder.get_max_value();
+
+        fwrite(&bytes[0], 1, bytes.size(), data_file_);
+        data_offset_ += bytes.size();
+        fwrite(&entry, sizeof(entry), 1, index_file_);
+        encoder.clear();
+    }
+
+    void flush_rollup(int resolution, uint32_t series_id) {
+        ArchiveRollupRecord &record = rollups_[resolution][series_id].record;
+        if (record.sample_count > 0) {
+            fwrite(&record, sizeof(record), 1, rollup_files_[resolution]);
+            record.sample_count = 0;
+        }
+    }
+
+    void add_to_rollup(int resolution, uint32_t series_id, int64_t time_ms,
+                       double value) {
+        int64_t bucket_ms = HistoryArchiveFormat::rollup_bucket_ms(
+            static_cast<ArchiveRollupResolution>(resolution));
+        int64_t bucket_start = time_ms - (time_ms % bucket_ms);
+        ArchiveRollupRecord &record = rollups_[resolution][series_id].record;
+        if (record.sample_count > 0 && record.bucket_start_ms != bucket_start) {
+            flush_rollup(resolution, series_id);
+        }
+        if (record.sample_count == 0) {
+            record.bucket_start_ms = bucket_start;
+            record.series_id = series_id;
+            record.min_value = record.max_value = value;
+            record.sum = 0.0;
+        }
+        record.min_value = value < record.min_value ? value : record.min_value;
+        record.max_value = value > record.max_value ? value : record.max_value;
+        record.sum += value;
+        ++record.sample_count;
+    }
+
+    void encode_frame(const Frame &frame) {
+        for (uint32_t id = 0; id < frame.values.size(); ++id) {
+            encoders_[id].append(frame.time_ms, frame.values[id]);
+            if (encoders_[id].get_sample_count() >=
+                SystemConstants::ARCHIVE_BLOCK_SAMPLES) {
+                flush_block(id);
+            }
+            add_to_rollup(ROLLUP_ONE_MINUTE, id, frame.time_ms,
+                          frame.values[id]);
+            add_to_rollup(ROLLUP_ONE_HOUR, id, frame.time_ms,
+                          frame.values[id]);
+        }
+    }
+
+    void writer_loop() {
+        vector<Frame> batch;
+        unique_lock<mutex> lock(mutex_);
+        while (true) {
+            wake_.wait(lock, [this] { return stopping_ || !pending_.empty(); });
+            if (pending_.empty() && stopping_) {
+                break;
+            }
+            batch.swap(pending_);
+            lock.unlock();
+
+            for (size_t i = 0; i < batch.size(); ++i) {
+                encode_frame(batch[i]);
+            }
+            fflush(index_file_);
+
+            lock.lock();
+            for (size_t i = 0; i < batch.size(); ++i) {
+                spare_frames_.push_back(Frame());
+                spare_frames_.back().values.swap(batch[i].values);
+            }
+            batch.clear();
+        }
+
+        for (uint32_t id = 0; id < encoders_.size(); ++id) {
+            flush_block(id);
+            flush_rollup(ROLLUP_ONE_MINUTE, id);
+            flush_rollup(ROLLUP_ONE_HOUR, id);
+        }
+    }
+
+    static bool same_series(const string &base_path,
+                            const vector<string> &names) {
+        ifstream series_file(
+            HistoryArchiveFormat::series_path(base_path).c_str());
+        if (!series_file) {
+            return false;
+        }
+        string line;
+        size_t count = 0;
+        while (getline(series_file, line)) {
+            if (count >= names.size() || line != names[count]) {
+                return false;
+            }
+            ++count;
+        }
+        return count == names.size();
+    }
+
+    static void move_aside(const string &path) {
+        string previous = path + ".anterior";
+        remove(previous.c_str());
+        rename(path.c_str(), previous.c_str());
+    }
+
+    // Disable copying: the writer thread is bound to this instance
+    HistoryArchiveWriter(const HistoryArchiveWriter &);
+    HistoryArchiveWriter &operator=(const HistoryArchiveWriter &);
+
+  public:
+    HistoryArchiveWriter(const Factory &factory, const string &base_path)
+        : sampler_(factory), base_path_(base_path),
+          epoch_ms_(static_cast<int64_t>(time(NULL)) * 1000 -
+                    static_cast<int64_t>(factory.get_sim_time() * 1000.0)),
+          stopping_(false) {
+        const vector<string> &names = sampler_.get_names();
+        if (!same_series(base_path, names)) {
+            move_aside(HistoryArchiveFormat::series_path(base_path));
+            move_aside(HistoryArchiveFormat::data_path(base_path));
+            move_aside(HistoryArchiveFormat::index_path(base_path));
+            move_aside(HistoryArchiveFormat::rollup_path(base_path,
+                                                         ROLLUP_ONE_MINUTE));
+            move_aside(HistoryArchiveFormat::rollup_path(base_path,
+                                                         ROLLUP_ONE_HOUR));
+            ofstream series_file(
+                HistoryArchiveFormat::series_path(base_path).c_str());
+            if (!series_file) {
+                throw runtime_error("Could not write archive series list: " +
+                                    base_path);
+            }
+            for (size_t i = 0; i < names.size(); ++i) {
+                series_file << names[i] << "\n";
+            }
+        }
+
+        data_file_ = HistoryArchiveFormat::open_or_throw(
+            HistoryArchiveFormat::data_path(base_path), "ab");
+        fseek(data_file_, 0, SEEK_END);
+        data_offset_ = static_cast<uint64_t>(ftell(data_file_));
+        index_file_ = HistoryArchiveFormat::open_or_throw(
+            HistoryArchiveFormat::index_path(base_path), "ab");
+        for (int resolution = 0; resolution < 2; ++resolution) {
+            rollup_files_[resolution] = HistoryArchiveFormat::open_or_throw(
+                HistoryArchiveFormat::rollup_path(
+                    base_path, static_cast<ArchiveRollupResolution>(resolution)),
+                "ab");
+            rollups_[resolution].resize(names.size());
+            for (size_t id = 0; id < names.size(); ++id) {
+                rollups_[resolution][id].record.sample_count = 0;
+            }
+        }
+        encoders_.resize(names.size());
+        writer_ = thread(&HistoryArchiveWriter::writer_loop, this);
+    }
+
+    // Writes out open blocks and partial rollup buckets
+    ~HistoryArchiveWriter() {
+        {
+            lock_guard<mutex> lock(mutex_);
+            stopping_ = true;
+        }
+        wake_.notify_one();
+        writer_.join();
+        fclose(data_file_);
+        fclose(index_file_);
+        fclose(rollup_files_[ROLLUP_ONE_MINUTE]);
+        fclose(rollup_files_[ROLLUP_ONE_HOUR]);
+    }
+
+    void record(const Factory &factory) {
+        Frame frame;
+        frame.time_ms =
+            epoch_ms_ + static_cast<int64_t>(factory.get_sim_time() * 1000.0);
+        {
+            lock_guard<mutex> lock(mutex_);
+            if (!spare_frames_.empty()) {
+                frame.values.swap(spare_frames_.back().values);
+                spare_frames_.pop_back();
+            }
+        }
+        sampler_.sample(factory, frame.values);
+        {
+            lock_guard<mutex> lock(mutex_);
+            pending_.push_back(Frame());
+            pending_.back().time_ms = frame.time_ms;
+            pending_.back().values.swap(frame.values);
+        }
+        wake_.notify_one();
+    }
+};
+
+// Range queries over an archive. The data and index files are memory
+// mapped; a query only decodes the blocks of one series that overlap the
+// range, and rollup queries binary search the time-ordered rollup file.
+class HistoryArchiveReader {
+  private:
+    string base_path_;
+    vector<string> names_;
+    MappedFile data_;
+    MappedFile index_file_;
+    const ArchiveBlockIndexEntry *index_;
+    size_t index_count_;
+
+  public:
+    explicit HistoryArchiveReader(const string &base_path)
+        : base_path_(base_path),
+          data_(HistoryArchiveFormat::data_path(base_path)),
+          index_file_(HistoryArchiveFormat::index_path(base_path)),
+          index_(reinterpret_cast<const ArchiveBlockIndexEntry *>(
+              index_file_.get_data())),
+          index_count_(index_file_.get_size() /
+                       sizeof(ArchiveBlockIndexEntry)) {
+        ifstream series_file(
+            HistoryArchiveFormat::series_path(base_path).c_str());
+        if (!series_file) {
+            throw runtime_error("Archive not found: " + base_path);
+        }
+        string name;
+        while (getline(series_file, name)) {
+            names_.push_back(StringUtils::trim_whitespace(name));
+        }
+    }
+
+    const vector<string> &get_series_names() const { return names_; }
+    size_t get_block_count() const { return index_count_; }
+    const ArchiveBlockIndexEntry &get_block(size_t i) const {
+        return index_[i];
+    }
+
+    int find_series(const string &name) const {
+        for (size_t i = 0; i < names_.size(); ++i) {
+            if (names_[i] == name) {
+                return static_cast<int>(i);
+            }
+        }
+        return -1;
+    }
+
+    int require_series(const string &name) const {
+        int series_id = find_series(name);
+        if (series_id < 0) {
+            throw runtime_error("Unknown archive series: " + name);
+        }
+        return series_id;
+    }
+
+    // Raw samples of one series in [from_ms, to_ms], in time order
+    void query(const string &series, int64_t from_ms, int64_t to_ms,
+               vector<int64_t> &times, vector<double> &values) const {
+        uint32_t series_id = static_cast<uint32_t>(require_series(series));
+        for (size_t i = 0; i < index_count_; ++i) {
+            const ArchiveBlockIndexEntry &entry = index_[i];
+            if (entry.series_id != series_id || entry.end_ms < from_ms ||
+                entry.start_ms > to_ms) {
+                continue;
+            }
+            if (entry.offset + entry.byte_length > data_.get_size()) {
+                throw runtime_error("Archive data file is truncated");
+            }
+            SeriesBlockDecoder decoder(data_.get_data() + entry.offset,
+                                       entry.byte_length, entry.sample_count);
+            int64_t time_ms;
+            double value;
+            while (decoder.next(time_ms, value)) {
+                if (time_ms >= from_ms && time_ms <= to_ms) {
+                    times.push_back(time_ms);
+                    values.push_back(value);
+                }
+            }
+        }
+    }
+
+    // Min/max/avg buckets of one series whose start lies in [from_ms, to_ms]
+    void query_rollup(const string &series, ArchiveRollupResolution resolution,
+                      int64_t from_ms, int64_t to_ms,
+                      vector<ArchiveRollupRecord> &records) const {
+        uint32_t series_id = static_cast<uint32_t>(require_series(series));
+        MappedFile file(HistoryArchiveFormat::rollup_path(base_path_,
+                                                          resolution));
+        const ArchiveRollupRecord *rollups =
+            reinterpret_cast<const ArchiveRollupRecord *>(file.get_data());
+        size_t count = file.get_size() / sizeof(ArchiveRollupRecord);
+
+        // Records are appended as buckets close, so they are sorted by time
+        size_t low = 0;
+        size_t high = count;
+        while (low < high) {
+            size_t middle = low + (high - low) / 2;
+            if (rollups[middle].bucket_start_ms < from_ms) {
+                low = middle + 1;
+            } else {
+                high = middle;
+            }
+        }
+        for (size_t i = low; i < count && rollups[i].bucket_start_ms <= to_ms;
+             ++i) {
+            if (rollups[i].series_id == series_id) {
+                records.push_back(rollups[i]);
+            }
+        }
+    }
+};
+
+// Predicate scans over decoded columns. Predicates write one bit per sample
+// into 64-bit words (SSE2 compares two doubles per instruction where
+// available) and runs of set bits are extracted a word at a time, so long
+// quiet stretches cost one compare per 64 samples.
+class ColumnScan {
+  public:
+    // Bit i of mask is set when low < values[i] < high
+    static void between(const double *values, size_t count, double low,
+                        double high, vector<uint64_t> &mask) {
+        mask.assign((count + 63) / 64, 0);
+        size_t i = 0;
+#ifdef DUPONT_HAVE_SSE2
+        __m128d low_bound = _mm_set1_pd(low);
+        __m128d high_bound = _mm_set1_pd(high);
+        for (; i + 8 <= count; i += 8) {
+            uint64_t bits = 0;
+            for (int lane = 0; lane < 8; lane += 2) {
+                __m128d pair = _mm_loadu_pd(values + i + lane);
+                __m128d inside = _mm_and_pd(_mm_cmpgt_pd(pair, low_bound),
+                                            _mm_cmplt_pd(pair, high_bound));
+                bits |= static_cast<uint64_t>(_mm_movemask_pd(inside)) << lane;
+            }
+            mask[i / 64] |= bits << (i % 64);
+        }
+#endif
+        for (; i < count; ++i) {
+            if (values[i] > low && values[i] < high) {
+                mask[i / 64] |= 1ULL << (i % 64);
+            }
+        }
+    }
+
+    static void greater_than(const double *values, size_t count,
+                             double threshold, vector<uint64_t> &mask) {
+        between(values, count, threshold,
+                numeric_limits<double>::infinity(), mask);
+    }
+
+    static void less_than(const double *values, size_t count, double threshold,
+                          vector<uint64_t> &mask) {
+        between(values, count, -numeric_limits<double>::infinity(), threshold,
+                mask);
+    }
+
+    // Half-open [first, last) sample ranges whose bits are set
+    static void extract_runs(const vector<uint64_t> &mask, size_t count,
+                             vector<pair<size_t, size_t> > &runs) {
+        bool in_run = false;
+        size_t run_start = 0;
+        for (size_t word_index = 0; word_index < mask.size(); ++word_index) {
+            uint64_t word = mask[word_index];
+            // Bits where the value differs from the bit before it
+            uint64_t edges = word ^ ((word << 1) | (in_run ? 1 : 0));
+            while (edges != 0) {
+                size_t position = word_index * 64 + count_trailing_zeros(edges);
+                if (position >= count) {
+                    break;
+                }
+                if (!in_run) {
+                    run_start = position;
+                } else {
+                    runs.push_back(make_pair(run_start, position));
+                }
+                in_run = !in_run;
+                edges &= edges - 1;
+            }
+        }
+        if (in_run) {
+            runs.push_back(make_pair(run_start, count));
+        }
+    }
+};
+
+// Command-line analytics over a recorded archive:
+//   series                              list recorded series
+//   excede <serie> <umbral>             intervals above a threshold
+//   bajo <serie> <umbral>               intervals below a threshold
+//   cierre-a-disparo <valvula> <bomba>  valve closure to overpressure trip
+//   lotes-bajo-volumen <litros>         lots that began mixing short of volume
+class HistoryQueryTool {
+  private:
+    const HistoryArchiveReader &archive_;
+    size_t bytes_scanned_;
+    double scan_seconds_;
+
+    void load(const string &series, vector<int64_t> &times,
+              vector<double> &values) const {
+        archive_.query(series, INT64_MIN, INT64_MAX, times, values);
+    }
+
+    template <class Predicate>
+    void scan(const vector<double> &values, Predicate predicate,
+              vector<pair<size_t, size_t> > &runs) {
+        vector<uint64_t> mask;
+        chrono::steady_clock::time_point start = chrono::steady_clock::now();
+        predicate(values.empty() ? NULL : &values[0], values.size(), mask);
+        ColumnScan::extract_runs(mask, values.size(), runs);
+        scan_seconds_ += chrono::duration<double>(
+                             chrono::steady_clock::now() - start)
+                             .count();
+        bytes_scanned_ += values.size() * sizeof(double);
+    }
+
+    static string format_time(int64_t time_ms) {
+        time_t seconds = static_cast<time_t>(time_ms / 1000);
+        char buffer[32];
+        strftime(buffer, sizeof(buffer), "%Y-%m-%d %H:%M:%S",
+                 localtime(&seconds));
+        return buffer;
+    }
+
+    static double parse_number(const string &text) {
+        char *end = NULL;
+        double value = strtod(text.c_str(), &end);
+        if (end == text.c_str() || *end != '\0') {
+            throw runtime_error("Numero invalido: " + text);
+        }
+        return value;
+    }
+
+    void print_intervals(const string &series, double threshold, bool above) {
+        vector<int64_t> times;
+        vector<double> values;
+        load(series, times, values);
+        vector<pair<size_t, size_t> > runs;
+        if (above) {
+            scan(values,
+                 [threshold](const double *v, size_t n, vector<uint64_t> &m) {
+                     ColumnScan::greater_than(v, n, threshold, m);
+                 },
+                 runs);
+        } else {
+            scan(values,
+                 [threshold](const double *v, size_t n, vector<uint64_t> &m) {
+                     ColumnScan::less_than(v, n, threshold, m);
+                 },
+                 runs);
+        }
+        for (size_t i = 0; i < runs.size(); ++i) {
+            size_t first = runs[i].first;
+            size_t last = runs[i].second - 1;
+            double extreme = values[first];
+            for (size_t j = first; j <= last; ++j) {
+                if (above ? values[j] > extreme : values[j] < extreme) {
+                    extreme = values[j];
+                }
+            }
+            cout << format_time(times[first]) << " -> "
+                 << format_time(times[last]) << "  "
+                 << (times[last] - times[first]) / 1000.0 + 1.0 << "s, "
+                 << (above ? "maximo " : "minimo ") << extreme << endl;
+        }
+        cout << runs.size() << " intervalos de " << series
+             << (above ? " > " : " < ") << threshold << endl;
+    }
+
+    // State-coded series hold small integers, so equality is a narrow band
+    void find_state_starts(const string &series, double state,
+                           vector<int64_t> &starts, vector<size_t> *indices) {
+        vector<int64_t> times;
+        vector<double> values;
+        load(series, times, values);
+        vector<pair<size_t, size_t> > runs;
+        scan(values,
+             [state](const double *v, size_t n, vector<uint64_t> &m) {
+                 ColumnScan::between(v, n, state - 0.5, state + 0.5, m);
+             },
+             runs);
+        for (size_t i = 0; i < runs.size(); ++i) {
+            starts.push_back(times[runs[i].first]);
+            if (indices != NULL) {
+                indices->push_back(runs[i].first);
+            }
+        }
+    }
+
+    void print_closure_to_trip(const string &valve, const string &pump) {
+        vector<int64_t> closures;
+        vector<int64_t> trips;
+        find_state_starts(valve, 0.0, closures, NULL);
+        find_state_starts(pump + ".estado", STOPPED_HIGH_PRESSURE, trips,
+                          NULL);
+
+        size_t next_trip = 0;
+        size_t matched = 0;
+        for (size_t i = 0; i < closures.size(); ++i) {
+            while (next_trip < trips.size() && trips[next_trip] < closures[i]) {
+                ++next_trip;
+            }
+            // Only a trip before the valve's next closure belongs to it
+            if (next_trip == trips.size() ||
+                (i + 1 < closures.size() && trips[next_trip] >= closures[i + 1])) {
+                continue;
+            }
+            cout << valve << " cerrada " << format_time(closures[i]) << ", "
+                 << pump << " disparo " << format_time(trips[next_trip])
+                 << ": " << (trips[next_trip] - closures[i]) / 1000.0 << "s"
+                 << endl;
+            ++matched;
+        }
+        cout << matched << " de " << closures.size() << " cierres de " << valve
+             << " terminaron en disparo por sobrepresion de " << pump << endl;
+    }
+
+    void print_short_batches(double liters) {
+        vector<int64_t> mixing_starts;
+        vector<size_t> indices;
+        find_state_starts("LOTE.fase", BATCH_MIXING, mixing_starts, &indices);
+        vector<int64_t> times;
+        vector<double> volumes;
+        load("M401.litros", times, volumes);
+
+        size_t short_batches = 0;
+        for (size_t i = 0; i < indices.size(); ++i) {
+            // Every series is sampled in the same frame, so indices align
+            double volume = volumes[indices[i]];
+            if (volume < liters) {
+                cout << "Lote iniciado " << format_time(mixing_starts[i])
+                     << " con " << volume << " litros" << endl;
+                ++short_batches;
+            }
+        }
+        cout << short_batches << " de " << indices.size()
+             << " lotes comenzaron a mezclar con menos de " << liters
+             << " litros" << endl;
+    }
+
+  public:
+    explicit HistoryQueryTool(const HistoryArchiveReader &archive)
+        : archive_(archive), bytes_scanned_(0), scan_seconds_(0.0) {}
+
+    static void print_usage() {
+        cout << "Uso: tercer_parcial --consultar <archivo_base> <consulta>"
+             << endl
+             << "  series" << endl
+             << "  excede <serie> <umbral>" << endl
+             << "  bajo <serie> <umbral>" << endl
+             << "  cierre-a-disparo <valvula> <bomba>" << endl
+             << "  lotes-bajo-volumen <litros>" << endl;
+    }
+
+    // Returns false when the query is not recognised
+    bool run(const vector<string> &arguments) {
+        if (arguments.empty()) {
+            return false;
+        }
+        const string &query = arguments[0];
+        if (query == "series" && arguments.size() == 1) {
+            const vector<string> &names = archive_.get_series_names();
+            for (size_t i = 0; i < names.size(); ++i) {
+                cout << names[i] << endl;
+            }
+            return true;
+        } else if (query == "excede" && arguments.size() == 3) {
+            print_intervals(arguments[1], parse_number(arguments[2]), true);
+        } else if (query == "bajo" && arguments.size() == 3) {
+            print_intervals(arguments[1], parse_number(arguments[2]), false);
+        } else if (query == "cierre-a-disparo" && arguments.size() == 3) {
+            print_closure_to_trip(arguments[1], arguments[2]);
+        } else if (query == "lotes-bajo-volumen" && arguments.size() == 2) {
+            print_short_batches(parse_number(arguments[1]));
+        } else {
+            return false;
+        }
+
+        if (scan_seconds_ > 0) {
+            cout << "Escaneo: " << bytes_scanned_ / 1e6 << " MB a "
+                 << bytes_scanned_ / scan_seconds_ / 1e9 << " GB/s" << endl;
+        }
+        return true;
+    }
+};
+
+enum PredictionKind {
+    PREDICT_FLOW_ALARM_TRIP,
+    PREDICT_OVERPRESSURE_TRIP,
+    PREDICT_TANK_DRY,
+    PREDICT_BATCH_DONE,
+    PREDICT_BATCH_LATE
+};
+
+struct PlantPrediction {
+    PredictionKind kind;
+    string subject;       // Pump or tank code, empty for the batch
+    double seconds_ahead;
+    double liters_short;  // Tank dry only: base the lot will be missing
+};
+
+// Shadow simulation run ahead of the plant on a background thread. Each
+// submit() forks the plant; the twin steps the copy with the operator's
+// inputs frozen and reports what happens within the horizon.
+class PredictiveTwin {
+  private:
+    // Watches the forked plant while it runs ahead
+    class Forecast : public PlantObserver {
+      private:
+        double start_time_;
+        double step_seconds_;
+        vector<PlantPrediction> predictions_;
+        bool batch_finished_;
+
+        PlantPrediction *find(PredictionKind kind, const string &subject) {
+            for (size_t i = 0; i < predictions_.size(); ++i) {
+                if (predictions_[i].kind == kind &&
+                    predictions_[i].subject == subject) {
+                    return &predictions_[i];
+                }
+            }
+            return NULL;
+        }
+
+        // Only the first occurrence of each event is reported
+        PlantPrediction *add_once(PredictionKind kind, const string &subject,
+                                  double sim_time) {
+            PlantPrediction *existing = find(kind, subject);
+            if (existing != NULL) {
+                return existing;
+            }
+            PlantPrediction prediction;
+            prediction.kind = kind;
+            prediction.subject = subject;
+            // Events fire during a step, before the clock advances, and are
+            // visible once that step ends
+            prediction.seconds_ahead = sim_time - start_time_ + step_seconds_;
+            prediction.liters_short = 0.0;
+            predictions_.push_back(prediction);
+            return &predictions_.back();
+        }
+
+      public:
+        Forecast(double start_time, double step_seconds)
+            : start_time_(start_time), step_seconds_(step_seconds),
+              batch_finished_(false) {}
+
+        void on_pump_state_changed(size_t /*line_index*/,
+                                   const PumpLine &pump_line,
+                                   PumpState /*previous_state*/,
+                                   double sim_time) {
+            PumpState state = pump_line.get_pump().get_state();
+            if (state == STOPPED_FLOW_ALARM) {
+                add_once(PREDICT_FLOW_ALARM_TRIP,
+                         pump_line.get_pump().get_code(), sim_time);
+            } else if (state == STOPPED_HIGH_PRESSURE) {
+                add_once(PREDICT_OVERPRESSURE_TRIP,
+                         pump_line.get_pump().get_code(), sim_time);
+            }
+        }
+
+        void on_liquid_transferred(size_t /*line_index*/,
+                                   const PumpLine &pump_line,
+                                   double requested_liters,
+                                   double delivered_liters, double sim_time) {
+            if (delivered_liters < requested_liters) {
+                add_once(PREDICT_TANK_DRY, pump_line.get_tank().get_code(),
+                         sim_time)
+                    ->liters_short += requested_liters - delivered_liters;
+            }
+        }
+
+        void on_batch_phase_changed(BatchPhase /*previous_phase*/,
+                                    BatchPhase new_phase, double sim_time) {
+            if (new_phase == BATCH_IDLE && !batch_finished_) {
+                batch_finished_ = true;
+                add_once(PREDICT_BATCH_DONE, "", sim_time);
+            }
+        }
+
+        bool is_batch_finished() const { return batch_finished_; }
+        const vector<PlantPrediction> &get_predictions() const {
+            return predictions_;
+        }
+    };
+
+    double horizon_seconds_;
+    double step_seconds_;
+    mutable mutex mutex_;
+    condition_variable wake_;
+    vector<Factory> pending_; // Latest fork, at most one
+    bool stopping_;
+    vector<PlantPrediction> predictions_;
+    double last_run_us_;
+    thread worker_;
+
+    // Same update order as the scan loop in main(); no new lot is started
+    static vector<PlantPrediction> run_ahead(Factory &twin, double horizon,
+                                             double step) {
+        Forecast forecast(twin.get_sim_time(), step);
+        BatchScheduler scheduler;
+        bool batch_running = scheduler.adopt_batch(twin);
+        twin.add_observer(&forecast);
+        for (double elapsed = 0.0; elapsed < horizon; elapsed += step) {
+            twin.step(step);
+        }
+        twin.remove_observer(&forecast);
+
+        vector<PlantPrediction> predictions = forecast.get_predictions();
+        if (batch_running && !forecast.is_batch_finished()) {
+            PlantPrediction late;
+            late.kind = PREDICT_BATCH_LATE;
+            late.seconds_ahead = horizon;
+            late.liters_short = 0.0;
+            predictions.push_back(late);
+        }
+        return predictions;
+    }
+
+    void run() {
+        ChromeTracer::name_thread("gemelo");
+        unique_lock<mutex> lock(mutex_);
+        for (;;) {
+            while (pending_.empty() && !stopping_) {
+                wake_.wait(lock);
+            }
+            if (stopping_) {
+                return;
+            }
+            Factory twin = pending_.back();
+            pending_.clear();
+            lock.unlock();
+            chrono::steady_clock::time_point start =
+                chrono::steady_clock::now();
+            vector<PlantPrediction> predictions;
+            {
+                TraceSpan span("prediccion");
+                predictions = run_ahead(twin, horizon_seconds_, step_seconds_);
+            }
+            double run_us = chrono::duration<double, micro>(
+                                chrono::steady_clock::now() - start)
+                                .count();
+            lock.lock();
+            predictions_.swap(predictions);
+            last_run_us_ = run_us;
+        }
+    }
+
+  public:
+    PredictiveTwin(double horizon_seconds, double step_seconds = 1.0)
+        : horizon_seconds_(horizon_seconds), step_seconds_(step_seconds),
+          stopping_(false), last_run_us_(0.0) {
+        if (horizon_seconds <= 0.0 || step_seconds <= 0.0) {
+            throw invalid_argument(
+                "Prediction horizon and step must be positive");
+        }
+        worker_ = thread(&PredictiveTwin::run, this);
+    }
+
+    ~PredictiveTwin() {
+        {
+            lock_guard<mutex> lock(mutex_);
+            stopping_ = true;
+        }
+        wake_.notify_one();
+        worker_.join();
+    }
+
+    // Called from the scan loop; a fork still waiting is replaced, so the
+    // twin always works on the newest state
+    void submit(const Factory &factory) {
+        Factory twin = factory.fork();
+        {
+            lock_guard<mutex> lock(mutex_);
+            pending_.clear();
+            pending_.push_back(twin);
+        }
+        wake_.notify_one();
+    }
+
+    vector<PlantPrediction> get_predictions() const {
+        lock_guard<mutex> lock(mutex_);
+        return predictions_;
+    }
+
+    double get_horizon_seconds() const { return horizon_seconds_; }
+    double get_last_run_microseconds() const {
+        lock_guard<mutex> lock(mutex_);
+        return last_run_us_;
+    }
+};
+
+// Live plant state in shared memory for local viewers (HMI, historian,
+// test harnesses). The layout is fixed and made of plain records, each
+// guarded by a sequence counter: the simulator makes it odd while it
+// writes, so a reader copies the record and retries if the counter moved.
+// Commands travel the other way through a single-producer ring.
+const uint32_t SHARED_TAGS_MAGIC = 0x44505447; // "DPTG"
+const uint32_t SHARED_TAGS_VERSION = 1;
+const size_t SHARED_TAG_CODE_SIZE = 16;
+
+static_assert(ATOMIC_INT_LOCK_FREE == 2,
+              "Shared memory needs address-free 32-bit atomics");
+
+struct SharedPumpLineTags {
+    char pump_code[SHARED_TAG_CODE_SIZE];
+    char enter_valve_code[SHARED_TAG_CODE_SIZE];
+    char exit_valve_code[SHARED_TAG_CODE_SIZE];
+    char flow_switch_code[SHARED_TAG_CODE_SIZE];
+    char pressure_code[SHARED_TAG_CODE_SIZE];
+    char tank_code[SHARED_TAG_CODE_SIZE];
+    char level_code[SHARED_TAG_CODE_SIZE];
+    char liquid_name[SHARED_TAG_CODE_SIZE];
+    int32_t pump_state;
+    uint8_t pump_on;
+    uint8_t enter_valve_open;
+    uint8_t exit_valve_open;
+    uint8_t flow_switch_alarm;
+    double pressure_psi;
+    double tank_level_percent;
+    double tank_liters;
+    double pump_elapsed_seconds;
+    double pump_target_seconds;
+};
+
+struct SharedPlantTags {
+    char mixer_code[SHARED_TAG_CODE_SIZE];
+    char mixer_level_code[SHARED_TAG_CODE_SIZE];
+    char batch_color[SHARED_TAG_CODE_SIZE];
+    double sim_time_seconds;
+    int32_t batch_phase;
+    uint8_t motor_running;
+    uint8_t low_level_alarm;
+    uint8_t emptying;
+    uint8_t reserved;
+    double mixer_level_percent;
+    double mixer_liters;
+    double motor_elapsed_seconds;
+    double motor_target_seconds;
+};
+
+// Each record sits on its own cache lines so writing one line does not
+// disturb readers of another
+template <typename Tags> struct alignas(64) SharedTagSlot {
+    atomic<uint32_t> sequence;
+    Tags tags;
+};
+
+// Keys and values are those of the configuration file
+struct SharedCommand {
+    char key[32];
+    char value[SHARED_TAG_CODE_SIZE];
+};
+
+struct SharedCommandRing {
+    alignas(64) atomic<uint32_t> head; // Written by the viewer
+    alignas(64) atomic<uint32_t> tail; // Written by the simulator
+    SharedCommand slots[SystemConstants::SHARED_COMMAND_SLOTS];
+};
+
+struct SharedTagHeader {
+    atomic<uint32_t> magic; // Stored last, once the segment is ready
+    uint32_t version;
+    uint32_t segment_size;
+    uint32_t line_count;
+    atomic<uint32_t> publish_count;
+    atomic<uint32_t> commands_applied;
+    atomic<uint32_t> commands_rejected;
+};
+
+struct SharedTagSegment {
+    SharedTagHeader header;
+    SharedTagSlot<SharedPlantTags> plant;
+    SharedTagSlot<SharedPumpLineTags>
+        lines[SystemConstants::SHARED_TAGS_MAX_LINES];
+    SharedCommandRing commands;
+};
+
+class SharedTagCodec {
+  public:
+    static void copy_code(char *target, const string &code, size_t size) {
+        memset(target, 0, size);
+        memcpy(target, code.data(),
+               code.size() < size ? code.size() : size - 1);
+    }
+
+    template <typename Tags>
+    static void write(SharedTagSlot<Tags> &slot, const Tags &tags) {
+        uint32_t sequence = slot.sequence.load(memory_order_relaxed);
+        slot.sequence.store(sequence + 1, memory_order_relaxed);
+        atomic_thread_fence(memory_order_release);
+        memcpy(&slot.tags, &tags, sizeof(Tags));
+        slot.sequence.store(sequence + 2, memory_order_release);
+    }
+
+    template <typename Tags>
+    static void read(const SharedTagSlot<Tags> &slot, Tags &tags) {
+        for (;;) {
+            uint32_t before = slot.sequence.load(memory_order_acquire);
+            if ((before & 1) == 0) {
+                memcpy(&tags, &slot.tags, sizeof(Tags));
+                atomic_thread_fence(memory_order_acquire);
+                if (slot.sequence.load(memory_order_relaxed) == before) {
+                    return;
+                }
+            }
+            this_thread::yield();
+        }
+    }
+};
+
+class SharedTagPublisher {
+  private:
+    SharedMemorySegment segment_;
+    SharedTagSegment *table_;
+    size_t line_count_;
+    vector<SharedPumpLineTags> published_lines_;
+
+    static void fill_line_tags(const PumpLine &pump_line,
+                               SharedPumpLineTags &tags) {
+        memset(&tags, 0, sizeof(tags));
+        const LiquidPump &pump = pump_line.get_pump();
+        const LiquidTank &tank = pump_line.get_tank();
+        SharedTagCodec::copy_code(tags.pump_code, pump.get_code(),
+                                  SHARED_TAG_CODE_SIZE);
+        SharedTagCodec::copy_code(tags.enter_valve_code,
+                                  pump_line.get_enter_valve().get_code(),
+                                  SHARED_TAG_CODE_SIZE);
+        SharedTagCodec::copy_code(tags.exit_valve_code,
+                                  pump_line.get_exit_valve().get_code(),
+                                  SHARED_TAG_CODE_SIZE);
+        SharedTagCodec::copy_code(tags.flow_switch_code,
+                                  pump_line.get_flow_switch().get_code(),
+                                  SHARED_TAG_CODE_SIZE);
+        SharedTagCodec::copy_code(
+            tags.pressure_code,
+            pump_line.get_pressure_transmitter().get_code(),
+            SHARED_TAG_CODE_SIZE);
+        SharedTagCodec::copy_code(tags.tank_code, tank.get_code(),
+                                  SHARED_TAG_CODE_SIZE);
+        SharedTagCodec::copy_code(tags.level_code,
+                                  tank.get_level_transmitter().get_code(),
+                                  SHARED_TAG_CODE_SIZE);
+        SharedTagCodec::copy_code(tags.liquid_name,
+                                  tank.get_liquid_in_tank_name(),
+                                  SHARED_TAG_CODE_SIZE);
+        tags.pump_state = pump.get_state();
+        tags.pump_on = pump.is_on();
+        tags.enter_valve_open = pump_line.get_enter_valve().is_open();
+        tags.exit_valve_open = pump_line.get_exit_valve().is_open();
+        tags.flow_switch_alarm = pump_line.get_flow_switch().is_alarm();
+        tags.pressure_psi =
+            pump_line.get_pressure_transmitter().read_pressure();
+        tags.tank_level_percent = tank.get_level();
+        tags.tank_liters = tank.get_current_capacity();
+        tags.pump_elapsed_seconds = pump.get_elapsed_seconds();
+        tags.pump_target_seconds = pump.get_target_duration();
+    }
+
+    static void fill_plant_tags(const Factory &factory,
+                                SharedPlantTags &tags) {
+        memset(&tags, 0, sizeof(tags));
+        const MixerTank &mixer = factory.get_mixer_tank();
+        const MixerMotor &motor = mixer.get_mixer_motor();
+        SharedTagCodec::copy_code(tags.mixer_code, mixer.get_code(),
+                                  SHARED_TAG_CODE_SIZE);
+        SharedTagCodec::copy_code(tags.mixer_level_code,
+                                  mixer.get_level_transmitter().get_code(),
+                                  SHARED_TAG_CODE_SIZE);
+        SharedTagCodec::copy_code(tags.batch_color, factory.get_batch_color(),
+                                  SHARED_TAG_CODE_SIZE);
+        tags.sim_time_seconds = factory.get_sim_time();
+        tags.batch_phase = factory.get_batch_phase();
+        tags.motor_running = motor.is_running();
+        tags.low_level_alarm = mixer.get_low_level_switch().is_alarm();
+        tags.emptying = mixer.is_emptying();
+        tags.mixer_level_percent = mixer.get_level();
+        tags.mixer_liters = mixer.get_current_capacity();
+        tags.motor_elapsed_seconds = motor.get_elapsed_time();
+        tags.motor_target_seconds = motor.get_target_time();
+    }
+
+  public:
+    // Lines beyond SHARED_TAGS_MAX_LINES are not published
+    SharedTagPublisher(const Factory &factory, const string &name)
+        : segment_(name, sizeof(SharedTagSegment), true),
+          table_(static_cast<SharedTagSegment *>(segment_.get_data())),
+          line_count_(factory.get_all_pump_lines().size()) {
+        if (line_count_ > SystemConstants::SHARED_TAGS_MAX_LINES) {
+            line_count_ = SystemConstants::SHARED_TAGS_MAX_LINES;
+        }
+        memset(static_cast<void *>(table_), 0, sizeof(SharedTagSegment));
+        table_->header.version = SHARED_TAGS_VERSION;
+        table_->header.segment_size = sizeof(SharedTagSegment);
+        table_->header.line_count = static_cast<uint32_t>(line_count_);
+        published_lines_.resize(line_count_);
+        publish(factory, true);
+        table_->header.magic.store(SHARED_TAGS_MAGIC, memory_order_release);
+    }
+
+    ~SharedTagPublisher() {
+        table_->header.magic.store(0, memory_order_release);
+    }
+
+    // Records whose values did not change are not rewritten, so readers
+    // of quiet lines never have to retry
+    void publish(const Factory &factory, bool force = false) {
+        SharedPlantTags plant;
+        fill_plant_tags(factory, plant);
+        SharedTagCodec::write(table_->plant, plant);
+
+        const PumpLineMap &pump_lines = factory.get_all_pump_lines();
+        size_t line_index = 0;
+        for (PumpLineMap::const_iterator it = pump_lines.begin();
+             it != pump_lines.end() && line_index < line_count_;
+             ++it, ++line_index) {
+            SharedPumpLineTags tags;
+            fill_line_tags(it->second, tags);
+            if (!force && memcmp(&tags, &published_lines_[line_index],
+                                 sizeof(tags)) == 0) {
+                continue;
+            }
+            published_lines_[line_index] = tags;
+            SharedTagCodec::write(table_->lines[line_index], tags);
+        }
+        table_->header.publish_count.fetch_add(1, memory_order_release);
+    }
+
+    bool pop_command(string &key, string &value) {
+        SharedCommandRing &ring = table_->commands;
+        uint32_t tail = ring.tail.load(memory_order_relaxed);
+        if (tail == ring.head.load(memory_order_acquire)) {
+            return false;
+        }
+        const SharedCommand &command =
+            ring.slots[tail & (SystemConstants::SHARED_COMMAND_SLOTS - 1)];
+        key.assign(command.key, strnlen(command.key, sizeof(command.key)));
+        value.assign(command.value,
+                     strnlen(command.value, sizeof(command.value)));
+        ring.tail.store(tail + 1, memory_order_release);
+        return true;
+    }
+
+    // Commands become configuration overrides; invalid ones are counted
+    // and dropped. Returns true when any override changed
+    bool apply_commands(ConfigOverrides &overrides,
+                        const SystemConfig &file_config) {
+        bool applied = false;
+        string key, value;
+        while (pop_command(key, value)) {
+            try {
+                overrides.set(key, value, file_config);
+                table_->header.commands_applied.fetch_add(1);
+                applied = true;
+            } catch (const runtime_error &) {
+                table_->header.commands_rejected.fetch_add(1);
+            }
+        }
+        return applied;
+    }
+
+    size_t get_line_count() const { return line_count_; }
+    uint32_t get_commands_applied() const {
+        return table_->header.commands_applied.load();
+    }
+    uint32_t get_commands_rejected() const {
+        return table_->header.commands_rejected.load();
+    }
+};
+
+class SharedTagViewer {
+  private:
+    SharedMemorySegment segment_;
+    SharedTagSegment *table_;
+
+  public:
+    explicit SharedTagViewer(const string &name)
+        : segment_(name, sizeof(SharedTagSegment), false),
+          table_(static_cast<SharedTagSegment *>(segment_.get_data())) {
+        if (table_->header.magic.load(memory_order_acquire) !=
+                SHARED_TAGS_MAGIC ||
+            table_->header.version != SHARED_TAGS_VERSION ||
+            table_->header.segment_size != sizeof(SharedTagSegment)) {
+            throw runtime_error("Shared tag table not ready or incompatible: " +
+                                name);
+        }
+    }
+
+    size_t get_line_count() const { return table_->header.line_count; }
+    uint32_t get_publish_count() const {
+        return table_->header.publish_count.load(memory_order_acquire);
+    }
+    uint32_t get_commands_rejected() const {
+        return table_->header.commands_rejected.load();
+    }
+
+    void read_plant(SharedPlantTags &tags) const {
+        SharedTagCodec::read(table_->plant, tags);
+    }
+
+    void read_line(size_t line_index, SharedPumpLineTags &tags) const {
+        if (line_index >= get_line_count()) {
+            throw invalid_argument("Line index out of range");
+        }
+        SharedTagCodec::read(table_->lines[line_index], tags);
+    }
+
+    // One viewer at a time may send; returns false when the ring is full
+    bool send_command(const string &key, const string &value) {
+        SharedCommandRing &ring = table_->commands;
+        uint32_t head = ring.head.load(memory_order_relaxed);
+        if (head - ring.tail.load(memory_order_acquire) >=
+            SystemConstants::SHARED_COMMAND_SLOTS) {
+            return false;
+        }
+        SharedCommand &command =
+            ring.slots[head & (SystemConstants::SHARED_COMMAND_SLOTS - 1)];
+        SharedTagCodec::copy_code(command.key, key, sizeof(command.key));
+        SharedTagCodec::copy_code(command.value, value, sizeof(command.value));
+        ring.head.store(head + 1, memory_order_release);
+        return true;
+    }
+};
+
+// Command-line viewer: prints the live tags or sends one command
+class SharedTagMonitor {
+  public:
+    static void print_usage() {
+        cout << "Uso: tercer_parcial --tags [CLAVE VALOR]" << endl;
+        cout << "  Sin argumentos muestra los tags del simulador en curso;"
+             << endl;
+        cout << "  con CLAVE VALOR envia un comando, por ejemplo V403 CLOSE."
+             << endl;
+    }
+
+    static void print_snapshot(const SharedTagViewer &viewer) {
+        SharedPlantTags plant;
+        viewer.read_plant(plant);
+        cout << "t=" << plant.sim_time_seconds << "s publicaciones "
+             << viewer.get_publish_count() << ", comandos rechazados "
+             << viewer.get_commands_rejected() << endl;
+        cout << plant.mixer_code << ": " << plant.mixer_level_code << "="
+             << plant.mixer_level_percent << "% (" << plant.mixer_liters
+             << " L), motor " << (plant.motor_running ? "ON" : "OFF") << " "
+             << plant.motor_elapsed_seconds << "/" << plant.motor_target_seconds
+             << "s, bajo nivel "
+             << (plant.low_level_alarm ? "ALARMA" : "NORMAL") << ", fase "
+             << plant.batch_phase << ", color " << plant.batch_color << endl;
+        for (size_t i = 0; i < viewer.get_line_count(); ++i) {
+            SharedPumpLineTags line;
+            viewer.read_line(i, line);
+            cout << line.pump_code << " "
+                 << pump_state_name(static_cast<PumpState>(line.pump_state))
+                 << " " << line.pump_elapsed_seconds << "/"
+                 << line.pump_target_seconds << "s, " << line.pressure_code
+                 << "=" << line.pressure_psi << " psi, "
+                 << line.flow_switch_code << "="
+                 << (line.flow_switch_alarm ? "ALARMA" : "NORMAL") << ", "
+                 << line.enter_valve_code << "="
+                 << (line.enter_valve_open ? "OPEN" : "CLOSE") << ", "
+                 << line.exit_valve_code << "="
+                 << (line.exit_valve_open ? "OPEN" : "CLOSE") << ", "
+                 << line.level_code << "=" << line.tank_level_percent << "%"
+                 << endl;
+        }
+    }
+
+    static bool run(const vector<string> &args) {
+        SharedTagViewer viewer(SystemConstants::SHARED_TAGS_NAME);
+        if (args.empty()) {
+            print_snapshot(viewer);
+            return true;
+        }
+        if (args.size() != 2) {
+            return false;
+        }
+        if (!viewer.send_command(args[0], args[1])) {
+            throw runtime_error("La cola de comandos esta llena");
+        }
+        cout << "Comando enviado: " << args[0] << "=" << args[1] << endl;
+        return true;
+    }
+};
+
+// Page served at / by DashboardServer; it renders each snapshot pushed on
+// /eventos and works with any browser on the same machine
+const char *const DASHBOARD_PAGE =
+    "<!DOCTYPE html><html><head><meta charset=\"utf-8\">"
+    "<title>Dupont - Mezcla de Pintura</title><style>"
+    "body{font-family:sans-serif;margin:1em}"
+    "table{border-collapse:collapse}td,th{border:1px solid #999;"
+    "padding:2px 8px;text-align:right}.alarma{background:#f99}"
+    "</style></head><body><h2>Sistema de Mezcla de Pintura Dupont</h2>"
+    "<p id=\"planta\">Esperando datos...</p><table><thead><tr>"
+    "<th>Bomba</th><th>Base</th><th>Estado</th><th>Presion psi</th>"
+    "<th>Tanque %</th><th>Tiempo s</th><th>Dosificado L</th>"
+    "<th>Valvulas</th></tr></thead><tbody id=\"lineas\"></tbody></table>"
+    "<script>"
+    "var fuente=new EventSource('/eventos');"
+    "fuente.onmessage=function(e){var s=JSON.parse(e.data),m=s.mezclador;"
+    "document.getElementById('planta').textContent='t='+s.sim_s.toFixed(1)"
+    "+'s, lote '+s.fase+' '+s.color+', mezclador '+m.codigo+' '"
+    "+m.litros.toFixed(1)+' L ('+m.nivel.toFixed(1)+'%), motor '"
+    "+(m.motor?'MEZCLANDO':'DETENIDO')+' '+m.mezcla_s.toFixed(1)+'/'"
+    "+m.mezcla_objetivo_s+'s, llenadora '+s.llenadora;"
+    "var filas='';s.lineas.forEach(function(l){filas+='<tr'"
+    "+(l.alarma_flujo?' class=\"alarma\"':'')+'><td>'+l.bomba+'</td><td>'"
+    "+l.base+'</td><td>'+l.estado+'</td><td>'+l.presion.toFixed(1)"
+    "+'</td><td>'+l.nivel.toFixed(1)+'</td><td>'+l.tiempo_s.toFixed(1)"
+    "+'/'+l.objetivo_s.toFixed(1)+'</td><td>'+l.dosificado_l.toFixed(3)"
+    "+'/'+l.objetivo_l.toFixed(3)+'</td><td>'+(l.entrada?'A':'C')+'/'"
+    "+(l.salida?'A':'C')+'</td></tr>';});"
+    "document.getElementById('lineas').innerHTML=filas;};"
+    "fuente.onerror=function(){document.getElementById('planta')"
+    ".textContent='Sin conexion con la planta';};"
+    "</script></body></html>";
+
+// Read-only web view of the plant on localhost: GET / serves the dashboard
+// page, /eventos streams the state as server-sent events and /estado
+// returns one snapshot. The control thread serializes the plant once per
+// scan, and only while someone is connected; every client is sent that one
+// shared frame, so viewers add no simulation time. The server thread polls
+// all sockets and queues the newest frame at each pass, skipping those
+// published in between. A client that falls DASHBOARD_MAX_QUEUED_FRAMES
+// behind is dropped.
+class DashboardServer {
+  public:
+#ifdef _WIN32
+    typedef SOCKET Socket;
+#else
+    typedef int Socket;
+#endif
+
+    static bool is_valid(Socket socket) {
+#ifdef _WIN32
+        return socket != INVALID_SOCKET;
+#else
+        return socket >= 0;
+#endif
+    }
+
+    static void close_socket(Socket socket) {
+#ifdef _WIN32
+        closesocket(socket);
+#else
+        close(socket);
+#endif
+    }
+
+  private:
+    typedef shared_ptr<const string> Frame; // "data: {...}\n\n"
+
+    struct Client {
+        Socket socket;
+        string request; // Until its blank line
+        bool streaming;
+        bool close_when_sent;
+        // A one-shot /estado waits for the first frame of this sequence
+        unsigned long long snapshot_sequence;
+        string response; // Head, page or snapshot
+        size_t response_sent;
+        deque<Frame> frames;
+        size_t frame_sent; // Into frames.front()
+    };
+
+    Socket listener_;
+    int port_;
+    vector<Client> clients_; // Server thread only
+    atomic<size_t> client_count_;
+    atomic<unsigned long> clients_dropped_;
+    mutex frame_mutex_;
+    Frame latest_frame_;
+    unsigned long long frame_sequence_;
+    atomic<bool> stopping_;
+    thread server_;
+
+    // Disable copying: the server thread works on this instance
+    DashboardServer(const DashboardServer &);
+    DashboardServer &operator=(const DashboardServer &);
+
+    static void set_non_blocking(Socket socket) {
+#ifdef _WIN32
+        u_long enabled = 1;
+        ioctlsocket(socket, FIONBIO, &enabled);
+#else
+        fcntl(socket, F_SETFL, fcntl(socket, F_GETFL, 0) | O_NONBLOCK);
+#ifdef SO_NOSIGPIPE
+        int enabled = 1;
+        setsockopt(socket, SOL_SOCKET, SO_NOSIGPIPE, &enabled,
+                   sizeof(enabled));
+#endif
+#endif
+    }
+
+    static bool would_block() {
+#ifdef _WIN32
+        return WSAGetLastError() == WSAEWOULDBLOCK;
+#else
+        return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR;
+#endif
+    }
+
+    // Bytes written, 0 when the socket is full, -1 when the client is gone
+    static long send_some(Socket socket, const char *data, size_t size) {
+#ifdef _WIN32
+        int sent = send(socket, data, static_cast<int>(size), 0);
+#else
+#ifdef MSG_NOSIGNAL
+        ssize_t sent = send(socket, data, size, MSG_NOSIGNAL);
+#else
+        ssize_t sent = send(socket, data, size, 0);
+#endif
+#endif
+        if (sent < 0) {
+            return would_block() ? 0 : -1;
+        }
+        return static_cast<long>(sent);
+    }
+
+    static void append_number(ostringstream &json, const char *name,
+                              double value) {
+        json << ",\"" << name << "\":" << value;
+    }
+
+    static Frame serialize(const Factory &factory) {
+        const MixerTank &mixer = factory.get_mixer_tank();
+        const MixerMotor &motor = mixer.get_mixer_motor();
+        string color;
+        append_json_string(color, factory.get_batch_color().c_str());
+        ostringstream json;
+        json << "data: {\"sim_s\":" << factory.get_sim_time()
+             << ",\"fase\":\"" << batch_phase_name(factory.get_batch_phase())
+             << "\",\"color\":" << color
+             << ",\"lote_l\":" << factory.get_batch_size()
+             << ",\"mezclador\":{\"codigo\":\"" << mixer.get_code() << "\"";
+        append_number(json, "litros", mixer.get_current_capacity());
+        append_number(json, "nivel", mixer.get_level());
+        json << ",\"motor\":" << (motor.is_running() ? "true" : "false");
+        append_number(json, "mezcla_s", motor.get_elapsed_time());
+        append_number(json, "mezcla_objetivo_s", motor.get_target_time());
+        json << ",\"vaciando\":" << (mixer.is_emptying() ? "true" : "false")
+             << ",\"bajo_nivel\":"
+             << (mixer.get_low_level_switch().is_alarm() ? "true" : "false")
+             << "},\"llenadora\":\""
+             << filler_state_name(
+                    factory.get_filling_line().get_filler().get_state())
+             << "\",\"lineas\":[";
+        const PumpLineMap &pump_lines = factory.get_all_pump_lines();
+        for (PumpLineMap::const_iterator it = pump_lines.begin();
+             it != pump_lines.end(); ++it) {
+            const PumpLine &pump_line = it->second;
+            const LiquidPump &pump = pump_line.get_pump();
+            const LiquidTank &tank = pump_line.get_tank();
+            json << (it == pump_lines.begin() ? "" : ",") << "{\"bomba\":\""
+                 << pump.get_code() << "\",\"base\":\""
+                 << tank.get_liquid_in_tank_name() << "\",\"estado\":\""
+                 << pump_state_name(pump.get_state()) << "\"";
+            append_number(json, "presion",
+                          pump_line.get_pressure_transmitter().read_pressure());
+            append_number(json, "tanque_l", tank.get_current_capacity());
+            append_number(json, "nivel", tank.get_level());
+            append_number(json, "tiempo_s", pump.get_elapsed_seconds());
+            append_number(json, "objetivo_s", pump.get_target_duration());
+            append_number(json, "dosificado_l", pump.get_delivered_liters());
+            append_number(json, "objetivo_l", pump.get_target_liters());
+            json << ",\"entrada\":"
+                 << (pump_line.get_enter_valve().is_open() ? "true" : "false")
+                 << ",\"salida\":"
+                 << (pump_line.get_exit_valve().is_open() ? "true" : "false")
+                 << ",\"alarma_flujo\":"
+                 << (pump_line.get_flow_switch().is_alarm() ? "true"
+                                                            : "false")
+                 << "}";
+        }
+        json << "]}\n\n";
+        return Frame(new string(json.str()));
+    }
+
+    void start_response(Client &client, const char *status,
+                        const char *content_type, const string &body) {
+        ostringstream head;
+        head << "HTTP/1.1 " << status << "\r\nContent-Type: " << content_type
+             << "\r\nContent-Length: " << body.size()
+             << "\r\nConnection: close\r\n\r\n";
+        client.response = head.str() + body;
+        client.response_sent = 0;
+        client.close_when_sent = true;
+    }
+
+    void handle_request(Client &client) {
+        size_t space = client.request.find(' ');
+        string method = client.request.substr(0, space);
+        string path = space == string::npos
+                          ? ""
+                          : client.request.substr(
+                                space + 1,
+                                client.request.find(' ', space + 1) - space -
+                                    1);
+        if (method != "GET") {
+            start_response(client, "405 Method Not Allowed", "text/plain",
+                           "Solo GET\n");
+        } else if (path == "/") {
+            start_response(client, "200 OK", "text/html; charset=utf-8",
+                           DASHBOARD_PAGE);
+        } else if (path == "/eventos") {
+            client.response = "HTTP/1.1 200 OK\r\nContent-Type: "
+                              "text/event-stream\r\nCache-Control: no-cache"
+                              "\r\nConnection: keep-alive\r\n\r\n";
+            client.response_sent = 0;
+            client.streaming = true;
+        } else if (path == "/estado") {
+            lock_guard<mutex> lock(frame_mutex_);
+            client.snapshot_sequence = frame_sequence_ + 1;
+        } else {
+            start_response(client, "404 Not Found", "text/plain",
+                           "No encontrado\n");
+        }
+        client.request.clear();
+    }
+
+    // False once the client is done or gone
+    bool read_request(Client &client) {
+        char buffer[1024];
+        for (;;) {
+            long received = recv(client.socket, buffer, sizeof(buffer), 0);
+            if (received == 0) {
+                return false;
+            }
+            if (received < 0) {
+                return would_block();
+            }
+            if (client.streaming || client.snapshot_sequence != 0 ||
+                !client.response.empty()) {
+                continue; // Anything after the request is ignored
+            }
+            client.request.append(buffer, static_cast<size_t>(received));
+            if (client.request.find("\r\n\r\n") != string::npos) {
+                handle_request(client);
+            } else if (client.request.size() >
+                       SystemConstants::DASHBOARD_MAX_REQUEST_BYTES) {
+                return false;
+            }
+        }
+    }
+
+    bool write_pending(Client &client) {
+        while (client.response_sent < client.response.size()) {
+            long sent = send_some(
+                client.socket, client.response.data() + client.response_sent,
+                client.response.size() - client.response_sent);
+            if (sent <= 0) {
+                return sent == 0;
+            }
+            client.response_sent += static_cast<size_t>(sent);
+        }
+        if (client.close_when_sent) {
+            return false;
+        }
+        while (!client.frames.empty()) {
+            const string &frame = *client.frames.front();
+            long sent = send_some(client.socket,
+                                  frame.data() + client.frame_sent,
+                                  frame.size() - client.frame_sent);
+            if (sent <= 0) {
+                return sent == 0;
+            }
+            client.frame_sent += static_cast<size_t>(sent);
+            if (client.frame_sent == frame.size()) {
+                client.frames.pop_front();
+                client.frame_sent = 0;
+            }
+        }
+        return true;
+    }
+
+    void accept_clients() {
+        for (;;) {
+            Socket socket = accept(listener_, NULL, NULL);
+            if (!is_valid(socket)) {
+                return;
+            }
+            set_non_blocking(socket);
+            // A small kernel buffer makes a stalled client show up in its
+            // frame queue within seconds
+            int buffer_bytes = SystemConstants::DASHBOARD_SEND_BUFFER_BYTES;
+            setsockopt(socket, SOL_SOCKET, SO_SNDBUF,
+                       reinterpret_cast<const char *>(&buffer_bytes),
+                       sizeof(buffer_bytes));
+            Client client;
+            client.socket = socket;
+            client.streaming = false;
+            client.close_when_sent = false;
+            client.snapshot_sequence = 0;
+            client.response_sent = 0;
+            client.frame_sent = 0;
+            if (clients_.size() >= SystemConstants::DASHBOARD_MAX_CLIENTS) {
+                start_response(client, "503 Service Unavailable",
+                               "text/plain", "Demasiados clientes\n");
+            }
+            clients_.push_back(client);
+        }
+    }
+
+    // Hands the newest frame to every client waiting for one
+    void distribute_frame(unsigned long long &seen_sequence) {
+        Frame frame;
+        unsigned long long sequence;
+        {
+            lock_guard<mutex> lock(frame_mutex_);
+            if (frame_sequence_ == seen_sequence) {
+                return;
+            }
+            frame = latest_frame_;
+            sequence = frame_sequence_;
+        }
+        seen_sequence = sequence;
+        for (size_t i = 0; i < clients_.size(); ++i) {
+            Client &client = clients_[i];
+            if (client.streaming) {
+                if (client.frames.size() >=
+                    SystemConstants::DASHBOARD_MAX_QUEUED_FRAMES) {
+                    client.close_when_sent = true;
+                    client.response.clear();
+                    client.frames.clear();
+                    clients_dropped_.fetch_add(1);
+                } else {
+                    client.frames.push_back(frame);
+                }
+            } else if (client.snapshot_sequence != 0 &&
+                       sequence >= client.snapshot_sequence) {
+                // The frame minus its "data: " and blank line
+                client.snapshot_sequence = 0;
+                start_response(client, "200 OK", "application/json",
+                               frame->substr(6, frame->size() - 8) + "\n");
+            }
+        }
+    }
+
+    void serve() {
+        ChromeTracer::name_thread("panel");
+        unsigned long long seen_sequence = 0;
+        vector<pollfd> polled;
+        while (!stopping_.load()) {
+            polled.clear();
+            pollfd entry;
+            entry.fd = listener_;
+            entry.events = POLLIN;
+            entry.revents = 0;
+            polled.push_back(entry);
+            for (size_t i = 0; i < clients_.size(); ++i) {
+                entry.fd = clients_[i].socket;
+                entry.events = POLLIN;
+                if (clients_[i].response_sent < clients_[i].response.size() ||
+                    !clients_[i].frames.empty()) {
+                    entry.events |= POLLOUT;
+                }
+                polled.push_back(entry);
+            }
+#ifdef _WIN32
+            WSAPoll(&polled[0], static_cast<ULONG>(polled.size()),
+                    SystemConstants::DASHBOARD_POLL_MS);
+#else
+            poll(&polled[0], polled.size(), SystemConstants::DASHBOARD_POLL_MS);
+#endif
+            // Clients accepted now are polled from the next pass
+            size_t polled_clients = clients_.size();
+            if (polled[0].revents & POLLIN) {
+                accept_clients();
+            }
+            distribute_frame(seen_sequence);
+
+            vector<Client>::iterator it = clients_.begin();
+            for (size_t i = 0; it != clients_.end(); ++i) {
+                bool alive = true;
+                if (i >= polled_clients ||
+                    (polled[i + 1].revents & (POLLIN | POLLERR | POLLHUP))) {
+                    alive = read_request(*it);
+                }
+                alive = alive && write_pending(*it);
+                if (alive) {
+                    ++it;
+                } else {
+                    close_socket(it->socket);
+                    it = clients_.erase(it);
+                }
+            }
+            client_count_.store(clients_.size());
+        }
+        for (size_t i = 0; i < clients_.size(); ++i) {
+            close_socket(clients_[i].socket);
+        }
+        clients_.clear();
+    }
+
+  public:
+    // Listens on 127.0.0.1 only; port 0 picks a free one and a negative
+    // port leaves the dashboard off
+    explicit DashboardServer(int port)
+        : port_(-1), client_count_(0), clients_dropped_(0),
+          frame_sequence_(0), stopping_(false) {
+        if (port < 0) {
+            return;
+        }
+#ifdef _WIN32
+        WSADATA wsa_data;
+        if (WSAStartup(MAKEWORD(2, 2), &wsa_data) != 0) {
+            throw runtime_error("Could not start Winsock");
+        }
+#endif
+        listener_ = socket(AF_INET, SOCK_STREAM, 0);
+        if (!is_valid(listener_)) {
+            throw runtime_error("Could not create the dashboard socket");
+        }
+        int reuse = 1;
+        setsockopt(listener_, SOL_SOCKET, SO_REUSEADDR,
+                   reinterpret_cast<const char *>(&reuse), sizeof(reuse));
+        sockaddr_in address;
+        memset(&address, 0, sizeof(address));
+        address.sin_family = AF_INET;
+        address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        address.sin_port = htons(static_cast<unsigned short>(port));
+        socklen_t length = sizeof(address);
+        if (::bind(listener_, reinterpret_cast<sockaddr *>(&address),
+                   sizeof(address)) != 0 ||
+            listen(listener_, 16) != 0 ||
+            getsockname(listener_, reinterpret_cast<sockaddr *>(&address),
+                        &length) != 0) {
+            close_socket(listener_);
+            ostringstream message;
+            message << "Could not listen on 127.0.0.1:" << port;
+            throw runtime_error(message.str());
+        }
+        port_ = ntohs(address.sin_port);
+        set_non_blocking(listener_);
+        server_ = thread(&DashboardServer::serve, this);
+    }
+
+    ~DashboardServer() {
+        if (!is_enabled()) {
+            return;
+        }
+        stopping_.store(true);
+        server_.join();
+        close_socket(listener_);
+#ifdef _WIN32
+        WSACleanup();
+#endif
+    }
+
+    // Called by the control thread after each scan
+    void publish(const Factory &factory) {
+        if (client_count_.load(memory_order_relaxed) == 0) {
+            return;
+        }
+        Frame frame = serialize(factory);
+        lock_guard<mutex> lock(frame_mutex_);
+        latest_frame_ = frame;
+        ++frame_sequence_;
+    }
+
+    bool is_enabled() const { return port_ >= 0; }
+    int get_port() const { return port_; }
+    size_t get_client_count() const { return client_count_.load(); }
+    unsigned long get_clients_dropped() const {
+        return clients_dropped_.load();
+    }
+};
+
+// Fixed-period scan loop in the style of a PLC task. Every cycle sleeps to
+// an absolute deadline on the monotonic clock, so the time spent loading
+// the configuration and drawing the screen does not accumulate as drift. A
+// cycle that finishes past its deadline is counted as an overrun and the
+// missed slots are skipped instead of being run back to back.
+class ScanCycleExecutor {
+  private:
+    typedef chrono::steady_clock Clock;
+
+    int period_ms_;
+    Clock::duration period_;
+    Clock::time_point next_deadline_;
+    unsigned long long cycles_;
+    unsigned long long overruns_;
+    unsigned long long skipped_cycles_;
+    unsigned long long jitter_samples_;
+    double jitter_min_us_;
+    double jitter_max_us_;
+    double jitter_sum_us_;
+
+    void record_jitter(double lateness_us) {
+        if (jitter_samples_ == 0 || lateness_us < jitter_min_us_) {
+            jitter_min_us_ = lateness_us;
+        }
+        if (jitter_samples_ == 0 || lateness_us > jitter_max_us_) {
+            jitter_max_us_ = lateness_us;
+        }
+        jitter_sum_us_ += lateness_us;
+        ++jitter_samples_;
+    }
+
+  public:
+    explicit ScanCycleExecutor(int period_ms)
+        : period_ms_(period_ms),
+          period_(chrono::milliseconds(period_ms)),
+          next_deadline_(Clock::now() + period_), cycles_(0), overruns_(0),
+          skipped_cycles_(0), jitter_samples_(0), jitter_min_us_(0.0),
+          jitter_max_us_(0.0), jitter_sum_us_(0.0) {
+        if (period_ms < SystemConstants::SCAN_PERIOD_MIN_MS ||
+            period_ms > SystemConstants::ONE_SECOND_IN_MS) {
+            throw invalid_argument(
+                "El periodo de scan debe estar entre " +
+                to_string(SystemConstants::SCAN_PERIOD_MIN_MS) + " y " +
+                to_string(SystemConstants::ONE_SECOND_IN_MS) + " ms");
+        }
+    }
+
+    // SCHED_FIFO and CPU pinning for the calling thread. Needs
+    // CAP_SYS_NICE on Linux; failures are reported, not fatal to the caller
+    static void enable_real_time(int cpu) {
+#ifdef __linux__
+        sched_param param;
+        param.sched_priority = sched_get_priority_max(SCHED_FIFO) / 2;
+        int result = pthread_setschedparam(pthread_self(), SCHED_FIFO, &param);
+        if (result != 0) {
+            throw runtime_error(string("SCHED_FIFO no disponible: ") +
+                                strerror(result));
+        }
+        if (cpu >= 0) {
+            cpu_set_t cpus;
+            CPU_ZERO(&cpus);
+            CPU_SET(cpu, &cpus);
+            result = pthread_setaffinity_np(pthread_self(), sizeof(cpus),
+                                            &cpus);
+            if (result != 0) {
+                throw runtime_error("No se pudo fijar el hilo a la CPU " +
+                                    to_string(cpu) + ": " + strerror(result));
+            }
+        }
+#else
+        (void)cpu;
+        throw runtime_error(
+            "La planificacion de tiempo real solo esta disponible en Linux");
+#endif
+    }
+
+    int get_period_ms() const { return period_ms_; }
+    double get_period_seconds() const { return period_ms_ / 1000.0; }
+
+    // Interactive work (configuration file, screen) runs about once per
+    // second regardless of the period; counted in cycles so it stays
+    // aligned with simulated time
+    bool is_housekeeping_due() const {
+        int cycles_per_second = SystemConstants::ONE_SECOND_IN_MS / period_ms_;
+        return cycles_ % cycles_per_second == 0;
+    }
+
+    void wait_for_next_cycle() {
+        ++cycles_;
+        Clock::time_point now = Clock::now();
+        if (now >= next_deadline_) {
+            ++overruns_;
+            Clock::duration::rep missed = (now - next_deadline_) / period_;
+            skipped_cycles_ += missed;
+            next_deadline_ += period_ * (missed + 1);
+        }
+        this_thread::sleep_until(next_deadline_);
+        record_jitter(chrono::duration<double, micro>(Clock::now() -
+                                                      next_deadline_)
+                          .count());
+        next_deadline_ += period_;
+    }
+
+    unsigned long long get_cycles() const { return cycles_; }
+    unsigned long long get_overruns() const { return overruns_; }
+    unsigned long long get_skipped_cycles() const { return skipped_cycles_; }
+    double get_jitter_min_us() const { return jitter_min_us_; }
+    double get_jitter_max_us() const { return jitter_max_us_; }
+    double get_jitter_average_us() const {
+        return jitter_samples_ > 0 ? jitter_sum_us_ / jitter_samples_ : 0.0;
+    }
+};
+
+struct KeyPress {
+    int key;
+    chrono::steady_clock::time_point pressed_at;
+};
+
+// Single keystrokes read on their own thread. A terminal is switched to raw
+// mode (no line buffering, no echo) so a key reaches the scan without Enter;
+// piped input is read as it comes. suspend() hands the terminal back to the
+// line-based prompts.
+class KeyboardInput {
+  private:
+    static const int POLL_MS = 20;
+
+    SpscRing<KeyPress, 64> keys_;
+    atomic<bool> stopping_;
+    atomic<bool> suspended_;
+    atomic<bool> reading_; // Between the suspend check and the read
+    bool raw_mode_;
+    thread reader_;
+
+#ifndef _WIN32
+    static termios &saved_terminal_mode() {
+        static termios mode;
+        return mode;
+    }
+
+    // Ctrl+C must not leave the shell without echo
+    static void restore_on_signal(int signal_number) {
+        tcsetattr(STDIN_FILENO, TCSANOW, &saved_terminal_mode());
+        signal(signal_number, SIG_DFL);
+        raise(signal_number);
+    }
+
+    // A handler the program installed itself (to stop cleanly) is kept; the
+    // normal shutdown then restores the terminal
+    static void install_restore_handler(int signal_number) {
+        void (*previous)(int) = signal(signal_number, restore_on_signal);
+        if (previous != SIG_DFL) {
+            signal(signal_number, previous);
+        }
+    }
+#endif
+
+    void enter_raw_mode() {
+#ifndef _WIN32
+        if (!isatty(STDIN_FILENO) ||
+            tcgetattr(STDIN_FILENO, &saved_terminal_mode()) != 0) {
+            return;
+        }
+        termios raw = saved_terminal_mode();
+        raw.c_lflag &= ~(ICANON | ECHO);
+        raw.c_cc[VMIN] = 1;
+        raw.c_cc[VTIME] = 0;
+        if (tcsetattr(STDIN_FILENO, TCSANOW, &raw) == 0) {
+            raw_mode_ = true;
+            install_restore_handler(SIGINT);
+            install_restore_handler(SIGTERM);
+        }
+#endif
+        // The Windows console already delivers keys one by one to _getch()
+    }
+
+    void leave_raw_mode() {
+#ifndef _WIN32
+        if (raw_mode_) {
+            tcsetattr(STDIN_FILENO, TCSANOW, &saved_terminal_mode());
+            raw_mode_ = false;
+        }
+#endif
+    }
+
+    // Waits up to POLL_MS for a key; false at end of input
+    bool read_key(int &key, bool &has_key) {
+        has_key = false;
+#ifdef _WIN32
+        if (!_kbhit()) {
+            Sleep(POLL_MS);
+            return true;
+        }
+        key = _getch();
+        has_key = true;
+        return true;
+#else
+        pollfd input;
+        input.fd = STDIN_FILENO;
+        input.events = POLLIN;
+        input.revents = 0;
+        if (poll(&input, 1, POLL_MS) <= 0) {
+            return true;
+        }
+        unsigned char byte;
+        ssize_t count = read(STDIN_FILENO, &byte, 1);
+        if (count <= 0) {
+            return false;
+        }
+        key = byte;
+        has_key = true;
+        return true;
+#endif
+    }
+
+    void reader_loop() {
+        while (!stopping_.load(memory_order_acquire)) {
+            reading_.store(true, memory_order_seq_cst);
+            if (suspended_.load(memory_order_seq_cst)) {
+                reading_.store(false, memory_order_release);
+                this_thread::sleep_for(chrono::milliseconds(POLL_MS));
+                continue;
+            }
+            int key = 0;
+            bool has_key = false;
+            bool more = read_key(key, has_key);
+            reading_.store(false, memory_order_release);
+            if (!more) {
+                return;
+            }
+            if (has_key) {
+                KeyPress press;
+                press.key = key;
+                press.pressed_at = chrono::steady_clock::now();
+                keys_.try_push(press); // A full ring drops the keystroke
+            }
+        }
+    }
+
+    // Disable copying: the reader thread is bound to this instance
+    KeyboardInput(const KeyboardInput &);
+    KeyboardInput &operator=(const KeyboardInput &);
+
+  public:
+    KeyboardInput()
+        : stopping_(false), suspended_(false), reading_(false),
+          raw_mode_(false) {
+        enter_raw_mode();
+        reader_ = thread(&KeyboardInput::reader_loop, this);
+    }
+
+    ~KeyboardInput() {
+        stopping_.store(true, memory_order_release);
+        reader_.join();
+        leave_raw_mode();
+    }
+
+    bool pop_key(KeyPress &press) { return keys_.try_pop(press); }
+
+    // Returns once the reader has let go of the input
+    void suspend() {
+        suspended_.store(true, memory_order_seq_cst);
+        while (reading_.load(memory_order_seq_cst)) {
+            this_thread::yield();
+        }
+        leave_raw_mode();
+    }
+
+    void resume() {
+        enter_raw_mode();
+        suspended_.store(false, memory_order_seq_cst);
+    }
+};
+
+// What the overview lists: one page of the anomalous lines or of every
+// line, of one base or all, or a single line in full. Positions are clamped
+// when drawn, since the lists change under them.
+struct OverviewView {
+    bool all_lines; // Every line, not only the anomalous ones
+    string base;    // Empty for every base
+    size_t page;
+    bool detail; // Only the detail_position-th line of the list
+    size_t detail_position;
+
+    OverviewView()
+        : all_lines(false), page(0), detail(false), detail_position(0) {}
+};
+
+// Line counts by PumpState and the lines that need attention: flow switch
+// in alarm, discharge above OVERVIEW_PRESSURE_WARNING_PSI, or pump stopped
+// with its dose unfinished. Kept up to date from plant events alone: a
+// reading that moves is checked as it arrives and queued only when the
+// line enters or leaves the list, and a refresh re-checks just the queued
+// lines, so its cost follows what changed rather than the plant size.
+class LineOverviewIndex : public PlantObserver {
+  private:
+    vector<const PumpLine *> lines_; // By line_index
+    vector<PumpState> known_states_;
+    vector<size_t> state_counts_;
+    vector<string> bases_;                    // In order of first line
+    map<string, vector<size_t> > base_lines_; // Positions, ascending
+    vector<size_t> anomalies_;                // Positions, ascending
+    vector<char> anomalous_;                  // By line_index
+    map<string, vector<size_t> > base_anomalies_;
+    vector<char> pending_; // Event since the last refresh
+    vector<size_t> pending_list_;
+
+    static void set_member(vector<size_t> &positions, size_t position,
+                           bool member) {
+        vector<size_t>::iterator it =
+            lower_bound(positions.begin(), positions.end(), position);
+        bool present = it != positions.end() && *it == position;
+        if (member && !present) {
+            positions.insert(it, position);
+        } else if (!member && present) {
+            positions.erase(it);
+        }
+    }
+
+    void recheck(size_t position) {
+        const PumpLine &line = *lines_[position];
+        PumpState state = line.get_pump().get_state();
+        --state_counts_[known_states_[position]];
+        ++state_counts_[state];
+        known_states_[position] = state;
+        bool anomalous = is_anomalous(line);
+        if ((anomalous_[position] != 0) == anomalous) {
+            return;
+        }
+        anomalous_[position] = anomalous ? 1 : 0;
+        set_member(anomalies_, position, anomalous);
+        set_member(base_anomalies_[line.get_tank().get_liquid_in_tank_name()],
+                   position, anomalous);
+    }
+
+    void mark(size_t position) {
+        if (position < pending_.size() && !pending_[position]) {
+            pending_[position] = 1;
+            pending_list_.push_back(position);
+        }
+    }
+
+    const vector<size_t> *list_positions(bool all_lines,
+                                         const string &base) const {
+        const map<string, vector<size_t> > &by_base =
+            all_lines ? base_lines_ : base_anomalies_;
+        if (base.empty()) {
+            return all_lines ? NULL : &anomalies_;
+        }
+        map<string, vector<size_t> >::const_iterator it = by_base.find(base);
+        return it != by_base.end() ? &it->second : NULL;
+    }
+
+    // Disable copying: the plant holds a pointer to this observer
+    LineOverviewIndex(const LineOverviewIndex &);
+    LineOverviewIndex &operator=(const LineOverviewIndex &);
+
+  public:
+    // The plant's lines must not be added to or moved afterwards
+    explicit LineOverviewIndex(const Factory &factory)
+        : state_counts_(PUMP_STATE_COUNT, 0) {
+        const PumpLineMap &pump_lines = factory.get_all_pump_lines();
+        for (PumpLineMap::const_iterator it = pump_lines.begin();
+             it != pump_lines.end(); ++it) {
+            const string &base = it->second.get_tank().get_liquid_in_tank_name();
+            if (base_lines_.find(base) == base_lines_.end()) {
+                bases_.push_back(base);
+            }
+            base_lines_[base].push_back(lines_.size());
+            base_anomalies_[base];
+            lines_.push_back(&it->second);
+            known_states_.push_back(it->second.get_pump().get_state());
+            ++state_counts_[known_states_.back()];
+        }
+        pending_.assign(lines_.size(), 0);
+        anomalous_.assign(lines_.size(), 0);
+        for (size_t i = 0; i < lines_.size(); ++i) {
+            recheck(i);
+        }
+    }
+
+    static bool is_paused(const PumpLine &line) {
+        const LiquidPump &pump = line.get_pump();
+        return !pump.is_on() && pump.has_target() && !pump.is_target_reached();
+    }
+
+    static bool is_anomalous(const PumpLine &line) {
+        return line.get_flow_switch().is_alarm() ||
+               line.get_pressure_transmitter().read_pressure() >
+                   SystemConstants::OVERVIEW_PRESSURE_WARNING_PSI ||
+               is_paused(line);
+    }
+
+    void on_pump_state_changed(size_t line_index, const PumpLine &, PumpState,
+                               double) {
+        mark(line_index);
+    }
+
+    void on_flow_switch_changed(size_t line_index, const PumpLine &, double) {
+        mark(line_index);
+    }
+
+    void on_line_readings_changed(size_t line_index, const PumpLine &line,
+                                  double) {
+        if (line_index < anomalous_.size() &&
+            (anomalous_[line_index] != 0) != is_anomalous(line)) {
+            mark(line_index);
+        }
+    }
+
+    // Valves, drive settings and a lot's new targets
+    void on_line_setpoint_changed(size_t line_index, const PumpLine &,
+                                  double) {
+        mark(line_index);
+    }
+
+    // Call before drawing
+    void refresh() {
+        for (size_t i = 0; i < pending_list_.size(); ++i) {
+            recheck(pending_list_[i]);
+            pending_[pending_list_[i]] = 0;
+        }
+        pending_list_.clear();
+    }
+
+    size_t get_line_count() const { return lines_.size(); }
+    const PumpLine &get_line(size_t position) const {
+        return *lines_[position];
+    }
+    size_t get_state_count(PumpState state) const {
+        return state_counts_[state];
+    }
+    size_t get_anomaly_count() const { return anomalies_.size(); }
+    const vector<string> &get_bases() const { return bases_; }
+
+    size_t get_list_size(bool all_lines, const string &base) const {
+        const vector<size_t> *positions = list_positions(all_lines, base);
+        if (positions != NULL) {
+            return positions->size();
+        }
+        return all_lines && base.empty() ? lines_.size() : 0;
+    }
+
+    // Positions [first, first + count) of a list; only those are copied
+    vector<size_t> get_list_slice(bool all_lines, const string &base,
+                                  size_t first, size_t count) const {
+        vector<size_t> slice;
+        const vector<size_t> *positions = list_positions(all_lines, base);
+        size_t size = get_list_size(all_lines, base);
+        for (size_t i = first; i < size && i < first + count; ++i) {
+            slice.push_back(positions != NULL ? (*positions)[i] : i);
+        }
+        return slice;
+    }
+};
+
+// Live operator console. Hotkeys act on the plant on the next scan; valve
+// and colour keys go through the same overrides as shared-tag commands, so
+// a later edit of the file takes over again.
+class OperatorConsole {
+  private:
+    KeyboardInput *input_; // NULL when the console is off
+    bool paused_;
+    unsigned long commands_applied_;
+    double last_latency_ms_;
+    double max_latency_ms_;
+    string last_message_;
+    OverviewView view_;
+
+    static const char *valve_keys() { return "123456"; }
+    static const char *flow_switch_keys() { return "qwe"; }
+
+    // Line at a position in map order, as the keys are laid out
+    static PumpLine *line_at(Factory &factory, size_t position) {
+        const PumpLineMap &pump_lines = factory.get_all_pump_lines();
+        if (position >= pump_lines.size()) {
+            return NULL;
+        }
+        PumpLineMap::const_iterator it = pump_lines.begin();
+        advance(it, position);
+        return &factory.get_pump_line_mutable(it->first);
+    }
+
+    // Overview navigation; returns false for other keys
+    bool apply_view_key(int key, const LineOverviewIndex &overview) {
+        const size_t page_lines = SystemConstants::OVERVIEW_PAGE_LINES;
+        size_t size = overview.get_list_size(view_.all_lines, view_.base);
+        if (key == 'v') {
+            view_.all_lines = !view_.all_lines;
+            view_.page = 0;
+            view_.detail_position = 0;
+            last_message_ = view_.all_lines ? "Lista: todas las lineas"
+                                            : "Lista: lineas anomalas";
+        } else if (key == 'f') {
+            const vector<string> &bases = overview.get_bases();
+            vector<string>::const_iterator it =
+                find(bases.begin(), bases.end(), view_.base);
+            if (view_.base.empty()) {
+                view_.base = bases.empty() ? "" : bases.front();
+            } else {
+                view_.base = it == bases.end() || it + 1 == bases.end()
+                                 ? ""
+                                 : *(it + 1);
+            }
+            view_.page = 0;
+            view_.detail_position = 0;
+            last_message_ = "Base: " + (view_.base.empty() ? string("todas")
+                                                           : view_.base);
+        } else if (key == 'n') {
+            if (view_.detail) {
+                if (view_.detail_position + 1 < size) {
+                    ++view_.detail_position;
+                }
+            } else if ((view_.page + 1) * page_lines < size) {
+                ++view_.page;
+            }
+        } else if (key == 'b') {
+            if (view_.detail && view_.detail_position > 0) {
+                --view_.detail_position;
+            } else if (!view_.detail && view_.page > 0) {
+                --view_.page;
+            }
+        } else if (key == 'd') {
+            view_.detail = !view_.detail;
+            if (view_.detail) {
+                view_.detail_position = view_.page * page_lines;
+            } else {
+                view_.page = view_.detail_position / page_lines;
+            }
+        } else {
+            return false;
+        }
+        return true;
+    }
+
+    void apply_key(int key, PlantSession &plant, ConfigOverrides &overrides,
+                   const SystemConfig &file_config, SystemConfig &user_config,
+                   AlarmManager &alarms, PlantEventLog &events,
+                   const LineOverviewIndex &overview) {
+        // The view changes nothing in the plant
+        if (apply_view_key(key, overview)) {
+            return;
+        }
+        Factory &factory = plant.get_factory();
+        const char *valve_key = strchr(valve_keys(), key);
+        const char *flow_key = strchr(flow_switch_keys(), key);
+        const vector<string> &valves = ConfigValidator::get_known_valve_keys();
+
+        if (key != 0 && valve_key != NULL &&
+            static_cast<size_t>(valve_key - valve_keys()) < valves.size()) {
+            const string &valve = valves[valve_key - valve_keys()];
+            string value =
+                ConfigValidator::get_config_value(user_config, valve) == "OPEN"
+                    ? "CLOSE"
+                    : "OPEN";
+            overrides.set(valve, value, file_config);
+            last_message_ = valve + " -> " + value;
+        } else if (key != 0 && flow_key != NULL) {
+            PumpLine *line = line_at(factory, flow_key - flow_switch_keys());
+            if (line == NULL) {
+                return;
+            }
+            FlowSwitch &flow_switch = line->get_flow_switch_mutable();
+            flow_switch.set_forced_alarm(!flow_switch.is_forced_alarm());
+            last_message_ = flow_switch.get_code() +
+                            (flow_switch.is_forced_alarm() ? " forzado a ALARMA"
+                                                           : " liberado");
+        } else if (key == 'm' || key == 'c') {
+            string color = key == 'm' ? "AzMarino" : "AzCeleste";
+            overrides.set("COLOR_A_MEZCLAR", color, file_config);
+            last_message_ = "Color " + color;
+        } else if (key == 'i') {
+            StartResult start = plant.press_start(user_config);
+            events.on_start_result(start, factory);
+            report_start_result(start);
+        } else if (key == 'p') {
+            paused_ = !paused_;
+            last_message_ =
+                paused_ ? "Simulacion en pausa" : "Simulacion reanudada";
+        } else if (key == 'a') {
+            alarms.acknowledge_all(factory.get_sim_time());
+            last_message_ = "Alarmas reconocidas";
+        } else if (key == 's') {
+            double now = factory.get_sim_time();
+            for (int priority = ALARM_PRIORITY_LOW;
+                 priority <= ALARM_PRIORITY_CRITICAL; ++priority) {
+                const set<unsigned> &standing = alarms.get_standing_alarms(
+                    static_cast<AlarmPriority>(priority));
+                for (set<unsigned>::const_iterator it = standing.begin();
+                     it != standing.end(); ++it) {
+                    if (alarms.get_alarm(*it).active &&
+                        alarms.is_annunciated(*it, now)) {
+                        alarms.shelve(*it,
+                                      SystemConstants::ALARM_SHELVE_SECONDS,
+                                      now);
+                    }
+                }
+            }
+            last_message_ = "Alarmas activas suprimidas";
+        } else {
+            return;
+        }
+
+        // Overrides take effect at once, not at the next file read
+        user_config = file_config;
+        overrides.apply(user_config);
+        StartResult start = plant.apply_config(user_config);
+        events.on_start_result(start, factory);
+        if (start != START_NOT_REQUESTED) {
+            report_start_result(start);
+        }
+    }
+
+    // Disable copying: the console owns its keyboard reader
+    OperatorConsole(const OperatorConsole &);
+    OperatorConsole &operator=(const OperatorConsole &);
+
+  public:
+    explicit OperatorConsole(bool enabled)
+        : input_(enabled ? new KeyboardInput() : NULL), paused_(false),
+          commands_applied_(0), last_latency_ms_(0.0), max_latency_ms_(0.0) {}
+
+    ~OperatorConsole() { delete input_; }
+
+    bool is_enabled() const { return input_ != NULL; }
+    bool is_paused() const { return paused_; }
+    const OverviewView &get_view() const { return view_; }
+
+    // Applies every key pressed since the last scan
+    void apply_pending(PlantSession &plant, ConfigOverrides &overrides,
+                       const SystemConfig &file_config,
+                       SystemConfig &user_config, AlarmManager &alarms,
+                       PlantEventLog &events,
+                       const LineOverviewIndex &overview) {
+        if (input_ == NULL) {
+            return;
+        }
+        KeyPress press;
+        while (input_->pop_key(press)) {
+            try {
+                apply_key(press.key, plant, overrides, file_config,
+                          user_config, alarms, events, overview);
+            } catch (const exception &e) {
+                last_message_ = e.what();
+            }
+            double latency_ms = chrono::duration<double, milli>(
+                                    chrono::steady_clock::now() -
+                                    press.pressed_at)
+                                    .count();
+            last_latency_ms_ = latency_ms;
+            if (latency_ms > max_latency_ms_) {
+                max_latency_ms_ = latency_ms;
+            }
+            ++commands_applied_;
+        }
+    }
+
+    // The console never blocks on a rejected start; the reason stays on
+    // screen until the next message
+    void report_start_result(StartResult result) {
+        switch (result) {
+        case START_ACCEPTED:
+            last_message_ = "Lote iniciado";
+            break;
+        case START_REJECTED_BATCH_IN_PROCESS:
+            last_message_ = "Lote rechazado: espere a que termine el lote "
+                            "actual";
+            break;
+        case START_REJECTED_MIXER_NOT_EMPTY:
+            last_message_ = "Lote rechazado: el interruptor de bajo nivel "
+                            "del mezclador no esta en alarma";
+            break;
+        case START_REJECTED_BASES_SHORT:
+            last_message_ = "Lote rechazado: las bases no alcanzan para el "
+                            "lote del pedido";
+            break;
+        default:
+            break;
+        }
+    }
+
+    // A finished lot is reported like a start so the scan keeps running
+    void report_batch_completed(const string &color) {
+        last_message_ = "Lote de " + color + " completado; mezclador vacio";
+    }
+
+    void suspend() {
+        if (input_ != NULL) {
+            input_->suspend();
+        }
+    }
+
+    void resume() {
+        if (input_ != NULL) {
+            input_->resume();
+        }
+    }
+
+    void show_status(const Factory &factory) const {
+        if (input_ == NULL) {
+            return;
+        }
+        cout << "=== Consola ===" << endl;
+        cout << "[1-6] V201..V403  [q/w/e] forzar FS  [m/c] color  "
+                "[i] iniciar lote  [p] pausa  [a] reconocer  [s] suprimir"
+             << endl;
+        const PumpLineMap &pump_lines = factory.get_all_pump_lines();
+        if (pump_lines.size() > SystemConstants::OVERVIEW_DETAIL_MAX_LINES) {
+            cout << "[v] anomalas/todas  [f] base  [n/b] pagina o linea  "
+                    "[d] detalle"
+                 << endl;
+        }
+        // Only the lines with a key can be forced from here
+        PumpLineMap::const_iterator keyed_end = pump_lines.begin();
+        for (size_t i = 0;
+             i < strlen(flow_switch_keys()) && keyed_end != pump_lines.end();
+             ++i) {
+            ++keyed_end;
+        }
+        for (PumpLineMap::const_iterator it = pump_lines.begin();
+             it != keyed_end; ++it) {
+            if (it->second.get_flow_switch().is_forced_alarm()) {
+                cout << it->second.get_flow_switch().get_code()
+                     << " forzado a ALARMA" << endl;
+            }
+        }
+        if (paused_) {
+            cout << "SIMULACION EN PAUSA" << endl;
+        }
+        if (!last_message_.empty()) {
+            cout << "Ultimo comando: " << last_message_ << endl;
+        }
+        if (commands_applied_ > 0) {
+            cout << "Latencia tecla-actuacion: " << last_latency_ms_
+                 << " ms (max " << max_latency_ms_ << " ms, "
+                 << commands_applied_ << " teclas)" << endl;
+        }
+        cout << endl;
+    }
+};
+
+class UserInterface {
+  private:
+    static const size_t RECENT_ALARM_EVENTS = 5;
+
+    bool last_batch_in_process_;
+    vector<AlarmJournalEntry> recent_alarm_events_;
+    
+    void clear_screen() {
+#ifdef _WIN32
+        system("cls");
+#else
+        cout << "\033[2J\033[H"; // ANSI: clear, cursor home
+#endif
+    }
+
+  public:
+    UserInterface() : last_batch_in_process_(false) {}
+    
+    void clear_display() { clear_screen(); }
+
+    void show_simulation_status(const Factory &factory,
+                                const SystemConfig &config,
+                                const OrderQueue &orders,
+                                const KpiTracker &kpi,
+                                AlarmManager &alarms,
+                                const ScanCycleExecutor &scan,
+                                const PredictiveTwin &twin,
+                                const BaseInventoryPlanner &inventory,
+                                LineOverviewIndex &overview,
+                                OperatorConsole &console) {
+        const OverviewView &view = console.get_view();
+        clear_screen();
+        
+        // Check if batch just completed
+        if (last_batch_in_process_ && !factory.is_batch_in_process() && 
+            !factory.is_emptying_in_process()) {
+            if (console.is_enabled()) {
+                console.report_batch_completed(factory.get_batch_color());
+            } else {
+                // The prompt reads a whole line, so the keys are handed back
+                console.suspend();
+                cout << "*** LOTE COMPLETADO EXITOSAMENTE ***" << endl;
+                cout << "El lote de " << factory.get_batch_color() << " ha sido completado." << endl;
+                cout << "El mezclador ha sido vaciado y esta listo para un nuevo lote." << endl;
+                cout << "Presione Enter para continuar..." << endl;
+                cin.ignore(numeric_limits<streamsize>::max(), '\n');
+                cin.get();
+                console.resume();
+                clear_screen();
+            }
+        }
+        
+        // Update tracking variable
+        last_batch_in_process_ = factory.is_batch_in_process();
+        
+        cout << "=== Sistema de Mezcla de Pintura Dupont ===" << endl;
+        cout << "Color a mezclar: " << config.color_a_mezclar << endl;
+        cout << "Estado de fabricacion: " << config.arranque_de_fabricacion
+             << endl;
+        cout << "Lote en proceso: "
+             << (factory.is_batch_in_process() ? "SI" : "NO") << endl;
+        if (!orders.is_empty()) {
+            // Lots are then sized from the orders, not the configuration
+            cout << "Pedidos pendientes: " << orders.get_orders().size()
+                 << " (" << orders.get_remaining_liters() << " L), siguiente "
+                 << orders.get_orders().front().color << endl;
+        }
+        cout << "Vaciado en proceso: "
+             << (factory.is_emptying_in_process() ? "SI" : "NO") << endl;
+        
+        // Show current batch phase
+        if (factory.is_batch_in_process()) {
+            cout << "Fase actual: ";
+            // The phase and line counters are kept by plant events, so this
+            // costs the same on any plant size
+            if (factory.get_batch_phase() == BATCH_PUMPING) {
+                cout << "BOMBEANDO (" << factory.get_completed_line_count()
+                     << " de " << factory.get_required_line_count()
+                     << " lineas completas)" << endl;
+            } else if (factory.get_mixer_tank().get_mixer_motor().is_running()) {
+                cout << "MEZCLANDO" << endl;
+            } else if (factory.is_emptying_in_process()) {
+                cout << "VACIANDO" << endl;
+            } else {
+                cout << "COMPLETANDO..." << endl;
+            }
+        }
+        cout << endl;
+
+        // Lines shown on this screen; the sections below follow them
+        vector<size_t> visible_lines;
+        if (overview.get_line_count() <=
+            SystemConstants::OVERVIEW_DETAIL_MAX_LINES) {
+            cout << "=== Estado de las Lineas de Bombeo ===" << endl;
+            for (size_t i = 0; i < overview.get_line_count(); ++i) {
+                show_pump_line_status(overview.get_line(i));
+                visible_lines.push_back(i);
+            }
+
+            cout << "=== Estado de Valvulas ===" << endl;
+            show_valve_status(factory, config);
+        } else {
+            visible_lines = show_line_overview(overview, view);
+        }
+
+        cout << "=== Estado del Mezclador ===" << endl;
+        show_mixer_status(factory.get_mixer_tank());
+
+        cout << "=== Linea de Llenado ===" << endl;
+        show_filling_status(factory);
+
+        cout << "=== Inventario de Bases ===" << endl;
+        show_inventory_status(factory, inventory, overview, visible_lines);
+
+        cout << "=== Indicadores de Produccion ===" << endl;
+        show_kpi_status(kpi, factory.get_sim_time(), visible_lines);
+
+        cout << "=== Alarmas ===" << endl;
+        show_alarm_status(alarms, factory.get_sim_time());
+
+        cout << "=== Prediccion ===" << endl;
+        show_prediction_status(twin);
+
+        cout << "=== Ciclo de Scan ===" << endl;
+        show_scan_cycle_status(scan);
+    }
+
+    // Warnings for a start command the plant did not accept
+    void show_start_result(StartResult result, const Factory &factory) {
+        if (result == START_REJECTED_MIXER_NOT_EMPTY) {
+            cout << "ADVERTENCIA: No se puede iniciar un nuevo lote." << endl;
+            cout << "El interruptor de bajo nivel del mezclador NO esta en alarma (el tanque no esta lo suficientemente vacio)." << endl;
+        } else if (result == START_REJECTED_BATCH_IN_PROCESS) {
+            cout << "ADVERTENCIA: No se puede iniciar un nuevo lote." << endl;
+            cout << "Espere a que termine el lote actual antes de iniciar uno nuevo." << endl;
+            cout << "Estado actual: ";
+            if (factory.get_batch_phase() == BATCH_PUMPING) {
+                cout << "Bombeando liquidos..." << endl;
+            } else if (factory.get_mixer_tank().get_mixer_motor().is_running()) {
+                cout << "Mezclando..." << endl;
+            } else if (factory.is_emptying_in_process()) {
+                cout << "Vaciando mezclador..." << endl;
+            }
+        } else if (result == START_REJECTED_BASES_SHORT) {
+            cout << "ADVERTENCIA: No se puede iniciar un nuevo lote." << endl;
+            cout << "Las bases disponibles no alcanzan para el lote minimo "
+                    "del pedido en curso."
+                 << endl;
+        } else {
+            return;
+        }
+        cout << "Presione Enter para continuar..." << endl;
+        std::cin.ignore(std::numeric_limits<std::streamsize>::max(), '\n');
+        std::cin.get();
+    }
+
+  private:
+    // Plants too large to list line by line: counts by state, then one page
+    // of the chosen list or one line in full. Returns the positions shown.
+    vector<size_t> show_line_overview(LineOverviewIndex &overview,
+                                      const OverviewView &view) {
+        const size_t page_lines = SystemConstants::OVERVIEW_PAGE_LINES;
+        overview.refresh();
+        cout << "=== Resumen de Lineas de Bombeo ("
+             << overview.get_line_count() << " lineas) ===" << endl;
+        for (int state = RUNNING; state >= 0; --state) {
+            cout << (state == RUNNING ? "" : ", ")
+                 << pump_state_name(static_cast<PumpState>(state)) << " "
+                 << overview.get_state_count(static_cast<PumpState>(state));
+        }
+        cout << endl;
+        cout << "Anomalas: " << overview.get_anomaly_count()
+             << " (alarma de flujo, presion sobre "
+             << SystemConstants::OVERVIEW_PRESSURE_WARNING_PSI
+             << " psi o dosis detenida)" << endl;
+        cout << endl;
+
+        size_t size = overview.get_list_size(view.all_lines, view.base);
+        cout << "=== "
+             << (view.all_lines ? "Todas las lineas" : "Lineas anomalas")
+             << ", base " << (view.base.empty() ? "todas" : view.base);
+        if (view.detail) {
+            size_t position =
+                view.detail_position < size ? view.detail_position : size - 1;
+            vector<size_t> shown =
+                overview.get_list_slice(view.all_lines, view.base, position, 1);
+            if (shown.empty()) {
+                cout << " ===" << endl;
+                cout << "Sin lineas que mostrar" << endl << endl;
+                return shown;
+            }
+            cout << ": linea " << position + 1 << "/" << size << " ===" << endl;
+            const PumpLine &pump_line = overview.get_line(shown[0]);
+            show_pump_line_status(pump_line);
+            cout << "Valvula " << pump_line.get_enter_valve().get_code() << ": "
+                 << (pump_line.get_enter_valve().is_open() ? "ABIERTA"
+                                                           : "CERRADA")
+                 << ", valvula " << pump_line.get_exit_valve().get_code()
+                 << ": "
+                 << (pump_line.get_exit_valve().is_open() ? "ABIERTA"
+                                                          : "CERRADA")
+                 << endl;
+            cout << endl;
+            return shown;
+        }
+
+        size_t pages = size == 0 ? 1 : (size + page_lines - 1) / page_lines;
+        size_t page = view.page < pages ? view.page : pages - 1;
+        cout << ": pagina " << page + 1 << "/" << pages << " ===" << endl;
+        vector<size_t> shown = overview.get_list_slice(
+            view.all_lines, view.base, page * page_lines, page_lines);
+        if (shown.empty()) {
+            cout << "Sin lineas que mostrar" << endl;
+        }
+        for (size_t i = 0; i < shown.size(); ++i) {
+            show_pump_line_row(overview.get_line(shown[i]));
+        }
+        cout << endl;
+        return shown;
+    }
+
+    // One row of the overview list, reasons for attention last
+    void show_pump_line_row(const PumpLine &pump_line) {
+        const LiquidPump &pump = pump_line.get_pump();
+        double pressure = pump_line.get_pressure_transmitter().read_pressure();
+        cout << pump.get_code() << " ("
+             << pump_line.get_tank().get_liquid_in_tank_name()
+             << "): " << pump_state_name(pump.get_state()) << ", "
+             << pressure << " psi, " << pump.get_delivered_liters() << "/"
+             << pump.get_target_liters() << " lts, tanque "
+             << pump_line.get_tank().get_level() << "%, valvulas "
+             << (pump_line.get_enter_valve().is_open() ? "A" : "C") << "/"
+             << (pump_line.get_exit_valve().is_open() ? "A" : "C");
+        if (pump_line.get_flow_switch().is_alarm()) {
+            cout << " [ALARMA FS]";
+        }
+        if (pressure > SystemConstants::OVERVIEW_PRESSURE_WARNING_PSI) {
+            cout << " [PRESION]";
+        }
+        if (LineOverviewIndex::is_paused(pump_line)) {
+            cout << " [DETENIDA]";
+        }
+        cout << endl;
+    }
+
+    void show_pump_line_status(const PumpLine &pump_line) {
+        const LiquidPump& pump = pump_line.get_pump();
+        const LiquidTank& tank = pump_line.get_tank();
+        const PressureTransmitter& pressure = pump_line.get_pressure_transmitter();
+
+        cout << "Bomba " << pump.get_code() << " ("
+             << tank.get_liquid_in_tank_name() << "):" << endl;
+        cout << "  Estado: " << (pump.is_on() ? "ENCENDIDA" : "APAGADA")
+             << endl;
+        cout << "  Tiempo transcurrido: " << pump.get_elapsed_seconds() << "s"
+             << endl;
+        cout << "  Tiempo objetivo: " << pump.get_target_duration() << "s"
+             << endl;
+        cout << "  Dosificado: " << pump.get_delivered_liters() << "/"
+             << pump.get_target_liters() << " lts" << endl;
+        if (pump.is_vfd_mode()) {
+            cout << "  Velocidad: " << pump.get_speed_percent() << "% ("
+                 << pump.get_flow_rate() << " lts/min)" << endl;
+        }
+        cout << "  Nivel tanque: " << tank.get_level() << "%" << endl;
+        cout << "  Presion: " << pressure.read_pressure() << " psi" << endl;
+        const FlowSwitch& flow_switch = pump_line.get_flow_switch(); // Get the flow switch
+        cout << "  Flujo Switch " << flow_switch.get_code() << ": "
+             << (flow_switch.is_normal() ? "NORMAL" : "ALARMA") << endl;
+        cout << endl;
+    }
+
+    void show_valve_status(const Factory &factory, const SystemConfig &config) {
+        // Display valve states from configuration and actual valve states
+        for (map<string, string>::const_iterator it = config.valve_states.begin(); 
              it != config.valve_states.end(); ++it) {
             const string& valve_name = it->first;
-            const string& valve_state = it->second;
-            bool should_be_open = (valve_state == "OPEN");
-                // TODO: Consider a more robust way to map valve names to components if more valves are added.
-                // For now, direct mapping is used.
+            const string& config_state = it->second;
+            cout << "Valvula " << valve_name << ": ";
+            cout << "Config=" << config_state;
+            
+            // Show actual valve state
+            bool actual_state = false;
             if (valve_name == "V201") {
-                get_pump_line_mutable("P201").get_enter_valve_mutable().set_open(should_be_open);
+                actual_state = factory.get_pump_line("P201").get_enter_valve().is_open();
             } else if (valve_name == "V202") {
-                get_pump_line_mutable("P202").get_enter_valve_mutable().set_open(should_be_open);
+                actual_state = factory.get_pump_line("P202").get_enter_valve().is_open();
             } else if (valve_name == "V203") {
-                get_pump_line_mutable("P203").get_enter_valve_mutable().set_open(should_be_open);
+                actual_state = factory.get_pump_line("P203").get_enter_valve().is_open();
             } else if (valve_name == "V401") {
-                get_pump_line_mutable("P201").get_exit_valve_mutable().set_open(should_be_open);
+                actual_state = factory.get_pump_line("P201").get_exit_valve().is_open();
             } else if (valve_name == "V402") {
-                get_pump_line_mutable("P202").get_exit_valve_mutable().set_open(should_be_open);
+                actual_state = factory.get_pump_line("P202").get_exit_valve().is_open();
             } else if (valve_name == "V403") {
-                get_pump_line_mutable("P203").get_exit_valve_mutable().set_open(should_be_open);
+                actual_state = factory.get_pump_line("P203").get_exit_valve().is_open();
+            }
+            
+            cout << ", Estado=" << (actual_state ? "ABIERTA" : "CERRADA") << endl;
+        }
+        cout << endl;
+    }
+
+    void show_prediction_status(const PredictiveTwin &twin) {
+        vector<PlantPrediction> predictions = twin.get_predictions();
+        if (predictions.empty()) {
+            cout << "Sin eventos en los proximos " << twin.get_horizon_seconds()
+                 << " s" << endl;
+        }
+        for (size_t i = 0; i < predictions.size(); ++i) {
+            const PlantPrediction &prediction = predictions[i];
+            switch (prediction.kind) {
+            case PREDICT_FLOW_ALARM_TRIP:
+                cout << prediction.subject
+                     << " se detendra por alarma de flujo en "
+                     << prediction.seconds_ahead << " s" << endl;
+                break;
+            case PREDICT_OVERPRESSURE_TRIP:
+                cout << prediction.subject
+                     << " disparara por sobrepresion en "
+                     << prediction.seconds_ahead << " s" << endl;
+                break;
+            case PREDICT_TANK_DRY:
+                cout << prediction.subject << " se vaciara en "
+                     << prediction.seconds_ahead
+                     << " s: el lote quedara corto "
+                     << prediction.liters_short << " L" << endl;
+                break;
+            case PREDICT_BATCH_DONE:
+                cout << "El lote terminara en " << prediction.seconds_ahead
+                     << " s" << endl;
+                break;
+            case PREDICT_BATCH_LATE:
+                cout << "El lote no terminara en los proximos "
+                     << prediction.seconds_ahead << " s" << endl;
+                break;
+            }
+        }
+        cout << "Simulacion adelantada: " << twin.get_last_run_microseconds()
+             << " us" << endl;
+        cout << endl;
+    }
+
+    void show_scan_cycle_status(const ScanCycleExecutor &scan) {
+        cout << "Ciclo de scan: periodo " << scan.get_period_ms()
+             << " ms, ciclos " << scan.get_cycles() << ", sobrepasos "
+             << scan.get_overruns() << " (" << scan.get_skipped_cycles()
+             << " ciclos saltados)" << endl;
+        cout << "Jitter: min " << scan.get_jitter_min_us() << " us, prom "
+             << scan.get_jitter_average_us() << " us, max "
+             << scan.get_jitter_max_us() << " us" << endl;
+        cout << endl;
+    }
+
+    void show_kpi_status(const KpiTracker &kpi, double now,
+                         const vector<size_t> &visible_lines) {
+        const BatchCycleTimes &last_batch = kpi.get_last_batch();
+        cout << "Lotes completados: " << kpi.get_batches_completed()
+             << ", ciclo promedio: " << kpi.get_average_cycle_seconds() << "s"
+             << endl;
+        cout << "Ultimo lote: " << last_batch.get_total() << "s (espera "
+             << last_batch.phase_seconds[BATCH_IDLE] << "s, bombeo "
+             << last_batch.phase_seconds[BATCH_PUMPING] << "s, mezcla "
+             << last_batch.phase_seconds[BATCH_MIXING] << "s, vaciado "
+             << last_batch.phase_seconds[BATCH_EMPTYING] << "s)" << endl;
+        cout << "Mezclador inactivo entre lotes: "
+             << kpi.get_mixer_idle_seconds(now) << "s" << endl;
+        for (size_t v = 0; v < visible_lines.size(); ++v) {
+            size_t i = visible_lines[v];
+            cout << "Bomba " << kpi.get_pump_code(i) << ": utilizacion "
+                 << kpi.get_utilisation_percent(i, now)
+                 << "%, disparos por sobrepresion "
+                 << kpi.get_overpressure_trips(i) << endl;
+            cout << " ";
+            for (int state = 0; state < PUMP_STATE_COUNT; ++state) {
+                cout << " " << pump_state_name(static_cast<PumpState>(state))
+                     << "=" << kpi.get_seconds_in_state(
+                                   i, static_cast<PumpState>(state), now)
+                     << "s";
+            }
+            cout << endl;
+        }
+        cout << endl;
+    }
+
+    void show_alarm_status(AlarmManager &alarms, double now) {
+        // Most urgent first, over the standing alarms only
+        for (int priority = ALARM_PRIORITY_CRITICAL;
+             priority >= ALARM_PRIORITY_LOW; --priority) {
+            const set<unsigned> &standing = alarms.get_standing_alarms(
+                static_cast<AlarmPriority>(priority));
+            for (set<unsigned>::const_iterator it = standing.begin();
+                 it != standing.end(); ++it) {
+                unsigned id = *it;
+                const AlarmManager::Alarm &alarm = alarms.get_alarm(id);
+                if (!alarms.is_annunciated(id, now)) {
+                    continue;
+                }
+                cout << "[" << alarm_priority_name(alarm.priority) << "] "
+                     << alarm.tag << ": " << alarm.message << " ("
+                     << (alarm.active ? "ACTIVA" : "NORMALIZADA") << ", "
+                     << (alarm.acknowledged ? "RECONOCIDA" : "SIN RECONOCER")
+                     << ")" << endl;
+            }
+        }
+
+        AlarmJournalEntry entry;
+        while (alarms.pop_journal_entry(entry)) {
+            if (recent_alarm_events_.size() == RECENT_ALARM_EVENTS) {
+                recent_alarm_events_.erase(recent_alarm_events_.begin());
+            }
+            recent_alarm_events_.push_back(entry);
+        }
+        cout << "Ultimos eventos:" << endl;
+        for (size_t i = 0; i < recent_alarm_events_.size(); ++i) {
+            const AlarmJournalEntry &event = recent_alarm_events_[i];
+            cout << "  t=" << event.sim_time << "s "
+                 << alarms.get_alarm(event.alarm_id).tag << " "
+                 << alarm_event_name(event.event)
+                 << (event.annunciated ? "" : " (suprimida)") << endl;
+        }
+        cout << endl;
+    }
+
+    void show_inventory_status(const Factory &factory,
+                               const BaseInventoryPlanner &inventory,
+                               const LineOverviewIndex &overview,
+                               const vector<size_t> &visible_lines) {
+        for (size_t i = 0; i < visible_lines.size(); ++i) {
+            const PumpLine &pump_line = overview.get_line(visible_lines[i]);
+            BaseForecast base = inventory.forecast_line(factory, pump_line);
+            cout << base.base_name << ": " << base.on_hand_liters
+                 << " litros en " << pump_line.get_reserve_tanks().size() + 1
+                 << " tanque(s), alimenta " << pump_line.get_tank().get_code()
+                 << " (" << pump_line.get_tank().get_level() << "%)";
+            if (base.liters_per_lot > 0.0) {
+                cout << ", alcanza para " << floor(base.lots_remaining)
+                     << " lotes";
+            }
+            cout << endl;
+            if (base.on_order_liters > 0.0) {
+                cout << "  Reposicion pedida: " << base.on_order_liters
+                     << " litros" << endl;
+            }
+        }
+        const vector<BaseRefill> &refills = factory.get_pending_refills();
+        if (!refills.empty()) {
+            cout << "Proxima entrega: " << refills.front().pump_code << " en "
+                 << refills.front().arrival_time - factory.get_sim_time()
+                 << "s" << endl;
+        }
+        cout << endl;
+    }
+
+    void show_filling_status(const Factory &factory) {
+        const FillingLine &filling_line = factory.get_filling_line();
+        const ProductBufferList &buffers = filling_line.get_buffers();
+        for (size_t i = 0; i < buffers.size(); ++i) {
+            cout << "Tanque " << buffers[i].get_code() << " ("
+                 << buffers[i].get_color() << "): "
+                 << buffers[i].get_current_liters() << "/"
+                 << buffers[i].get_capacity() << " litros ("
+                 << buffers[i].get_level() << "%)" << endl;
+        }
+        const CanFiller &filler = filling_line.get_filler();
+        cout << "Llenadora " << filler.get_code() << ": "
+             << filler_state_name(filler.get_state());
+        if (filler.get_state() == FILLER_CHANGEOVER) {
+            cout << " a " << filler.get_color() << ", faltan "
+                 << filler.get_changeover_left() << "s";
+        } else if (filler.get_state() == FILLER_FILLING) {
+            cout << " " << filler.get_color();
+        }
+        cout << " (" << filler.get_cans_per_minute() << " latas/min de "
+             << filler.get_can_liters() << " L)" << endl;
+        cout << "  Latas llenadas: " << filler.get_cans_filled()
+             << ", cambios de color: " << filler.get_changeovers() << endl;
+        cout << "  Descarga del mezclador: "
+             << (factory.is_discharge_blocked() ? "BLOQUEADA (tanque lleno)"
+                                                : "LIBRE")
+             << ", tiempo bloqueada: "
+             << factory.get_discharge_blocked_seconds() << "s" << endl;
+        cout << endl;
+    }
+
+    void show_mixer_status(const MixerTank &mixer_tank) {
+        const MixerMotor& mixer_motor = mixer_tank.get_mixer_motor();
+
+        cout << "Mezclador " << mixer_tank.get_code() << ":" << endl;
+        cout << "  Nivel: " << mixer_tank.get_level() << "%" << endl;
+        cout << "  Capacidad actual: " << mixer_tank.get_current_capacity()
+             << " litros" << endl;
+        cout << "  Motor: "
+             << (mixer_motor.is_running() ? "MEZCLANDO" : "DETENIDO") << endl;
+        cout << "  Tiempo de mezcla transcurrido: "
+             << mixer_motor.get_elapsed_time() << "s" << endl;
+        cout << "  Tiempo objetivo de mezcla: " << mixer_motor.get_target_time()
+             << "s" << endl;
+        cout << "  Estado de vaciado: "
+             << (mixer_tank.is_emptying() ? "VACIANDO" : "DETENIDO") << endl;
+        cout << "  Tiempo de vaciado transcurrido: "
+             << mixer_tank.get_emptying_elapsed_time() << "s" << endl;
+        cout << "  Interruptor bajo nivel: "
+             << (mixer_tank.get_low_level_switch().is_alarm() ? "ALARMA"
+                                                              : "NORMAL")
+             << endl;
+        cout << endl;
+    }
+};
+
+class ConfigurationUI {
+  private:
+    UserInterface ui_;
+    AsyncLogger &log_;
+    OperatorConsole &console_;
+    // Malformed lines already logged, so a file re-read every second does
+    // not repeat them
+    vector<int> reported_malformed_lines_;
+
+    void log_malformed_lines(const vector<int> &lines, double sim_time) {
+        if (lines == reported_malformed_lines_) {
+            return;
+        }
+        for (vector<int>::const_iterator it = lines.begin(); it != lines.end();
+             ++it) {
+            log_.write(LOG_WARNING, LOG_EVENT_CONFIG_MALFORMED_LINE, sim_time,
+                       *it);
+        }
+        reported_malformed_lines_ = lines;
+    }
+
+    bool prompt_config_repair(const runtime_error &e) {
+        ui_.clear_display();
+        cerr << "Ha ocurrido un error leyendo la configuracion: " << e.what()
+             << endl;
+        cout << "Quieres que se corrija la configuracion con un archivo de "
+                "configuracion con las configuraciones iniciales? "
+                "Escribe 'si', o escribe 'no' para cerrar el programa."
+             << endl;
+
+        cout << "Tu opcion: ";
+        string user_choice;
+        cin >> user_choice;
+
+        if (user_choice != "si") {
+            cout << "El usuario eligio no reparar la configuracion." << endl;
+            return false;
+        }
+        return true;
+    }
+
+    void show_config_repair_success() {
+        cout << "El archivo de configuracion ha sido escrito en: "
+             << SystemConstants::CONFIG_FILE_PATH << endl;
+        cout << "Por favor, ajusta la configuracion segun sea necesario."
+             << endl;
+        cout << "Cuando hayas terminado, presiona Enter para continuar..."
+             << endl;
+        cin.ignore(numeric_limits<streamsize>::max(), '\n');
+        cin.get();
+    }
+
+    void show_config_repair_error(const exception &ex) {
+        cerr << "Error en reparar la configuracion: " << ex.what() << endl;
+    }
+
+    bool attempt_config_repair() {
+        try {
+            ConfigManager::repair_or_create_config_file();
+            show_config_repair_success();
+            return true;
+        } catch (const exception &ex) {
+            show_config_repair_error(ex);
+            return false;
+        }
+    }
+
+    bool handle_config_error(const runtime_error &e) {
+        // The prompts read whole lines, so the console lets go of the keys
+        console_.suspend();
+        bool repaired = prompt_config_repair(e) && attempt_config_repair();
+        console_.resume();
+        return repaired;
+    }
+
+  public:
+    ConfigurationUI(AsyncLogger &log, OperatorConsole &console)
+        : log_(log), console_(console) {}
+
+    SystemConfig handle_config_loading(double sim_time) {
+        while (true) {
+            try {
+                vector<int> malformed_lines;
+                SystemConfig config = ConfigManager::read_config(
+                    SystemConstants::CONFIG_FILE_PATH, &malformed_lines);
+                log_malformed_lines(malformed_lines, sim_time);
+                return config;
+            } catch (const runtime_error &e) {
+                log_.write(LOG_ERROR, LOG_EVENT_CONFIG_ERROR, sim_time, 0,
+                           e.what());
+                if (!handle_config_error(e)) {
+                    throw runtime_error(
+                        "La configuracion no pudo ser corregida con la "
+                        "herramienta de reparacion. El programa se cerrara.");
+                }
+            }
+        }
+    }
+};
+
+// Headless measurements run from the command line instead of the HMI
+class SimulationBenchmark {
+  private:
+    static void build_plants(size_t plants, bool use_arena, size_t *sink) {
+        SimulationArena arena;
+        size_t lines = 0;
+        for (size_t i = 0; i < plants; ++i) {
+            {
+                Factory factory = Factory::create_dupont_paint_factory(
+                    use_arena ? &arena : NULL);
+                lines += factory.get_all_pump_lines().size();
+            }
+            if (use_arena) {
+                arena.reset();
+            }
+        }
+        *sink = lines;
+    }
+
+    // Returns nanoseconds per plant built and torn down, over all threads
+    static double time_plant_lifecycle(size_t plants_per_thread,
+                                       size_t thread_count, bool use_arena) {
+        vector<size_t> sinks(thread_count, 0);
+        vector<thread> workers;
+        chrono::steady_clock::time_point start = chrono::steady_clock::now();
+        for (size_t i = 0; i < thread_count; ++i) {
+            workers.push_back(thread(build_plants, plants_per_thread,
+                                     use_arena, &sinks[i]));
+        }
+        for (size_t i = 0; i < workers.size(); ++i) {
+            workers[i].join();
+        }
+        double elapsed_ns = chrono::duration<double, nano>(
+                                chrono::steady_clock::now() - start)
+                                .count();
+        return elapsed_ns / (plants_per_thread * thread_count);
+    }
+
+    // Liters a lot did not get because a base tank was dry
+    class ShortfallMeter : public PlantObserver {
+      private:
+        double lot_short_;
+        double total_short_;
+        int lots_done_;
+        int short_lots_;
+        int switchovers_;
+
+      public:
+        ShortfallMeter()
+            : lot_short_(0.0), total_short_(0.0), lots_done_(0),
+              short_lots_(0), switchovers_(0) {}
+
+        void on_batch_phase_changed(BatchPhase, BatchPhase new_phase,
+                                    double) {
+            if (new_phase == BATCH_PUMPING) {
+                lot_short_ = 0.0;
+            } else if (new_phase == BATCH_IDLE) {
+                ++lots_done_;
+                if (lot_short_ > 0.5) {
+                    ++short_lots_;
+                }
+            }
+        }
+
+        void on_liquid_transferred(size_t, const PumpLine &,
+                                   double requested_liters,
+                                   double delivered_liters, double) {
+            lot_short_ += requested_liters - delivered_liters;
+            total_short_ += requested_liters - delivered_liters;
+        }
+
+        void on_source_tank_switched(size_t, const PumpLine &, double) {
+            ++switchovers_;
+        }
+
+        int get_lots_done() const { return lots_done_; }
+        int get_short_lots() const { return short_lots_; }
+        double get_total_short() const { return total_short_; }
+        int get_switchovers() const { return switchovers_; }
+    };
+
+    static void run_inventory_scenario(int lots, int tanks_per_base,
+                                       bool refills, double lead_seconds) {
+        const double step_seconds = 0.1;
+        const int steps_per_second = 10;
+        Factory factory = Factory::create_dupont_paint_factory();
+        factory.add_standard_reserve_tanks(tanks_per_base - 1);
+        BaseInventoryPlanner planner(lead_seconds);
+        ShortfallMeter meter;
+        factory.add_observer(&meter);
+
+        vector<string> colors;
+        const map<string, map<string, double> > &recipes =
+            SystemConstants::COLOR_RECIPES;
+        for (map<string, map<string, double> >::const_iterator it =
+                 recipes.begin();
+             it != recipes.end(); ++it) {
+            colors.push_back(it->first);
+        }
+
+        // No lot finished in this long: the plant has stalled
+        const double stall_seconds = 3600.0;
+        BatchScheduler scheduler;
+        int started = 0;
+        int lots_done = 0;
+        double last_lot_time = 0.0;
+        bool stalled = false;
+        for (long step = 0; lots_done < lots; ++step) {
+            if (refills && step % steps_per_second == 0) {
+                planner.update(factory);
+            }
+            if (!factory.is_batch_in_process() && started < lots) {
+                scheduler.start_batch(factory, colors[started % colors.size()]);
+                ++started;
+            }
+            factory.step(step_seconds);
+            if (meter.get_lots_done() != lots_done) {
+                lots_done = meter.get_lots_done();
+                last_lot_time = factory.get_sim_time();
+            } else if (factory.get_sim_time() - last_lot_time > stall_seconds) {
+                stalled = true;
+                break;
+            }
+        }
+        factory.remove_observer(&meter);
+
+        double hours = last_lot_time / 3600.0;
+        int good_lots = lots_done - meter.get_short_lots();
+        cout << tanks_per_base << " tanque(s) por base, "
+             << (refills ? "con" : "sin") << " reposicion: "
+             << meter.get_lots_done() << " lotes, " << meter.get_short_lots()
+             << " cortos (" << meter.get_total_short()
+             << " L sin bombear), " << meter.get_switchovers()
+             << " cambios de tanque, " << planner.get_refills_ordered()
+             << " reposiciones; " << (hours > 0.0 ? good_lots / hours : 0.0)
+             << " lotes/h completos";
+        if (stalled) {
+            cout << " (detenida en el lote " << lots_done + 1
+                 << ": sin base en los tanques)";
+        }
+        cout << endl;
+    }
+
+    struct OrderBookOutcome {
+        int lots;
+        double hours; // To the end of the last lot
+        double produced_liters;
+        double overproduced_liters;
+        bool stalled;
+    };
+
+    // Works through the order book on the standard plant. The buffer tanks
+    // take whatever is discharged, so the mixing section sets the pace.
+    static OrderBookOutcome run_order_book(
+        const vector<ProductionOrder> &orders, LotSizingPolicy policy) {
+        const double step_seconds = 0.1;
+        Factory factory = Factory::create_dupont_paint_factory();
+        factory.get_filling_line_mutable().set_buffer_capacity(HUGE_VAL);
+        ShortfallMeter meter;
+        factory.add_observer(&meter);
+        OrderQueue queue(policy);
+        for (size_t i = 0; i < orders.size(); ++i) {
+            queue.add_order(orders[i].color, orders[i].liters);
+        }
+
+        const double stall_seconds = 3600.0;
+        BatchScheduler scheduler;
+        OrderBookOutcome outcome;
+        outcome.stalled = false;
+        int lots_done = 0;
+        double last_lot_time = 0.0;
+        while (!queue.is_empty() || factory.is_batch_in_process()) {
+            if (!factory.is_batch_in_process()) {
+                queue.start_next_lot(factory, scheduler);
+            }
+            factory.step(step_seconds);
+            if (meter.get_lots_done() != lots_done) {
+                lots_done = meter.get_lots_done();
+                last_lot_time = factory.get_sim_time();
+            } else if (factory.get_sim_time() - last_lot_time > stall_seconds) {
+                outcome.stalled = true;
+                break;
             }
         }
+        factory.remove_observer(&meter);
+
+        outcome.lots = lots_done;
+        outcome.hours = last_lot_time / 3600.0;
+        outcome.produced_liters = queue.get_produced_liters();
+        outcome.overproduced_liters = queue.get_overproduced_liters();
+        return outcome;
     }
 
-    bool can_start_batch(const string &target_color) const {
-        // Check if required valves are open for the target color
-        map<string, map<string, double> > color_recipes = SystemConstants::create_color_recipes();
-        map<string, map<string, double> >::const_iterator color_recipe = color_recipes.find(target_color);
-        if (color_recipe == color_recipes.end()) {
-            return false;
+    // Runs one lot of the colour to the end and returns its cycle times
+    static BatchCycleTimes run_batch(const string &color, bool vfd_mode,
+                                     double step_seconds) {
+        Factory factory = Factory::create_dupont_paint_factory();
+        factory.set_vfd_mode(vfd_mode);
+        KpiTracker kpi(factory, "");
+        factory.add_observer(&kpi);
+        BatchScheduler scheduler;
+        scheduler.start_batch(factory, color);
+        while (factory.is_batch_in_process()) {
+            factory.step(step_seconds);
         }
+        factory.remove_observer(&kpi);
+        return kpi.get_last_batch();
+    }
 
-        // Check mixer tank low level switch
-        if (!mixer_tank_.get_low_level_switch().is_alarm()) {
-            return false; // Tank must be empty to start
+  public:
+    static void run_vfd_comparison() {
+        const double step_seconds = 0.1;
+        cout << "=== Ciclo por receta: velocidad fija vs VFD ===" << endl;
+        const map<string, map<string, double> > &recipes =
+            SystemConstants::COLOR_RECIPES;
+        for (map<string, map<string, double> >::const_iterator it =
+                 recipes.begin();
+             it != recipes.end(); ++it) {
+            BatchCycleTimes fixed = run_batch(it->first, false, step_seconds);
+            BatchCycleTimes vfd = run_batch(it->first, true, step_seconds);
+            double fixed_pumping = fixed.phase_seconds[BATCH_PUMPING];
+            double vfd_pumping = vfd.phase_seconds[BATCH_PUMPING];
+            cout << it->first << ": bombeo " << fixed_pumping << "s -> "
+                 << vfd_pumping << "s ("
+                 << (fixed_pumping - vfd_pumping) / fixed_pumping * 100.0
+                 << "% menos), ciclo " << fixed.get_total() << "s -> "
+                 << vfd.get_total() << "s" << endl;
         }
+    }
 
-        // Check if required pump lines have both valves open
-        for (map<string, PumpLine>::const_iterator it = pump_lines_.begin(); 
-             it != pump_lines_.end(); ++it) {
-            const PumpLine& pump_line = it->second;
-            const string& tank_liquid = pump_line.get_tank().get_liquid_in_tank_name();
-            
-            // Check if this liquid is needed for the recipe
-            bool liquid_needed = color_recipe->second.find(tank_liquid) != color_recipe->second.end();
-            
-            if (liquid_needed) {
-                // Both enter and exit valves must be open for required liquids
-                if (!pump_line.get_enter_valve().is_open() || !pump_line.get_exit_valve().is_open()) {
-                    return false;
+    // Control-thread cost of AsyncLogger::write(). Bursts stay under the
+    // ring size and the writer drains between them, as in the scan loop.
+    static void run_log_benchmark(const string &path) {
+        const int bursts = 200;
+        const int events_per_burst = 512;
+        double write_ns = 0.0;
+        unsigned long dropped;
+        {
+            AsyncLogger log(path);
+            for (int burst = 0; burst < bursts; ++burst) {
+                chrono::steady_clock::time_point start =
+                    chrono::steady_clock::now();
+                for (int i = 0; i < events_per_burst; ++i) {
+                    log.write(LOG_INFO, LOG_EVENT_PUMP_STATE, burst + i * 0.01,
+                              RUNNING, "P201");
                 }
+                write_ns += chrono::duration<double, nano>(
+                                chrono::steady_clock::now() - start)
+                                .count();
+                this_thread::sleep_for(chrono::milliseconds(
+                    2 * SystemConstants::EVENT_LOG_DRAIN_MS));
             }
+            dropped = log.get_dropped();
         }
-        
-        return true;
+        cout << "Registro de eventos: " << (write_ns / (bursts * events_per_burst))
+             << " ns/evento en el hilo de control, " << dropped
+             << " descartados (" << path << ")" << endl;
     }
 
-    bool can_start_mixing() const {
-        // Complete check to avoid premature mixing before all base colors are fully pumped
-        // This method enforces that mixing cannot start while pumps are in paused states
-        
-        for (map<string, PumpLine>::const_iterator it = pump_lines_.begin(); 
-             it != pump_lines_.end(); ++it) {
-            const PumpLine& pump_line = it->second;
-            const LiquidPump& pump = pump_line.get_pump();
-            
-            // Skip pumps with no target (target duration = 0) - not required for this batch
-            if (pump.get_target_duration() <= 0) {
-                continue;
+    // Runs lots back to back, cycling through the recipes, and compares the
+    // lots per hour each stage could sustain on its own. The mixer train
+    // (dosing, mixing and discharge into the buffer) is one stage because
+    // M401 holds a lot through all three; time the discharge spent blocked
+    // by a full buffer is charged to the filler.
+    static void run_bottleneck_report(int lots, double cans_per_minute,
+                                      double changeover_seconds,
+                                      double buffer_liters) {
+        const double step_seconds = 0.1;
+        if (lots <= 0) {
+            throw invalid_argument("At least one lot is needed");
+        }
+        Factory factory = Factory::create_dupont_paint_factory();
+        FillingLine &filling_line = factory.get_filling_line_mutable();
+        filling_line.get_filler_mutable().set_cans_per_minute(cans_per_minute);
+        filling_line.get_filler_mutable().set_changeover_seconds(
+            changeover_seconds);
+        filling_line.set_buffer_capacity(buffer_liters);
+        const CanFiller &filler = filling_line.get_filler();
+
+        vector<string> colors;
+        const map<string, map<string, double> > &recipes =
+            SystemConstants::COLOR_RECIPES;
+        for (map<string, map<string, double> >::const_iterator it =
+                 recipes.begin();
+             it != recipes.end(); ++it) {
+            colors.push_back(it->first);
+        }
+
+        // A lot that cannot finish (a base tank ran dry) ends the study
+        const double time_limit = lots * 3600.0;
+        BatchScheduler scheduler;
+        double phase_seconds[BATCH_EMPTYING + 1] = {0.0, 0.0, 0.0, 0.0};
+        int started = 0;
+        while (factory.get_sim_time() < time_limit) {
+            if (!factory.is_batch_in_process() && started < lots) {
+                scheduler.start_batch(factory, colors[started % colors.size()]);
+                ++started;
             }
-            
-            // CRITICAL CHECK: Ensure target time > 0 and elapsed time >= target time
-            // This prevents mixing when pumps have not reached their pumping goals
-            if (pump.get_elapsed_seconds() < pump.get_target_duration()) {
-                return false; // This pump hasn't finished pumping its required amount
+            if (started == lots && !factory.is_batch_in_process() &&
+                filler.get_state() == FILLER_STARVED) {
+                break;
             }
-            
-            // CRITICAL CHECK: Ensure pumps are not just paused but actually completed
-            // Pumps in STOPPED_FLOW_ALARM, STOPPED_HIGH_PRESSURE, or STOPPED_LOW_PRESSURE
-            // are paused and may restart - mixing must wait for them to complete or be permanently stopped
-            PumpState state = pump.get_state();
-            if (state == STOPPED_FLOW_ALARM || 
-                state == STOPPED_HIGH_PRESSURE || 
-                state == STOPPED_LOW_PRESSURE) {
-                // Pump is paused but not permanently stopped - could potentially restart
-                // Check if pump can still continue (valves open and has remaining target time)
-                if (pump_line.get_enter_valve().is_open() && 
-                    pump_line.get_exit_valve().is_open()) {
-                    return false; // Pump could restart, don't mix yet
+            phase_seconds[factory.get_batch_phase()] += step_seconds;
+            factory.step(step_seconds);
+        }
+        if (factory.get_sim_time() >= time_limit) {
+            cout << "El estudio no termino: revise el nivel de los tanques "
+                    "base"
+                 << endl;
+            return;
+        }
+
+        double elapsed_hours = factory.get_sim_time() / 3600.0;
+        double blocked = factory.get_discharge_blocked_seconds();
+        double mixer_seconds = phase_seconds[BATCH_PUMPING] +
+                               phase_seconds[BATCH_MIXING] +
+                               phase_seconds[BATCH_EMPTYING] - blocked;
+        double filler_seconds = filler.get_seconds_in_state(FILLER_FILLING) +
+                                filler.get_seconds_in_state(FILLER_CHANGEOVER);
+        double mixer_lots_per_hour = lots * 3600.0 / mixer_seconds;
+        double filler_lots_per_hour = lots * 3600.0 / filler_seconds;
+
+        cout << "=== Cuello de botella: " << lots << " lotes de "
+             << SystemConstants::BATCH_SIZE << " L ===" << endl;
+        cout << "Llenadora: " << cans_per_minute << " latas/min de "
+             << filler.get_can_liters() << " L, cambio de color "
+             << changeover_seconds << "s, tanques de " << buffer_liters
+             << " L" << endl;
+        cout << "Mezclador " << factory.get_mixer_tank().get_code() << ": "
+             << mixer_lots_per_hour << " lotes/h (por lote: bombeo "
+             << phase_seconds[BATCH_PUMPING] / lots << "s, mezcla "
+             << phase_seconds[BATCH_MIXING] / lots << "s, vaciado "
+             << (phase_seconds[BATCH_EMPTYING] - blocked) / lots << "s)"
+             << endl;
+        cout << "Llenadora " << filler.get_code() << ": "
+             << filler_lots_per_hour << " lotes/h (por lote: llenado "
+             << filler.get_seconds_in_state(FILLER_FILLING) / lots
+             << "s, cambios de color "
+             << filler.get_seconds_in_state(FILLER_CHANGEOVER) / lots << "s)"
+             << endl;
+        cout << "Obtenido: " << lots / elapsed_hours << " lotes/h, "
+             << filler.get_cans_filled() << " latas en "
+             << factory.get_sim_time() << "s" << endl;
+        if (filler_lots_per_hour < mixer_lots_per_hour) {
+            cout << "Limita la llenadora: la descarga del mezclador estuvo "
+                    "bloqueada "
+                 << blocked << "s ("
+                 << blocked / factory.get_sim_time() * 100.0
+                 << "% del tiempo)" << endl;
+        } else {
+            cout << "Limita el mezclador: la llenadora estuvo sin producto "
+                 << filler.get_seconds_in_state(FILLER_STARVED) << "s ("
+                 << filler.get_seconds_in_state(FILLER_STARVED) /
+                        factory.get_sim_time() * 100.0
+                 << "% del tiempo)" << endl;
+        }
+    }
+
+    // Base inventory study: the same lots with one or two tanks per base,
+    // with and without refills, at fixed pump speed. A dry tank does not
+    // stop the lot; it comes out short, and only lots within half a liter
+    // of every target count towards lots per hour. Once every base a lot
+    // needs is dry, nothing reaches the mixer and the plant stalls.
+    static void run_inventory_study(int lots, double lead_seconds) {
+        if (lots <= 0) {
+            throw invalid_argument("At least one lot is needed");
+        }
+        cout << "=== Inventario de bases: " << lots
+             << " lotes alternando recetas, reposicion en " << lead_seconds
+             << "s ===" << endl;
+        for (int tanks = 1; tanks <= 2; ++tanks) {
+            for (int refills = 0; refills <= 1; ++refills) {
+                run_inventory_scenario(lots, tanks, refills != 0,
+                                       lead_seconds);
+            }
+        }
+    }
+
+    // Fixed 150 L lots against lots sized per order, on one order book
+    static void run_lot_sizing_report(const vector<ProductionOrder> &orders) {
+        double ordered = 0.0;
+        for (size_t i = 0; i < orders.size(); ++i) {
+            ordered += orders[i].liters;
+        }
+        cout << "=== Tamano de lote: " << orders.size() << " ordenes, "
+             << ordered << " L, mezclador de "
+             << SystemConstants::MIXER_TANK_CAPACITY << " L ===" << endl;
+        OrderBookOutcome fixed = run_order_book(orders, LOT_SIZE_FIXED);
+        OrderBookOutcome variable = run_order_book(orders, LOT_SIZE_VARIABLE);
+        const OrderBookOutcome *outcomes[] = {&fixed, &variable};
+        const char *names[] = {"Lote fijo de 150 L", "Lote por orden"};
+        for (int i = 0; i < 2; ++i) {
+            const OrderBookOutcome &outcome = *outcomes[i];
+            double hours = outcome.hours > 0.0 ? outcome.hours : HUGE_VAL;
+            cout << names[i] << ": " << outcome.lots << " lotes en "
+                 << outcome.hours * 60.0 << " min, "
+                 << outcome.lots / hours << " lotes/h, "
+                 << (outcome.produced_liters - outcome.overproduced_liters) /
+                        hours
+                 << " L/h de ordenes (" << outcome.overproduced_liters
+                 << " L de sobreproduccion)";
+            if (outcome.stalled) {
+                cout << " (detenida: sin base en los tanques)";
+            }
+            cout << endl;
+        }
+        double fixed_rate =
+            (fixed.produced_liters - fixed.overproduced_liters) / fixed.hours;
+        double variable_rate = (variable.produced_liters -
+                                variable.overproduced_liters) /
+                               variable.hours;
+        cout << "Ganancia: " << (variable_rate / fixed_rate - 1.0) * 100.0
+             << "% L/h, "
+             << ((variable.lots / variable.hours) / (fixed.lots / fixed.hours) -
+                 1.0) * 100.0
+             << "% lotes/h, " << (1.0 - variable.hours / fixed.hours) * 100.0
+             << "% menos tiempo para las mismas ordenes" << endl;
+    }
+
+    // Per-event cost of the tracer with and without a trace being recorded,
+    // and what tracing adds to a tick of the standard plant running a lot
+    static void run_trace_benchmark(const string &path) {
+        const int spans = 500000;
+        const int ticks = 100000;
+        const double step_seconds = 0.01;
+
+        chrono::steady_clock::time_point start = chrono::steady_clock::now();
+        for (int i = 0; i < spans; ++i) {
+            TraceSpan span("benchmark");
+        }
+        double idle_ns = chrono::duration<double, nano>(
+                             chrono::steady_clock::now() - start)
+                             .count() /
+                         (2.0 * spans);
+
+        double plain_tick_ns = 0.0;
+        double traced_tick_ns = 0.0;
+        double event_ns;
+        size_t events;
+        {
+            ChromeTracer tracer(path);
+            ChromeTracer::name_thread("benchmark");
+            start = chrono::steady_clock::now();
+            for (int i = 0; i < spans; ++i) {
+                TraceSpan span("benchmark");
+            }
+            event_ns = chrono::duration<double, nano>(
+                           chrono::steady_clock::now() - start)
+                           .count() /
+                       (2.0 * spans);
+
+            PlantTraceEvents plant_trace;
+            for (int traced = 0; traced < 2; ++traced) {
+                Factory factory = Factory::create_dupont_paint_factory();
+                BatchScheduler scheduler;
+                scheduler.start_batch(factory, "AzMarino");
+                if (traced != 0) {
+                    factory.attach_phase_sink(&plant_trace);
                 }
-                // If valves are closed, pump is effectively permanently stopped
-                // Continue checking other pumps
+                start = chrono::steady_clock::now();
+                for (int i = 0; i < ticks; ++i) {
+                    factory.step(step_seconds);
+                }
+                double tick_ns = chrono::duration<double, nano>(
+                                     chrono::steady_clock::now() - start)
+                                     .count() /
+                                 ticks;
+                (traced != 0 ? traced_tick_ns : plain_tick_ns) = tick_ns;
             }
-            
-            // CRITICAL CHECK: Running pumps must not be interrupted by mixing
-            if (state == RUNNING) {
-                return false; // Pump is still actively pumping
+            events = tracer.get_event_count();
+        }
+        cout << "Traza: " << event_ns << " ns/evento grabando, " << idle_ns
+             << " ns/evento sin traza" << endl;
+        cout << "Tick de la planta: " << plain_tick_ns << " ns -> "
+             << traced_tick_ns << " ns con las fases trazadas" << endl;
+        cout << events << " eventos escritos en " << path << endl;
+    }
+
+    // Reads a dashboard stream until the socket is shut down
+    static void read_dashboard_stream(DashboardServer::Socket socket) {
+        const char request[] = "GET /eventos HTTP/1.1\r\n\r\n";
+        send(socket, request, sizeof(request) - 1, 0);
+        char buffer[4096];
+        while (recv(socket, buffer, sizeof(buffer), 0) > 0) {
+        }
+    }
+
+    // Control-thread cost of a scan that steps the plant and publishes it,
+    // by number of dashboard viewers. The plant is serialized once per scan
+    // however many are connected.
+    static void run_dashboard_benchmark() {
+        DashboardServer dashboard(0);
+        const size_t viewer_counts[] = {0, 1, 8, 32};
+        const int scans = 20000;
+        cout << "=== Panel HTTP: costo por scan segun los clientes ===" << endl;
+        for (size_t c = 0; c < 4; ++c) {
+            size_t viewers = viewer_counts[c];
+            vector<DashboardServer::Socket> sockets;
+            vector<thread> readers;
+            for (size_t i = 0; i < viewers; ++i) {
+                DashboardServer::Socket socket = ::socket(AF_INET, SOCK_STREAM, 0);
+                sockaddr_in address;
+                memset(&address, 0, sizeof(address));
+                address.sin_family = AF_INET;
+                address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+                address.sin_port =
+                    htons(static_cast<unsigned short>(dashboard.get_port()));
+                if (connect(socket, reinterpret_cast<sockaddr *>(&address),
+                            sizeof(address)) != 0) {
+                    DashboardServer::close_socket(socket);
+                    throw runtime_error("Could not connect to the dashboard");
+                }
+                sockets.push_back(socket);
+                readers.push_back(thread(read_dashboard_stream, socket));
+            }
+            for (int wait = 0;
+                 wait < 200 && dashboard.get_client_count() != viewers;
+                 ++wait) {
+                this_thread::sleep_for(chrono::milliseconds(10));
+            }
+
+            Factory factory = Factory::create_dupont_paint_factory();
+            BatchScheduler scheduler;
+            chrono::steady_clock::time_point start =
+                chrono::steady_clock::now();
+            for (int scan = 0; scan < scans; ++scan) {
+                if (!factory.is_batch_in_process()) {
+                    scheduler.start_batch(factory, "AzMarino");
+                }
+                factory.step(0.01);
+                dashboard.publish(factory);
+            }
+            double elapsed_ns = chrono::duration<double, nano>(
+                                    chrono::steady_clock::now() - start)
+                                    .count();
+            for (size_t i = 0; i < sockets.size(); ++i) {
+#ifdef _WIN32
+                shutdown(sockets[i], SD_BOTH);
+#else
+                shutdown(sockets[i], SHUT_RDWR);
+#endif
+            }
+            for (size_t i = 0; i < readers.size(); ++i) {
+                readers[i].join();
+                DashboardServer::close_socket(sockets[i]);
+            }
+            cout << "Clientes " << viewers << ": " << elapsed_ns / scans
+                 << " ns/scan" << endl;
+            for (int wait = 0; wait < 200 && dashboard.get_client_count() != 0;
+                 ++wait) {
+                this_thread::sleep_for(chrono::milliseconds(10));
             }
-            
-            // At this point, pump has either:
-            // 1. Reached target (STOPPED_TARGET_REACHED) - OK to mix
-            // 2. Is permanently unable to continue due to closed valves - OK to mix
         }
-        
-        // All checks passed - safe to start mixing
-        return true;
+        cout << "Clientes descartados por lentos: "
+             << dashboard.get_clients_dropped() << endl;
+    }
+
+    // Pumping-phase tick cost as the plant grows. Lines past the first three
+    // hold bases no recipe uses, so they settle and stop costing anything.
+    static void run_activity_benchmark() {
+        const size_t sizes[] = {3, 100, 1000, 10000};
+        const int ticks = 3000;
+        const double step_seconds = 0.01;
+        for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); ++s) {
+            vector<PumpLine> lines;
+            lines.push_back(
+                PumpLine::create_standard_paint_line("P201", "Blanco"));
+            lines.push_back(
+                PumpLine::create_standard_paint_line("P202", "Azul"));
+            lines.push_back(
+                PumpLine::create_standard_paint_line("P203", "Negro"));
+            for (size_t i = lines.size(); i < sizes[s]; ++i) {
+                ostringstream code, base;
+                code << "P" << (1000 + i);
+                base << "Base" << i;
+                lines.push_back(PumpLine::create_standard_paint_line(
+                    code.str(), base.str()));
+            }
+            Factory factory = Factory::create_custom_factory(lines);
+            BatchScheduler scheduler;
+            scheduler.start_batch(factory, "AzMarino");
+            factory.step(step_seconds); // Unused lines settle here
+
+            chrono::steady_clock::time_point start =
+                chrono::steady_clock::now();
+            for (int i = 0; i < ticks; ++i) {
+                factory.step(step_seconds);
+            }
+            double tick_ns = chrono::duration<double, nano>(
+                                 chrono::steady_clock::now() - start)
+                                 .count() /
+                             ticks;
+            cout << "Lineas " << sizes[s] << ": activas "
+                 << factory.get_active_line_count() << ", " << tick_ns
+                 << " ns/scan" << endl;
+        }
+    }
+
+    // Every value a tick can change, for comparing runs exactly
+    static vector<double> plant_fingerprint(const Factory &factory) {
+        vector<double> values;
+        values.push_back(factory.get_mixer_tank().get_current_capacity());
+        values.push_back(factory.get_batch_phase());
+        const PumpLineMap &pump_lines = factory.get_all_pump_lines();
+        for (PumpLineMap::const_iterator it = pump_lines.begin();
+             it != pump_lines.end(); ++it) {
+            const PumpLine &line = it->second;
+            values.push_back(line.get_pump().get_state());
+            values.push_back(line.get_pump().get_elapsed_seconds());
+            values.push_back(line.get_pump().get_delivered_liters());
+            values.push_back(line.get_pump().get_speed_percent());
+            values.push_back(line.get_pressure_transmitter().read_pressure());
+            values.push_back(line.get_flow_switch().is_alarm());
+            values.push_back(line.get_tank().get_current_capacity());
+        }
+        return values;
     }
 
-    // ...existing code...
+    // Pumping ticks of a plant whose lines all run, on 1..N threads. Each
+    // run must leave the plant exactly as the single-thread run does.
+    static void run_parallel_tick_benchmark(size_t line_count,
+                                            size_t max_threads) {
+        const char *bases[] = {"Blanco", "Azul", "Negro"};
+        vector<PumpLine> lines;
+        for (size_t i = 0; i < line_count; ++i) {
+            ostringstream code;
+            code << "P" << (1000 + i);
+            lines.push_back(
+                PumpLine::create_standard_paint_line(code.str(), bases[i % 3]));
+        }
+        const int ticks = 500;
+        const double step_seconds = 0.01;
+
+        vector<double> reference;
+        double single_thread_ns = 0.0;
+        for (size_t threads = 1; threads <= max_threads; threads *= 2) {
+            TickWorkerPool pool(threads);
+            Factory factory = Factory::create_custom_factory(lines);
+            factory.attach_worker_pool(&pool);
+            // VFD mode keeps the drives and the PI loops busy as well
+            factory.set_vfd_mode(true);
+            BatchScheduler scheduler;
+            scheduler.start_batch(factory, "AzMarino");
+
+            chrono::steady_clock::time_point start =
+                chrono::steady_clock::now();
+            for (int i = 0; i < ticks; ++i) {
+                factory.step(step_seconds);
+            }
+            double tick_ns = chrono::duration<double, nano>(
+                                 chrono::steady_clock::now() - start)
+                                 .count() /
+                             ticks;
+
+            vector<double> fingerprint = plant_fingerprint(factory);
+            if (threads == 1) {
+                reference = fingerprint;
+                single_thread_ns = tick_ns;
+            }
+            cout << "Hilos " << threads << ": " << (tick_ns / 1000.0)
+                 << " us/scan con " << line_count << " lineas ("
+                 << (single_thread_ns / tick_ns) << "x), resultado "
+                 << (fingerprint == reference ? "identico" : "DISTINTO")
+                 << endl;
+        }
+    }
+
+    static void run_arena_benchmark(size_t plants_per_thread) {
+        size_t max_threads = thread::hardware_concurrency();
+        if (max_threads == 0) {
+            max_threads = 1;
+        }
+
+        cout << "=== Arranque y cierre de plantas: heap vs arena ===" << endl;
+        cout << "Plantas por hilo: " << plants_per_thread << endl;
+        // One thread shows the startup cost, all cores show contention
+        size_t thread_counts[] = {1, max_threads};
+        size_t runs = max_threads > 1 ? 2 : 1;
+        for (size_t i = 0; i < runs; ++i) {
+            size_t threads = thread_counts[i];
+            double heap_ns =
+                time_plant_lifecycle(plants_per_thread, threads, false);
+            double arena_ns =
+                time_plant_lifecycle(plants_per_thread, threads, true);
+            cout << "Hilos " << threads << ": heap " << heap_ns
+                 << " ns/planta, arena " << arena_ns << " ns/planta ("
+                 << (heap_ns / arena_ns) << "x)" << endl;
+        }
+    }
 };
 
-class UserInterface {
+// One point of the design space searched by DesignOptimizer
+struct PlantDesign {
+    double flow_rate_lts_min; // Every base pump
+    double batch_liters;
+    double mixing_seconds;
+    double emptying_percent_per_second;
+    int mixers;
+};
+
+struct DesignResult {
+    PlantDesign design;
+    int lots_done;
+    double lots_per_hour;
+    double liters_per_hour;
+    // Mean over lots of the volume off target, in % of the lot
+    double dosing_error_percent;
+    int trips; // Pump stops for high pressure or a flow alarm
+    bool pruned;
+};
+
+// Searches plant designs by running the headless model on a grid of
+// candidates, in parallel over all cores, under a given order mix. Mixers
+// share the dosing pumps, so only one of them is pumped at a time, and the
+// buffer tanks take whatever is discharged: the result measures the mixing
+// section alone. Lot size is a design variable, so liters per hour is an
+// objective next to lots per hour. A pilot sample of the grid runs in full
+// first; any other candidate that one of the pilots clearly dominates part
+// way through its run is dropped. The pilots are fixed before the rest
+// start, so the result does not depend on which thread finishes first.
+class DesignOptimizer {
   private:
-    bool last_batch_in_process_;
-    
-    void clear_screen() { system("cls"); }
+    // Per-mixer tally of trips and dosing error
+    class DesignMeter : public PlantObserver {
+      private:
+        const Factory &factory_;
+        vector<double> drained_; // This lot, by line index
+        double error_percent_sum_;
+        int lots_dosed_;
+        int lots_done_;
+        int trips_;
+
+      public:
+        explicit DesignMeter(const Factory &factory)
+            : factory_(factory),
+              drained_(factory.get_all_pump_lines().size(), 0.0),
+              error_percent_sum_(0.0), lots_dosed_(0), lots_done_(0),
+              trips_(0) {}
+
+        void on_batch_phase_changed(BatchPhase, BatchPhase new_phase,
+                                    double) {
+            if (new_phase == BATCH_PUMPING) {
+                fill(drained_.begin(), drained_.end(), 0.0);
+            } else if (new_phase == BATCH_MIXING) {
+                // In whole millilitres, as the pumps meter their doses
+                long long off_target_ml = 0;
+                const PumpLineMap &lines = factory_.get_all_pump_lines();
+                size_t index = 0;
+                for (PumpLineMap::const_iterator it = lines.begin();
+                     it != lines.end(); ++it, ++index) {
+                    off_target_ml += llabs(llround(drained_[index] * 1000.0) -
+                                           it->second.get_pump().get_target_ml());
+                }
+                error_percent_sum_ +=
+                    off_target_ml / 10.0 / factory_.get_batch_size();
+                ++lots_dosed_;
+            } else if (new_phase == BATCH_IDLE) {
+                ++lots_done_;
+            }
+        }
+
+        void on_liquid_transferred(size_t line_index, const PumpLine &,
+                                   double, double delivered_liters, double) {
+            drained_[line_index] += delivered_liters;
+        }
+
+        void on_pump_state_changed(size_t, const PumpLine &pump_line,
+                                   PumpState, double) {
+            PumpState state = pump_line.get_pump().get_state();
+            if (state == STOPPED_HIGH_PRESSURE || state == STOPPED_FLOW_ALARM) {
+                ++trips_;
+            }
+        }
+
+        double get_error_percent_sum() const { return error_percent_sum_; }
+        int get_lots_dosed() const { return lots_dosed_; }
+        int get_lots_done() const { return lots_done_; }
+        int get_trips() const { return trips_; }
+    };
+
+    vector<string> color_sequence_; // Lot colours in order
+    double step_seconds_;
+    vector<PlantDesign> candidates_;
+    vector<DesignResult> results_;
+    vector<size_t> pass_; // Candidates of the running pass, by index
+    atomic<size_t> next_candidate_; // Position in pass_
+    vector<DesignResult> bound_; // Complete pilot runs, read-only after
+
+    // Disable copying: workers hold a pointer to the optimizer
+    DesignOptimizer(const DesignOptimizer &);
+    DesignOptimizer &operator=(const DesignOptimizer &);
+
+    static bool dominates(const DesignResult &a, const DesignResult &b) {
+        return a.lots_per_hour >= b.lots_per_hour &&
+               a.liters_per_hour >= b.liters_per_hour &&
+               a.dosing_error_percent <= b.dosing_error_percent &&
+               a.trips <= b.trips &&
+               (a.lots_per_hour > b.lots_per_hour ||
+                a.liters_per_hour > b.liters_per_hour ||
+                a.dosing_error_percent < b.dosing_error_percent ||
+                a.trips < b.trips);
+    }
+
+    // Partial results are compared per lot; "clearly" means a margin on
+    // both throughputs, so only the plainly worse are dropped early
+    bool is_clearly_dominated(const DesignResult &partial) const {
+        const double margin = 1.0 + SystemConstants::OPTIMIZER_PRUNE_MARGIN;
+        for (size_t i = 0; i < bound_.size(); ++i) {
+            const DesignResult &done = bound_[i];
+            if (done.lots_per_hour > partial.lots_per_hour * margin &&
+                done.liters_per_hour > partial.liters_per_hour * margin &&
+                done.dosing_error_percent <= partial.dosing_error_percent &&
+                double(done.trips) / done.lots_done <=
+                    double(partial.trips) / partial.lots_done) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void evaluate(const PlantDesign &design, DesignResult &result) const {
+        vector<Factory> mixers(design.mixers,
+                               Factory::create_dupont_paint_factory());
+        vector<DesignMeter *> meters;
+        for (size_t i = 0; i < mixers.size(); ++i) {
+            Factory &mixer = mixers[i];
+            mixer.set_batch_size(design.batch_liters);
+            mixer.set_pump_flow_rate(design.flow_rate_lts_min);
+            mixer.set_mixing_seconds(design.mixing_seconds);
+            mixer.set_emptying_rate_percent(
+                design.emptying_percent_per_second);
+            mixer.get_filling_line_mutable().set_buffer_capacity(HUGE_VAL);
+            meters.push_back(new DesignMeter(mixer));
+            mixer.add_observer(meters.back());
+        }
+
+        result.design = design;
+        result.pruned = false;
+        const int lots = static_cast<int>(color_sequence_.size());
+        // Check for pruning after each quarter of the run
+        const int check_every = lots / 4 > 1 ? lots / 4 : 1;
+        const double stall_seconds = 3600.0;
+        BatchScheduler scheduler;
+        int started = 0;
+        int lots_done = 0;
+        double last_lot_time = 0.0;
+        double sim_time = 0.0;
+        while (lots_done < lots) {
+            bool pumping = false;
+            for (size_t i = 0; i < mixers.size(); ++i) {
+                pumping = pumping || mixers[i].get_batch_phase() == BATCH_PUMPING;
+            }
+            for (size_t i = 0; i < mixers.size() && !pumping && started < lots;
+                 ++i) {
+                if (!mixers[i].is_batch_in_process() &&
+                    scheduler.start_batch(mixers[i],
+                                          color_sequence_[started])) {
+                    ++started;
+                    pumping = true;
+                }
+            }
+            for (size_t i = 0; i < mixers.size(); ++i) {
+                mixers[i].step(step_seconds_);
+            }
+            sim_time += step_seconds_;
+
+            int done = 0;
+            for (size_t i = 0; i < meters.size(); ++i) {
+                done += meters[i]->get_lots_done();
+            }
+            if (done != lots_done) {
+                lots_done = done;
+                last_lot_time = sim_time;
+                if (lots_done < lots && lots_done % check_every == 0) {
+                    tally(meters, lots_done, last_lot_time, result);
+                    if (is_clearly_dominated(result)) {
+                        result.pruned = true;
+                        break;
+                    }
+                }
+            } else if (sim_time - last_lot_time > stall_seconds) {
+                break;
+            }
+        }
+        tally(meters, lots_done, last_lot_time, result);
+
+        for (size_t i = 0; i < mixers.size(); ++i) {
+            mixers[i].remove_observer(meters[i]);
+            delete meters[i];
+        }
+    }
+
+    static void tally(const vector<DesignMeter *> &meters, int lots_done,
+                      double seconds, DesignResult &result) {
+        double error_sum = 0.0;
+        int lots_dosed = 0;
+        result.trips = 0;
+        for (size_t i = 0; i < meters.size(); ++i) {
+            error_sum += meters[i]->get_error_percent_sum();
+            lots_dosed += meters[i]->get_lots_dosed();
+            result.trips += meters[i]->get_trips();
+        }
+        result.lots_done = lots_done;
+        result.lots_per_hour = seconds > 0.0 ? lots_done / (seconds / 3600.0)
+                                             : 0.0;
+        result.liters_per_hour =
+            result.lots_per_hour * result.design.batch_liters;
+        result.dosing_error_percent =
+            lots_dosed > 0 ? error_sum / lots_dosed : 0.0;
+    }
+
+    void run_worker() {
+        for (;;) {
+            size_t position = next_candidate_.fetch_add(1);
+            if (position >= pass_.size()) {
+                return;
+            }
+            size_t index = pass_[position];
+            evaluate(candidates_[index], results_[index]);
+        }
+    }
+
+    void run_pass(const vector<size_t> &pass, size_t thread_count) {
+        pass_ = pass;
+        next_candidate_ = 0;
+        vector<thread> workers;
+        for (size_t i = 1; i < thread_count; ++i) {
+            workers.push_back(thread(&DesignOptimizer::run_worker, this));
+        }
+        run_worker();
+        for (size_t i = 0; i < workers.size(); ++i) {
+            workers[i].join();
+        }
+    }
 
   public:
-    UserInterface() : last_batch_in_process_(false) {}
-    
-    void clear_display() { clear_screen(); }
+    // order_mix shares are relative, as in BaseInventoryPlanner
+    DesignOptimizer(const map<string, double> &order_mix, int lots,
+                    double step_seconds = 0.1)
+        : step_seconds_(step_seconds), next_candidate_(0) {
+        if (lots <= 0) {
+            throw invalid_argument("The search needs at least one lot");
+        }
+        double total = 0.0;
+        for (map<string, double>::const_iterator it = order_mix.begin();
+             it != order_mix.end(); ++it) {
+            if (SystemConstants::COLOR_RECIPES.find(it->first) ==
+                    SystemConstants::COLOR_RECIPES.end() ||
+                it->second < 0) {
+                throw invalid_argument("Invalid order mix entry: " +
+                                       it->first);
+            }
+            total += it->second;
+        }
+        if (total <= 0) {
+            throw invalid_argument("The order mix must have a positive share");
+        }
+        // Smooth weighted round robin spreads each colour over the run
+        map<string, double> credit;
+        for (int lot = 0; lot < lots; ++lot) {
+            map<string, double>::const_iterator chosen = order_mix.end();
+            for (map<string, double>::const_iterator it = order_mix.begin();
+                 it != order_mix.end(); ++it) {
+                credit[it->first] += it->second;
+                if (chosen == order_mix.end() ||
+                    credit[it->first] > credit[chosen->first]) {
+                    chosen = it;
+                }
+            }
+            credit[chosen->first] -= total;
+            color_sequence_.push_back(chosen->first);
+        }
+    }
 
-    void show_simulation_status(const Factory &factory,
-                                const SystemConfig &config) {
-        clear_screen();
-        
-        // Check if batch just completed
-        if (last_batch_in_process_ && !factory.is_batch_in_process() && 
-            !factory.is_emptying_in_process()) {
-            cout << "*** LOTE COMPLETADO EXITOSAMENTE ***" << endl;
-            cout << "El lote de " << config.color_a_mezclar << " ha sido completado." << endl;
-            cout << "El mezclador ha sido vaciado y esta listo para un nuevo lote." << endl;
-            cout << "Presione Enter para continuar..." << endl;
-            cin.ignore(numeric_limits<streamsize>::max(), '\n');
-            cin.get();
-            clear_screen();
+    // Every combination of the levels below
+    static vector<PlantDesign> standard_grid() {
+        const double flow_rates[] = {80.0, 100.0, 120.0, 130.0};
+        const double batch_sizes[] = {150.0, 175.0,
+                                      SystemConstants::MIXER_TANK_CAPACITY};
+        const double mixing_times[] = {20.0, 30.0};
+        const double emptying_rates[] = {4.0, 8.0};
+        const int mixer_counts[] = {1, 2};
+        vector<PlantDesign> grid;
+        for (size_t a = 0; a < 4; ++a) {
+            for (size_t b = 0; b < 3; ++b) {
+                for (size_t c = 0; c < 2; ++c) {
+                    for (size_t d = 0; d < 2; ++d) {
+                        for (size_t e = 0; e < 2; ++e) {
+                            PlantDesign design;
+                            design.flow_rate_lts_min = flow_rates[a];
+                            design.batch_liters = batch_sizes[b];
+                            design.mixing_seconds = mixing_times[c];
+                            design.emptying_percent_per_second =
+                                emptying_rates[d];
+                            design.mixers = mixer_counts[e];
+                            grid.push_back(design);
+                        }
+                    }
+                }
+            }
         }
-        
-        // Update tracking variable
-        last_batch_in_process_ = factory.is_batch_in_process();
-        
-        cout << "=== Sistema de Mezcla de Pintura Dupont ===" << endl;
-        cout << "Color a mezclar: " << config.color_a_mezclar << endl;
-        cout << "Estado de fabricacion: " << config.arranque_de_fabricacion
+        return grid;
+    }
+
+    // Results in candidate order
+    const vector<DesignResult> &run(const vector<PlantDesign> &candidates,
+                                    size_t thread_count) {
+        candidates_ = candidates;
+        results_.assign(candidates.size(), DesignResult());
+        bound_.clear();
+
+        // Evenly spaced pilots; the bound is empty while they run, so none
+        // of them is pruned
+        size_t count = candidates.size();
+        size_t pilots = min(SystemConstants::OPTIMIZER_PILOT_CANDIDATES, count);
+        vector<size_t> pilot_pass;
+        vector<size_t> main_pass;
+        for (size_t i = 0; i < count; ++i) {
+            if (i * pilots / count != (i + 1) * pilots / count) {
+                pilot_pass.push_back(i);
+            } else {
+                main_pass.push_back(i);
+            }
+        }
+        run_pass(pilot_pass, thread_count);
+        for (size_t i = 0; i < pilot_pass.size(); ++i) {
+            const DesignResult &result = results_[pilot_pass[i]];
+            if (result.lots_done == static_cast<int>(color_sequence_.size())) {
+                bound_.push_back(result);
+            }
+        }
+        run_pass(main_pass, thread_count);
+        return results_;
+    }
+
+    // Complete runs no other complete run dominates, fastest first
+    static vector<DesignResult>
+    pareto_front(const vector<DesignResult> &results, int lots) {
+        vector<DesignResult> front;
+        for (size_t i = 0; i < results.size(); ++i) {
+            if (results[i].pruned || results[i].lots_done < lots) {
+                continue;
+            }
+            bool dominated = false;
+            for (size_t j = 0; j < results.size() && !dominated; ++j) {
+                dominated = !results[j].pruned &&
+                            results[j].lots_done == lots &&
+                            dominates(results[j], results[i]);
+            }
+            if (!dominated) {
+                size_t position = 0;
+                while (position < front.size() &&
+                       front[position].lots_per_hour >=
+                           results[i].lots_per_hour) {
+                    ++position;
+                }
+                front.insert(front.begin() + position, results[i]);
+            }
+        }
+        return front;
+    }
+
+    int get_lot_count() const {
+        return static_cast<int>(color_sequence_.size());
+    }
+
+    static void run_study(const map<string, double> &order_mix, int lots,
+                          size_t thread_count) {
+        DesignOptimizer optimizer(order_mix, lots);
+        vector<PlantDesign> grid = standard_grid();
+        chrono::steady_clock::time_point start = chrono::steady_clock::now();
+        const vector<DesignResult> &results = optimizer.run(grid, thread_count);
+        double elapsed = chrono::duration<double>(
+                             chrono::steady_clock::now() - start)
+                             .count();
+
+        int pruned = 0;
+        int incomplete = 0;
+        for (size_t i = 0; i < results.size(); ++i) {
+            if (results[i].pruned) {
+                ++pruned;
+            } else if (results[i].lots_done < lots) {
+                ++incomplete;
+            }
+        }
+        cout << "=== Diseno de planta: " << grid.size() << " candidatos, "
+             << lots << " lotes (";
+        for (map<string, double>::const_iterator it = order_mix.begin();
+             it != order_mix.end(); ++it) {
+            cout << (it == order_mix.begin() ? "" : ", ") << it->first << " "
+                 << it->second;
+        }
+        cout << ") ===" << endl;
+        cout << thread_count << " hilos, " << elapsed << "s; " << pruned
+             << " descartados antes de terminar, " << incomplete
+             << " sin completar los lotes" << endl;
+        cout << "Frente de Pareto (lotes/h, L/h, error de dosificacion, "
+                "disparos):"
              << endl;
-        cout << "Lote en proceso: "
-             << (factory.is_batch_in_process() ? "SI" : "NO") << endl;
-        cout << "Vaciado en proceso: "
-             << (factory.is_emptying_in_process() ? "SI" : "NO") << endl;
-        
-        // Show current batch phase
-        if (factory.is_batch_in_process()) {
-            cout << "Fase actual: ";
-            if (!factory.all_required_pumps_completed()) {
-                cout << "BOMBEANDO" << endl;
-            } else if (factory.get_mixer_tank().get_mixer_motor().is_running()) {
-                cout << "MEZCLANDO" << endl;
-            } else if (factory.is_emptying_in_process()) {
-                cout << "VACIANDO" << endl;
+        vector<DesignResult> front = pareto_front(results, lots);
+        for (size_t i = 0; i < front.size(); ++i) {
+            const DesignResult &result = front[i];
+            const PlantDesign &design = result.design;
+            cout << "  " << design.flow_rate_lts_min << " lts/min, lote "
+                 << design.batch_liters << " L, mezcla "
+                 << design.mixing_seconds << "s, vaciado "
+                 << design.emptying_percent_per_second << "%/s, "
+                 << design.mixers << " mezclador(es): "
+                 << result.lots_per_hour << " lotes/h ("
+                 << result.liters_per_hour << " L/h), error "
+                 << result.dosing_error_percent << "%, " << result.trips
+                 << " disparos" << endl;
+        }
+    }
+};
+
+// Ways of stepping a plant that must give exactly the same results. The
+// reference is the plainest: one thread updating every line every scan.
+enum EngineBackend {
+    ENGINE_REFERENCE,
+    ENGINE_ACTIVE_LINES, // Settled lines sleep, as in the default plant
+    ENGINE_WORKER_POOL,  // Active lines also split across a TickWorkerPool
+    ENGINE_FORKED        // Re-forked every few scans, its batch adopted
+};
+
+static const char *engine_backend_name(EngineBackend backend) {
+    switch (backend) {
+    case ENGINE_REFERENCE:
+        return "referencia";
+    case ENGINE_ACTIVE_LINES:
+        return "actividad";
+    case ENGINE_WORKER_POOL:
+        return "hilos";
+    case ENGINE_FORKED:
+        return "fork";
+    }
+    return "desconocido";
+}
+
+// A randomized run, reproducible from its seed alone
+struct DifferentialScenario {
+    unsigned seed;
+    size_t line_count;
+    size_t reserve_tanks; // Per line
+    bool vfd_mode;
+    double batch_liters;
+    double tick_seconds;
+    unsigned long ticks;
+
+    static DifferentialScenario generate(unsigned seed) {
+        const double tick_choices[] = {0.05, 0.1, 0.25, 0.5, 1.0};
+        mt19937 rng(seed);
+        DifferentialScenario scenario;
+        scenario.seed = seed;
+        scenario.tick_seconds = tick_choices[rng() % 5];
+        double seconds = 200.0 + rng() % 400;
+        // One plant in eight is large enough to use the workers, for less
+        // simulated time
+        if (rng() % 8 == 0) {
+            scenario.line_count =
+                SystemConstants::PARALLEL_TICK_MIN_LINES + rng() % 64;
+            seconds /= 4.0;
+        } else {
+            scenario.line_count = 3 + rng() % 30;
+        }
+        scenario.reserve_tanks = rng() % 3;
+        scenario.vfd_mode = rng() % 2 == 0;
+        scenario.batch_liters = 60.0 + rng() % 141;
+        scenario.ticks =
+            static_cast<unsigned long>(seconds / scenario.tick_seconds);
+        return scenario;
+    }
+
+    // Lines cycle through the recipe bases plus one no recipe uses
+    Factory build_plant() const {
+        const char *bases[] = {"Blanco", "Azul", "Negro", "Rojo"};
+        vector<PumpLine> lines;
+        for (size_t i = 0; i < line_count; ++i) {
+            ostringstream code;
+            code << "P" << (1000 + i);
+            lines.push_back(PumpLine::create_standard_paint_line(
+                code.str(), bases[i % 4]));
+        }
+        Factory plant = Factory::create_custom_factory(lines);
+        plant.add_standard_reserve_tanks(reserve_tanks);
+        plant.set_vfd_mode(vfd_mode);
+        plant.set_batch_size(batch_liters);
+        return plant;
+    }
+};
+
+// Operator and supply events of a scenario. They are drawn from its seed and
+// never from the plant, so every engine gets the same ones at the same scan.
+class ScenarioDriver {
+  private:
+    mt19937 rng_;
+    vector<string> pump_codes_;
+
+  public:
+    ScenarioDriver(const DifferentialScenario &scenario, const Factory &plant)
+        : rng_(scenario.seed ^ 0x9e3779b9u) {
+        const PumpLineMap &pump_lines = plant.get_all_pump_lines();
+        for (PumpLineMap::const_iterator it = pump_lines.begin();
+             it != pump_lines.end(); ++it) {
+            pump_codes_.push_back(it->first);
+        }
+    }
+
+    void apply(Factory &plant, BatchScheduler &scheduler) {
+        unsigned roll = rng_() % 1000;
+        if (roll >= 14) {
+            return;
+        }
+        const string &code = pump_codes_[rng_() % pump_codes_.size()];
+        unsigned value = rng_();
+        if (roll < 5) {
+            scheduler.start_batch(plant,
+                                  value % 2 == 0 ? "AzMarino" : "AzCeleste");
+        } else if (roll < 9) {
+            PumpLine &line = plant.get_pump_line_mutable(code);
+            Valve &valve = value % 2 == 0 ? line.get_enter_valve_mutable()
+                                          : line.get_exit_valve_mutable();
+            valve.set_open(value % 8 >= 2); // Mostly reopening
+        } else if (roll < 12) {
+            plant.get_pump_line_mutable(code)
+                .get_flow_switch_mutable()
+                .set_forced_alarm(value % 3 == 0);
+        } else {
+            plant.order_refill(code, 20.0 + value % 180, (value >> 8) % 60);
+        }
+    }
+};
+
+// One plant stepped by one backend, with the scenario's events applied
+class DifferentialEngine {
+  private:
+    EngineBackend backend_;
+    unique_ptr<TickWorkerPool> pool_; // Declared first, destroyed last
+    unique_ptr<Factory> plant_;
+    unique_ptr<BatchScheduler> scheduler_;
+    unique_ptr<ScenarioDriver> driver_;
+    unsigned long ticks_;
+
+    // Disable copying: the scheduler points at this engine's plant
+    DifferentialEngine(const DifferentialEngine &);
+    DifferentialEngine &operator=(const DifferentialEngine &);
+
+  public:
+    DifferentialEngine(EngineBackend backend,
+                       const DifferentialScenario &scenario)
+        : backend_(backend), plant_(new Factory(scenario.build_plant())),
+          scheduler_(new BatchScheduler()), ticks_(0) {
+        driver_.reset(new ScenarioDriver(scenario, *plant_));
+        if (backend == ENGINE_REFERENCE) {
+            plant_->set_line_sleeping(false);
+        } else if (backend == ENGINE_WORKER_POOL) {
+            pool_.reset(new TickWorkerPool(2));
+            plant_->attach_worker_pool(pool_.get());
+        }
+    }
+
+    const Factory &get_plant() const { return *plant_; }
+
+    void tick(double seconds) {
+        driver_->apply(*plant_, *scheduler_);
+        if (backend_ == ENGINE_FORKED && ticks_ > 0 &&
+            ticks_ % SystemConstants::DIFFERENTIAL_FORK_INTERVAL == 0) {
+            unique_ptr<Factory> copy(new Factory(plant_->fork()));
+            scheduler_.reset(new BatchScheduler());
+            scheduler_->adopt_batch(*copy);
+            plant_.swap(copy);
+        }
+        plant_->step(seconds);
+        ++ticks_;
+    }
+};
+
+// Runs candidate engines in lockstep with the reference on randomized
+// scenarios. Every scan folds the whole plant state into a hash chain per
+// engine; the chains are compared once per scenario, and a mismatch is
+// bisected on them to the first divergent scan, which is then replayed to
+// show the fields that differ.
+class DifferentialTester {
+  private:
+    // Every value a scan can change, as (component, field, value)
+    template <class Visitor>
+    static void visit_plant_state(const Factory &plant, Visitor &visitor) {
+        static const string plant_code = "planta";
+        visitor.field(plant_code, "tiempo_s", plant.get_sim_time());
+        visitor.field(plant_code, "fase", plant.get_batch_phase());
+        visitor.field(plant_code, "descarga_bloqueada",
+                      plant.is_discharge_blocked());
+        visitor.field(plant_code, "descarga_bloqueada_s",
+                      plant.get_discharge_blocked_seconds());
+        const vector<BaseRefill> &refills = plant.get_pending_refills();
+        visitor.field(plant_code, "reposiciones", refills.size());
+        for (size_t i = 0; i < refills.size(); ++i) {
+            visitor.field(refills[i].pump_code, "reposicion_lts",
+                          refills[i].liters);
+            visitor.field(refills[i].pump_code, "reposicion_llegada_s",
+                          refills[i].arrival_time);
+        }
+
+        const MixerTank &mixer = plant.get_mixer_tank();
+        const MixerMotor &motor = mixer.get_mixer_motor();
+        visitor.field(mixer.get_code(), "lts", mixer.get_current_capacity());
+        visitor.field(mixer.get_code(), "bajo_nivel",
+                      mixer.get_low_level_switch().is_alarm());
+        visitor.field(mixer.get_code(), "vaciando", mixer.is_emptying());
+        visitor.field(mixer.get_code(), "vaciado_s",
+                      mixer.get_emptying_elapsed_time());
+        visitor.field(motor.get_code(), "encendido", motor.is_running());
+        visitor.field(motor.get_code(), "mezcla_s", motor.get_elapsed_time());
+
+        const PumpLineMap &pump_lines = plant.get_all_pump_lines();
+        for (PumpLineMap::const_iterator it = pump_lines.begin();
+             it != pump_lines.end(); ++it) {
+            const PumpLine &line = it->second;
+            const LiquidPump &pump = line.get_pump();
+            const string &code = pump.get_code();
+            visitor.field(code, "estado", pump.get_state());
+            visitor.field(code, "encendida", pump.is_on());
+            visitor.field(code, "tiempo_s", pump.get_elapsed_seconds());
+            visitor.field(code, "objetivo_ml", pump.get_target_ml());
+            visitor.field(code, "dosificado_ml", pump.get_delivered_ml());
+            visitor.field(code, "resto_ml", pump.get_metered_remainder());
+            visitor.field(code, "velocidad", pump.get_speed_percent());
+            visitor.field(code, "integral_pi",
+                          line.get_speed_controller().get_integral());
+            visitor.field(code, "presion",
+                          line.get_pressure_transmitter().read_pressure());
+            visitor.field(code, "valvula_entrada",
+                          line.get_enter_valve().is_open());
+            visitor.field(code, "valvula_salida",
+                          line.get_exit_valve().is_open());
+            visitor.field(code, "alarma_flujo",
+                          line.get_flow_switch().is_alarm());
+            visitor.field(code, "flujo_forzado",
+                          line.get_flow_switch().is_forced_alarm());
+            visitor.field(line.get_tank().get_code(), "lts",
+                          line.get_tank().get_current_capacity());
+            const vector<LiquidTank> &reserves = line.get_reserve_tanks();
+            for (size_t i = 0; i < reserves.size(); ++i) {
+                visitor.field(reserves[i].get_code(), "lts",
+                              reserves[i].get_current_capacity());
+            }
+        }
+
+        const FillingLine &filling = plant.get_filling_line();
+        const ProductBufferList &buffers = filling.get_buffers();
+        for (size_t i = 0; i < buffers.size(); ++i) {
+            visitor.field(buffers[i].get_code(), "lts",
+                          buffers[i].get_current_liters());
+        }
+        const CanFiller &filler = filling.get_filler();
+        visitor.field(filler.get_code(), "estado", filler.get_state());
+        visitor.field(filler.get_code(), "latas", filler.get_cans_filled());
+        visitor.field(filler.get_code(), "cambio_s",
+                      filler.get_changeover_left());
+    }
+
+    // Folds the bit patterns, so 0.1 + 0.2 and 0.3 differ as they should
+    class StateHasher {
+      private:
+        uint64_t hash_;
+
+      public:
+        explicit StateHasher(uint64_t seed) : hash_(seed) {}
+
+        void field(const string &, const char *, double value) {
+            hash_ = (hash_ ^ double_to_bits(value)) * 0x100000001b3ULL;
+            hash_ ^= hash_ >> 29;
+        }
+
+        uint64_t get_hash() const { return hash_; }
+    };
+
+    // Fields by name, in visiting order. A repeated name (two refills for
+    // one line) gets its occurrence appended, so plants whose lists differ
+    // in length still compare field by field.
+    class StateRecorder {
+      public:
+        vector<string> names;
+        map<string, double> values;
+
+        void field(const string &component, const char *name, double value) {
+            string key = component + "." + name;
+            for (int occurrence = 2; values.count(key) > 0; ++occurrence) {
+                ostringstream numbered;
+                numbered << component << "." << name << " #" << occurrence;
+                key = numbered.str();
+            }
+            names.push_back(key);
+            values[key] = value;
+        }
+    };
+
+    // The first divergence found, by scenario order
+    struct Divergence {
+        size_t scenario_index;
+        unsigned seed;
+        EngineBackend backend;
+        unsigned long tick;
+        string error; // Set when an engine threw instead
+    };
+
+    unsigned first_seed_;
+    size_t scenario_count_;
+    vector<EngineBackend> candidates_;
+    atomic<size_t> next_scenario_;
+    atomic<unsigned long long> ticks_run_;
+    atomic<size_t> divergent_scenarios_;
+    mutex divergence_mutex_;
+    bool diverged_;
+    Divergence first_divergence_;
+
+    // The reference comes first in backends; chains[e][t] covers scans 0..t
+    static void run_lockstep(const DifferentialScenario &scenario,
+                             const vector<EngineBackend> &backends,
+                             unsigned long ticks,
+                             vector<vector<uint64_t> > &chains) {
+        vector<unique_ptr<DifferentialEngine> > engines;
+        for (size_t e = 0; e < backends.size(); ++e) {
+            engines.push_back(unique_ptr<DifferentialEngine>(
+                new DifferentialEngine(backends[e], scenario)));
+        }
+        chains.assign(backends.size(), vector<uint64_t>(ticks));
+        for (unsigned long t = 0; t < ticks; ++t) {
+            for (size_t e = 0; e < engines.size(); ++e) {
+                engines[e]->tick(scenario.tick_seconds);
+                StateHasher hasher(t > 0 ? chains[e][t - 1]
+                                         : 0xcbf29ce484222325ULL);
+                visit_plant_state(engines[e]->get_plant(), hasher);
+                chains[e][t] = hasher.get_hash();
+            }
+        }
+    }
+
+    // First scan whose chains differ; the last scan is known to
+    static unsigned long first_divergent_tick(const vector<uint64_t> &reference,
+                                              const vector<uint64_t> &candidate) {
+        unsigned long low = 0;
+        unsigned long high = reference.size() - 1;
+        while (low < high) {
+            unsigned long middle = low + (high - low) / 2;
+            if (reference[middle] != candidate[middle]) {
+                high = middle;
             } else {
-                cout << "COMPLETANDO..." << endl;
+                low = middle + 1;
             }
         }
-        cout << endl;
+        return low;
+    }
 
-        cout << "=== Estado de las Lineas de Bombeo ===" << endl;
-        const map<string, PumpLine>& pump_lines = factory.get_all_pump_lines();
-        for (map<string, PumpLine>::const_iterator it = pump_lines.begin(); 
-             it != pump_lines.end(); ++it) {
-            const PumpLine& pump_line = it->second;
-            show_pump_line_status(pump_line);
+    void record_divergence(const Divergence &divergence) {
+        divergent_scenarios_.fetch_add(1);
+        lock_guard<mutex> lock(divergence_mutex_);
+        if (!diverged_ ||
+            divergence.scenario_index < first_divergence_.scenario_index) {
+            first_divergence_ = divergence;
+            diverged_ = true;
         }
+    }
 
-        cout << "=== Estado de Valvulas ===" << endl;
-        show_valve_status(factory, config);
+    void check_scenario(size_t index) {
+        DifferentialScenario scenario =
+            DifferentialScenario::generate(first_seed_ + index);
+        vector<EngineBackend> backends(1, ENGINE_REFERENCE);
+        backends.insert(backends.end(), candidates_.begin(),
+                        candidates_.end());
+        Divergence divergence;
+        divergence.scenario_index = index;
+        divergence.seed = scenario.seed;
+        divergence.backend = ENGINE_REFERENCE;
+        divergence.tick = 0;
+        vector<vector<uint64_t> > chains;
+        try {
+            run_lockstep(scenario, backends, scenario.ticks, chains);
+        } catch (const exception &e) {
+            divergence.error = e.what();
+            record_divergence(divergence);
+            return;
+        }
+        ticks_run_.fetch_add(scenario.ticks * backends.size());
+        for (size_t e = 1; e < backends.size(); ++e) {
+            if (chains[e].back() != chains[0].back()) {
+                divergence.backend = backends[e];
+                divergence.tick = first_divergent_tick(chains[0], chains[e]);
+                record_divergence(divergence);
+                return;
+            }
+        }
+    }
 
-        cout << "=== Estado del Mezclador ===" << endl;
-        show_mixer_status(factory.get_mixer_tank());
+    void run_worker() {
+        for (;;) {
+            size_t index = next_scenario_.fetch_add(1);
+            if (index >= scenario_count_) {
+                return;
+            }
+            check_scenario(index);
+        }
     }
 
-  private:
-    void show_pump_line_status(const PumpLine &pump_line) {
-        const LiquidPump& pump = pump_line.get_pump();
-        const LiquidTank& tank = pump_line.get_tank();
-        const PressureTransmitter& pressure = pump_line.get_pressure_transmitter();
+    // Replays both engines up to the divergent scan and compares the fields
+    static void print_field_diff(const Divergence &divergence) {
+        DifferentialScenario scenario =
+            DifferentialScenario::generate(divergence.seed);
+        DifferentialEngine reference(ENGINE_REFERENCE, scenario);
+        DifferentialEngine candidate(divergence.backend, scenario);
+        for (unsigned long t = 0; t <= divergence.tick; ++t) {
+            reference.tick(scenario.tick_seconds);
+            candidate.tick(scenario.tick_seconds);
+        }
+        StateRecorder expected;
+        StateRecorder actual;
+        visit_plant_state(reference.get_plant(), expected);
+        visit_plant_state(candidate.get_plant(), actual);
+
+        // Reference fields in order, then those only the candidate has
+        vector<string> names = expected.names;
+        for (size_t i = 0; i < actual.names.size(); ++i) {
+            if (expected.values.count(actual.names[i]) == 0) {
+                names.push_back(actual.names[i]);
+            }
+        }
+        size_t shown = 0;
+        streamsize precision = cout.precision(17);
+        for (size_t i = 0; i < names.size(); ++i) {
+            map<string, double>::const_iterator a =
+                expected.values.find(names[i]);
+            map<string, double>::const_iterator b =
+                actual.values.find(names[i]);
+            if (a != expected.values.end() && b != actual.values.end() &&
+                double_to_bits(a->second) == double_to_bits(b->second)) {
+                continue;
+            }
+            if (shown++ >= SystemConstants::DIFFERENTIAL_MAX_FIELDS_SHOWN) {
+                continue;
+            }
+            cout << "  " << names[i] << ": referencia ";
+            if (a != expected.values.end()) {
+                cout << a->second;
+            } else {
+                cout << "(no existe)";
+            }
+            cout << ", candidato ";
+            if (b != actual.values.end()) {
+                cout << b->second;
+            } else {
+                cout << "(no existe)";
+            }
+            cout << endl;
+        }
+        cout.precision(precision);
+        if (shown > SystemConstants::DIFFERENTIAL_MAX_FIELDS_SHOWN) {
+            cout << "  ... y "
+                 << shown - SystemConstants::DIFFERENTIAL_MAX_FIELDS_SHOWN
+                 << " campos mas" << endl;
+        }
+    }
 
-        cout << "Bomba " << pump.get_code() << " ("
-             << tank.get_liquid_in_tank_name() << "):" << endl;
-        cout << "  Estado: " << (pump.is_on() ? "ENCENDIDA" : "APAGADA")
-             << endl;
-        cout << "  Tiempo transcurrido: " << pump.get_elapsed_seconds() << "s"
-             << endl;
-        cout << "  Tiempo objetivo: " << pump.get_target_duration() << "s"
-             << endl;
-        cout << "  Nivel tanque: " << tank.get_level() << "%" << endl;
-        cout << "  Presion: " << pressure.read_pressure() << " psi" << endl;
-        const FlowSwitch& flow_switch = pump_line.get_flow_switch(); // Get the flow switch
-        cout << "  Flujo Switch " << flow_switch.get_code() << ": "
-             << (flow_switch.is_normal() ? "NORMAL" : "ALARMA") << endl;
-        cout << endl;
+    // Disable copying: worker threads use this instance
+    DifferentialTester(const DifferentialTester &);
+    DifferentialTester &operator=(const DifferentialTester &);
+
+  public:
+    DifferentialTester(unsigned first_seed, size_t scenario_count,
+                       const vector<EngineBackend> &candidates)
+        : first_seed_(first_seed), scenario_count_(scenario_count),
+          candidates_(candidates), next_scenario_(0), ticks_run_(0),
+          divergent_scenarios_(0), diverged_(false) {
+        if (candidates.empty()) {
+            throw invalid_argument("No candidate engine to compare");
+        }
     }
 
-    void show_valve_status(const Factory &factory, const SystemConfig &config) {
-        // Display valve states from configuration and actual valve states
-        for (map<string, string>::const_iterator it = config.valve_states.begin(); 
-             it != config.valve_states.end(); ++it) {
-            const string& valve_name = it->first;
-            const string& config_state = it->second;
-            cout << "Valvula " << valve_name << ": ";
-            cout << "Config=" << config_state;
-            
-            // Show actual valve state
-            bool actual_state = false;
-            if (valve_name == "V201") {
-                actual_state = factory.get_pump_line("P201").get_enter_valve().is_open();
-            } else if (valve_name == "V202") {
-                actual_state = factory.get_pump_line("P202").get_enter_valve().is_open();
-            } else if (valve_name == "V203") {
-                actual_state = factory.get_pump_line("P203").get_enter_valve().is_open();
-            } else if (valve_name == "V401") {
-                actual_state = factory.get_pump_line("P201").get_exit_valve().is_open();
-            } else if (valve_name == "V402") {
-                actual_state = factory.get_pump_line("P202").get_exit_valve().is_open();
-            } else if (valve_name == "V403") {
-                actual_state = factory.get_pump_line("P203").get_exit_valve().is_open();
+    static bool parse_backend(const string &name, EngineBackend &backend) {
+        const EngineBackend backends[] = {ENGINE_ACTIVE_LINES,
+                                          ENGINE_WORKER_POOL, ENGINE_FORKED};
+        for (size_t i = 0; i < 3; ++i) {
+            if (name == engine_backend_name(backends[i])) {
+                backend = backends[i];
+                return true;
             }
-            
-            cout << ", Estado=" << (actual_state ? "ABIERTA" : "CERRADA") << endl;
         }
-        cout << endl;
+        return false;
     }
 
-    void show_mixer_status(const MixerTank &mixer_tank) {
-        const MixerMotor& mixer_motor = mixer_tank.get_mixer_motor();
+    static vector<EngineBackend> all_candidates() {
+        vector<EngineBackend> candidates;
+        candidates.push_back(ENGINE_ACTIVE_LINES);
+        candidates.push_back(ENGINE_WORKER_POOL);
+        candidates.push_back(ENGINE_FORKED);
+        return candidates;
+    }
 
-        cout << "Mezclador " << mixer_tank.get_code() << ":" << endl;
-        cout << "  Nivel: " << mixer_tank.get_level() << "%" << endl;
-        cout << "  Capacidad actual: " << mixer_tank.get_current_capacity()
-             << " litros" << endl;
-        cout << "  Motor: "
-             << (mixer_motor.is_running() ? "MEZCLANDO" : "DETENIDO") << endl;
-        cout << "  Tiempo de mezcla transcurrido: "
-             << mixer_motor.get_elapsed_time() << "s" << endl;
-        cout << "  Tiempo objetivo de mezcla: " << mixer_motor.get_target_time()
-             << "s" << endl;
-        cout << "  Estado de vaciado: "
-             << (mixer_tank.is_emptying() ? "VACIANDO" : "DETENIDO") << endl;
-        cout << "  Tiempo de vaciado transcurrido: "
-             << mixer_tank.get_emptying_elapsed_time() << "s" << endl;
-        cout << "  Interruptor bajo nivel: "
-             << (mixer_tank.get_low_level_switch().is_alarm() ? "ALARMA"
-                                                              : "NORMAL")
+    // Returns true when every candidate matched the reference throughout
+    bool run(size_t thread_count) {
+        cout << "=== Prueba diferencial: " << scenario_count_
+             << " escenarios desde la semilla " << first_seed_ << ", motor(es)";
+        for (size_t i = 0; i < candidates_.size(); ++i) {
+            cout << (i == 0 ? " " : ", ")
+                 << engine_backend_name(candidates_[i]);
+        }
+        cout << " contra la referencia ===" << endl;
+
+        chrono::steady_clock::time_point start = chrono::steady_clock::now();
+        vector<thread> workers;
+        for (size_t i = 0; i < thread_count; ++i) {
+            workers.push_back(thread(&DifferentialTester::run_worker, this));
+        }
+        for (size_t i = 0; i < workers.size(); ++i) {
+            workers[i].join();
+        }
+        double elapsed = chrono::duration<double>(
+                             chrono::steady_clock::now() - start)
+                             .count();
+        cout << thread_count << " hilos, " << elapsed << "s: "
+             << scenario_count_ / elapsed * 60.0 << " escenarios/min, "
+             << ticks_run_.load() / elapsed << " scans/s" << endl;
+
+        if (!diverged_) {
+            cout << "Sin diferencias" << endl;
+            return true;
+        }
+        const Divergence &first = first_divergence_;
+        cout << "Escenarios con diferencias: " << divergent_scenarios_.load()
              << endl;
-        cout << endl;
+        if (!first.error.empty()) {
+            cout << "Semilla " << first.seed << ": error " << first.error
+                 << endl;
+        } else {
+            DifferentialScenario scenario =
+                DifferentialScenario::generate(first.seed);
+            cout << "Semilla " << first.seed << " (" << scenario.line_count
+                 << " lineas, " << scenario.reserve_tanks
+                 << " reservas por linea, lote " << scenario.batch_liters
+                 << " L, " << (scenario.vfd_mode ? "VFD" : "velocidad fija")
+                 << ", scan " << scenario.tick_seconds << "s): motor "
+                 << engine_backend_name(first.backend)
+                 << " diverge en el scan " << first.tick << " (t="
+                 << (first.tick + 1) * scenario.tick_seconds << "s)" << endl;
+            print_field_diff(first);
+            cout << "Repetir con: tercer_parcial --diferencial 1 "
+                 << engine_backend_name(first.backend) << " " << first.seed
+                 << endl;
+        }
+        return false;
     }
 };
 
-class ConfigurationUI {
-  private:
-    UserInterface ui_;
+// The standard plant, or with --lineas more lines of its three bases after
+// P201..P203, to try the overview screen on a large plant
+static Factory create_console_plant(size_t line_count) {
+    Factory standard = Factory::create_dupont_paint_factory();
+    if (line_count <= 3) {
+        return standard;
+    }
+    const char *bases[] = {"Blanco", "Azul", "Negro"};
+    vector<PumpLine> lines;
+    const PumpLineMap &standard_lines = standard.get_all_pump_lines();
+    for (PumpLineMap::const_iterator it = standard_lines.begin();
+         it != standard_lines.end(); ++it) {
+        lines.push_back(it->second);
+    }
+    for (size_t i = lines.size(); i < line_count; ++i) {
+        ostringstream code;
+        code << "P" << (SystemConstants::CONSOLE_EXTRA_LINE_BASE + i);
+        lines.push_back(
+            PumpLine::create_standard_paint_line(code.str(), bases[i % 3]));
+    }
+    return Factory::create_custom_factory(lines);
+}
 
-    bool prompt_config_repair(const runtime_error &e) {
-        ui_.clear_display();
-        cerr << "Ha ocurrido un error leyendo la configuracion: " << e.what()
-             << endl;
-        cout << "Quieres que se corrija la configuracion con un archivo de "
-                "configuracion con las configuraciones iniciales? "
-                "Escribe 'si', o escribe 'no' para cerrar el programa."
-             << endl;
+// Set by Ctrl+C while a trace is recorded, so the run ends through the
+// destructors and the trace gets written; a second Ctrl+C still kills it
+volatile sig_atomic_t stop_requested = 0;
 
-        cout << "Tu opcion: ";
-        string user_choice;
-        cin >> user_choice;
+void request_stop(int signal_number) {
+    stop_requested = 1;
+    signal(signal_number, SIG_DFL);
+}
 
-        if (user_choice != "si") {
-            cout << "El usuario eligio no reparar la configuracion." << endl;
-            return false;
+int main(int argc, char *argv[]) {
+#ifdef _WIN32
+    SetConsoleOutputCP(CP_UTF8);
+#endif
+
+    if (argc > 1 && string(argv[1]) == "--consultar") {
+        try {
+            if (argc < 4) {
+                HistoryQueryTool::print_usage();
+                return 1;
+            }
+            HistoryArchiveReader archive(argv[2]);
+            HistoryQueryTool tool(archive);
+            if (!tool.run(vector<string>(argv + 3, argv + argc))) {
+                HistoryQueryTool::print_usage();
+                return 1;
+            }
+        } catch (const exception &e) {
+            cerr << "Error en la consulta: " << e.what() << endl;
+            return 1;
         }
-        return true;
+        return 0;
     }
 
-    void show_config_repair_success() {
-        cout << "El archivo de configuracion ha sido escrito en: "
-             << SystemConstants::CONFIG_FILE_PATH << endl;
-        cout << "Por favor, ajusta la configuracion segun sea necesario."
-             << endl;
-        cout << "Cuando hayas terminado, presiona Enter para continuar..."
-             << endl;
-        cin.ignore(numeric_limits<streamsize>::max(), '\n');
-        cin.get();
+    if (argc > 1 && string(argv[1]) == "--tags") {
+        try {
+            if (!SharedTagMonitor::run(vector<string>(argv + 2, argv + argc))) {
+                SharedTagMonitor::print_usage();
+                return 1;
+            }
+        } catch (const exception &e) {
+            cerr << "Error en los tags compartidos: " << e.what() << endl;
+            return 1;
+        }
+        return 0;
     }
 
-    void show_config_repair_error(const exception &ex) {
-        cerr << "Error en reparar la configuracion: " << ex.what() << endl;
+    if (argc > 1 && string(argv[1]) == "--comparar-vfd") {
+        SimulationBenchmark::run_vfd_comparison();
+        return 0;
     }
 
-    bool attempt_config_repair() {
+    if (argc > 1 && string(argv[1]) == "--benchmark-log") {
+        SimulationBenchmark::run_log_benchmark(
+            argc > 2 ? argv[2] : SystemConstants::EVENT_LOG_PATH);
+        return 0;
+    }
+
+    if (argc > 1 && string(argv[1]) == "--cuello-botella") {
         try {
-            ConfigManager::repair_or_create_config_file();
-            show_config_repair_success();
-            return true;
-        } catch (const exception &ex) {
-            show_config_repair_error(ex);
-            return false;
+            SimulationBenchmark::run_bottleneck_report(
+                argc > 2 ? atoi(argv[2]) : 12,
+                argc > 3 ? atof(argv[3])
+                         : SystemConstants::FILLER_CANS_PER_MINUTE,
+                argc > 4 ? atof(argv[4])
+                         : SystemConstants::FILLER_CHANGEOVER_SECONDS,
+                argc > 5 ? atof(argv[5])
+                         : SystemConstants::PRODUCT_BUFFER_CAPACITY);
+        } catch (const exception &e) {
+            cerr << "Error en el estudio: " << e.what() << endl;
+            cerr << "Uso: tercer_parcial --cuello-botella [LOTES] "
+                    "[LATAS_MIN] [CAMBIO_S] [BUFFER_L]"
+                 << endl;
+            return 1;
         }
+        return 0;
     }
 
-    bool handle_config_error(const runtime_error &e) {
-        if (!prompt_config_repair(e)) {
-            return false;
+    if (argc > 1 && string(argv[1]) == "--inventario") {
+        try {
+            SimulationBenchmark::run_inventory_study(
+                argc > 2 ? atoi(argv[2]) : 200,
+                argc > 3 ? atof(argv[3])
+                         : SystemConstants::REFILL_LEAD_SECONDS);
+        } catch (const exception &e) {
+            cerr << "Error en el estudio: " << e.what() << endl;
+            cerr << "Uso: tercer_parcial --inventario [LOTES] [PLAZO_S]"
+                 << endl;
+            return 1;
         }
-        return attempt_config_repair();
+        return 0;
     }
 
-  public:
-    SystemConfig handle_config_loading() {
-        while (true) {
-            try {
-                return ConfigManager::read_config();
-            } catch (const runtime_error &e) {
-                if (!handle_config_error(e)) {
-                    throw runtime_error(
-                        "La configuracion no pudo ser corregida con la "
-                        "herramienta de reparacion. El programa se cerrara.");
+    if (argc > 1 && string(argv[1]) == "--tamano-lote") {
+        try {
+            // COLOR=LITROS orders in arrival order, or a sample order book
+            vector<ProductionOrder> orders;
+            for (int i = 2; i < argc; ++i) {
+                string entry = argv[i];
+                size_t equals = entry.find('=');
+                if (equals == string::npos) {
+                    throw invalid_argument("Expected COLOR=LITROS: " + entry);
+                }
+                ProductionOrder order;
+                order.color = entry.substr(0, equals);
+                order.liters = atof(entry.c_str() + equals + 1);
+                orders.push_back(order);
+            }
+            if (orders.empty()) {
+                const char *colors[] = {"AzMarino", "AzCeleste"};
+                const double liters[] = {480.0, 350.0, 1000.0, 220.0,
+                                         600.0, 90.0,  750.0,  400.0};
+                for (int i = 0; i < 8; ++i) {
+                    ProductionOrder order;
+                    order.color = colors[i % 2];
+                    order.liters = liters[i];
+                    orders.push_back(order);
                 }
             }
+            SimulationBenchmark::run_lot_sizing_report(orders);
+        } catch (const exception &e) {
+            cerr << "Error en el estudio: " << e.what() << endl;
+            cerr << "Uso: tercer_parcial --tamano-lote [COLOR=LITROS ...]"
+                 << endl;
+            return 1;
         }
+        return 0;
     }
-};
 
-int main() {
-    SetConsoleOutputCP(CP_UTF8);
+    if (argc > 1 && string(argv[1]) == "--optimizar") {
+        try {
+            int lots = argc > 2 ? atoi(argv[2])
+                                : SystemConstants::OPTIMIZER_DEFAULT_LOTS;
+            // COLOR=PESO pairs; an equal mix of every recipe by default
+            map<string, double> order_mix;
+            for (int i = 3; i < argc; ++i) {
+                string entry = argv[i];
+                size_t equals = entry.find('=');
+                if (equals == string::npos) {
+                    throw invalid_argument("Expected COLOR=PESO: " + entry);
+                }
+                order_mix[entry.substr(0, equals)] =
+                    atof(entry.c_str() + equals + 1);
+            }
+            if (order_mix.empty()) {
+                const map<string, map<string, double> > &recipes =
+                    SystemConstants::COLOR_RECIPES;
+                for (map<string, map<string, double> >::const_iterator it =
+                         recipes.begin();
+                     it != recipes.end(); ++it) {
+                    order_mix[it->first] = 1.0;
+                }
+            }
+            size_t threads = thread::hardware_concurrency();
+            DesignOptimizer::run_study(order_mix, lots,
+                                       threads > 0 ? threads : 1);
+        } catch (const exception &e) {
+            cerr << "Error en la optimizacion: " << e.what() << endl;
+            cerr << "Uso: tercer_parcial --optimizar [LOTES] [COLOR=PESO ...]"
+                 << endl;
+            return 1;
+        }
+        return 0;
+    }
+
+    if (argc > 1 && string(argv[1]) == "--diferencial") {
+        try {
+            size_t scenarios =
+                argc > 2 ? strtoul(argv[2], NULL, 10)
+                         : SystemConstants::DIFFERENTIAL_DEFAULT_SCENARIOS;
+            vector<EngineBackend> candidates =
+                DifferentialTester::all_candidates();
+            if (argc > 3 && string(argv[3]) != "todos") {
+                EngineBackend backend;
+                if (!DifferentialTester::parse_backend(argv[3], backend)) {
+                    throw invalid_argument(string("Unknown engine: ") +
+                                           argv[3]);
+                }
+                candidates.assign(1, backend);
+            }
+            unsigned first_seed =
+                argc > 4 ? static_cast<unsigned>(strtoul(argv[4], NULL, 10))
+                         : 1;
+            DifferentialTester tester(first_seed, scenarios, candidates);
+            size_t threads = thread::hardware_concurrency();
+            return tester.run(threads > 0 ? threads : 1) ? 0 : 1;
+        } catch (const exception &e) {
+            cerr << "Error en la prueba diferencial: " << e.what() << endl;
+            cerr << "Uso: tercer_parcial --diferencial [ESCENARIOS] "
+                    "[actividad|hilos|fork|todos] [SEMILLA]"
+                 << endl;
+            return 1;
+        }
+    }
+
+    if (argc > 1 && string(argv[1]) == "--benchmark-traza") {
+        SimulationBenchmark::run_trace_benchmark(
+            argc > 2 ? argv[2] : "./tercer_parcial_traza.json");
+        return 0;
+    }
+
+    if (argc > 1 && string(argv[1]) == "--benchmark-panel") {
+        try {
+            SimulationBenchmark::run_dashboard_benchmark();
+        } catch (const exception &e) {
+            cerr << "Error en el benchmark: " << e.what() << endl;
+            return 1;
+        }
+        return 0;
+    }
+
+    if (argc > 1 && string(argv[1]) == "--benchmark-actividad") {
+        SimulationBenchmark::run_activity_benchmark();
+        return 0;
+    }
+
+    if (argc > 1 && string(argv[1]) == "--benchmark-paralelo") {
+        size_t lines = argc > 2 ? strtoul(argv[2], NULL, 10) : 20000;
+        size_t threads = argc > 3 ? strtoul(argv[3], NULL, 10)
+                                  : thread::hardware_concurrency();
+        SimulationBenchmark::run_parallel_tick_benchmark(
+            lines > 0 ? lines : 1, threads > 0 ? threads : 1);
+        return 0;
+    }
+
+    if (argc > 1 && string(argv[1]) == "--benchmark-arena") {
+        size_t plants = argc > 2 ? strtoul(argv[2], NULL, 10) : 200000;
+        SimulationBenchmark::run_arena_benchmark(plants > 0 ? plants : 1);
+        return 0;
+    }
+
+    int scan_period_ms = SystemConstants::ONE_SECOND_IN_MS;
+    bool real_time = false;
+    int real_time_cpu = -1;
+    double prediction_horizon = SystemConstants::PREDICTION_HORIZON_SECONDS;
+    bool vfd_mode = false;
+    bool console_mode = false;
+    string trace_path;
+    double filler_cans_per_minute = SystemConstants::FILLER_CANS_PER_MINUTE;
+    double changeover_seconds = SystemConstants::FILLER_CHANGEOVER_SECONDS;
+    double buffer_liters = SystemConstants::PRODUCT_BUFFER_CAPACITY;
+    int tanks_per_base = 1;
+    double refill_lead_seconds = -1.0; // Refills off
+    int dashboard_port = -1;           // Dashboard off
+    int line_count = 3;
+    vector<string> order_entries; // COLOR=LITROS, in arrival order
+    for (int i = 1; i < argc; ++i) {
+        string option = argv[i];
+        if (option == "--periodo-ms" && i + 1 < argc) {
+            scan_period_ms = atoi(argv[++i]);
+        } else if (option == "--tiempo-real") {
+            real_time = true;
+        } else if (option == "--cpu" && i + 1 < argc) {
+            real_time_cpu = atoi(argv[++i]);
+        } else if (option == "--horizonte-s" && i + 1 < argc) {
+            prediction_horizon = atof(argv[++i]);
+        } else if (option == "--vfd") {
+            vfd_mode = true;
+        } else if (option == "--consola") {
+            console_mode = true;
+        } else if (option == "--traza" && i + 1 < argc) {
+            trace_path = argv[++i];
+        } else if (option == "--llenadora-cpm" && i + 1 < argc) {
+            filler_cans_per_minute = atof(argv[++i]);
+        } else if (option == "--cambio-color-s" && i + 1 < argc) {
+            changeover_seconds = atof(argv[++i]);
+        } else if (option == "--buffer-l" && i + 1 < argc) {
+            buffer_liters = atof(argv[++i]);
+        } else if (option == "--tanques-base" && i + 1 < argc) {
+            tanks_per_base = atoi(argv[++i]);
+        } else if (option == "--reposicion-s" && i + 1 < argc) {
+            refill_lead_seconds = atof(argv[++i]);
+        } else if (option == "--panel" && i + 1 < argc) {
+            dashboard_port = atoi(argv[++i]);
+        } else if (option == "--lineas" && i + 1 < argc) {
+            line_count = atoi(argv[++i]);
+        } else if (option == "--pedido" && i + 1 < argc) {
+            order_entries.push_back(argv[++i]);
+        } else {
+            cerr << "Opcion desconocida: " << option << endl;
+            cerr << "Uso: tercer_parcial [--periodo-ms N] [--tiempo-real] "
+                    "[--cpu N] [--horizonte-s N] [--vfd] [--consola] "
+                    "[--traza ARCHIVO] [--llenadora-cpm N] "
+                    "[--cambio-color-s N] [--buffer-l N] [--tanques-base N] "
+                    "[--reposicion-s N] [--panel PUERTO] [--lineas N] "
+                    "[--pedido COLOR=LITROS]..."
+                 << endl;
+            return 1;
+        }
+    }
 
     try {
         bool is_running = true;
+        SystemConfig file_config;
         SystemConfig user_config;
-        string previous_arranque_state = "OFF";
-        string previous_color = ""; // Track previous color to detect changes
+        ConfigOverrides overrides;
 
-        Factory factory = Factory::create_dupont_paint_factory();
+        // Declared first so it outlives every traced thread
+        ChromeTracer tracer(trace_path);
+        ChromeTracer::name_thread("control");
+
+        AsyncLogger event_log(SystemConstants::EVENT_LOG_PATH);
+        if (line_count < 3) {
+            throw invalid_argument("The plant needs its three standard lines");
+        }
+        PlantSession plant(create_console_plant(line_count));
+        Factory &factory = plant.get_factory();
+        factory.set_vfd_mode(vfd_mode);
+        FillingLine &filling_line = factory.get_filling_line_mutable();
+        filling_line.get_filler_mutable().set_cans_per_minute(
+            filler_cans_per_minute);
+        filling_line.get_filler_mutable().set_changeover_seconds(
+            changeover_seconds);
+        filling_line.set_buffer_capacity(buffer_liters);
+        if (tanks_per_base < 1) {
+            throw invalid_argument("Each base needs at least one tank");
+        }
+        factory.add_standard_reserve_tanks(tanks_per_base - 1);
+        for (size_t i = 0; i < order_entries.size(); ++i) {
+            size_t equals = order_entries[i].find('=');
+            if (equals == string::npos) {
+                throw invalid_argument("Expected COLOR=LITROS: " +
+                                       order_entries[i]);
+            }
+            plant.get_orders().add_order(
+                order_entries[i].substr(0, equals),
+                atof(order_entries[i].c_str() + equals + 1));
+        }
+        // Always forecasts; orders refills only with --reposicion-s
+        BaseInventoryPlanner inventory(
+            refill_lead_seconds >= 0.0 ? refill_lead_seconds
+                                       : SystemConstants::REFILL_LEAD_SECONDS);
+        PlantTraceEvents plant_trace;
+        if (tracer.is_enabled()) {
+            factory.add_observer(&plant_trace);
+            factory.attach_phase_sink(&plant_trace);
+        }
+        PlantEventLog plant_events(event_log);
+        factory.add_observer(&plant_events);
+        KpiTracker kpi(factory, SystemConstants::KPI_CSV_PATH);
+        factory.add_observer(&kpi);
+        DurableAppendLog genealogy_log(SystemConstants::GENEALOGY_LOG_PATH);
+        BatchGenealogyRecorder genealogy(factory, genealogy_log);
+        factory.add_observer(&genealogy);
+        AlarmManager alarms(factory);
+        factory.add_observer(&alarms);
+        LineOverviewIndex overview(factory);
+        factory.add_observer(&overview);
+        HistoryArchiveWriter history(factory,
+                                     SystemConstants::HISTORY_ARCHIVE_PATH);
+        SharedTagPublisher shared_tags(factory,
+                                       SystemConstants::SHARED_TAGS_NAME);
+        PredictiveTwin twin(prediction_horizon);
+        DashboardServer dashboard(dashboard_port);
+        if (dashboard.is_enabled()) {
+            event_log.write(LOG_INFO, LOG_EVENT_DASHBOARD, 0.0,
+                            dashboard.get_port());
+        }
 
-        ConfigurationUI config_ui;
+        OperatorConsole console(console_mode);
+        ConfigurationUI config_ui(event_log, console);
         UserInterface main_ui;
 
-        while (is_running) {
+        ScanCycleExecutor scan(scan_period_ms);
+        const double scan_seconds = scan.get_period_seconds();
+        if (real_time) {
+            try {
+                ScanCycleExecutor::enable_real_time(real_time_cpu);
+            } catch (const runtime_error &e) {
+                event_log.write(LOG_WARNING, LOG_EVENT_REAL_TIME, 0.0, 0,
+                                e.what());
+            }
+        }
+        unsigned long long logged_overruns = 0;
+        if (tracer.is_enabled()) {
+            signal(SIGINT, request_stop);
+            signal(SIGTERM, request_stop);
+        }
+
+        while (is_running && !stop_requested) {
+            // Keys pressed since the last scan act on this one
+            console.apply_pending(plant, overrides, file_config, user_config,
+                                  alarms, plant_events, overview);
+
+            if (shared_tags.apply_commands(overrides, file_config)) {
+                user_config = file_config;
+                overrides.apply(user_config);
+                event_log.write(LOG_INFO, LOG_EVENT_SHARED_COMMANDS,
+                                factory.get_sim_time(),
+                                static_cast<int>(overrides.get_count()));
+                StartResult start;
+                {
+                    TraceSpan span("aplicar_configuracion");
+                    start = plant.apply_config(user_config);
+                }
+                plant_events.on_start_result(start, factory);
+                if (console.is_enabled()) {
+                    console.report_start_result(start);
+                } else {
+                    main_ui.show_start_result(start, factory);
+                }
+            }
+
+            // The configuration file, the screen and the start command are
+            // handled once per second; the physics runs every scan
+            if (!scan.is_housekeeping_due()) {
+                if (!console.is_paused()) {
+                    plant.step(scan_seconds);
+                }
+                kpi.export_if_window_elapsed(factory.get_sim_time());
+                shared_tags.publish(factory);
+                dashboard.publish(factory);
+                scan.wait_for_next_cycle();
+                continue;
+            }
+
+            if (scan.get_overruns() != logged_overruns) {
+                logged_overruns = scan.get_overruns();
+                event_log.write(LOG_WARNING, LOG_EVENT_SCAN_OVERRUN,
+                                factory.get_sim_time(),
+                                static_cast<int>(logged_overruns));
+            }
+
             try {
-                user_config = config_ui.handle_config_loading();
+                TraceSpan span("carga_configuracion");
+                file_config =
+                    config_ui.handle_config_loading(factory.get_sim_time());
             } catch (const runtime_error &e) {
+                event_log.write(LOG_ERROR, LOG_EVENT_FATAL,
+                                factory.get_sim_time(), 0, e.what());
+                console.suspend();
                 cerr << "Error critico durante el manejo del archivo de "
                         "configuracion: "
                      << e.what() << endl;
-                system("pause");
+#ifdef _WIN32
+                system("pause"); // Keeps the console window open
+#endif
                 return 1;
             }
 
-            main_ui.show_simulation_status(factory, user_config);
+            user_config = file_config;
+            overrides.apply(user_config);
 
-            // Apply valve configuration from config file
-            factory.apply_valve_configuration(user_config);
-
-            // Check for color change when not in batch process
-            bool color_changed = (previous_color != user_config.color_a_mezclar);
-            if (color_changed && !factory.is_batch_in_process()) {
-                // Update pump times immediately when color changes (but not during batch)
-                factory.set_pump_times(user_config.color_a_mezclar);
+            if (refill_lead_seconds >= 0.0) {
+                vector<BaseRefill> ordered;
+                if (inventory.update(factory, &ordered) > 0) {
+                    plant_events.on_refills_ordered(ordered,
+                                                    factory.get_sim_time());
+                }
             }
 
-            // Check for batch start command (OFF to ON transition)
-            bool start_command_triggered = (previous_arranque_state == "OFF" && 
-                                           user_config.arranque_de_fabricacion == "ON");
+            {
+                TraceSpan span("pantalla");
+                main_ui.show_simulation_status(factory, user_config,
+                                               plant.get_orders(), kpi,
+                                               alarms, scan, twin, inventory,
+                                               overview, console);
+                console.show_status(factory);
+            }
 
-            if (!factory.is_batch_in_process()) {
-                if (start_command_triggered && factory.get_mixer_tank().get_low_level_switch().is_alarm()) {
-                    factory.set_batch_in_process();
-                    factory.reset();
-                    factory.set_pump_times(user_config.color_a_mezclar);
-                } else if (start_command_triggered) { // Else if start was triggered but low level switch is NOT alarm
-                    // Add message to user
-                    cout << "ADVERTENCIA: No se puede iniciar un nuevo lote." << endl;
-                    cout << "El interruptor de bajo nivel del mezclador NO esta en alarma (el tanque no esta lo suficientemente vacio)." << endl;
-                    cout << "Presione Enter para continuar..." << endl;
-                    std::cin.ignore(std::numeric_limits<std::streamsize>::max(), '\n');
-                    std::cin.get();
-                }
+            // Valves, colour and the start command (OFF to ON edge)
+            StartResult start;
+            {
+                TraceSpan span("aplicar_configuracion");
+                start = plant.apply_config(user_config);
+            }
+            plant_events.on_start_result(start, factory);
+            if (console.is_enabled()) {
+                console.report_start_result(start);
             } else {
-                // Batch is currently running
-                if (start_command_triggered) {
-                    cout << "ADVERTENCIA: No se puede iniciar un nuevo lote." << endl;
-                    cout << "Espere a que termine el lote actual antes de iniciar uno nuevo." << endl;
-                    cout << "Estado actual: ";
-                    if (!factory.all_required_pumps_completed()) {
-                        cout << "Bombeando liquidos..." << endl;
-                    } else if (factory.get_mixer_tank().get_mixer_motor().is_running()) {
-                        cout << "Mezclando..." << endl;
-                    } else if (factory.is_emptying_in_process()) {
-                        cout << "Vaciando mezclador..." << endl;
-                    }
-                    cout << "Presione Enter para continuar..." << endl;
-                    std::cin.ignore(std::numeric_limits<std::streamsize>::max(), '\n');
-                    std::cin.get();
-                }
-                
-                if (!factory.all_required_pumps_completed()) {
-                    factory.update_all_pump_lines();
-                }
+                main_ui.show_start_result(start, factory);
             }
 
-            previous_arranque_state = user_config.arranque_de_fabricacion; // Update previous state
-            previous_color = user_config.color_a_mezclar; // Update previous color
-            
-            factory.update_mix(); // Update mixing process
-            factory.update_emptying(); // Update emptying process
-            
-            Sleep(SystemConstants::ONE_SECOND_IN_MS); // Simulation delay
+            // Lines are stepped for the whole pumping phase so a pump that
+            // reaches its target also reaches STOPPED_TARGET_REACHED
+            if (!console.is_paused()) {
+                plant.step(scan_seconds);
+            }
+            kpi.export_if_window_elapsed(factory.get_sim_time());
+            // The archive keeps one sample per second whatever the period
+            history.record(factory);
+            shared_tags.publish(factory);
+            dashboard.publish(factory);
+            twin.submit(factory);
+
+            scan.wait_for_next_cycle();
         }
     } catch (const exception &e) {
         cerr << "Error critico en el programa: " << e.what() << endl;